@@ -8,14 +8,20 @@
  */
 
 #include "algorithm.h"
+#include "bench.h"
 #include "driver-baikal.h"
 #include "sph/sph_sha2.h"
+#include "sph/sph_groestl.h"
+#include "sph/sph_echo.h"
+#include "sph/sph_aesni.h"
+#include "sph/sph_sha256_hw.h"
 
 #ifdef USE_GPU
 #include "ocl.h"
 #include "ocl/build_kernel.h"
 #endif
 
+#include "algorithm/lanes.h"
 #include "algorithm/scrypt.h"
 #include "algorithm/animecoin.h"
 #include "algorithm/inkcoin.h"
@@ -99,6 +105,77 @@ const char *algorithm_type_str[] = {
   "Veltor"
 };
 
+/* An 80 byte bitcoin style header, what most algorithms use. Every entry sets
+ * each member once so the table builds clean with -Woverride-init. */
+#define LAYOUT_HEADER80 \
+  { .data_len = 128, .nonce_off = 76, .coinbase_nonce2 = true, .merkle = true, \
+    .block_check = true, .baikal_len = 80 }
+
+#define LAYOUT_BLAKE256 \
+  { .data_len = 128, .nonce_off = 76, .coinbase_nonce2 = true, .merkle = true, \
+    .block_check = true, .baikal_len = 80, .baikal_swab = 20, \
+    .baikal_midstate = BAIKAL_MIDSTATE_BLAKE256 }
+
+const algorithm_layout_t algorithm_layouts[ALGO_MAX] = {
+  [ALGO_UNK]              = LAYOUT_HEADER80,
+  [ALGO_CRE]              = { .data_len = 128, .nonce_off = 140, .coinbase_nonce2 = true, .merkle = true,
+                              .block_check = true, .baikal_len = 80 },
+  [ALGO_SCRYPT]           = LAYOUT_HEADER80,
+  [ALGO_NSCRYPT]          = LAYOUT_HEADER80,
+  [ALGO_PASCAL]           = { .data_len = 256, .nonce_off = 196, .submit_be = true, .coinbase_nonce2 = true,
+                              .block_check = true, .baikal_len = 200 },
+  [ALGO_X11]              = LAYOUT_HEADER80,
+  [ALGO_X11GOST]          = LAYOUT_HEADER80,
+  [ALGO_X13]              = LAYOUT_HEADER80,
+  [ALGO_X14]              = LAYOUT_HEADER80,
+  [ALGO_X15]              = LAYOUT_HEADER80,
+  [ALGO_KECCAK]           = LAYOUT_HEADER80,
+  [ALGO_QUARK]            = LAYOUT_HEADER80,
+  [ALGO_TWE]              = LAYOUT_HEADER80,
+  [ALGO_FUGUE]            = LAYOUT_HEADER80,
+  [ALGO_NIST]             = LAYOUT_HEADER80,
+  [ALGO_FRESH]            = LAYOUT_HEADER80,
+  [ALGO_WHIRL]            = LAYOUT_HEADER80,
+  [ALGO_NEOSCRYPT]        = { .data_len = 128, .nonce_off = 76, .submit_be = true, .coinbase_nonce2 = true,
+                              .merkle = true, .block_check = true, .baikal_len = 80 },
+  [ALGO_WHIRLPOOLX]       = LAYOUT_HEADER80,
+  [ALGO_LYRA2RE]          = LAYOUT_HEADER80,
+  [ALGO_LYRA2REV2]        = LAYOUT_HEADER80,
+  [ALGO_PLUCK]            = LAYOUT_HEADER80,
+  [ALGO_YESCRYPT]         = LAYOUT_HEADER80,
+  [ALGO_YESCRYPT_MULTI]   = LAYOUT_HEADER80,
+  [ALGO_BLAKECOIN]        = LAYOUT_BLAKE256,
+  [ALGO_BLAKE]            = LAYOUT_HEADER80,
+#if SUPPORT_SIAPOOL
+  [ALGO_SIA]              = { .data_len = 128, .nonce_off = 32, .submit_be = true, .submit_nonce64 = true,
+                              .coinbase_nonce2 = true, .block_check = true, .baikal_len = 80,
+                              .baikal_swab = 20 },
+#else
+  [ALGO_SIA]              = { .data_len = 128, .nonce_off = 32, .block_check = true, .baikal_len = 80,
+                              .baikal_swab = 20 },
+#endif
+  [ALGO_DECRED]           = { .data_len = 180, .nonce_off = 140, .block_check = true, .baikal_len = 180,
+                              .baikal_midstate = BAIKAL_MIDSTATE_DECRED },
+  [ALGO_VANILLA]          = LAYOUT_BLAKE256,
+  [ALGO_LBRY]             = { .data_len = 128, .nonce_off = 108, .coinbase_nonce2 = true, .merkle = true,
+                              .block_check = true, .baikal_len = 112, .baikal_swab = 27 },
+  [ALGO_CRYPTONIGHT]      = { .data_len = 128, .nonce_off = 39, .nicehash_nonce24 = true,
+                              .coinbase_nonce2 = true, .merkle = true, .baikal_len = 80 },
+  [ALGO_CRYPTONIGHT_LITE] = { .data_len = 128, .nonce_off = 39, .coinbase_nonce2 = true, .merkle = true,
+                              .baikal_len = 80 },
+  [ALGO_SKEINCOIN]        = LAYOUT_HEADER80,
+  [ALGO_SKEIN2]           = LAYOUT_HEADER80,
+  [ALGO_QUBIT]            = LAYOUT_HEADER80,
+  [ALGO_MYRIAD_GROESTL]   = LAYOUT_HEADER80,
+  [ALGO_GROESTL]          = LAYOUT_HEADER80,
+  [ALGO_DIDAMOND]         = LAYOUT_HEADER80,
+  [ALGO_NEVACOIN]         = LAYOUT_HEADER80,
+  [ALGO_VELTOR]           = LAYOUT_HEADER80,
+};
+
+#undef LAYOUT_BLAKE256
+#undef LAYOUT_HEADER80
+
 void sha256(const unsigned char *message, unsigned int len, unsigned char *digest)
 {
   sph_sha256_context ctx_sha2;
@@ -120,6 +197,58 @@ void gen_hash(const unsigned char *data, unsigned int len, unsigned char *hash)
   sph_sha256_close(&ctx_sha2, hash);
 }
 
+/* gen_hash() of a message whose leading bytes have already been run through
+ * prefix, e.g. the part of a coinbase in front of nonce2 */
+void gen_hash_prefixed(const sph_sha256_context *prefix, const unsigned char *data, unsigned int len, unsigned char *hash)
+{
+  unsigned char hash1[32];
+  sph_sha256_context ctx_sha2;
+
+  memcpy(&ctx_sha2, prefix, sizeof(ctx_sha2));
+  sph_sha256(&ctx_sha2, data, len);
+  sph_sha256_close(&ctx_sha2, hash1);
+  sph_sha256(&ctx_sha2, hash1, 32);
+  sph_sha256_close(&ctx_sha2, hash);
+}
+
+static const sph_u32 sha256_iv[8] = {
+  0x6A09E667, 0xBB67AE85, 0x3C6EF372, 0xA54FF53A,
+  0x510E527F, 0x9B05688C, 0x1F83D9AB, 0x5BE0CD19
+};
+
+/* Padding block of a 64 byte message */
+static const sph_u32 sha256_pad64[16] = {
+  0x80000000, 0, 0, 0, 0, 0, 0, 0,
+  0, 0, 0, 0, 0, 0, 0, 0x00000200
+};
+
+/* gen_hash() of exactly 64 bytes, one merkle branch step. Both padding blocks
+ * are known up front so the compression function is called directly. */
+void gen_hash64(const unsigned char *data, unsigned char *hash)
+{
+  sph_u32 msg[16], val[8];
+  int i;
+
+  for (i = 0; i < 16; i++)
+    msg[i] = sph_dec32be(data + (i * 4));
+
+  memcpy(val, sha256_iv, sizeof(val));
+  sph_sha256_comp(msg, val);
+  sph_sha256_comp(sha256_pad64, val);
+
+  memcpy(msg, val, sizeof(val));
+  msg[8] = 0x80000000;
+  for (i = 9; i < 15; i++)
+    msg[i] = 0;
+  msg[15] = 0x00000100;
+
+  memcpy(val, sha256_iv, sizeof(val));
+  sph_sha256_comp(msg, val);
+
+  for (i = 0; i < 8; i++)
+    sph_enc32be(hash + (i * 4), val[i]);
+}
+
 void sha256d_midstate(struct work *work)
 {
   unsigned char data[64];
@@ -1385,9 +1514,9 @@ static algorithm_settings_t algos[] = {
 #ifdef USE_BAIKAL
 static algorithm_settings_t algos[] = {  
 #if BAIKAL_TYPE & BAIKAL_1772
-  { "quark",              ALGO_QUARK,            "",          256,          256,          256, 0, 0, 0xFF, 0xFFFFFFULL, 0x0000ffffUL,  0,            0,          quarkcoin_regenhash,               NULL,                   NULL, gen_hash },
-  { "qubit",              ALGO_QUBIT,            "",          256,          256,          256, 0, 0, 0xFF, 0xFFFFFFULL, 0x0000ffffUL,  0,            0,          qubitcoin_regenhash,               NULL,                   NULL, gen_hash },
-  { "x11",                ALGO_X11,              "",            1,            1,            1, 0, 0, 0xFF,   0xFFFFULL, 0x0000ffffUL,  0,            0,           darkcoin_regenhash,               NULL,                   NULL, gen_hash },   
+  { "quark",              ALGO_QUARK,            "",          256,          256,          256, 0, 0, 0xFF, 0xFFFFFFULL, 0x0000ffffUL,  0,            0,          quarkcoin_regenhash,               NULL,                   NULL, gen_hash, quarkcoin_regenhash_batch },
+  { "qubit",              ALGO_QUBIT,            "",          256,          256,          256, 0, 0, 0xFF, 0xFFFFFFULL, 0x0000ffffUL,  0,            0,          qubitcoin_regenhash,               NULL,                   NULL, gen_hash, qubitcoin_regenhash_batch },
+  { "x11",                ALGO_X11,              "",            1,            1,            1, 0, 0, 0xFF,   0xFFFFULL, 0x0000ffffUL,  0,            0,           darkcoin_regenhash,               NULL,                   NULL, gen_hash, darkcoin_regenhash_batch },
   { "skein-sha256",       ALGO_SKEINCOIN,        "",            1,            1,            1, 0, 0, 0xFF,   0xFFFFULL, 0x000000ffUL,  0,          128,          skeincoin_regenhash,               NULL, skeincoin_prepare_work, gen_hash },
   { "myriadcoin-groestl", ALGO_MYRIAD_GROESTL,   "",            1,            1,            1, 0, 0, 0xFF,   0xFFFFULL, 0x0000ffffUL,  0,            0, myriadcoin_groestl_regenhash,               NULL,                   NULL, gen_hash },
 //#if 0 - Moved to allow test of other algos. 25.03.18
@@ -1459,6 +1588,7 @@ void copy_algorithm_settings(algorithm_t* dest, const char* algo)
 #ifdef USE_GPU
       dest->set_compile_options = src->set_compile_options;
 #endif
+      dest->regenhash_batch = src->regenhash_batch;
       break;
     }
   }
@@ -1471,6 +1601,355 @@ void copy_algorithm_settings(algorithm_t* dest, const char* algo)
   }
 }
 
+struct bench_hash {
+  void (*regenhash)(struct work *);
+  struct work work;
+  uint32_t *nonce;
+  unsigned char ref[32];
+  bool bad;
+  double rate;
+  pthread_t pth;
+};
+
+static void bench_hash_one(void *arg)
+{
+  struct bench_hash *bh = (struct bench_hash *)arg;
+
+  (*bh->nonce)++;
+  bh->regenhash(&bh->work);
+}
+
+/* Hashes the same header over and over, every result must be the reference */
+static void bench_hash_same(void *arg)
+{
+  struct bench_hash *bh = (struct bench_hash *)arg;
+
+  bh->regenhash(&bh->work);
+  if (memcmp(bh->work.hash, bh->ref, 32))
+    bh->bad = true;
+}
+
+static void *bench_hash_thread(void *arg)
+{
+  struct bench_hash *bh = (struct bench_hash *)arg;
+
+  bh->rate = bench_rate(bench_hash_same, bh);
+
+  return (NULL);
+}
+
+/* Some regenhash() read their parameters from the work's pool, scrypt its N */
+static struct pool bench_pool;
+
+static void bench_hash_init(struct bench_hash *bh, const algorithm_settings_t *src)
+{
+  int i;
+
+  memset(bh, 0, sizeof(struct bench_hash));
+  bh->regenhash = src->regenhash;
+  bh->work.pool = &bench_pool;
+  for (i = 0; i < (int)sizeof(bh->work.data); i++)
+    bh->work.data[i] = (unsigned char)(i * 13 + 1);
+  bh->work.XMRBlobLen = 76;
+  bh->nonce = (uint32_t *)(bh->work.data + algorithm_layout(src->type)->nonce_off);
+}
+
+#define BENCH_HASH_BATCH 8
+
+struct bench_batch {
+  void (*regenhash_batch)(struct work **, int);
+  struct bench_hash lanes[BENCH_HASH_BATCH];
+  struct work *works[BENCH_HASH_BATCH];
+};
+
+static void bench_hash_batch(void *arg)
+{
+  struct bench_batch *bb = (struct bench_batch *)arg;
+  int i;
+
+  for (i = 0; i < BENCH_HASH_BATCH; i++)
+    (*bb->lanes[i].nonce)++;
+  bb->regenhash_batch(bb->works, BENCH_HASH_BATCH);
+}
+
+/* regenhash_batch() must give what regenhash() gives for every work of
+ * batches of each size up to BENCH_HASH_BATCH, headers differ per lane */
+static void bench_hash_lanes(const algorithm_settings_t *src)
+{
+  struct bench_batch *bb;
+  struct bench_hash bh;
+  char what[32];
+  int i, count;
+
+  bb = (struct bench_batch *)cgcalloc(1, sizeof(struct bench_batch));
+  bb->regenhash_batch = src->regenhash_batch;
+  for (i = 0; i < BENCH_HASH_BATCH; i++) {
+    bench_hash_init(&bb->lanes[i], src);
+    bb->lanes[i].work.data[0] ^= i;
+    *bb->lanes[i].nonce = 0x9e3779b9 * (i + 1);
+    bb->works[i] = &bb->lanes[i].work;
+  }
+
+  for (count = 1; count <= BENCH_HASH_BATCH; count++) {
+    for (i = 0; i < count; i++)
+      (*bb->lanes[i].nonce)++;
+    bb->regenhash_batch(bb->works, count);
+    for (i = 0; i < count; i++) {
+      bench_hash_init(&bh, src);
+      memcpy(bh.work.data, bb->lanes[i].work.data, sizeof(bh.work.data));
+      bh.regenhash(&bh.work);
+      if (memcmp(bh.work.hash, bb->lanes[i].work.hash, 32))
+        quit(1, "%s batch of %d hashed work %d differently", src->name, count, i);
+    }
+  }
+
+  snprintf(what, sizeof(what), "%s lanes", src->name);
+  bench_report("hash", what, bench_rate(bench_hash_batch, bb) * BENCH_HASH_BATCH, "H/s");
+  free(bb);
+}
+
+/* --bench hash: the regenhash() every nonce a device returns goes through,
+ * for each algorithm of this build. A second pass hashes from several
+ * threads at once, the way the nonce verifiers do, and checks they never
+ * disturb each other's chained sph contexts. Algorithms with a batch entry
+ * are then measured hashing BENCH_HASH_BATCH nonces per call. */
+void bench_hashes(void)
+{
+  const int threads = 4;
+  struct bench_hash bh, *bhs;
+  algorithm_settings_t *src;
+  double rate;
+  char what[32];
+  int i;
+
+  bhs = (struct bench_hash *)cgcalloc(threads, sizeof(struct bench_hash));
+
+  for (src = algos; src->name; src++) {
+    /* cryptonight-lite has no working host side hash to measure */
+    if (!src->regenhash || src->type == ALGO_CRYPTONIGHT_LITE)
+      continue;
+
+    /* set up like a pool mining it, before any hashing thread starts */
+    memset(&bench_pool.algorithm, 0, sizeof(bench_pool.algorithm));
+    set_algorithm(&bench_pool.algorithm, src->name);
+
+    bench_hash_init(&bh, src);
+    bench_report("hash", src->name, bench_rate(bench_hash_one, &bh), "H/s");
+
+    bench_hash_init(&bh, src);
+    bh.regenhash(&bh.work);
+    for (i = 0; i < threads; i++) {
+      bench_hash_init(&bhs[i], src);
+      memcpy(bhs[i].ref, bh.work.hash, 32);
+      if (unlikely(pthread_create(&bhs[i].pth, NULL, bench_hash_thread, &bhs[i])))
+        quit(1, "Failed to create hash bench thread");
+    }
+    rate = 0;
+    for (i = 0; i < threads; i++) {
+      pthread_join(bhs[i].pth, NULL);
+      if (bhs[i].bad)
+        quit(1, "%s hashed differently from %d threads", src->name, threads);
+      rate += bhs[i].rate;
+    }
+    snprintf(what, sizeof(what), "%s x%d", src->name, threads);
+    bench_report("hash", what, rate, "H/s");
+
+    if (src->regenhash_batch)
+      bench_hash_lanes(src);
+  }
+
+  free(bhs);
+}
+
+struct bench_aes {
+  const char *name;
+  size_t len;
+  size_t out;
+  void (*hash)(unsigned char *, const unsigned char *, size_t);
+};
+
+struct bench_aes_run {
+  const struct bench_aes *ba;
+  unsigned char in[64];
+  unsigned char out[64];
+};
+
+static void bench_aes_groestl512(unsigned char *out, const unsigned char *in, size_t len)
+{
+  sph_groestl512_context ctx;
+
+  sph_groestl512_init(&ctx);
+  sph_groestl512(&ctx, in, len);
+  sph_groestl512_close(&ctx, out);
+}
+
+static void bench_aes_groestl256(unsigned char *out, const unsigned char *in, size_t len)
+{
+  sph_groestl256_context ctx;
+
+  sph_groestl256_init(&ctx);
+  sph_groestl256(&ctx, in, len);
+  sph_groestl256_close(&ctx, out);
+}
+
+static void bench_aes_echo512(unsigned char *out, const unsigned char *in, size_t len)
+{
+  sph_echo512_context ctx;
+
+  sph_echo512_init(&ctx);
+  sph_echo512(&ctx, in, len);
+  sph_echo512_close(&ctx, out);
+}
+
+/* the message sizes the chained hashes feed them */
+static const struct bench_aes bench_aes_hashes[] = {
+  { "groestl512", 64, 64, bench_aes_groestl512 },
+  { "groestl256", 32, 32, bench_aes_groestl256 },
+  { "echo512", 64, 64, bench_aes_echo512 },
+  { NULL, 0, 0, NULL }
+};
+
+static void bench_aes_one(void *arg)
+{
+  struct bench_aes_run *br = (struct bench_aes_run *)arg;
+
+  br->in[0]++;
+  br->ba->hash(br->out, br->in, br->ba->len);
+}
+
+/* --bench aes: the sph Groestl and ECHO with their tables, then with AES-NI
+ * when sph_aesni_init() picked it, after checking both give the same digests */
+void bench_aes_hashes_run(void)
+{
+  const struct bench_aes *ba;
+  struct bench_aes_run br;
+  unsigned char ref[64];
+  char what[32];
+  int aesni = sph_aesni_active;
+  int i;
+
+  memset(&br, 0, sizeof(br));
+  for (i = 0; i < (int)sizeof(br.in); i++)
+    br.in[i] = (unsigned char)(i * 29 + 3);
+
+  for (ba = bench_aes_hashes; ba->name; ba++) {
+    br.ba = ba;
+    sph_aesni_active = 0;
+    snprintf(what, sizeof(what), "%s tables", ba->name);
+    bench_report("aes", what, bench_rate(bench_aes_one, &br), "H/s");
+
+    if (!aesni)
+      continue;
+
+    for (i = 0; i < 256; i++) {
+      br.in[0]++;
+      sph_aesni_active = 0;
+      ba->hash(ref, br.in, ba->len);
+      sph_aesni_active = 1;
+      ba->hash(br.out, br.in, ba->len);
+      if (memcmp(ref, br.out, ba->out))
+        quit(1, "%s AES-NI does not match the tables", ba->name);
+    }
+    snprintf(what, sizeof(what), "%s AES-NI", ba->name);
+    bench_report("aes", what, bench_rate(bench_aes_one, &br), "H/s");
+  }
+
+  sph_aesni_active = aesni;
+}
+
+#define BENCH_SHA_CB 110
+
+struct bench_sha {
+  sph_sha256_context prefix;
+  unsigned char in[LANES * 64];
+  unsigned char cb[LANES * BENCH_SHA_CB];
+  unsigned char out[LANES * 32];
+};
+
+static void bench_sha_hash64(void *arg)
+{
+  struct bench_sha *bs = (struct bench_sha *)arg;
+
+  bs->in[0]++;
+  gen_hash64(bs->in, bs->out);
+}
+
+static void bench_sha_hash64_lanes(void *arg)
+{
+  struct bench_sha *bs = (struct bench_sha *)arg;
+
+  bs->in[0]++;
+  sha256d64_lanes(bs->out, bs->in);
+}
+
+static void bench_sha_coinbase(void *arg)
+{
+  struct bench_sha *bs = (struct bench_sha *)arg;
+
+  bs->cb[0]++;
+  gen_hash_prefixed(&bs->prefix, bs->cb, BENCH_SHA_CB, bs->out);
+}
+
+static void bench_sha_coinbase_lanes(void *arg)
+{
+  struct bench_sha *bs = (struct bench_sha *)arg;
+
+  bs->cb[0]++;
+  sha256d_lanes(bs->out, &bs->prefix, bs->cb, BENCH_SHA_CB);
+}
+
+/* --bench sha256: a merkle branch step and the part of a coinbase behind
+ * nonce2 with the portable code, with the SHA extensions when
+ * sph_sha256_hw_init() picked them and LANES at a time, the lanes checked
+ * against the portable code first */
+void bench_sha256(void)
+{
+  struct bench_sha *bs;
+  unsigned char ref[32];
+  char what[32];
+  int hw = sph_sha256_hw_active;
+  int i;
+
+  bs = (struct bench_sha *)cgcalloc(1, sizeof(struct bench_sha));
+  for (i = 0; i < (int)sizeof(bs->in); i++)
+    bs->in[i] = (unsigned char)(i * 31 + 7);
+  for (i = 0; i < (int)sizeof(bs->cb); i++)
+    bs->cb[i] = (unsigned char)(i * 17 + 5);
+  sph_sha256_init(&bs->prefix);
+  sph_sha256(&bs->prefix, bs->in, 128);
+
+  sph_sha256_hw_active = 0;
+  sha256d64_lanes(bs->out, bs->in);
+  for (i = 0; i < LANES; i++) {
+    gen_hash64(bs->in + 64 * i, ref);
+    if (memcmp(ref, bs->out + 32 * i, 32))
+      quit(1, "sha256d64_lanes lane %d does not match gen_hash64", i);
+  }
+  sha256d_lanes(bs->out, &bs->prefix, bs->cb, BENCH_SHA_CB);
+  for (i = 0; i < LANES; i++) {
+    gen_hash_prefixed(&bs->prefix, bs->cb + BENCH_SHA_CB * i, BENCH_SHA_CB, ref);
+    if (memcmp(ref, bs->out + 32 * i, 32))
+      quit(1, "sha256d_lanes lane %d does not match gen_hash_prefixed", i);
+  }
+
+  bench_report("sha256", "merkle portable", bench_rate(bench_sha_hash64, bs), "H/s");
+  bench_report("sha256", "coinbase portable", bench_rate(bench_sha_coinbase, bs), "H/s");
+  if (hw) {
+    sph_sha256_hw_active = 1;
+    snprintf(what, sizeof(what), "merkle %s", sph_sha256_hw_name);
+    bench_report("sha256", what, bench_rate(bench_sha_hash64, bs), "H/s");
+    snprintf(what, sizeof(what), "coinbase %s", sph_sha256_hw_name);
+    bench_report("sha256", what, bench_rate(bench_sha_coinbase, bs), "H/s");
+  }
+  snprintf(what, sizeof(what), "merkle %d lanes", LANES);
+  bench_report("sha256", what, bench_rate(bench_sha_hash64_lanes, bs) * LANES, "H/s");
+  snprintf(what, sizeof(what), "coinbase %d lanes", LANES);
+  bench_report("sha256", what, bench_rate(bench_sha_coinbase_lanes, bs) * LANES, "H/s");
+
+  sph_sha256_hw_active = hw;
+  free(bs);
+}
+
 static const char *lookup_algorithm_alias(const char *lookup_alias, uint8_t *nfactor)
 {
 #define ALGO_ALIAS_NF(alias, name, nf) \
@@ -19,6 +19,8 @@
 #include "ocl/build_kernel.h"   // For the build_kernel_data type
 #endif 
 
+#include "sph/sph_sha2.h"
+
 #define SUPPORT_SIAPOOL        (1)
 
 typedef enum {
@@ -68,7 +70,40 @@ typedef enum {
 
 extern const char *algorithm_type_str[];
 
+/* How a Baikal board takes a header it can start from a midstate */
+typedef enum {
+  BAIKAL_MIDSTATE_NONE,
+  BAIKAL_MIDSTATE_BLAKE256,
+  BAIKAL_MIDSTATE_DECRED
+} baikal_midstate_t;
+
+/* Where the pieces of a header sit in work->data for one algorithm type, so
+ * the per share and per nonce paths can index a table instead of walking a
+ * chain of type compares. */
+typedef struct _algorithm_layout_t {
+  uint16_t data_len;        /* header bytes, as logged */
+  uint16_t nonce_off;       /* nonce position in work->data */
+  bool     submit_be;       /* nonce is submitted big endian */
+  bool     submit_nonce64;  /* submitted nonce is 64 bits */
+  bool     nicehash_nonce24;/* nicehash keeps the top nonce byte */
+  bool     coinbase_nonce2; /* nonce2 is stored in the coinbase */
+  bool     merkle;          /* merkle root is the double SHA-256 of the coinbase */
+  bool     block_check;     /* work goes stale with the block */
+  uint16_t baikal_len;      /* header bytes sent to a Baikal board */
+  uint8_t  baikal_swab;     /* leading header words the board wants byte swapped */
+  baikal_midstate_t baikal_midstate;
+} algorithm_layout_t;
+
+extern const algorithm_layout_t algorithm_layouts[ALGO_MAX];
+
+static inline const algorithm_layout_t *algorithm_layout(algorithm_type_t type)
+{
+  return &algorithm_layouts[type];
+}
+
 extern void gen_hash(const unsigned char *data, unsigned int len, unsigned char *hash);
+extern void gen_hash_prefixed(const sph_sha256_context *prefix, const unsigned char *data, unsigned int len, unsigned char *hash);
+extern void gen_hash64(const unsigned char *data, unsigned char *hash);
 
 #ifdef USE_GPU
 struct __clState;
@@ -116,6 +151,7 @@ typedef struct _algorithm_t {
 #ifdef USE_GPU
   void(*set_compile_options)(struct _build_kernel_data *, struct cgpu_info *, struct _algorithm_t *);
 #endif 
+  void(*regenhash_batch)(struct work **, int); /* regenhash for several works at once */
 } algorithm_t;
 
 typedef struct _algorithm_settings_t
@@ -146,6 +182,7 @@ typedef struct _algorithm_settings_t
 #ifdef USE_GPU
 	void     (*set_compile_options)(build_kernel_data *, struct cgpu_info *, algorithm_t *);
 #endif 
+	void     (*regenhash_batch)(struct work **, int);
 } algorithm_settings_t;
 
 /* Set default parameters based on name. */
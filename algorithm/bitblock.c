@@ -70,10 +70,11 @@ typedef struct {
     sph_whirlpool_context   whirlpool1;
 } Xhash_context_holder;
 
-static Xhash_context_holder base_contexts;
+static Xhash_context_holder base_contexts __cache_aligned;
+static pthread_once_t base_contexts_once = PTHREAD_ONCE_INIT;
 
 
-void init_Bhash_contexts()
+static void init_Bhash_contexts(void)
 {
     sph_blake512_init(&base_contexts.blake1);
     sph_bmw512_init(&base_contexts.bmw1);
@@ -97,12 +98,11 @@ static
 #endif
 void bitblockhash(void *state, const void *input)
 {
-    init_Bhash_contexts();
-
     Xhash_context_holder ctx;
 
     uint32_t hashA[16], hashB[16];
 
+    pthread_once(&base_contexts_once, init_Bhash_contexts);
     memcpy(&ctx, &base_contexts, sizeof(base_contexts));
 
     sph_blake512 (&ctx.blake1, input, 80);
@@ -3,8 +3,19 @@
 #include <string.h>
 #include <limits.h>
 #include <stdint.h>
+#include <stdlib.h>
+#ifndef WIN32
+#include <sys/mman.h>
+#endif
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <cpuid.h>
+#include <wmmintrin.h>
+#define CN_AESNI
+#endif
 
 #include "miner.h"
+#include "bench.h"
 #include "sph/sph_jh.h"
 #include "sph/sph_skein.h"
 #include "sph/sph_blake.h"
@@ -238,53 +249,94 @@ void AESExpandKey256(uint32_t *keybuf)
 	}
 }
 
-void cryptonight(uint8_t *Output, uint8_t *Input, uint32_t Length, int Variant)
+static __thread uint64_t *cn_scratchpad;
+static __thread const char *cn_scratchpad_backing;
+
+/* Each hashing thread gets one scratchpad, allocated the first time it hashes
+ * and kept for the life of the thread. A single 2 MB huge page covers it with
+ * one TLB entry, failing that it is 2 MB aligned and offered to transparent
+ * huge pages, failing that it is ordinary memory */
+static uint64_t *cn_alloc_scratchpad(const char **backing)
 {
-	CryptonightCtx CNCtx;
-	uint64_t text[16], a[2], b[2];
-	uint32_t ExpandedKey1[64], ExpandedKey2[64];
-	
-	CNKeccak(CNCtx.State, Input, Length);
+	void *pad;
+
+#if defined(MAP_HUGETLB) && defined(MAP_ANONYMOUS)
+	pad = mmap(NULL, CN_SCRATCHPAD_SIZE, PROT_READ | PROT_WRITE,
+		MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+	if (pad != MAP_FAILED) {
+		*backing = "hugetlb";
+		return (uint64_t *)pad;
+	}
+#endif
 
-	VARIANT1_INIT();
-	
-	for(int i = 0; i < 4; ++i) ((uint64_t *)ExpandedKey1)[i] = CNCtx.State[i];
-	for(int i = 0; i < 4; ++i) ((uint64_t *)ExpandedKey2)[i] = CNCtx.State[i + 4];
-	
-	AESExpandKey256(ExpandedKey1);
-	AESExpandKey256(ExpandedKey2);
+#ifdef WIN32
+	pad = _aligned_malloc(CN_SCRATCHPAD_SIZE, CN_SCRATCHPAD_SIZE);
+	*backing = "aligned";
+#else
+	if (posix_memalign(&pad, CN_SCRATCHPAD_SIZE, CN_SCRATCHPAD_SIZE))
+		pad = NULL;
+	*backing = "aligned";
+#ifdef MADV_HUGEPAGE
+	if (pad && !madvise(pad, CN_SCRATCHPAD_SIZE, MADV_HUGEPAGE))
+		*backing = "thp";
+#endif
+#endif
+	if (unlikely(!pad))
+		quit(1, "Failed to allocate cryptonight scratchpad");
+
+	return (uint64_t *)pad;
+}
+
+/* CN_SCRATCHPAD_SIZE bytes private to the calling thread */
+uint64_t *cryptonight_scratchpad(void)
+{
+	if (unlikely(!cn_scratchpad))
+		cn_scratchpad = cn_alloc_scratchpad(&cn_scratchpad_backing);
+	return cn_scratchpad;
+}
+
+/* The AES used by the memory hard part: one round on a 16 byte block with a
+ * 16 byte round key, and the 10 round transform of the 8 blocks of text */
+typedef void (*cn_aes_rnd_t)(uint64_t *X, const uint64_t *key);
+typedef void (*cn_aes_transform8_t)(uint64_t *text, const uint32_t *Key);
+
+typedef void (*cn_core_t)(CryptonightCtx *CNCtx, const uint32_t *ExpandedKey1, const uint32_t *ExpandedKey2, int Variant, uint64_t tweak1_2);
+
+/* Scratchpad fill, main loop and the fold back into the state. Written once
+ * and instantiated for every AES implementation below, which must give the
+ * same results bit for bit */
+static inline __attribute__((always_inline)) void cn_core(CryptonightCtx *CNCtx, const uint32_t *ExpandedKey1, const uint32_t *ExpandedKey2, int Variant, uint64_t tweak1_2, cn_aes_rnd_t aes_rnd, cn_aes_transform8_t aes_transform8)
+{
+	uint64_t text[16], a[2], b[2];
 	
-	memcpy(text, CNCtx.State + 8, 128);
+	memcpy(text, CNCtx->State + 8, 128);
 	
 	for(int i = 0; i < 0x4000; ++i)
 	{
-		for(int j = 0; j < 8; ++j)
-		{
-			CNAESTransform(text + (j << 1), ExpandedKey1);
-		}
+		aes_transform8(text, ExpandedKey1);
 		
-		memcpy(CNCtx.Scratchpad + (i << 4), text, 128);
+		memcpy(CNCtx->Scratchpad + (i << 4), text, 128);
 	}
 	
-	a[0] = CNCtx.State[0] ^ CNCtx.State[4];
-	b[0] = CNCtx.State[2] ^ CNCtx.State[6];
-	a[1] = CNCtx.State[1] ^ CNCtx.State[5];
-	b[1] = CNCtx.State[3] ^ CNCtx.State[7];
+	a[0] = CNCtx->State[0] ^ CNCtx->State[4];
+	b[0] = CNCtx->State[2] ^ CNCtx->State[6];
+	a[1] = CNCtx->State[1] ^ CNCtx->State[5];
+	b[1] = CNCtx->State[3] ^ CNCtx->State[7];
 	
 	for(int i = 0; i < 0x80000; ++i)
 	{
 		uint64_t c[2];
-		memcpy(c, CNCtx.Scratchpad + ((a[0] & 0x1FFFF0) >> 3), 16);
+		memcpy(c, CNCtx->Scratchpad + ((a[0] & 0x1FFFF0) >> 3), 16);
 		
-		CNAESRnd(c, a);
+		aes_rnd(c, a);
 		
 		b[0] ^= c[0];
 		b[1] ^= c[1];
 		
 		VARIANT1_1(b[1]);
-		memcpy(CNCtx.Scratchpad + ((a[0] & 0x1FFFF0) >> 3), b, 16);
+		memcpy(CNCtx->Scratchpad + ((a[0] & 0x1FFFF0) >> 3), b, 16);
 		
-		memcpy(b, CNCtx.Scratchpad + ((c[0] & 0x1FFFF0) >> 3), 16);
+		memcpy(b, CNCtx->Scratchpad + ((c[0] & 0x1FFFF0) >> 3), 16);
 		
 		uint64_t hi;
 		
@@ -292,7 +344,7 @@ void cryptonight(uint8_t *Output, uint8_t *Input, uint32_t Length, int Variant)
 		a[0] += hi;
 		
 		VARIANT1_2(a[1]);
-		memcpy(CNCtx.Scratchpad + ((c[0] & 0x1FFFF0) >> 3), a, 16);
+		memcpy(CNCtx->Scratchpad + ((c[0] & 0x1FFFF0) >> 3), a, 16);
 		VARIANT1_2(a[1]);
 		
 		a[0] ^= b[0];
@@ -302,21 +354,118 @@ void cryptonight(uint8_t *Output, uint8_t *Input, uint32_t Length, int Variant)
 		b[1] = c[1];
 	}
 	
-	memcpy(text, CNCtx.State + 8, 128);
+	memcpy(text, CNCtx->State + 8, 128);
 	
 	for(int i = 0; i < 0x4000; ++i)
 	{
-		for(int j = 0; j < 16; ++j) text[j] ^= CNCtx.Scratchpad[(i << 4) + j];
+		for(int j = 0; j < 16; ++j) text[j] ^= CNCtx->Scratchpad[(i << 4) + j];
 		
-		for(int j = 0; j < 8; ++j)
-		{
-			CNAESTransform(text + (j << 1), ExpandedKey2);
-		}
+		aes_transform8(text, ExpandedKey2);
 	}
 	
-	// Tail Keccak and arbitrary hash func here
-	memcpy(CNCtx.State + 8, text, 128);
+	memcpy(CNCtx->State + 8, text, 128);
+}
+
+/* Table driven, works everywhere. The tables work on 32 bit words so the
+ * blocks are copied rather than cast, which the optimiser may not see through
+ * once everything is inlined */
+static inline void cn_tbl_rnd(uint64_t *X, const uint64_t *key)
+{
+	uint32_t x[4], k[4];
+	
+	memcpy(x, X, 16);
+	memcpy(k, key, 16);
+	CNAESRnd(x, k);
+	memcpy(X, x, 16);
+}
+
+static inline void cn_tbl_transform8(uint64_t *text, const uint32_t *Key)
+{
+	uint32_t x[32];
+	
+	memcpy(x, text, 128);
+	for(int j = 0; j < 8; ++j)
+	{
+		CNAESTransform(x + (j << 2), Key);
+	}
+	memcpy(text, x, 128);
+}
+
+static void cn_core_tbl(CryptonightCtx *CNCtx, const uint32_t *ExpandedKey1, const uint32_t *ExpandedKey2, int Variant, uint64_t tweak1_2)
+{
+	cn_core(CNCtx, ExpandedKey1, ExpandedKey2, Variant, tweak1_2, cn_tbl_rnd, cn_tbl_transform8);
+}
+
+#ifdef CN_AESNI
+/* AESENC is exactly one CNAESRnd. The 8 independent blocks of the transform
+ * are interleaved so the rounds pipeline */
+static inline __attribute__((target("aes,sse2"))) void cn_aesni_rnd(uint64_t *X, const uint64_t *key)
+{
+	__m128i x = _mm_loadu_si128((const __m128i *)X);
 	
+	x = _mm_aesenc_si128(x, _mm_loadu_si128((const __m128i *)key));
+	_mm_storeu_si128((__m128i *)X, x);
+}
+
+static inline __attribute__((target("aes,sse2"))) void cn_aesni_transform8(uint64_t *text, const uint32_t *Key)
+{
+	__m128i x[8];
+	
+	for(int j = 0; j < 8; ++j) x[j] = _mm_loadu_si128((const __m128i *)(text + (j << 1)));
+	
+	for(int i = 0; i < 10; ++i)
+	{
+		const __m128i k = _mm_loadu_si128((const __m128i *)(Key + (i << 2)));
+		
+		for(int j = 0; j < 8; ++j) x[j] = _mm_aesenc_si128(x[j], k);
+	}
+	
+	for(int j = 0; j < 8; ++j) _mm_storeu_si128((__m128i *)(text + (j << 1)), x[j]);
+}
+
+static __attribute__((target("aes,sse2"))) void cn_core_aesni(CryptonightCtx *CNCtx, const uint32_t *ExpandedKey1, const uint32_t *ExpandedKey2, int Variant, uint64_t tweak1_2)
+{
+	cn_core(CNCtx, ExpandedKey1, ExpandedKey2, Variant, tweak1_2, cn_aesni_rnd, cn_aesni_transform8);
+}
+#endif
+
+static cn_core_t cn_core_best = cn_core_tbl;
+static const char *cn_core_name = "tables";
+static pthread_once_t cn_select_once = PTHREAD_ONCE_INIT;
+
+/* Picks the fastest AES the CPU has, once for the whole process */
+static void cn_select(void)
+{
+#ifdef CN_AESNI
+	unsigned int eax, ebx, ecx, edx;
+	
+	if (__get_cpuid(1, &eax, &ebx, &ecx, &edx) && (ecx & bit_AES)) {
+		cn_core_best = cn_core_aesni;
+		cn_core_name = "AES-NI";
+	}
+#endif
+	applog(LOG_INFO, "CryptoNight CPU hashing uses %s AES", cn_core_name);
+}
+
+static void cryptonight_pad(uint8_t *Output, uint8_t *Input, uint32_t Length, int Variant, uint64_t *Scratchpad, cn_core_t core)
+{
+	CryptonightCtx CNCtx;
+	uint32_t ExpandedKey1[64], ExpandedKey2[64];
+	
+	CNCtx.Scratchpad = Scratchpad;
+	CNKeccak(CNCtx.State, Input, Length);
+
+	VARIANT1_INIT();
+	
+	for(int i = 0; i < 4; ++i) ((uint64_t *)ExpandedKey1)[i] = CNCtx.State[i];
+	for(int i = 0; i < 4; ++i) ((uint64_t *)ExpandedKey2)[i] = CNCtx.State[i + 4];
+	
+	AESExpandKey256(ExpandedKey1);
+	AESExpandKey256(ExpandedKey2);
+	
+	core(&CNCtx, ExpandedKey1, ExpandedKey2, Variant, tweak1_2);
+	
+	// Tail Keccak and arbitrary hash func here
 	CNKeccakF1600(((uint64_t *)CNCtx.State));
 	
 	switch(CNCtx.State[0] & 3)
@@ -356,6 +505,12 @@ void cryptonight(uint8_t *Output, uint8_t *Input, uint32_t Length, int Variant)
 	}
 }
 
+void cryptonight(uint8_t *Output, uint8_t *Input, uint32_t Length, int Variant)
+{
+	pthread_once(&cn_select_once, cn_select);
+	cryptonight_pad(Output, Input, Length, Variant, cryptonight_scratchpad(), cn_core_best);
+}
+
 void cryptonight_regenhash(struct work *work)
 {
 	uint32_t data[20];
@@ -393,3 +548,64 @@ void cryptonightlite_regenhash(struct work *work)
 	
 	//memset(ohash, 0x00, 32);
 }
+
+struct bench_cn {
+	uint8_t input[76];
+	uint8_t hash[32];
+	uint64_t *pad;
+	cn_core_t core;
+};
+
+static void bench_cn_hash(void *arg)
+{
+	struct bench_cn *b = (struct bench_cn *)arg;
+
+	cryptonight_pad(b->hash, b->input, sizeof(b->input), 1, b->pad, b->core);
+	b->input[39]++;
+}
+
+/* Hashes with the table AES on a plain 4K page buffer like the scratchpad that
+ * used to live on the stack, then on the per thread arena, then with the AES
+ * picked for this CPU after checking it agrees with the tables */
+void bench_cryptonight(void)
+{
+	uint8_t ref[32], hash[32];
+	struct bench_cn b;
+	char what[32];
+	void *plain;
+	int variant;
+
+	pthread_once(&cn_select_once, cn_select);
+
+	memset(&b, 0, sizeof(b));
+	b.input[0] = 7;
+	b.core = cn_core_tbl;
+
+	plain = malloc(CN_SCRATCHPAD_SIZE + 4096);
+	if (unlikely(!plain))
+		quit(1, "Failed to allocate cryptonight bench buffer");
+	b.pad = (uint64_t *)(((uintptr_t)plain + 4095) & ~(uintptr_t)4095);
+#ifdef MADV_NOHUGEPAGE
+	madvise(b.pad, CN_SCRATCHPAD_SIZE, MADV_NOHUGEPAGE);
+#endif
+	bench_report("cn", "tables 4K pages", bench_rate(bench_cn_hash, &b), "H/s");
+	free(plain);
+
+	b.pad = cryptonight_scratchpad();
+	snprintf(what, sizeof(what), "tables arena (%s)", cn_scratchpad_backing);
+	bench_report("cn", what, bench_rate(bench_cn_hash, &b), "H/s");
+
+	if (cn_core_best == cn_core_tbl)
+		return;
+
+	for (variant = 0; variant < 2; variant++) {
+		cryptonight_pad(ref, b.input, sizeof(b.input), variant, b.pad, cn_core_tbl);
+		cryptonight_pad(hash, b.input, sizeof(b.input), variant, b.pad, cn_core_best);
+		if (memcmp(ref, hash, 32))
+			quit(1, "CryptoNight %s variant %d does not match the tables", cn_core_name, variant);
+	}
+
+	b.core = cn_core_best;
+	snprintf(what, sizeof(what), "%s arena", cn_core_name);
+	bench_report("cn", what, bench_rate(bench_cn_hash, &b), "H/s");
+}
@@ -1,16 +1,20 @@
 #ifndef __CRYPTONIGHT_H
 #define __CRYPTONIGHT_H
 
+/* Enough for the largest variant, smaller ones use the start of it */
+#define CN_SCRATCHPAD_SIZE	(1 << 21)
+
 typedef struct _CryptonightCtx
 {
 	uint64_t State[25];
-	uint64_t Scratchpad[1 << 18];
+	uint64_t *Scratchpad;
 } CryptonightCtx;
 
 static inline int monero_variant(struct work *work) {
   return (work->is_monero && work->data[0] >= 7) ? work->data[0] - 6 : 0;
 }
 
+uint64_t *cryptonight_scratchpad(void);
 void cryptonight_regenhash(struct work *work);
 void cryptonightlite_regenhash(struct work *work);
 
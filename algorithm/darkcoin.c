@@ -46,6 +46,7 @@
 #include "sph/sph_shavite.h"
 #include "sph/sph_simd.h"
 #include "sph/sph_echo.h"
+#include "algorithm/lanes.h"
 
 /* Move init out of loop, so init once externally, and then use one single memcpy with that bigger memory block */
 typedef struct {
@@ -62,10 +63,11 @@ typedef struct {
     sph_echo512_context     echo1;
 } Xhash_context_holder;
 
-static Xhash_context_holder base_contexts;
+static Xhash_context_holder base_contexts __cache_aligned;
+static pthread_once_t base_contexts_once = PTHREAD_ONCE_INIT;
 
 
-static void init_Xhash_contexts()
+static void init_Xhash_contexts(void)
 {
     sph_blake512_init(&base_contexts.blake1);
     sph_bmw512_init(&base_contexts.bmw1);
@@ -82,12 +84,11 @@ static void init_Xhash_contexts()
 
 static void xhash(void *state, const void *input)
 {
-    init_Xhash_contexts();
-
     Xhash_context_holder ctx;
 
     uint32_t hashA[16], hashB[16];
     //blake-bmw-groestl-sken-jh-meccak-luffa-cubehash-shivite-simd-echo
+    pthread_once(&base_contexts_once, init_Xhash_contexts);
     memcpy(&ctx, &base_contexts, sizeof(base_contexts));
 
     sph_blake512 (&ctx.blake1, input, 80);
@@ -127,6 +128,53 @@ static void xhash(void *state, const void *input)
 
 }
 
+/* xhash for LANES inputs, the primitives without a multi-lane version run
+ * once per lane on a copy of their base context */
+static void xhash_lanes(uint32_t hashA[LANES][16], uint32_t input[LANES][20])
+{
+    Xhash_context_holder ctx;
+    uint32_t hashB[LANES][16];
+    int l;
+
+    pthread_once(&base_contexts_once, init_Xhash_contexts);
+
+    blake512_lanes(hashA, input, 80);
+    bmw512_lanes(hashB, hashA, 64);
+
+    for (l = 0; l < LANES; l++) {
+        memcpy(&ctx.groestl1, &base_contexts.groestl1, sizeof(ctx.groestl1));
+        sph_groestl512 (&ctx.groestl1, hashB[l], 64);
+        sph_groestl512_close(&ctx.groestl1, hashA[l]);
+    }
+
+    skein512_lanes(hashB, hashA, 64);
+
+    for (l = 0; l < LANES; l++) {
+        memcpy(&ctx.jh1, &base_contexts.jh1, sizeof(ctx.jh1));
+        sph_jh512 (&ctx.jh1, hashB[l], 64);
+        sph_jh512_close(&ctx.jh1, hashA[l]);
+    }
+
+    keccak512_lanes(hashB, hashA, 64);
+
+    luffa512_lanes(hashA, hashB, 64);
+    cubehash512_lanes(hashB, hashA, 64);
+
+    for (l = 0; l < LANES; l++) {
+        memcpy(&ctx.shavite1, &base_contexts.shavite1, sizeof(ctx.shavite1));
+        sph_shavite512 (&ctx.shavite1, hashB[l], 64);
+        sph_shavite512_close(&ctx.shavite1, hashA[l]);
+
+        memcpy(&ctx.simd1, &base_contexts.simd1, sizeof(ctx.simd1));
+        sph_simd512 (&ctx.simd1, hashA[l], 64);
+        sph_simd512_close(&ctx.simd1, hashB[l]);
+
+        memcpy(&ctx.echo1, &base_contexts.echo1, sizeof(ctx.echo1));
+        sph_echo512 (&ctx.echo1, hashB[l], 64);
+        sph_echo512_close(&ctx.echo1, hashA[l]);
+    }
+}
+
 static const uint32_t diff1targ = 0x0000ffff;
 
 
@@ -163,6 +211,25 @@ void darkcoin_regenhash(struct work *work)
         xhash(ohash, data);
 }
 
+/* darkcoin_regenhash for count works, a short last group repeats its last work */
+void darkcoin_regenhash_batch(struct work **works, int count)
+{
+        uint32_t data[LANES][20], hash[LANES][16];
+        struct work *work;
+        int i, l;
+
+        for (i = 0; i < count; i += LANES) {
+                for (l = 0; l < LANES; l++) {
+                        work = works[MIN(i + l, count - 1)];
+                        be32enc_vect(data[l], (const uint32_t *)work->data, 19);
+                        data[l][19] = htobe32(*(uint32_t *)(work->data + 76));
+                }
+                xhash_lanes(hash, data);
+                for (l = 0; (l < LANES) && (i + l < count); l++)
+                        memcpy(works[i + l]->hash, hash[l], 32);
+        }
+}
+
 bool scanhash_darkcoin(struct thr_info *thr, const unsigned char __maybe_unused *pmidstate,
 		     unsigned char *pdata, unsigned char __maybe_unused *phash1,
 		     unsigned char __maybe_unused *phash, const unsigned char *ptarget,
@@ -6,5 +6,6 @@
 extern int darkcoin_test(unsigned char *pdata, const unsigned char *ptarget,
 			uint32_t nonce);
 extern void darkcoin_regenhash(struct work *work);
+extern void darkcoin_regenhash_batch(struct work **works, int count);
 
 #endif /* DARKCOIN_H */
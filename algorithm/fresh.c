@@ -49,9 +49,10 @@ typedef struct {
   sph_echo512_context     echo2;
 } FreshHash_context_holder;
 
-FreshHash_context_holder base_contexts;
+static FreshHash_context_holder base_contexts __cache_aligned;
+static pthread_once_t base_contexts_once = PTHREAD_ONCE_INIT;
 
-void init_freshHash_contexts()
+static void init_freshHash_contexts(void)
 {
   sph_shavite512_init(&base_contexts.shavite1);
   sph_simd512_init(&base_contexts.simd1);
@@ -66,12 +67,11 @@ static
 #endif
 void freshHash(void *state, const void *input)
 {
-  init_freshHash_contexts();
-
   FreshHash_context_holder ctx;
 
   uint32_t hashA[16], hashB[16];
   //shavite-simd-shavite-simd-echo
+  pthread_once(&base_contexts_once, init_freshHash_contexts);
   memcpy(&ctx, &base_contexts, sizeof(base_contexts));
 
   sph_shavite512 (&ctx.shavite1, input, 80);
@@ -0,0 +1,1061 @@
+/*
+ * Multi-lane blake512, bmw512, skein512, keccak512, cubehash512, luffa512
+ * and the double SHA-256 of coinbases and merkle branches.
+ *
+ * These follow the sph reference code word for word but keep every state
+ * word as a GCC vector holding that word for LANES independent messages, so
+ * one pass of the compression function hashes all of them. The vectors map
+ * to AVX2 or SSE2 on x86-64, picked when the binary is loaded. The build
+ * passes no -mfpu=neon, so on ARM GCC splits them into scalar operations:
+ * the results are the same, there is just no gain there.
+ *
+ * groestl, shavite and echo are not laned. They are AES style byte table
+ * lookups, which GCC vectors cannot gather, so a lane version would still
+ * look up one lane at a time; groestl and echo have AES-NI versions in
+ * sph/aesni.c instead. jh (bit sliced S-boxes) and simd (an NTT on 16 bit
+ * coefficients) do not map word for word onto lanes and would need their
+ * own vector code. The chained hashes run these once per lane.
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the Free
+ * Software Foundation; either version 3 of the License, or (at your option)
+ * any later version.  See COPYING for more details.
+ */
+
+#include "config.h"
+
+#include <string.h>
+#include <stdint.h>
+
+#include "miner.h"
+#include "algorithm/lanes.h"
+
+#if defined(__x86_64__) && defined(__ELF__) && defined(__GNUC__) && (__GNUC__ >= 6) && !defined(__clang__)
+#define LANES_TARGETS	__attribute__((target_clones("avx2", "default")))
+#else
+#define LANES_TARGETS
+#endif
+
+#define LANES_INLINE	static inline __attribute__((always_inline))
+
+typedef uint64_t v64 __attribute__((vector_size(8 * LANES)));
+typedef uint32_t v32 __attribute__((vector_size(4 * LANES)));
+
+#define ROTL64(x, n)	(((x) << (n)) | ((x) >> (64 - (n))))
+#define ROTR64(x, n)	(((x) >> (n)) | ((x) << (64 - (n))))
+#define ROTL32(x, n)	(((x) << (n)) | ((x) >> (32 - (n))))
+
+/* Word i of every lane's block goes into lane i of w[] */
+LANES_INLINE void load64le(v64 *w, const uint8_t *blk, size_t stride, int words)
+{
+	uint64_t t;
+	int i, l;
+
+	for (i = 0; i < words; i++) {
+		for (l = 0; l < LANES; l++) {
+			memcpy(&t, blk + l * stride + 8 * i, 8);
+			w[i][l] = le64toh(t);
+		}
+	}
+}
+
+LANES_INLINE void load64be(v64 *w, const uint8_t *blk, size_t stride, int words)
+{
+	uint64_t t;
+	int i, l;
+
+	for (i = 0; i < words; i++) {
+		for (l = 0; l < LANES; l++) {
+			memcpy(&t, blk + l * stride + 8 * i, 8);
+			w[i][l] = be64toh(t);
+		}
+	}
+}
+
+LANES_INLINE void store64le(uint8_t *out, const v64 *w)
+{
+	uint64_t t;
+	int i, l;
+
+	for (i = 0; i < 8; i++) {
+		for (l = 0; l < LANES; l++) {
+			t = htole64(w[i][l]);
+			memcpy(out + 64 * l + 8 * i, &t, 8);
+		}
+	}
+}
+
+LANES_INLINE void store64be(uint8_t *out, const v64 *w)
+{
+	uint64_t t;
+	int i, l;
+
+	for (i = 0; i < 8; i++) {
+		for (l = 0; l < LANES; l++) {
+			t = htobe64(w[i][l]);
+			memcpy(out + 64 * l + 8 * i, &t, 8);
+		}
+	}
+}
+
+
+/* blake512 */
+
+static const uint64_t blake512_iv[8] = {
+	0x6A09E667F3BCC908ULL, 0xBB67AE8584CAA73BULL,
+	0x3C6EF372FE94F82BULL, 0xA54FF53A5F1D36F1ULL,
+	0x510E527FADE682D1ULL, 0x9B05688C2B3E6C1FULL,
+	0x1F83D9ABFB41BD6BULL, 0x5BE0CD19137E2179ULL
+};
+
+static const uint64_t blake512_cb[16] = {
+	0x243F6A8885A308D3ULL, 0x13198A2E03707344ULL,
+	0xA4093822299F31D0ULL, 0x082EFA98EC4E6C89ULL,
+	0x452821E638D01377ULL, 0xBE5466CF34E90C6CULL,
+	0xC0AC29B7C97C50DDULL, 0x3F84D5B5B5470917ULL,
+	0x9216D5D98979FB1BULL, 0xD1310BA698DFB5ACULL,
+	0x2FFD72DBD01ADFB7ULL, 0xB8E1AFED6A267E96ULL,
+	0xBA7C9045F12C7F99ULL, 0x24A19947B3916CF7ULL,
+	0x0801F2E2858EFC16ULL, 0x636920D871574E69ULL
+};
+
+static const uint8_t blake512_sigma[16][16] = {
+	{  0,  1,  2,  3,  4,  5,  6,  7,  8,  9, 10, 11, 12, 13, 14, 15 },
+	{ 14, 10,  4,  8,  9, 15, 13,  6,  1, 12,  0,  2, 11,  7,  5,  3 },
+	{ 11,  8, 12,  0,  5,  2, 15, 13, 10, 14,  3,  6,  7,  1,  9,  4 },
+	{  7,  9,  3,  1, 13, 12, 11, 14,  2,  6,  5, 10,  4,  0, 15,  8 },
+	{  9,  0,  5,  7,  2,  4, 10, 15, 14,  1, 11, 12,  6,  8,  3, 13 },
+	{  2, 12,  6, 10,  0, 11,  8,  3,  4, 13,  7,  5, 15, 14,  1,  9 },
+	{ 12,  5,  1, 15, 14, 13,  4, 10,  0,  7,  6,  3,  9,  2,  8, 11 },
+	{ 13, 11,  7, 14, 12,  1,  3,  9,  5,  0, 15,  4,  8,  6,  2, 10 },
+	{  6, 15, 14,  9, 11,  3,  0,  8, 12,  2, 13,  7,  1,  4, 10,  5 },
+	{ 10,  2,  8,  4,  7,  6,  1,  5, 15, 11,  9, 14,  3, 12, 13,  0 },
+	{  0,  1,  2,  3,  4,  5,  6,  7,  8,  9, 10, 11, 12, 13, 14, 15 },
+	{ 14, 10,  4,  8,  9, 15, 13,  6,  1, 12,  0,  2, 11,  7,  5,  3 },
+	{ 11,  8, 12,  0,  5,  2, 15, 13, 10, 14,  3,  6,  7,  1,  9,  4 },
+	{  7,  9,  3,  1, 13, 12, 11, 14,  2,  6,  5, 10,  4,  0, 15,  8 },
+	{  9,  0,  5,  7,  2,  4, 10, 15, 14,  1, 11, 12,  6,  8,  3, 13 },
+	{  2, 12,  6, 10,  0, 11,  8,  3,  4, 13,  7,  5, 15, 14,  1,  9 }
+};
+
+#define BLAKE_G(a, b, c, d, s0, s1)	do { \
+		a += b + (m[s0] ^ blake512_cb[s1]); \
+		d = ROTR64(d ^ a, 32); \
+		c += d; \
+		b = ROTR64(b ^ c, 25); \
+		a += b + (m[s1] ^ blake512_cb[s0]); \
+		d = ROTR64(d ^ a, 16); \
+		c += d; \
+		b = ROTR64(b ^ c, 11); \
+	} while (0)
+
+/* One block with a zero salt, t0 is the bit count including this block */
+LANES_INLINE void blake512_compress(v64 *h, const v64 *m, uint64_t t0)
+{
+	const uint8_t *s;
+	v64 v[16];
+	int i, r;
+
+	for (i = 0; i < 8; i++) {
+		v[i] = h[i];
+		v[i + 8] = (v64){ 0 } + blake512_cb[i];
+	}
+	v[12] ^= t0;
+	v[13] ^= t0;
+
+	for (r = 0; r < 16; r++) {
+		s = blake512_sigma[r];
+		BLAKE_G(v[0], v[4], v[ 8], v[12], s[ 0], s[ 1]);
+		BLAKE_G(v[1], v[5], v[ 9], v[13], s[ 2], s[ 3]);
+		BLAKE_G(v[2], v[6], v[10], v[14], s[ 4], s[ 5]);
+		BLAKE_G(v[3], v[7], v[11], v[15], s[ 6], s[ 7]);
+		BLAKE_G(v[0], v[5], v[10], v[15], s[ 8], s[ 9]);
+		BLAKE_G(v[1], v[6], v[11], v[12], s[10], s[11]);
+		BLAKE_G(v[2], v[7], v[ 8], v[13], s[12], s[13]);
+		BLAKE_G(v[3], v[4], v[ 9], v[14], s[14], s[15]);
+	}
+
+	for (i = 0; i < 8; i++) {
+		h[i] ^= v[i] ^ v[i + 8];
+	}
+}
+
+LANES_TARGETS void blake512_lanes(void *out, const void *in, size_t len)
+{
+	uint8_t blk[LANES][128];
+	v64 h[8], m[16];
+	int i, l;
+
+	for (l = 0; l < LANES; l++) {
+		memset(blk[l], 0, sizeof(blk[l]));
+		memcpy(blk[l], (const uint8_t *)in + l * len, len);
+		blk[l][len] = 0x80;
+		blk[l][111] |= 0x01;
+		be64enc(&blk[l][120], (uint64_t)len << 3);
+	}
+
+	for (i = 0; i < 8; i++) {
+		h[i] = (v64){ 0 } + blake512_iv[i];
+	}
+	load64be(m, blk[0], sizeof(blk[0]), 16);
+	blake512_compress(h, m, (uint64_t)len << 3);
+	store64be(out, h);
+}
+
+
+/* bmw512 */
+
+static const uint64_t bmw512_iv[16] = {
+	0x8081828384858687ULL, 0x88898A8B8C8D8E8FULL,
+	0x9091929394959697ULL, 0x98999A9B9C9D9E9FULL,
+	0xA0A1A2A3A4A5A6A7ULL, 0xA8A9AAABACADAEAFULL,
+	0xB0B1B2B3B4B5B6B7ULL, 0xB8B9BABBBCBDBEBFULL,
+	0xC0C1C2C3C4C5C6C7ULL, 0xC8C9CACBCCCDCECFULL,
+	0xD0D1D2D3D4D5D6D7ULL, 0xD8D9DADBDCDDDEDFULL,
+	0xE0E1E2E3E4E5E6E7ULL, 0xE8E9EAEBECEDEEEFULL,
+	0xF0F1F2F3F4F5F6F7ULL, 0xF8F9FAFBFCFDFEFFULL
+};
+
+#define BMW_S0(x)	(((x) >> 1) ^ ((x) << 3) ^ ROTL64(x,  4) ^ ROTL64(x, 37))
+#define BMW_S1(x)	(((x) >> 1) ^ ((x) << 2) ^ ROTL64(x, 13) ^ ROTL64(x, 43))
+#define BMW_S2(x)	(((x) >> 2) ^ ((x) << 1) ^ ROTL64(x, 19) ^ ROTL64(x, 53))
+#define BMW_S3(x)	(((x) >> 2) ^ ((x) << 2) ^ ROTL64(x, 28) ^ ROTL64(x, 59))
+#define BMW_S4(x)	(((x) >> 1) ^ (x))
+#define BMW_S5(x)	(((x) >> 2) ^ (x))
+
+#define BMW_MR(j)	ROTL64(m[(j) & 15], ((j) & 15) + 1)
+
+LANES_INLINE void bmw512_compress(v64 *dh, const v64 *m, const v64 *h)
+{
+	v64 x[16], w[16], q[32], xl, xh;
+	int i, j;
+
+	for (i = 0; i < 16; i++) {
+		x[i] = m[i] ^ h[i];
+	}
+
+	w[ 0] = x[ 5] - x[ 7] + x[10] + x[13] + x[14];
+	w[ 1] = x[ 6] - x[ 8] + x[11] + x[14] - x[15];
+	w[ 2] = x[ 0] + x[ 7] + x[ 9] - x[12] + x[15];
+	w[ 3] = x[ 0] - x[ 1] + x[ 8] - x[10] + x[13];
+	w[ 4] = x[ 1] + x[ 2] + x[ 9] - x[11] - x[14];
+	w[ 5] = x[ 3] - x[ 2] + x[10] - x[12] + x[15];
+	w[ 6] = x[ 4] - x[ 0] - x[ 3] - x[11] + x[13];
+	w[ 7] = x[ 1] - x[ 4] - x[ 5] - x[12] - x[14];
+	w[ 8] = x[ 2] - x[ 5] - x[ 6] + x[13] - x[15];
+	w[ 9] = x[ 0] - x[ 3] + x[ 6] - x[ 7] + x[14];
+	w[10] = x[ 8] - x[ 1] - x[ 4] - x[ 7] + x[15];
+	w[11] = x[ 8] - x[ 0] - x[ 2] - x[ 5] + x[ 9];
+	w[12] = x[ 1] + x[ 3] - x[ 6] - x[ 9] + x[10];
+	w[13] = x[ 2] + x[ 4] + x[ 7] + x[10] + x[11];
+	w[14] = x[ 3] - x[ 5] + x[ 8] - x[11] - x[12];
+	w[15] = x[12] - x[ 4] - x[ 6] - x[ 9] + x[13];
+
+	for (i = 0; i < 16; i += 5) {
+		q[i] = BMW_S0(w[i]) + h[(i + 1) & 15];
+		if (i == 15) {
+			break;
+		}
+		q[i + 1] = BMW_S1(w[i + 1]) + h[(i + 2) & 15];
+		q[i + 2] = BMW_S2(w[i + 2]) + h[(i + 3) & 15];
+		q[i + 3] = BMW_S3(w[i + 3]) + h[(i + 4) & 15];
+		q[i + 4] = BMW_S4(w[i + 4]) + h[(i + 5) & 15];
+	}
+
+	for (i = 16; i < 32; i++) {
+		j = i - 16;
+		q[i] = (BMW_MR(j) + BMW_MR(j + 3) - BMW_MR(j + 10)
+			+ (uint64_t)(j + 16) * 0x0555555555555555ULL) ^ h[(j + 7) & 15];
+		if (i < 18) {
+			q[i] += BMW_S1(q[i - 16]) + BMW_S2(q[i - 15]) + BMW_S3(q[i - 14]) + BMW_S0(q[i - 13])
+				+ BMW_S1(q[i - 12]) + BMW_S2(q[i - 11]) + BMW_S3(q[i - 10]) + BMW_S0(q[i - 9])
+				+ BMW_S1(q[i - 8]) + BMW_S2(q[i - 7]) + BMW_S3(q[i - 6]) + BMW_S0(q[i - 5])
+				+ BMW_S1(q[i - 4]) + BMW_S2(q[i - 3]) + BMW_S3(q[i - 2]) + BMW_S0(q[i - 1]);
+		}
+		else {
+			q[i] += q[i - 16] + ROTL64(q[i - 15], 5)
+				+ q[i - 14] + ROTL64(q[i - 13], 11)
+				+ q[i - 12] + ROTL64(q[i - 11], 27)
+				+ q[i - 10] + ROTL64(q[i - 9], 32)
+				+ q[i - 8] + ROTL64(q[i - 7], 37)
+				+ q[i - 6] + ROTL64(q[i - 5], 43)
+				+ q[i - 4] + ROTL64(q[i - 3], 53)
+				+ BMW_S4(q[i - 2]) + BMW_S5(q[i - 1]);
+		}
+	}
+
+	xl = q[16] ^ q[17] ^ q[18] ^ q[19] ^ q[20] ^ q[21] ^ q[22] ^ q[23];
+	xh = xl ^ q[24] ^ q[25] ^ q[26] ^ q[27] ^ q[28] ^ q[29] ^ q[30] ^ q[31];
+
+	dh[ 0] = ((xh <<  5) ^ (q[16] >>  5) ^ m[ 0]) + (xl ^ q[24] ^ q[ 0]);
+	dh[ 1] = ((xh >>  7) ^ (q[17] <<  8) ^ m[ 1]) + (xl ^ q[25] ^ q[ 1]);
+	dh[ 2] = ((xh >>  5) ^ (q[18] <<  5) ^ m[ 2]) + (xl ^ q[26] ^ q[ 2]);
+	dh[ 3] = ((xh >>  1) ^ (q[19] <<  5) ^ m[ 3]) + (xl ^ q[27] ^ q[ 3]);
+	dh[ 4] = ((xh >>  3) ^ (q[20]      ) ^ m[ 4]) + (xl ^ q[28] ^ q[ 4]);
+	dh[ 5] = ((xh <<  6) ^ (q[21] >>  6) ^ m[ 5]) + (xl ^ q[29] ^ q[ 5]);
+	dh[ 6] = ((xh >>  4) ^ (q[22] <<  6) ^ m[ 6]) + (xl ^ q[30] ^ q[ 6]);
+	dh[ 7] = ((xh >> 11) ^ (q[23] <<  2) ^ m[ 7]) + (xl ^ q[31] ^ q[ 7]);
+	dh[ 8] = ROTL64(dh[4],  9) + (xh ^ q[24] ^ m[ 8]) + ((xl << 8) ^ q[23] ^ q[ 8]);
+	dh[ 9] = ROTL64(dh[5], 10) + (xh ^ q[25] ^ m[ 9]) + ((xl >> 6) ^ q[16] ^ q[ 9]);
+	dh[10] = ROTL64(dh[6], 11) + (xh ^ q[26] ^ m[10]) + ((xl << 6) ^ q[17] ^ q[10]);
+	dh[11] = ROTL64(dh[7], 12) + (xh ^ q[27] ^ m[11]) + ((xl << 4) ^ q[18] ^ q[11]);
+	dh[12] = ROTL64(dh[0], 13) + (xh ^ q[28] ^ m[12]) + ((xl >> 3) ^ q[19] ^ q[12]);
+	dh[13] = ROTL64(dh[1], 14) + (xh ^ q[29] ^ m[13]) + ((xl >> 4) ^ q[20] ^ q[13]);
+	dh[14] = ROTL64(dh[2], 15) + (xh ^ q[30] ^ m[14]) + ((xl >> 7) ^ q[21] ^ q[14]);
+	dh[15] = ROTL64(dh[3], 16) + (xh ^ q[31] ^ m[15]) + ((xl >> 2) ^ q[22] ^ q[15]);
+}
+
+LANES_TARGETS void bmw512_lanes(void *out, const void *in, size_t len)
+{
+	uint8_t blk[LANES][128];
+	v64 h[16], m[16], h2[16];
+	int i, l;
+
+	for (l = 0; l < LANES; l++) {
+		memset(blk[l], 0, sizeof(blk[l]));
+		memcpy(blk[l], (const uint8_t *)in + l * len, len);
+		blk[l][len] = 0x80;
+		le64enc(&blk[l][120], (uint64_t)len << 3);
+	}
+
+	for (i = 0; i < 16; i++) {
+		h[i] = (v64){ 0 } + bmw512_iv[i];
+	}
+	load64le(m, blk[0], sizeof(blk[0]), 16);
+	bmw512_compress(h2, m, h);
+
+	/* the final block is the chaining value, keyed with 0xaa..a0 + i */
+	for (i = 0; i < 16; i++) {
+		h[i] = (v64){ 0 } + (0xaaaaaaaaaaaaaaa0ULL + i);
+	}
+	bmw512_compress(m, h2, h);
+	store64le(out, &m[8]);
+}
+
+
+/* skein512 */
+
+static const uint64_t skein512_iv[8] = {
+	0x4903ADFF749C51CEULL, 0x0D95DE399746DF03ULL,
+	0x8FD1934127C79BCEULL, 0x9A255629FF352CB1ULL,
+	0x5DB62599DF6CA7B0ULL, 0xEABE394CA9D5C3F4ULL,
+	0x991112C71A75B523ULL, 0xAE18A40B660FCC33ULL
+};
+
+#define SKEIN_MIX(x0, x1, rc)	do { \
+		x0 += x1; \
+		x1 = ROTL64(x1, rc) ^ x0; \
+	} while (0)
+
+/* Subkey s, k[] and t[] hold the key and tweak words repeated so that no
+ * index needs reducing */
+#define SKEIN_ADDKEY(s)	do { \
+		p0 += k[(s) + 0]; \
+		p1 += k[(s) + 1]; \
+		p2 += k[(s) + 2]; \
+		p3 += k[(s) + 3]; \
+		p4 += k[(s) + 4]; \
+		p5 += k[(s) + 5] + t[(s)]; \
+		p6 += k[(s) + 6] + t[(s) + 1]; \
+		p7 += k[(s) + 7] + (uint64_t)(s); \
+	} while (0)
+
+#define SKEIN_ROUNDS_EVEN	do { \
+		SKEIN_MIX(p0, p1, 46); SKEIN_MIX(p2, p3, 36); SKEIN_MIX(p4, p5, 19); SKEIN_MIX(p6, p7, 37); \
+		SKEIN_MIX(p2, p1, 33); SKEIN_MIX(p4, p7, 27); SKEIN_MIX(p6, p5, 14); SKEIN_MIX(p0, p3, 42); \
+		SKEIN_MIX(p4, p1, 17); SKEIN_MIX(p6, p3, 49); SKEIN_MIX(p0, p5, 36); SKEIN_MIX(p2, p7, 39); \
+		SKEIN_MIX(p6, p1, 44); SKEIN_MIX(p0, p7,  9); SKEIN_MIX(p2, p5, 54); SKEIN_MIX(p4, p3, 56); \
+	} while (0)
+
+#define SKEIN_ROUNDS_ODD	do { \
+		SKEIN_MIX(p0, p1, 39); SKEIN_MIX(p2, p3, 30); SKEIN_MIX(p4, p5, 34); SKEIN_MIX(p6, p7, 24); \
+		SKEIN_MIX(p2, p1, 13); SKEIN_MIX(p4, p7, 50); SKEIN_MIX(p6, p5, 10); SKEIN_MIX(p0, p3, 17); \
+		SKEIN_MIX(p4, p1, 25); SKEIN_MIX(p6, p3, 29); SKEIN_MIX(p0, p5, 39); SKEIN_MIX(p2, p7, 43); \
+		SKEIN_MIX(p6, p1,  8); SKEIN_MIX(p0, p7, 35); SKEIN_MIX(p2, p5, 56); SKEIN_MIX(p4, p3, 22); \
+	} while (0)
+
+/* One UBI block: Threefish-512 keyed with h and tweak t0/t1, then h = m ^ E(m) */
+LANES_INLINE void skein512_ubi(v64 *h, const v64 *m, uint64_t t0, uint64_t t1)
+{
+	v64 k[26], p0, p1, p2, p3, p4, p5, p6, p7;
+	uint64_t t[20];
+	int i, s;
+
+	k[8] = (v64){ 0 } + 0x1BD11BDAA9FC1A22ULL;
+	for (i = 0; i < 8; i++) {
+		k[i] = h[i];
+		k[8] ^= h[i];
+	}
+	for (i = 9; i < 26; i++) {
+		k[i] = k[i - 9];
+	}
+	t[0] = t0;
+	t[1] = t1;
+	t[2] = t0 ^ t1;
+	for (i = 3; i < 20; i++) {
+		t[i] = t[i - 3];
+	}
+
+	p0 = m[0]; p1 = m[1]; p2 = m[2]; p3 = m[3];
+	p4 = m[4]; p5 = m[5]; p6 = m[6]; p7 = m[7];
+
+	for (s = 0; s < 18; s += 2) {
+		SKEIN_ADDKEY(s);
+		SKEIN_ROUNDS_EVEN;
+		SKEIN_ADDKEY(s + 1);
+		SKEIN_ROUNDS_ODD;
+	}
+	SKEIN_ADDKEY(18);
+
+	h[0] = m[0] ^ p0; h[1] = m[1] ^ p1; h[2] = m[2] ^ p2; h[3] = m[3] ^ p3;
+	h[4] = m[4] ^ p4; h[5] = m[5] ^ p5; h[6] = m[6] ^ p6; h[7] = m[7] ^ p7;
+}
+
+LANES_TARGETS void skein512_lanes(void *out, const void *in, size_t len)
+{
+	uint8_t blk[LANES][64];
+	v64 h[8], m[8];
+	int i, l;
+
+	for (l = 0; l < LANES; l++) {
+		memset(blk[l], 0, sizeof(blk[l]));
+		memcpy(blk[l], (const uint8_t *)in + l * len, len);
+	}
+
+	for (i = 0; i < 8; i++) {
+		h[i] = (v64){ 0 } + skein512_iv[i];
+	}
+	load64le(m, blk[0], sizeof(blk[0]), 8);
+	/* message block: type 48, first and final */
+	skein512_ubi(h, m, len, 0xF000000000000000ULL);
+
+	/* output block: type 63, first and final, counter 0 */
+	memset(m, 0, sizeof(m));
+	skein512_ubi(h, m, 8, 0xFF00000000000000ULL);
+	store64le(out, h);
+}
+
+
+/* keccak512 */
+
+#define KECCAK512_RATE	72
+
+static const uint64_t keccak_rc[24] = {
+	0x0000000000000001ULL, 0x0000000000008082ULL,
+	0x800000000000808AULL, 0x8000000080008000ULL,
+	0x000000000000808BULL, 0x0000000080000001ULL,
+	0x8000000080008081ULL, 0x8000000000008009ULL,
+	0x000000000000008AULL, 0x0000000000000088ULL,
+	0x0000000080008009ULL, 0x000000008000000AULL,
+	0x000000008000808BULL, 0x800000000000008BULL,
+	0x8000000000008089ULL, 0x8000000000008003ULL,
+	0x8000000000008002ULL, 0x8000000000000080ULL,
+	0x000000000000800AULL, 0x800000008000000AULL,
+	0x8000000080008081ULL, 0x8000000000008080ULL,
+	0x0000000080000001ULL, 0x8000000080008008ULL
+};
+
+#define KECCAK_CHI(y)	do { \
+		a[y + 0] = b[y + 0] ^ (~b[y + 1] & b[y + 2]); \
+		a[y + 1] = b[y + 1] ^ (~b[y + 2] & b[y + 3]); \
+		a[y + 2] = b[y + 2] ^ (~b[y + 3] & b[y + 4]); \
+		a[y + 3] = b[y + 3] ^ (~b[y + 4] & b[y + 0]); \
+		a[y + 4] = b[y + 4] ^ (~b[y + 0] & b[y + 1]); \
+	} while (0)
+
+/* Rho and pi are spelled out so the state words stay in registers */
+LANES_INLINE void keccak_f1600(v64 *a)
+{
+	v64 b[25], c[5], d[5];
+	int r;
+
+	for (r = 0; r < 24; r++) {
+		c[0] = a[0] ^ a[5] ^ a[10] ^ a[15] ^ a[20];
+		c[1] = a[1] ^ a[6] ^ a[11] ^ a[16] ^ a[21];
+		c[2] = a[2] ^ a[7] ^ a[12] ^ a[17] ^ a[22];
+		c[3] = a[3] ^ a[8] ^ a[13] ^ a[18] ^ a[23];
+		c[4] = a[4] ^ a[9] ^ a[14] ^ a[19] ^ a[24];
+		d[0] = c[4] ^ ROTL64(c[1], 1);
+		d[1] = c[0] ^ ROTL64(c[2], 1);
+		d[2] = c[1] ^ ROTL64(c[3], 1);
+		d[3] = c[2] ^ ROTL64(c[4], 1);
+		d[4] = c[3] ^ ROTL64(c[0], 1);
+
+		b[ 0] = a[ 0] ^ d[0];
+		b[ 1] = ROTL64(a[ 6] ^ d[1], 44);
+		b[ 2] = ROTL64(a[12] ^ d[2], 43);
+		b[ 3] = ROTL64(a[18] ^ d[3], 21);
+		b[ 4] = ROTL64(a[24] ^ d[4], 14);
+		b[ 5] = ROTL64(a[ 3] ^ d[3], 28);
+		b[ 6] = ROTL64(a[ 9] ^ d[4], 20);
+		b[ 7] = ROTL64(a[10] ^ d[0],  3);
+		b[ 8] = ROTL64(a[16] ^ d[1], 45);
+		b[ 9] = ROTL64(a[22] ^ d[2], 61);
+		b[10] = ROTL64(a[ 1] ^ d[1],  1);
+		b[11] = ROTL64(a[ 7] ^ d[2],  6);
+		b[12] = ROTL64(a[13] ^ d[3], 25);
+		b[13] = ROTL64(a[19] ^ d[4],  8);
+		b[14] = ROTL64(a[20] ^ d[0], 18);
+		b[15] = ROTL64(a[ 4] ^ d[4], 27);
+		b[16] = ROTL64(a[ 5] ^ d[0], 36);
+		b[17] = ROTL64(a[11] ^ d[1], 10);
+		b[18] = ROTL64(a[17] ^ d[2], 15);
+		b[19] = ROTL64(a[23] ^ d[3], 56);
+		b[20] = ROTL64(a[ 2] ^ d[2], 62);
+		b[21] = ROTL64(a[ 8] ^ d[3], 55);
+		b[22] = ROTL64(a[14] ^ d[4], 39);
+		b[23] = ROTL64(a[15] ^ d[0], 41);
+		b[24] = ROTL64(a[21] ^ d[1],  2);
+
+		KECCAK_CHI(0);
+		KECCAK_CHI(5);
+		KECCAK_CHI(10);
+		KECCAK_CHI(15);
+		KECCAK_CHI(20);
+
+		a[0] ^= keccak_rc[r];
+	}
+}
+
+LANES_TARGETS void keccak512_lanes(void *out, const void *in, size_t len)
+{
+	const uint8_t *src = in;
+	uint8_t blk[LANES][KECCAK512_RATE];
+	size_t off, rem;
+	v64 a[25], m[KECCAK512_RATE / 8];
+	int i, l;
+
+	memset(a, 0, sizeof(a));
+
+	for (off = 0; len - off >= KECCAK512_RATE; off += KECCAK512_RATE) {
+		load64le(m, src + off, len, KECCAK512_RATE / 8);
+		for (i = 0; i < KECCAK512_RATE / 8; i++) {
+			a[i] ^= m[i];
+		}
+		keccak_f1600(a);
+	}
+
+	rem = len - off;
+	for (l = 0; l < LANES; l++) {
+		memset(blk[l], 0, sizeof(blk[l]));
+		memcpy(blk[l], src + l * len + off, rem);
+		blk[l][rem] ^= 0x01;
+		blk[l][KECCAK512_RATE - 1] ^= 0x80;
+	}
+	load64le(m, blk[0], sizeof(blk[0]), KECCAK512_RATE / 8);
+	for (i = 0; i < KECCAK512_RATE / 8; i++) {
+		a[i] ^= m[i];
+	}
+	keccak_f1600(a);
+
+	store64le(out, a);
+}
+
+
+/* cubehash512 */
+
+static const uint32_t cubehash512_iv[32] = {
+	0x2AEA2A61, 0x50F494D4, 0x2D538B8B, 0x4167D83E,
+	0x3FEE2313, 0xC701CF8C, 0xCC39968E, 0x50AC5695,
+	0x4D42C787, 0xA647A8B3, 0x97CF0BEF, 0x825B4537,
+	0xEEF864D2, 0xF22090C4, 0xD0E5CD33, 0xA23911AE,
+	0xFCD398D9, 0x148FE485, 0x1B017BEF, 0xB6444532,
+	0x6A536159, 0x2FF5781C, 0x91FA7934, 0x0DBADEA9,
+	0xD65C8A2B, 0xA5A70E75, 0xB1C62456, 0xBC796576,
+	0x1921C8F7, 0xE7989AF1, 0x7795D246, 0xD43E3B44
+};
+
+#define CUBE_SWAP(a, b)	do { t = a; a = b; b = t; } while (0)
+
+LANES_INLINE void cubehash_rounds(v32 *x, int rounds)
+{
+	v32 t;
+	int i, r;
+
+	for (r = 0; r < rounds; r++) {
+		for (i = 0; i < 16; i++) {
+			x[i + 16] += x[i];
+			x[i] = ROTL32(x[i], 7);
+		}
+		for (i = 0; i < 8; i++) {
+			CUBE_SWAP(x[i], x[i + 8]);
+		}
+		for (i = 0; i < 16; i++) {
+			x[i] ^= x[i + 16];
+		}
+		for (i = 16; i < 32; i += 4) {
+			CUBE_SWAP(x[i], x[i + 2]);
+			CUBE_SWAP(x[i + 1], x[i + 3]);
+		}
+		for (i = 0; i < 16; i++) {
+			x[i + 16] += x[i];
+			x[i] = ROTL32(x[i], 11);
+		}
+		for (i = 0; i < 16; i += 8) {
+			CUBE_SWAP(x[i], x[i + 4]);
+			CUBE_SWAP(x[i + 1], x[i + 5]);
+			CUBE_SWAP(x[i + 2], x[i + 6]);
+			CUBE_SWAP(x[i + 3], x[i + 7]);
+		}
+		for (i = 0; i < 16; i++) {
+			x[i] ^= x[i + 16];
+		}
+		for (i = 16; i < 32; i += 2) {
+			CUBE_SWAP(x[i], x[i + 1]);
+		}
+	}
+}
+
+LANES_INLINE void cubehash_block(v32 *x, const uint8_t *blk, size_t stride)
+{
+	uint32_t w;
+	int i, l;
+
+	for (i = 0; i < 8; i++) {
+		for (l = 0; l < LANES; l++) {
+			memcpy(&w, blk + l * stride + 4 * i, 4);
+			x[i][l] ^= le32toh(w);
+		}
+	}
+	cubehash_rounds(x, 16);
+}
+
+LANES_TARGETS void cubehash512_lanes(void *out, const void *in, size_t len)
+{
+	const uint8_t *src = in;
+	uint8_t blk[LANES][32], *dst = out;
+	size_t off, rem;
+	uint32_t w;
+	v32 x[32];
+	int i, l;
+
+	for (i = 0; i < 32; i++) {
+		x[i] = (v32){ 0 } + cubehash512_iv[i];
+	}
+
+	for (off = 0; len - off >= 32; off += 32) {
+		cubehash_block(x, src + off, len);
+	}
+
+	rem = len - off;
+	for (l = 0; l < LANES; l++) {
+		memset(blk[l], 0, sizeof(blk[l]));
+		memcpy(blk[l], src + l * len + off, rem);
+		blk[l][rem] = 0x80;
+	}
+	cubehash_block(x, blk[0], sizeof(blk[0]));
+
+	x[31] ^= 1;
+	cubehash_rounds(x, 160);
+
+	for (i = 0; i < 16; i++) {
+		for (l = 0; l < LANES; l++) {
+			w = htole32(x[i][l]);
+			memcpy(dst + 64 * l + 4 * i, &w, 4);
+		}
+	}
+}
+
+
+/* luffa512 */
+
+static const uint32_t luffa512_iv[5][8] = {
+	{ 0x6d251e69, 0x44b051e0, 0x4eaa6fb4, 0xdbf78465,
+	  0x6e292011, 0x90152df4, 0xee058139, 0xdef610bb },
+	{ 0xc3b44b95, 0xd9d2f256, 0x70eee9a0, 0xde099fa3,
+	  0x5d9b0557, 0x8fc944b3, 0xcf1ccf0e, 0x746cd581 },
+	{ 0xf7efc89d, 0x5dba5781, 0x04016ce5, 0xad659c05,
+	  0x0306194f, 0x666d1836, 0x24aa230a, 0x8b264ae7 },
+	{ 0x858075d5, 0x36d79cce, 0xe571f7d7, 0x204b1f67,
+	  0x35870c6a, 0x57e9e923, 0x14bcb808, 0x7cde72ce },
+	{ 0x6c68e9be, 0x5ec41e22, 0xc825b7c7, 0xaffb4363,
+	  0xf5df3999, 0x0fc688f1, 0xb07224cc, 0x03e86cea }
+};
+
+/* Round constants of sub-permutation j, added to words 0 and 4 */
+static const uint32_t luffa512_rc[5][2][8] = {
+	{ { 0x303994a6, 0xc0e65299, 0x6cc33a12, 0xdc56983e,
+	    0x1e00108f, 0x7800423d, 0x8f5b7882, 0x96e1db12 },
+	  { 0xe0337818, 0x441ba90d, 0x7f34d442, 0x9389217f,
+	    0xe5a8bce6, 0x5274baf4, 0x26889ba7, 0x9a226e9d } },
+	{ { 0xb6de10ed, 0x70f47aae, 0x0707a3d4, 0x1c1e8f51,
+	    0x707a3d45, 0xaeb28562, 0xbaca1589, 0x40a46f3e },
+	  { 0x01685f3d, 0x05a17cf4, 0xbd09caca, 0xf4272b28,
+	    0x144ae5cc, 0xfaa7ae2b, 0x2e48f1c1, 0xb923c704 } },
+	{ { 0xfc20d9d2, 0x34552e25, 0x7ad8818f, 0x8438764a,
+	    0xbb6de032, 0xedb780c8, 0xd9847356, 0xa2c78434 },
+	  { 0xe25e72c1, 0xe623bb72, 0x5c58a4a4, 0x1e38e2e7,
+	    0x78e38b9d, 0x27586719, 0x36eda57f, 0x703aace7 } },
+	{ { 0xb213afa5, 0xc84ebe95, 0x4e608a22, 0x56d858fe,
+	    0x343b138f, 0xd0ec4e3d, 0x2ceb4882, 0xb3ad2208 },
+	  { 0xe028c9bf, 0x44756f91, 0x7e8fce32, 0x956548be,
+	    0xfe191be2, 0x3cb226e5, 0x5944a28e, 0xa1c4c355 } },
+	{ { 0xf0d2e9e3, 0xac11d7fa, 0x1bcb66f2, 0x6f2d9bc9,
+	    0x78602649, 0x8edae952, 0x3b6ba548, 0xedae9520 },
+	  { 0x5090d577, 0x2d1925ab, 0xb46496ac, 0xd1925ab0,
+	    0x29131ab6, 0x0fc053c3, 0x3f014f0c, 0xfc053c31 } }
+};
+
+/* Multiplication by 2 in GF(2^32)^8, d may be s */
+LANES_INLINE void luffa_m2(v32 *d, const v32 *s)
+{
+	v32 t = s[7];
+
+	d[7] = s[6];
+	d[6] = s[5];
+	d[5] = s[4];
+	d[4] = s[3] ^ t;
+	d[3] = s[2] ^ t;
+	d[2] = s[1];
+	d[1] = s[0] ^ t;
+	d[0] = t;
+}
+
+LANES_INLINE void luffa_xor(v32 *d, const v32 *s)
+{
+	int i;
+
+	for (i = 0; i < 8; i++) {
+		d[i] ^= s[i];
+	}
+}
+
+LANES_INLINE void luffa_sub_crumb(v32 *a0, v32 *a1, v32 *a2, v32 *a3)
+{
+	v32 t = *a0;
+
+	*a0 |= *a1;
+	*a2 ^= *a3;
+	*a1 = ~*a1;
+	*a0 ^= *a3;
+	*a3 &= t;
+	*a1 ^= *a3;
+	*a3 ^= *a2;
+	*a2 &= *a0;
+	*a0 = ~*a0;
+	*a2 ^= *a1;
+	*a1 |= *a3;
+	t ^= *a1;
+	*a3 ^= *a2;
+	*a2 &= *a1;
+	*a1 ^= *a0;
+	*a0 = t;
+}
+
+LANES_INLINE void luffa_mix_word(v32 *u, v32 *v)
+{
+	*v ^= *u;
+	*u = ROTL32(*u, 2) ^ *v;
+	*v = ROTL32(*v, 14) ^ *u;
+	*u = ROTL32(*u, 10) ^ *v;
+	*v = ROTL32(*v, 1);
+}
+
+/* Message injection of the 32 byte block m, then the five sub-permutations */
+LANES_INLINE void luffa_block(v32 v[5][8], v32 *m)
+{
+	v32 a[8], b[8];
+	int i, j, r;
+
+	for (i = 0; i < 8; i++) {
+		a[i] = v[0][i] ^ v[1][i] ^ v[2][i] ^ v[3][i] ^ v[4][i];
+	}
+	luffa_m2(a, a);
+	for (j = 0; j < 5; j++) {
+		luffa_xor(v[j], a);
+	}
+
+	luffa_m2(b, v[0]);
+	luffa_xor(b, v[1]);
+	luffa_m2(v[1], v[1]);
+	luffa_xor(v[1], v[2]);
+	luffa_m2(v[2], v[2]);
+	luffa_xor(v[2], v[3]);
+	luffa_m2(v[3], v[3]);
+	luffa_xor(v[3], v[4]);
+	luffa_m2(v[4], v[4]);
+	luffa_xor(v[4], v[0]);
+	luffa_m2(v[0], b);
+	luffa_xor(v[0], v[4]);
+	luffa_m2(v[4], v[4]);
+	luffa_xor(v[4], v[3]);
+	luffa_m2(v[3], v[3]);
+	luffa_xor(v[3], v[2]);
+	luffa_m2(v[2], v[2]);
+	luffa_xor(v[2], v[1]);
+	luffa_m2(v[1], v[1]);
+	luffa_xor(v[1], b);
+
+	for (j = 0; j < 5; j++) {
+		luffa_xor(v[j], m);
+		if (j < 4) {
+			luffa_m2(m, m);
+		}
+	}
+
+	for (j = 1; j < 5; j++) {
+		for (i = 4; i < 8; i++) {
+			v[j][i] = ROTL32(v[j][i], j);
+		}
+	}
+
+	for (j = 0; j < 5; j++) {
+		for (r = 0; r < 8; r++) {
+			luffa_sub_crumb(&v[j][0], &v[j][1], &v[j][2], &v[j][3]);
+			luffa_sub_crumb(&v[j][5], &v[j][6], &v[j][7], &v[j][4]);
+			for (i = 0; i < 4; i++) {
+				luffa_mix_word(&v[j][i], &v[j][i + 4]);
+			}
+			v[j][0] ^= luffa512_rc[j][0][r];
+			v[j][4] ^= luffa512_rc[j][1][r];
+		}
+	}
+}
+
+LANES_INLINE void luffa_load(v32 *m, const uint8_t *blk, size_t stride)
+{
+	uint32_t w;
+	int i, l;
+
+	for (i = 0; i < 8; i++) {
+		for (l = 0; l < LANES; l++) {
+			memcpy(&w, blk + l * stride + 4 * i, 4);
+			m[i][l] = be32toh(w);
+		}
+	}
+}
+
+LANES_INLINE void luffa_store(uint8_t *out, v32 v[5][8])
+{
+	uint32_t w;
+	int i, l;
+
+	for (i = 0; i < 8; i++) {
+		for (l = 0; l < LANES; l++) {
+			w = htobe32(v[0][i][l] ^ v[1][i][l] ^ v[2][i][l] ^ v[3][i][l] ^ v[4][i][l]);
+			memcpy(out + 64 * l + 4 * i, &w, 4);
+		}
+	}
+}
+
+LANES_TARGETS void luffa512_lanes(void *out, const void *in, size_t len)
+{
+	const uint8_t *src = in;
+	uint8_t blk[LANES][32], *dst = out;
+	size_t off, rem;
+	v32 v[5][8], m[8];
+	int i, j, l;
+
+	for (j = 0; j < 5; j++) {
+		for (i = 0; i < 8; i++) {
+			v[j][i] = (v32){ 0 } + luffa512_iv[j][i];
+		}
+	}
+
+	for (off = 0; len - off >= 32; off += 32) {
+		luffa_load(m, src + off, len);
+		luffa_block(v, m);
+	}
+
+	rem = len - off;
+	for (l = 0; l < LANES; l++) {
+		memset(blk[l], 0, sizeof(blk[l]));
+		memcpy(blk[l], src + l * len + off, rem);
+		blk[l][rem] = 0x80;
+	}
+	luffa_load(m, blk[0], sizeof(blk[0]));
+	luffa_block(v, m);
+
+	/* two blank rounds, each gives half of the digest */
+	memset(m, 0, sizeof(m));
+	luffa_block(v, m);
+	luffa_store(dst, v);
+	memset(m, 0, sizeof(m));
+	luffa_block(v, m);
+	luffa_store(dst + 32, v);
+}
+
+
+/* sha256d */
+
+static const uint32_t sha256_iv[8] = {
+	0x6A09E667, 0xBB67AE85, 0x3C6EF372, 0xA54FF53A,
+	0x510E527F, 0x9B05688C, 0x1F83D9AB, 0x5BE0CD19
+};
+
+static const uint32_t sha256_k[64] = {
+	0x428A2F98, 0x71374491, 0xB5C0FBCF, 0xE9B5DBA5,
+	0x3956C25B, 0x59F111F1, 0x923F82A4, 0xAB1C5ED5,
+	0xD807AA98, 0x12835B01, 0x243185BE, 0x550C7DC3,
+	0x72BE5D74, 0x80DEB1FE, 0x9BDC06A7, 0xC19BF174,
+	0xE49B69C1, 0xEFBE4786, 0x0FC19DC6, 0x240CA1CC,
+	0x2DE92C6F, 0x4A7484AA, 0x5CB0A9DC, 0x76F988DA,
+	0x983E5152, 0xA831C66D, 0xB00327C8, 0xBF597FC7,
+	0xC6E00BF3, 0xD5A79147, 0x06CA6351, 0x14292967,
+	0x27B70A85, 0x2E1B2138, 0x4D2C6DFC, 0x53380D13,
+	0x650A7354, 0x766A0ABB, 0x81C2C92E, 0x92722C85,
+	0xA2BFE8A1, 0xA81A664B, 0xC24B8B70, 0xC76C51A3,
+	0xD192E819, 0xD6990624, 0xF40E3585, 0x106AA070,
+	0x19A4C116, 0x1E376C08, 0x2748774C, 0x34B0BCB5,
+	0x391C0CB3, 0x4ED8AA4A, 0x5B9CCA4F, 0x682E6FF3,
+	0x748F82EE, 0x78A5636F, 0x84C87814, 0x8CC70208,
+	0x90BEFFFA, 0xA4506CEB, 0xBEF9A3F7, 0xC67178F2
+};
+
+#define ROTR32(x, n)	ROTL32(x, 32 - (n))
+#define SHA_BSG0(x)	(ROTR32(x, 2) ^ ROTR32(x, 13) ^ ROTR32(x, 22))
+#define SHA_BSG1(x)	(ROTR32(x, 6) ^ ROTR32(x, 11) ^ ROTR32(x, 25))
+#define SHA_SSG0(x)	(ROTR32(x, 7) ^ ROTR32(x, 18) ^ ((x) >> 3))
+#define SHA_SSG1(x)	(ROTR32(x, 17) ^ ROTR32(x, 19) ^ ((x) >> 10))
+
+/* Round j + k, the message schedule is kept in w[] in place */
+#define SHA_ROUND(a, b, c, d, e, f, g, h, k)	do { \
+	if (j) \
+		w[k] += SHA_SSG1(w[((k) + 14) & 15]) + w[((k) + 9) & 15] \
+			+ SHA_SSG0(w[((k) + 1) & 15]); \
+	t1 = h + SHA_BSG1(e) + (((f ^ g) & e) ^ g) + sha256_k[j + (k)] + w[k]; \
+	t2 = SHA_BSG0(a) + ((a & b) | ((a | b) & c)); \
+	d += t1; \
+	h = t1 + t2; \
+} while (0)
+
+LANES_INLINE void sha256_compress(v32 *st, v32 *w)
+{
+	v32 a = st[0], b = st[1], c = st[2], d = st[3];
+	v32 e = st[4], f = st[5], g = st[6], h = st[7];
+	v32 t1, t2;
+	int j;
+
+	for (j = 0; j < 64; j += 16) {
+		SHA_ROUND(a, b, c, d, e, f, g, h, 0);
+		SHA_ROUND(h, a, b, c, d, e, f, g, 1);
+		SHA_ROUND(g, h, a, b, c, d, e, f, 2);
+		SHA_ROUND(f, g, h, a, b, c, d, e, 3);
+		SHA_ROUND(e, f, g, h, a, b, c, d, 4);
+		SHA_ROUND(d, e, f, g, h, a, b, c, 5);
+		SHA_ROUND(c, d, e, f, g, h, a, b, 6);
+		SHA_ROUND(b, c, d, e, f, g, h, a, 7);
+		SHA_ROUND(a, b, c, d, e, f, g, h, 8);
+		SHA_ROUND(h, a, b, c, d, e, f, g, 9);
+		SHA_ROUND(g, h, a, b, c, d, e, f, 10);
+		SHA_ROUND(f, g, h, a, b, c, d, e, 11);
+		SHA_ROUND(e, f, g, h, a, b, c, d, 12);
+		SHA_ROUND(d, e, f, g, h, a, b, c, 13);
+		SHA_ROUND(c, d, e, f, g, h, a, b, 14);
+		SHA_ROUND(b, c, d, e, f, g, h, a, 15);
+	}
+
+	st[0] += a;
+	st[1] += b;
+	st[2] += c;
+	st[3] += d;
+	st[4] += e;
+	st[5] += f;
+	st[6] += g;
+	st[7] += h;
+}
+
+LANES_INLINE void sha256_load(v32 *w, const uint8_t *blk, size_t stride)
+{
+	uint32_t t;
+	int i, l;
+
+	for (i = 0; i < 16; i++) {
+		for (l = 0; l < LANES; l++) {
+			memcpy(&t, blk + l * stride + 4 * i, 4);
+			w[i][l] = be32toh(t);
+		}
+	}
+}
+
+/* The second SHA-256, of the 32 byte first digests in st */
+LANES_INLINE void sha256_second(uint8_t *out, const v32 *st)
+{
+	v32 h[8], w[16];
+	uint32_t t;
+	int i, l;
+
+	for (i = 0; i < 8; i++) {
+		w[i] = st[i];
+		h[i] = (v32){ 0 } + sha256_iv[i];
+	}
+	w[8] = (v32){ 0 } + 0x80000000;
+	for (i = 9; i < 15; i++) {
+		w[i] = (v32){ 0 };
+	}
+	w[15] = (v32){ 0 } + 256;
+	sha256_compress(h, w);
+
+	for (i = 0; i < 8; i++) {
+		for (l = 0; l < LANES; l++) {
+			t = htobe32(h[i][l]);
+			memcpy(out + 32 * l + 4 * i, &t, 4);
+		}
+	}
+}
+
+LANES_TARGETS void sha256d_lanes(void *out, const sph_sha256_context *prefix, const void *in, size_t len)
+{
+	const uint8_t *src = in;
+	uint8_t blk[LANES][64];
+	size_t ptr = prefix->count & 63, total = ptr + len;
+	size_t blocks = (total + 9 + 63) / 64, pos, k, n, b;
+	v32 st[8], w[16];
+	int i, l;
+
+	for (i = 0; i < 8; i++) {
+		st[i] = (v32){ 0 } + prefix->val[i];
+	}
+
+	/* each block is the buffered prefix bytes, the message and padding */
+	for (b = 0; b < blocks; b++) {
+		for (l = 0; l < LANES; l++) {
+			memset(blk[l], 0, 64);
+			pos = 64 * b;
+			k = 0;
+			if (pos < ptr) {
+				n = ptr - pos;
+				memcpy(blk[l], prefix->buf + pos, n);
+				k += n;
+				pos += n;
+			}
+			if (pos < total) {
+				n = total - pos < 64 - k ? total - pos : 64 - k;
+				memcpy(blk[l] + k, src + l * len + pos - ptr, n);
+				k += n;
+				pos += n;
+			}
+			if (k < 64 && pos == total) {
+				blk[l][k] = 0x80;
+			}
+			if (b == blocks - 1) {
+				be64enc(&blk[l][56], (uint64_t)(prefix->count + len) << 3);
+			}
+		}
+		sha256_load(w, blk[0], sizeof(blk[0]));
+		sha256_compress(st, w);
+	}
+
+	sha256_second(out, st);
+}
+
+LANES_TARGETS void sha256d64_lanes(void *out, const void *in)
+{
+	v32 st[8], w[16];
+	int i;
+
+	for (i = 0; i < 8; i++) {
+		st[i] = (v32){ 0 } + sha256_iv[i];
+	}
+	sha256_load(w, in, 64);
+	sha256_compress(st, w);
+
+	w[0] = (v32){ 0 } + 0x80000000;
+	for (i = 1; i < 15; i++) {
+		w[i] = (v32){ 0 };
+	}
+	w[15] = (v32){ 0 } + 512;
+	sha256_compress(st, w);
+
+	sha256_second(out, st);
+}
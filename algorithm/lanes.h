@@ -0,0 +1,37 @@
+#ifndef LANES_H
+#define LANES_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "sph/sph_sha2.h"
+
+/* Number of messages the multi-lane hashes work on at once */
+#define LANES 4
+
+/*
+ * Multi-lane versions of the sph primitives shared by the chained X-family
+ * hashes. Each one hashes LANES messages of len bytes stored back to back
+ * in "in" and stores the LANES 64 byte digests back to back in "out", which
+ * may be "in". The digests are bit for bit those of the sph functions.
+ *
+ * blake512 and bmw512 take 1 to 111 bytes, skein512 1 to 64 bytes.
+ */
+void blake512_lanes(void *out, const void *in, size_t len);
+void bmw512_lanes(void *out, const void *in, size_t len);
+void skein512_lanes(void *out, const void *in, size_t len);
+void keccak512_lanes(void *out, const void *in, size_t len);
+void cubehash512_lanes(void *out, const void *in, size_t len);
+void luffa512_lanes(void *out, const void *in, size_t len);
+
+/*
+ * Double SHA-256 of LANES messages of len bytes that continue the message
+ * already run through prefix, LANES 32 byte digests to out. The same as
+ * gen_hash_prefixed() on each of them.
+ */
+void sha256d_lanes(void *out, const sph_sha256_context *prefix, const void *in, size_t len);
+
+/* gen_hash64() of LANES 64 byte messages, out may be in */
+void sha256d64_lanes(void *out, const void *in);
+
+#endif /* LANES_H */
@@ -66,10 +66,11 @@ typedef struct {
     sph_fugue512_context    fugue1;
 } Xhash_context_holder;
 
-static Xhash_context_holder base_contexts;
+static Xhash_context_holder base_contexts __cache_aligned;
+static pthread_once_t base_contexts_once = PTHREAD_ONCE_INIT;
 
 
-void init_Mhash_contexts()
+static void init_Mhash_contexts(void)
 {
     sph_blake512_init(&base_contexts.blake1);   
     sph_bmw512_init(&base_contexts.bmw1);   
@@ -91,12 +92,11 @@ static
 #endif
 void maruhash(void *state, const void *input)
 {
-    init_Mhash_contexts();
-    
     Xhash_context_holder ctx;
     
     uint32_t hashA[16], hashB[16];  
     //blake-bmw-groestl-sken-jh-meccak-luffa-cubehash-shivite-simd-echo
+    pthread_once(&base_contexts_once, init_Mhash_contexts);
     memcpy(&ctx, &base_contexts, sizeof(base_contexts));
     
     sph_blake512 (&ctx.blake1, input, 80);
@@ -37,6 +37,7 @@
 #include "sph/sph_skein.h"
 #include "sph/sph_jh.h"
 #include "sph/sph_keccak.h" 
+#include "algorithm/lanes.h"
 
 #ifdef __APPLE_CC__
 static
@@ -130,6 +131,61 @@ void quarkhash(void *state, const void *input)
     memcpy(state, hash, 32);
 }
 
+#define QUARK_BRANCH(h) (((const unsigned char *)(h))[0] & 0x8)
+
+/* quarkhash for LANES inputs. Both sides of a branch are hashed for every
+ * lane when both have a multi-lane version and each lane keeps its own. */
+static void quarkhash_lanes(uint32_t hash[LANES][16], uint32_t input[LANES][20])
+{
+    sph_groestl512_context   ctx_groestl;
+    sph_jh512_context        ctx_jh;
+    uint32_t hashA[LANES][16], hashB[LANES][16];
+    int l;
+
+    blake512_lanes(hash, input, 80);
+    bmw512_lanes(hash, hash, 64);
+
+    skein512_lanes(hashA, hash, 64);
+    for (l = 0; l < LANES; l++) {
+        if (QUARK_BRANCH(hash[l]))
+        {
+            sph_groestl512_init(&ctx_groestl);
+            sph_groestl512 (&ctx_groestl, hash[l], 64);
+            sph_groestl512_close(&ctx_groestl, hash[l]);
+        }
+        else
+            memcpy(hash[l], hashA[l], 64);
+
+        sph_groestl512_init(&ctx_groestl);
+        sph_groestl512 (&ctx_groestl, hash[l], 64);
+        sph_groestl512_close(&ctx_groestl, hash[l]);
+
+        sph_jh512_init(&ctx_jh);
+        sph_jh512 (&ctx_jh, hash[l], 64);
+        sph_jh512_close(&ctx_jh, hash[l]);
+    }
+
+    blake512_lanes(hashA, hash, 64);
+    bmw512_lanes(hashB, hash, 64);
+    for (l = 0; l < LANES; l++)
+        memcpy(hash[l], QUARK_BRANCH(hash[l]) ? hashA[l] : hashB[l], 64);
+
+    keccak512_lanes(hash, hash, 64);
+    skein512_lanes(hash, hash, 64);
+
+    keccak512_lanes(hashA, hash, 64);
+    for (l = 0; l < LANES; l++) {
+        if (QUARK_BRANCH(hash[l]))
+            memcpy(hash[l], hashA[l], 64);
+        else
+        {
+            sph_jh512_init(&ctx_jh);
+            sph_jh512 (&ctx_jh, hash[l], 64);
+            sph_jh512_close(&ctx_jh, hash[l]);
+        }
+    }
+}
+
 static const uint32_t diff1targ = 0x0000ffff;
 
 
@@ -166,6 +222,25 @@ void quarkcoin_regenhash(struct work *work)
         quarkhash(ohash, data);
 }
 
+/* quarkcoin_regenhash for count works, a short last group repeats its last work */
+void quarkcoin_regenhash_batch(struct work **works, int count)
+{
+        uint32_t data[LANES][20], hash[LANES][16];
+        struct work *work;
+        int i, l;
+
+        for (i = 0; i < count; i += LANES) {
+                for (l = 0; l < LANES; l++) {
+                        work = works[MIN(i + l, count - 1)];
+                        be32enc_vect(data[l], (const uint32_t *)work->data, 19);
+                        data[l][19] = htobe32(*(uint32_t *)(work->data + 76));
+                }
+                quarkhash_lanes(hash, data);
+                for (l = 0; (l < LANES) && (i + l < count); l++)
+                        memcpy(works[i + l]->hash, hash[l], 32);
+        }
+}
+
 bool scanhash_quarkcoin(struct thr_info *thr, const unsigned char __maybe_unused *pmidstate,
 		     unsigned char *pdata, unsigned char __maybe_unused *phash1,
 		     unsigned char __maybe_unused *phash, const unsigned char *ptarget,
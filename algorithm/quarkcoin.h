@@ -6,5 +6,6 @@
 extern int quarkcoin_test(unsigned char *pdata, const unsigned char *ptarget,
 			uint32_t nonce);
 extern void quarkcoin_regenhash(struct work *work);
+extern void quarkcoin_regenhash_batch(struct work **works, int count);
 
 #endif /* QUARKCOIN_H */
@@ -40,6 +40,7 @@
 #include "sph/sph_shavite.h"
 #include "sph/sph_simd.h"
 #include "sph/sph_echo.h"
+#include "algorithm/lanes.h"
 
 /* Move init out of loop, so init once externally, and then use one single memcpy with that bigger memory block */
 typedef struct {
@@ -50,10 +51,11 @@ typedef struct {
     sph_echo512_context     echo1;
 } Qhash_context_holder;
 
-Qhash_context_holder base_contexts;
+static Qhash_context_holder base_contexts __cache_aligned;
+static pthread_once_t base_contexts_once = PTHREAD_ONCE_INIT;
 
 
-void init_Qhash_contexts()
+static void init_Qhash_contexts(void)
 {
     sph_luffa512_init(&base_contexts.luffa1);
     sph_cubehash512_init(&base_contexts.cubehash1);
@@ -67,12 +69,11 @@ static
 #endif
 void qhash(void *state, const void *input)
 {
-    init_Qhash_contexts();
-    
     Qhash_context_holder ctx;
     
     uint32_t hashA[16], hashB[16];  
     //luffa-cubehash-shivite-simd-echo
+    pthread_once(&base_contexts_once, init_Qhash_contexts);
     memcpy(&ctx, &base_contexts, sizeof(base_contexts));
     
     sph_luffa512 (&ctx.luffa1, input, 80);
@@ -93,6 +94,33 @@ void qhash(void *state, const void *input)
     memcpy(state, hashA, 32);
 }
 
+/* qhash for LANES inputs, luffa and cubehash have multi-lane versions */
+static void qhash_lanes(uint32_t hashA[LANES][16], uint32_t input[LANES][20])
+{
+    Qhash_context_holder ctx;
+    uint32_t hashB[LANES][16];
+    int l;
+
+    pthread_once(&base_contexts_once, init_Qhash_contexts);
+
+    luffa512_lanes(hashA, input, 80);
+    cubehash512_lanes(hashB, hashA, 64);
+
+    for (l = 0; l < LANES; l++) {
+        memcpy(&ctx.shavite1, &base_contexts.shavite1, sizeof(ctx.shavite1));
+        sph_shavite512 (&ctx.shavite1, hashB[l], 64);
+        sph_shavite512_close(&ctx.shavite1, hashA[l]);
+
+        memcpy(&ctx.simd1, &base_contexts.simd1, sizeof(ctx.simd1));
+        sph_simd512 (&ctx.simd1, hashA[l], 64);
+        sph_simd512_close(&ctx.simd1, hashB[l]);
+
+        memcpy(&ctx.echo1, &base_contexts.echo1, sizeof(ctx.echo1));
+        sph_echo512 (&ctx.echo1, hashB[l], 64);
+        sph_echo512_close(&ctx.echo1, hashA[l]);
+    }
+}
+
 static const uint32_t diff1targ = 0x0000ffff;
 
 
@@ -129,6 +157,25 @@ void qubitcoin_regenhash(struct work *work)
         qhash(ohash, data);
 }
 
+/* qubitcoin_regenhash for count works, a short last group repeats its last work */
+void qubitcoin_regenhash_batch(struct work **works, int count)
+{
+        uint32_t data[LANES][20], hash[LANES][16];
+        struct work *work;
+        int i, l;
+
+        for (i = 0; i < count; i += LANES) {
+                for (l = 0; l < LANES; l++) {
+                        work = works[MIN(i + l, count - 1)];
+                        be32enc_vect(data[l], (const uint32_t *)work->data, 19);
+                        data[l][19] = htobe32(*(uint32_t *)(work->data + 76));
+                }
+                qhash_lanes(hash, data);
+                for (l = 0; (l < LANES) && (i + l < count); l++)
+                        memcpy(works[i + l]->hash, hash[l], 32);
+        }
+}
+
 bool scanhash_qubitcoin(struct thr_info *thr, const unsigned char __maybe_unused *pmidstate,
 		     unsigned char *pdata, unsigned char __maybe_unused *phash1,
 		     unsigned char __maybe_unused *phash, const unsigned char *ptarget,
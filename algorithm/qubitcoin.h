@@ -6,5 +6,6 @@
 extern int qubitcoin_test(unsigned char *pdata, const unsigned char *ptarget,
 			uint32_t nonce);
 extern void qubitcoin_regenhash(struct work *work);
+extern void qubitcoin_regenhash_batch(struct work **works, int count);
 
 #endif /* QUBITCOIN_H */
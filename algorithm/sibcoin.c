@@ -64,10 +64,11 @@ typedef struct {
     sph_echo512_context     echo1;
 } Xhash_context_holder;
 
-static Xhash_context_holder base_contexts;
+static Xhash_context_holder base_contexts __cache_aligned;
+static pthread_once_t base_contexts_once = PTHREAD_ONCE_INIT;
 
 
-static void init_Xhash_contexts()
+static void init_Xhash_contexts(void)
 {
     sph_blake512_init(&base_contexts.blake1);
     sph_bmw512_init(&base_contexts.bmw1);
@@ -86,12 +87,11 @@ static void init_Xhash_contexts()
 
 static inline void xhash(void *state, const void *input)
 {
-    init_Xhash_contexts();
-
     Xhash_context_holder ctx;
 
     uint32_t hashA[16], hashB[16];
     //blake-bmw-groestl-sken-jh-meccak-luffa-cubehash-shivite-simd-echo
+    pthread_once(&base_contexts_once, init_Xhash_contexts);
     memcpy(&ctx, &base_contexts, sizeof(base_contexts));
 
     sph_blake512 (&ctx.blake1, input, 80);
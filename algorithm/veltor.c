@@ -47,9 +47,10 @@ typedef struct {
     sph_gost512_context     gost1;
 } Xhash_context_holder;
 
-static Xhash_context_holder base_contexts;
+static Xhash_context_holder base_contexts __cache_aligned;
+static pthread_once_t base_contexts_once = PTHREAD_ONCE_INIT;
 
-static void init_Xhash_contexts()
+static void init_Xhash_contexts(void)
 {
     sph_skein512_init(&base_contexts.skein1);
     sph_shavite512_init(&base_contexts.shavite1);
@@ -65,12 +66,11 @@ static inline void be32enc_vect(uint32_t *dst, const uint32_t *src, uint32_t len
 
 static inline void xhash(void *state, const void *input)
 {
-    init_Xhash_contexts();
-
     Xhash_context_holder ctx;
 
     uint32_t hashA[16];
 
+    pthread_once(&base_contexts_once, init_Xhash_contexts);
     memcpy(&ctx, &base_contexts, sizeof(base_contexts));
 
     sph_skein512(&ctx.skein1, input, 80);
@@ -44,10 +44,11 @@ typedef struct {
   sph_whirlpool1_context whirlpool4;
 } Whash_context_holder;
 
-Whash_context_holder base_contexts;
+static Whash_context_holder base_contexts __cache_aligned;
+static pthread_once_t base_contexts_once = PTHREAD_ONCE_INIT;
 
 
-void init_whirlcoin_hash_contexts()
+static void init_whirlcoin_hash_contexts(void)
 {
   sph_whirlpool1_init(&base_contexts.whirlpool1);
   sph_whirlpool1_init(&base_contexts.whirlpool2);
@@ -60,11 +61,10 @@ static
 #endif
 void whirlcoin_hash(void *state, const void *input)
 {
-  init_whirlcoin_hash_contexts();
-
   Whash_context_holder ctx;
   uint32_t hashA[16], hashB[16];
 
+  pthread_once(&base_contexts_once, init_whirlcoin_hash_contexts);
   memcpy(&ctx, &base_contexts, sizeof(base_contexts));
 
   sph_whirlpool1(&ctx.whirlpool1, input, 80);
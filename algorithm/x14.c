@@ -68,9 +68,10 @@ typedef struct {
   sph_shabal512_context   shabal1;
 } Xhash_context_holder;
 
-static Xhash_context_holder base_contexts;
+static Xhash_context_holder base_contexts __cache_aligned;
+static pthread_once_t base_contexts_once = PTHREAD_ONCE_INIT;
 
-void init_X14hash_contexts()
+static void init_X14hash_contexts(void)
 {
   sph_blake512_init(&base_contexts.blake1);
   sph_bmw512_init(&base_contexts.bmw1);
@@ -93,12 +94,11 @@ static
 #endif
 void x14hash(void *state, const void *input)
 {
-  init_X14hash_contexts();
-
   Xhash_context_holder ctx;
 
   uint32_t hashA[16], hashB[16];
 
+  pthread_once(&base_contexts_once, init_X14hash_contexts);
   memcpy(&ctx, &base_contexts, sizeof(base_contexts));
 
   sph_blake512 (&ctx.blake1, input, 80);
@@ -25,6 +25,13 @@
 #include <limits.h>
 #include <sys/types.h>
 
+#ifdef HAVE_SYS_EPOLL_H
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#endif
+
 #include "compat.h"
 #include "api.h"
 #include "miner.h"
@@ -34,6 +41,7 @@
 #include "algorithm.h"
 
 #include "config_parser.h"
+#include "executor.h"
 
 #ifdef WIN32
 static char WSAbuf[1024];
@@ -293,6 +301,7 @@ static const char *OSINFO =
 
 static const char *JSON_COMMAND = "command";
 static const char *JSON_PARAMETER = "parameter";
+static const char *JSON_KEEPALIVE = "keepalive";
 static const char ISJSON = '{';
 static const char *localaddr = "127.0.0.1";
 
@@ -305,7 +314,8 @@ static pthread_mutex_t quit_restart_lock;
 static bool do_a_quit;
 static bool do_a_restart;
 
-static time_t when = 0; // when the request occurred
+// Write mode commands are run one at a time
+static pthread_mutex_t api_write_lock;
 
 static struct IP4ACCESS *ipaccess = NULL;
 static int ips = 0;
@@ -918,7 +928,7 @@ foundit:
 #endif
 // All replies (except BYE and RESTART) start with a message
 //  thus for JSON, message() inserts JSON_START at the front
-//  and send_result() adds JSON_END at the end
+//  and finish_result() adds JSON_END at the end
 void message(struct io_data *io_data, int messageid, int paramid, char *param2, bool isjson)
 {
     struct api_data *root = NULL;
@@ -1013,7 +1023,7 @@ void message(struct io_data *io_data, int messageid, int paramid, char *param2,
             }
 
             root = api_add_string(root, _STATUS, severity, false);
-            root = api_add_time(root, "When", &when, false);
+            root = api_add_time(root, "When", &(io_data->when), false);
             root = api_add_int(root, "Code", &messageid, false);
             root = api_add_escape(root, "Msg", buf, false);
             root = api_add_escape(root, "Description", opt_api_description, false);
@@ -1027,7 +1037,7 @@ void message(struct io_data *io_data, int messageid, int paramid, char *param2,
     }
 
     root = api_add_string(root, _STATUS, "F", false);
-    root = api_add_time(root, "When", &when, false);
+    root = api_add_time(root, "When", &(io_data->when), false);
     int id = -1;
     root = api_add_int(root, "Code", &id, false);
     sprintf(buf, "%d", messageid);
@@ -1181,6 +1191,17 @@ static void markgotdid(LOCKINFO *info, uint64_t id, const char *file, const char
                    got ? "got" : "did/didnt", got ? "get" : "try", id);
     }
 
+    if (got) {
+        struct timeval now;
+        double waited;
+
+        cgtime(&now);
+        waited = tdiff(&now, &(line->stat->tv));
+        info->waited += waited;
+        if (waited > info->max_waited)
+            info->max_waited = waited;
+    }
+
     // Unlink it
     if (line->prev)
         line->prev->next = line->next;
@@ -1278,6 +1299,18 @@ void api_gunlock(void *lock, const char *file, const char *func, const int linen
     info = findlock(lock, CGLOCK_UNKNOWN, file, func, linenum);
     info->unlocks++;
 
+    /* Only exact for a mutex, with read locks it is since the last reader */
+    if (info->gots > 0 || info->dids > 0) {
+        struct timeval now;
+        double held;
+
+        cgtime(&now);
+        held = tdiff(&now, &(info->lastgot.tv));
+        info->held += held;
+        if (held > info->max_held)
+            info->max_held = held;
+    }
+
     lockunlock();
 }
 
@@ -1330,6 +1363,11 @@ void dsp_lock(LOCKINFO *info)
                 info->dids,
                 info->didnts,
                 info->unlocks);
+    LOCKMSGMORE("waited:%.6fs max:%.6fs held:%.6fs max:%.6fs",
+                info->waited,
+                info->max_waited,
+                info->held,
+                info->max_held);
 
     if (info->gots > 0 || info->dids > 0) {
         if (info->unlocks < info->gots + info->dids)
@@ -1869,6 +1907,9 @@ static void summary(struct io_data *io_data, __maybe_unused SOCKETTYPE c, __mayb
     char buf[TMPBUFSIZ];
     bool io_open;
     double utility, mhs, work_utility;
+    struct verify_stats vstats;
+    struct exec_stats estats;
+    double vwait, vhash, ewait, erun;
 
     message(io_data, MSG_SUMM, 0, NULL, isjson);
     io_open = io_add(io_data, isjson ? COMSTR JSON_SUMMARY : _SUMMARY COMSTR);
@@ -1925,6 +1966,35 @@ static void summary(struct io_data *io_data, __maybe_unused SOCKETTYPE c, __mayb
 
     mutex_unlock(&hash_lock);
 
+    get_verify_stats(&vstats);
+    vwait = vstats.verified ? vstats.wait_total / vstats.verified : 0;
+    vhash = vstats.verified ? vstats.hash_total / vstats.verified : 0;
+    root = api_add_int(root, "Verify Threads", &opt_verify_threads, false);
+    root = api_add_int(root, "Verify Queue", &(vstats.queued), true);
+    root = api_add_int(root, "Verify Queue Max", &(vstats.queued_max), true);
+    root = api_add_uint64(root, "Verify Queue Full", &(vstats.full), true);
+    root = api_add_uint64(root, "Verified", &(vstats.verified), true);
+    root = api_add_uint64(root, "Verify Invalid", &(vstats.invalid), true);
+    root = api_add_uint64(root, "Verify Batched", &(vstats.batched), true);
+    root = api_add_double(root, "Verify Wait Avg", &vwait, true);
+    root = api_add_double(root, "Verify Wait Max", &(vstats.wait_max), true);
+    root = api_add_double(root, "Verify Time Avg", &vhash, true);
+    root = api_add_double(root, "Verify Time Max", &(vstats.hash_max), true);
+
+    get_exec_stats(&estats);
+    ewait = estats.run ? estats.wait_total / estats.run : 0;
+    erun = estats.run ? estats.run_total / estats.run : 0;
+    root = api_add_int(root, "Exec Threads", &(estats.workers), true);
+    root = api_add_int(root, "Exec Busy", &(estats.busy), true);
+    root = api_add_int(root, "Exec Queue", &(estats.queued), true);
+    root = api_add_int(root, "Exec Queue Max", &(estats.queued_max), true);
+    root = api_add_uint64(root, "Exec Tasks", &(estats.run), true);
+    root = api_add_uint64(root, "Exec Blocked", &(estats.blocked), true);
+    root = api_add_double(root, "Exec Wait Avg", &ewait, true);
+    root = api_add_double(root, "Exec Wait Max", &(estats.wait_max), true);
+    root = api_add_double(root, "Exec Time Avg", &erun, true);
+    root = api_add_double(root, "Exec Time Max", &(estats.run_max), true);
+
     root = print_data(root, buf, isjson, false);
     io_add(io_data, buf);
     if (isjson && io_open)
@@ -2877,6 +2947,7 @@ static int itemstats(struct io_data *io_data, int i, char *id, struct sgminer_st
 {
     struct api_data *root = NULL;
     char buf[TMPBUFSIZ];
+    double share_bytes, share_calls;
 
     root = api_add_int(root, "STATS", &i, false);
     root = api_add_string(root, "ID", id, false);
@@ -2908,6 +2979,12 @@ static int itemstats(struct io_data *io_data, int i, char *id, struct sgminer_st
         root = api_add_uint64(root, "Bytes Recv", &(pool_stats->bytes_received), false);
         root = api_add_uint64(root, "Net Bytes Sent", &(pool_stats->net_bytes_sent), false);
         root = api_add_uint64(root, "Net Bytes Recv", &(pool_stats->net_bytes_received), false);
+        root = api_add_uint64(root, "Send Calls", &(pool_stats->send_calls), false);
+        root = api_add_uint64(root, "Shares Sent", &(pool_stats->shares_sent), false);
+        share_bytes = pool_stats->shares_sent ? (double)(pool_stats->share_bytes_sent) / pool_stats->shares_sent : 0;
+        share_calls = pool_stats->shares_sent ? (double)(pool_stats->share_send_calls) / pool_stats->shares_sent : 0;
+        root = api_add_double(root, "Bytes Per Share", &share_bytes, true);
+        root = api_add_double(root, "Send Calls Per Share", &share_calls, true);
     }
 
     if (extra)
@@ -3006,7 +3083,7 @@ static void minerstats(struct io_data *io_data, __maybe_unused SOCKETTYPE c, __m
         if (cgpu->usbinfo.nodev) {
             if (howoldsec <= 0)
                 continue;
-            if ((when - cgpu->usbinfo.last_nodev.tv_sec) >= howoldsec)
+            if ((io_data->when - cgpu->usbinfo.last_nodev.tv_sec) >= howoldsec)
                 continue;
         }
         if (cgpu->drv) {
@@ -3710,20 +3787,24 @@ static void tail_join(struct io_data *io_data, bool isjson)
     }
 }
 
-static void send_result(struct io_data *io_data, SOCKETTYPE c, bool isjson)
+/* Terminates the reply, io_add() always leaves room for this */
+static void finish_result(struct io_data *io_data, bool isjson)
 {
-    int count, sendc, res, tosend, len, n;
-    char *buf = io_data->ptr;
-
-    strcpy(buf, io_data->ptr);
-
     if (io_data->close)
-        strcat(buf, JSON_CLOSE);
+        strcat(io_data->ptr, JSON_CLOSE);
 
     if (isjson)
-        strcat(buf, JSON_END);
+        strcat(io_data->ptr, JSON_END);
 
-    len = strlen(buf);
+    io_data->cur = io_data->ptr + strlen(io_data->ptr);
+}
+
+static void send_result(struct io_data *io_data, SOCKETTYPE c)
+{
+    int count, sendc, res, tosend, len, n;
+    char *buf = io_data->ptr;
+
+    len = io_data->cur - io_data->ptr;
     tosend = len + 1;
 
     applog(LOG_DEBUG, "API: send reply: (%d) '%.10s%s'", tosend, buf, len > 10 ? "..." : BLANK);
@@ -4264,12 +4345,756 @@ void mcast_init()
         quit(1, "API mcast thread create failed");
 }
 
+/* Parses one request received at when and runs its command, or commands when
+ * joined, leaving the finished reply in io_data. Write mode commands are run
+ * one at a time since with --api-epoll requests are handled by several
+ * threads. keepalive, if not NULL, is set when a JSON request asks for the
+ * connection to stay open. */
+static void api_request(struct io_data *io_data, char *buf, int n, char group, const char *connectaddr,
+                        time_t when, bool *keepalive)
+{
+    char param_buf[TMPBUFSIZ];
+    char cmdbuf[100];
+    char *cmd = NULL, *cmdptr, *cmdsbuf = NULL;
+    char *param;
+    json_error_t json_err;
+    json_t *json_config = NULL;
+    json_t *json_val;
+    bool isjson;
+    bool did, isjoin = false, firstjoin;
+    int i;
+
+    io_reinit(io_data);
+    io_data->when = when;
+    if (keepalive)
+        *keepalive = false;
+
+    did = false;
+
+    if (*buf != ISJSON) {
+        isjson = false;
+
+        param = strchr(buf, SEPARATOR);
+        if (param != NULL)
+            *(param++) = '\0';
+
+        cmd = buf;
+    }
+    else {
+        isjson = true;
+
+        param = NULL;
+
+#if JANSSON_MAJOR_VERSION > 2 || (JANSSON_MAJOR_VERSION == 2 && JANSSON_MINOR_VERSION > 0)
+        json_config = json_loadb(buf, n, 0, &json_err);
+#elif JANSSON_MAJOR_VERSION > 1
+        json_config = json_loads(buf, 0, &json_err);
+#else
+        json_config = json_loads(buf, &json_err);
+#endif
+
+        if (!json_is_object(json_config)) {
+            message(io_data, MSG_INVJSON, 0, NULL, isjson);
+            finish_result(io_data, isjson);
+            did = true;
+        }
+        else {
+            if (keepalive)
+                *keepalive = json_is_true(json_object_get(json_config, JSON_KEEPALIVE));
+
+            json_val = json_object_get(json_config, JSON_COMMAND);
+            if (json_val == NULL) {
+                message(io_data, MSG_MISCMD, 0, NULL, isjson);
+                finish_result(io_data, isjson);
+                did = true;
+            }
+            else {
+                if (!json_is_string(json_val)) {
+                    message(io_data, MSG_INVCMD, 0, NULL, isjson);
+                    finish_result(io_data, isjson);
+                    did = true;
+                }
+                else {
+                    cmd = (char *)json_string_value(json_val);
+                    json_val = json_object_get(json_config, JSON_PARAMETER);
+                    if (json_is_string(json_val))
+                        param = (char *)json_string_value(json_val);
+                    else if (json_is_integer(json_val)) {
+                        sprintf(param_buf, "%d", (int)json_integer_value(json_val));
+                        param = param_buf;
+                    }
+                    else if (json_is_real(json_val)) {
+                        sprintf(param_buf, "%f", (double)json_real_value(json_val));
+                        param = param_buf;
+                    }
+                }
+            }
+        }
+    }
+
+    if (!did) {
+        if (strchr(cmd, CMDJOIN)) {
+            firstjoin = isjoin = true;
+            // cmd + leading '|' + '\0'
+            cmdsbuf = (char *)malloc(strlen(cmd) + 2);
+            if (!cmdsbuf)
+                quithere(1, "OOM cmdsbuf");
+            strcpy(cmdsbuf, "|");
+            param = NULL;
+        }
+        else
+            firstjoin = isjoin = false;
+
+        cmdptr = cmd;
+        do {
+            did = false;
+            if (isjoin) {
+                cmd = strchr(cmdptr, CMDJOIN);
+                if (cmd)
+                    *(cmd++) = '\0';
+                if (!*cmdptr)
+                    goto inochi;
+            }
+
+            for (i = 0; cmds[i].name != NULL; i++) {
+                if (strcmp(cmdptr, cmds[i].name) == 0) {
+                    sprintf(cmdbuf, "|%s|", cmdptr);
+                    if (isjoin) {
+                        if (strstr(cmdsbuf, cmdbuf)) {
+                            did = true;
+                            break;
+                        }
+                        strcat(cmdsbuf, cmdptr);
+                        strcat(cmdsbuf, "|");
+                        head_join(io_data, cmdptr, isjson, &firstjoin);
+                        if (!cmds[i].joinable) {
+                            message(io_data, MSG_ACCDENY, 0, cmds[i].name, isjson);
+                            did = true;
+                            tail_join(io_data, isjson);
+                            break;
+                        }
+                    }
+                    if (ISPRIVGROUP(group) || strstr(COMMANDS(group), cmdbuf)) {
+                        if (cmds[i].iswritemode)
+                            mutex_lock(&api_write_lock);
+                        (cmds[i].func)(io_data, INVSOCK, param, isjson, group);
+                        if (cmds[i].iswritemode)
+                            mutex_unlock(&api_write_lock);
+                    }
+                    else {
+                        message(io_data, MSG_ACCDENY, 0, cmds[i].name, isjson);
+                        applog(LOG_DEBUG, "API: access denied to '%s' for '%s' command", connectaddr, cmds[i].name);
+                    }
+
+                    did = true;
+                    if (!isjoin)
+                        finish_result(io_data, isjson);
+                    else
+                        tail_join(io_data, isjson);
+                    break;
+                }
+            }
+
+            if (!did) {
+                if (isjoin)
+                    head_join(io_data, cmdptr, isjson, &firstjoin);
+                message(io_data, MSG_INVCMD, 0, NULL, isjson);
+                if (isjoin)
+                    tail_join(io_data, isjson);
+                else
+                    finish_result(io_data, isjson);
+            }
+        inochi:
+            if (isjoin)
+                cmdptr = cmd;
+        }
+        while (isjoin && cmdptr);
+    }
+
+    if (isjoin)
+        finish_result(io_data, isjson);
+
+    if (isjson && json_is_object(json_config))
+        json_decref(json_config);
+    free(cmdsbuf);
+}
+
+#ifdef HAVE_SYS_EPOLL_H
+/*
+ * --api-epoll: one thread waits on the listening socket and every client,
+ * the commands themselves run on a few API worker threads of their own so
+ * they neither wait behind nor hold up the mining tasks of the executor.
+ *
+ * A JSON request is complete once its top level object is closed, however
+ * many reads or lines it took. A plain request is the first read as the
+ * original API expects it. Either is answered and the connection closed,
+ * unless the JSON request had "keepalive":true. The client may then send
+ * more requests, JSON objects or plain ones ended by a '\n', and gets the
+ * replies back one at a time in order, every reply ended by a '\0' as usual.
+ */
+#define API_CONN_MAX        256
+#define API_CONN_IDLE_MS    10000   // close a client that hasn't sent a request
+#define API_EPOLL_WAIT_MS   100
+#define API_EPOLL_EVENTS    64
+#define API_WORKERS         2
+
+#define API_EPOLL_LISTEN    ((uint64_t)API_CONN_MAX)
+#define API_EPOLL_EVFD      ((uint64_t)API_CONN_MAX + 1)
+
+struct api_conn {
+    int id;
+    SOCKETTYPE sock;
+    char group;
+    char addr[INET_ADDRSTRLEN];
+    uint32_t events;
+    char in[TMPBUFSIZ];
+    int inlen;
+    char req[TMPBUFSIZ];
+    int reqlen;
+    time_t when;
+    struct io_data *io_data;
+    char *out;
+    size_t outsiz;
+    size_t outlen;
+    size_t outsent;
+    bool busy;
+    bool eof;
+    bool keepalive;         // set by the worker for the request it ran
+    bool piped;             // a request asked for the connection to stay open
+    bool closed;
+    int requests;
+    struct timeval tv_last;
+    struct api_conn *next;  // on the todo or the done list while busy
+};
+
+static struct api_conn *api_conns[API_CONN_MAX];
+static int api_epfd = -1;
+static int api_evfd = -1;
+
+static pthread_mutex_t api_done_lock;
+static struct api_conn *api_done;
+
+static pthread_mutex_t api_todo_lock;
+static pthread_cond_t api_todo_cond;
+static struct api_conn *api_todo, **api_todo_tail = &api_todo;
+static pthread_t api_workers[API_WORKERS];
+static bool api_workers_quit;
+
+static void api_conn_task(struct api_conn *conn)
+{
+    uint64_t one = 1;
+
+    api_request(conn->io_data, conn->req, conn->reqlen, conn->group, conn->addr, conn->when, &conn->keepalive);
+
+    mutex_lock(&api_done_lock);
+    conn->next = api_done;
+    api_done = conn;
+    mutex_unlock(&api_done_lock);
+
+    if (write(api_evfd, &one, sizeof(one)) != sizeof(one))
+        applog(LOG_DEBUG, "API: eventfd write failed: %s", strerror(errno));
+}
+
+static void *api_worker(__maybe_unused void *userdata)
+{
+    struct api_conn *conn;
+
+    RenameThread("APIWorker");
+
+    mutex_lock(&api_todo_lock);
+    while (42) {
+        while (!api_todo && !api_workers_quit)
+            pthread_cond_wait(&api_todo_cond, &api_todo_lock);
+        if (!api_todo)
+            break;
+
+        conn = api_todo;
+        api_todo = conn->next;
+        if (!api_todo)
+            api_todo_tail = &api_todo;
+        mutex_unlock(&api_todo_lock);
+
+        api_conn_task(conn);
+
+        mutex_lock(&api_todo_lock);
+    }
+    mutex_unlock(&api_todo_lock);
+
+    return (NULL);
+}
+
+// Never waits, a connection has one request at most on the list
+static void api_conn_queue(struct api_conn *conn)
+{
+    mutex_lock(&api_todo_lock);
+    conn->next = NULL;
+    *api_todo_tail = conn;
+    api_todo_tail = &conn->next;
+    pthread_cond_signal(&api_todo_cond);
+    mutex_unlock(&api_todo_lock);
+}
+
+static void api_conn_events(struct api_conn *conn)
+{
+    struct epoll_event ev;
+    uint32_t events = 0;
+
+    if (!conn->eof && (conn->piped || !conn->requests) && conn->inlen < TMPBUFSIZ - 1)
+        events |= EPOLLIN;
+    if (conn->outsent < conn->outlen)
+        events |= EPOLLOUT;
+
+    if (events == conn->events)
+        return;
+
+    memset(&ev, 0, sizeof(ev));
+    ev.events = events;
+    ev.data.u64 = conn->id;
+    if (epoll_ctl(api_epfd, EPOLL_CTL_MOD, conn->sock, &ev))
+        applog(LOG_DEBUG, "API: epoll_ctl failed for %s: %s", conn->addr, strerror(errno));
+    conn->events = events;
+}
+
+static void api_conn_close(struct api_conn *conn)
+{
+    epoll_ctl(api_epfd, EPOLL_CTL_DEL, conn->sock, NULL);
+    CLOSESOCKET(conn->sock);
+    conn->sock = INVSOCK;
+    conn->closed = true;
+
+    applog(LOG_DEBUG, "API: closed %s after %d request%s",
+           conn->addr, conn->requests, conn->requests == 1 ? "" : "s");
+}
+
+static void api_conn_flush(struct api_conn *conn)
+{
+    ssize_t n;
+
+    while (conn->outsent < conn->outlen) {
+        n = send(conn->sock, conn->out + conn->outsent, conn->outlen - conn->outsent, MSG_NOSIGNAL);
+        if (n < 0) {
+            if (errno == EINTR)
+                continue;
+            if (errno == EAGAIN || errno == EWOULDBLOCK)
+                break;
+            applog(LOG_DEBUG, "API: send to %s failed: %s", conn->addr, strerror(errno));
+            api_conn_close(conn);
+            return;
+        }
+        conn->outsent += n;
+        cgtime(&conn->tv_last);
+    }
+
+    if (conn->outsent == conn->outlen)
+        conn->outsent = conn->outlen = 0;
+}
+
+/* Length of the request at the start of conn->in, -1 while it is incomplete.
+ * *used is set to the bytes it takes up, with its '\n' if it has one. */
+static int api_conn_frame(struct api_conn *conn, int *used)
+{
+    bool more = !conn->eof && conn->inlen < TMPBUFSIZ - 1;
+    bool quoted = false, escaped = false;
+    int depth = 0, i, len;
+    char *nl;
+
+    if (conn->in[0] == ISJSON) {
+        for (i = 0; i < conn->inlen; i++) {
+            if (quoted) {
+                if (escaped)
+                    escaped = false;
+                else if (conn->in[i] == '\\')
+                    escaped = true;
+                else if (conn->in[i] == '"')
+                    quoted = false;
+            }
+            else if (conn->in[i] == '"')
+                quoted = true;
+            else if (conn->in[i] == '{')
+                depth++;
+            else if (conn->in[i] == '}' && --depth == 0) {
+                *used = i + 1;
+                return (i + 1);
+            }
+        }
+    }
+    else if (conn->piped) {
+        nl = (char *)memchr(conn->in, '\n', conn->inlen);
+        if (nl) {
+            *used = nl - conn->in + 1;
+            len = nl - conn->in;
+            if (len && conn->in[len - 1] == '\r')
+                len--;
+            return (len);
+        }
+    }
+    else
+        more = false;
+
+    // the rest is all there is going to be, api_request() answers it
+    if (more)
+        return (-1);
+    *used = conn->inlen;
+    return (conn->inlen);
+}
+
+// Hands the next complete request, if any, to the API workers
+static void api_conn_next(struct api_conn *conn)
+{
+    int len, used, skip;
+
+    if (conn->closed)
+        return;
+
+    while (!conn->busy && !conn->outlen && (conn->piped || !conn->requests) && conn->inlen) {
+        // blank lines and spaces before or between requests
+        for (skip = 0; skip < conn->inlen && isspace((unsigned char)conn->in[skip]); skip++)
+            ;
+        if (skip) {
+            conn->inlen -= skip;
+            memmove(conn->in, conn->in + skip, conn->inlen);
+            continue;
+        }
+
+        len = api_conn_frame(conn, &used);
+        if (len < 0)
+            break;
+
+        memcpy(conn->req, conn->in, len);
+        conn->inlen -= used;
+        memmove(conn->in, conn->in + used, conn->inlen);
+
+        conn->req[len] = '\0';
+        conn->reqlen = len;
+        conn->when = time(NULL);
+        conn->requests++;
+        conn->busy = true;
+
+        applog(LOG_DEBUG, "API: recv command: (%d) '%s'", len, conn->req);
+
+        api_conn_queue(conn);
+    }
+
+    if (!conn->busy && !conn->outlen &&
+        ((!conn->piped && conn->requests) || (conn->eof && !conn->inlen)))
+        api_conn_close(conn);
+    else
+        api_conn_events(conn);
+}
+
+static void api_conn_read(struct api_conn *conn)
+{
+    ssize_t n;
+
+    if (conn->eof || conn->inlen >= TMPBUFSIZ - 1)
+        return;
+
+    n = recv(conn->sock, conn->in + conn->inlen, TMPBUFSIZ - 1 - conn->inlen, 0);
+    if (n < 0) {
+        if (errno == EINTR || errno == EAGAIN || errno == EWOULDBLOCK)
+            return;
+        applog(LOG_DEBUG, "API: recv from %s failed: %s", conn->addr, strerror(errno));
+        api_conn_close(conn);
+        return;
+    }
+
+    if (n == 0)
+        conn->eof = true;
+    else {
+        conn->inlen += n;
+        cgtime(&conn->tv_last);
+    }
+
+    api_conn_next(conn);
+}
+
+// A finished command, move the reply to the output buffer and go on
+static void api_conn_done(struct api_conn *conn)
+{
+    struct io_data *io_data = conn->io_data;
+    size_t len = io_data->cur - io_data->ptr + 1;
+
+    conn->busy = false;
+    if (conn->keepalive)
+        conn->piped = true;
+    cgtime(&conn->tv_last);
+
+    if (conn->closed)
+        return;
+
+    if (conn->outlen + len > conn->outsiz) {
+        conn->outsiz = conn->outlen + len;
+        conn->out = (char *)realloc(conn->out, conn->outsiz);
+        if (unlikely(!conn->out))
+            quithere(1, "OOM API out");
+    }
+    memcpy(conn->out + conn->outlen, io_data->ptr, len);
+    conn->outlen += len;
+
+    api_conn_flush(conn);
+    api_conn_next(conn);
+}
+
+static void api_conn_accept(SOCKETTYPE apisock)
+{
+    struct api_conn *conn = NULL;
+    struct epoll_event ev;
+    struct sockaddr_in cli;
+    socklen_t clisiz;
+    char *connectaddr;
+    SOCKETTYPE c;
+    bool addrok;
+    char group;
+    int i;
+
+    while (42) {
+        clisiz = sizeof(cli);
+        c = accept4(apisock, (struct sockaddr *)(&cli), &clisiz, SOCK_NONBLOCK | SOCK_CLOEXEC);
+        if (SOCKETFAIL(c)) {
+            if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)
+                applog(LOG_ERR, "API accept failed (%s)", SOCKERRMSG);
+            return;
+        }
+
+        addrok = check_connect(&cli, &connectaddr, &group);
+        applog(LOG_DEBUG, "API: connection from %s - %s",
+               connectaddr, addrok ? "Accepted" : "Ignored");
+
+        if (!addrok) {
+            CLOSESOCKET(c);
+            continue;
+        }
+
+        for (i = 0; i < API_CONN_MAX; i++) {
+            conn = api_conns[i];
+            if (!conn || (conn->closed && !conn->busy))
+                break;
+        }
+        if (i == API_CONN_MAX) {
+            applog(LOG_WARNING, "API: too many connections, dropped %s", connectaddr);
+            CLOSESOCKET(c);
+            continue;
+        }
+
+        if (!conn) {
+            conn = (struct api_conn *)calloc(1, sizeof(*conn));
+            if (unlikely(!conn))
+                quithere(1, "OOM API conn");
+            conn->id = i;
+            conn->io_data = sock_io_new();
+            api_conns[i] = conn;
+        }
+
+        conn->sock = c;
+        conn->group = group;
+        snprintf(conn->addr, sizeof(conn->addr), "%s", connectaddr);
+        conn->inlen = conn->outlen = conn->outsent = 0;
+        conn->busy = conn->eof = conn->keepalive = conn->piped = conn->closed = false;
+        conn->requests = 0;
+        conn->events = EPOLLIN;
+        cgtime(&conn->tv_last);
+
+        memset(&ev, 0, sizeof(ev));
+        ev.events = conn->events;
+        ev.data.u64 = conn->id;
+        if (epoll_ctl(api_epfd, EPOLL_CTL_ADD, c, &ev)) {
+            applog(LOG_ERR, "API: epoll_ctl failed for %s: %s", connectaddr, strerror(errno));
+            CLOSESOCKET(c);
+            conn->closed = true;
+        }
+    }
+}
+
+// Closes clients that have gone quiet, returns how many are still waiting on a command
+static int api_conn_timeouts(void)
+{
+    struct api_conn *conn;
+    struct timeval now;
+    int i, busy = 0;
+
+    cgtime(&now);
+    for (i = 0; i < API_CONN_MAX; i++) {
+        conn = api_conns[i];
+        if (!conn)
+            continue;
+        if (conn->busy) {
+            busy++;
+            continue;
+        }
+        if (conn->closed)
+            continue;
+
+        if (ms_tdiff(&now, &conn->tv_last) > API_CONN_IDLE_MS)
+            api_conn_close(conn);
+    }
+
+    return (busy);
+}
+
+static void api_epoll_done(void)
+{
+    struct api_conn *conn, *done;
+
+    mutex_lock(&api_done_lock);
+    done = api_done;
+    api_done = NULL;
+    mutex_unlock(&api_done_lock);
+
+    while (done) {
+        conn = done;
+        done = conn->next;
+        api_conn_done(conn);
+    }
+}
+
+/* Serves clients until bye. Returns false if it could not, or stopped for
+ * another reason, with apisock left as it was for the blocking loop. */
+static bool api_epoll(SOCKETTYPE apisock)
+{
+    struct epoll_event ev, events[API_EPOLL_EVENTS];
+    struct api_conn *conn;
+    bool listening = true;
+    uint64_t count;
+    int flags = -1, workers = 0, n, i;
+
+    mutex_init(&api_done_lock);
+    mutex_init(&api_todo_lock);
+    if (unlikely(pthread_cond_init(&api_todo_cond, NULL)))
+        quit(1, "Failed to pthread_cond_init api_todo_cond");
+    api_workers_quit = false;
+
+    api_epfd = epoll_create1(EPOLL_CLOEXEC);
+    api_evfd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (api_epfd < 0 || api_evfd < 0) {
+        applog(LOG_ERR, "API epoll initialisation failed (%s)", strerror(errno));
+        goto out;
+    }
+
+    flags = fcntl(apisock, F_GETFL, 0);
+    if (flags < 0 || fcntl(apisock, F_SETFL, flags | O_NONBLOCK)) {
+        applog(LOG_ERR, "API non-blocking listen failed (%s)", strerror(errno));
+        flags = -1;
+        goto out;
+    }
+
+    memset(&ev, 0, sizeof(ev));
+    ev.events = EPOLLIN;
+    ev.data.u64 = API_EPOLL_LISTEN;
+    if (epoll_ctl(api_epfd, EPOLL_CTL_ADD, apisock, &ev)) {
+        applog(LOG_ERR, "API epoll listen failed (%s)", strerror(errno));
+        goto out;
+    }
+    ev.data.u64 = API_EPOLL_EVFD;
+    if (epoll_ctl(api_epfd, EPOLL_CTL_ADD, api_evfd, &ev)) {
+        applog(LOG_ERR, "API epoll eventfd failed (%s)", strerror(errno));
+        goto out;
+    }
+
+    for (workers = 0; workers < API_WORKERS; workers++) {
+        if (unlikely(pthread_create(&api_workers[workers], NULL, api_worker, NULL))) {
+            applog(LOG_ERR, "API worker thread create failed");
+            goto out;
+        }
+    }
+
+    while (42) {
+        n = epoll_wait(api_epfd, events, API_EPOLL_EVENTS, API_EPOLL_WAIT_MS);
+        if (n < 0) {
+            if (errno == EINTR)
+                continue;
+            applog(LOG_ERR, "API epoll_wait failed (%s)", strerror(errno));
+            break;
+        }
+
+        for (i = 0; i < n; i++) {
+            if (events[i].data.u64 == API_EPOLL_LISTEN) {
+                if (listening)
+                    api_conn_accept(apisock);
+                continue;
+            }
+            if (events[i].data.u64 == API_EPOLL_EVFD) {
+                if (read(api_evfd, &count, sizeof(count)) < 0 && errno != EAGAIN)
+                    applog(LOG_DEBUG, "API: eventfd read failed: %s", strerror(errno));
+                continue;
+            }
+
+            conn = api_conns[events[i].data.u64];
+            if (conn->closed)
+                continue;
+            if (events[i].events & EPOLLOUT) {
+                api_conn_flush(conn);
+                api_conn_next(conn);
+            }
+            if (conn->closed)
+                continue;
+            if (events[i].events & EPOLLIN)
+                api_conn_read(conn);
+            else if (events[i].events & (EPOLLHUP | EPOLLERR))
+                api_conn_close(conn);
+        }
+
+        api_epoll_done();
+
+        // Quit and restart still get their reply
+        if (api_conn_timeouts() == 0 && bye)
+            break;
+        if (bye && listening) {
+            epoll_ctl(api_epfd, EPOLL_CTL_DEL, apisock, NULL);
+            listening = false;
+        }
+    }
+
+out:
+    // The io_data of a command still running must outlive it
+    while (workers && api_conn_timeouts()) {
+        cgsleep_ms(API_EPOLL_WAIT_MS / 10);
+        api_epoll_done();
+    }
+
+    mutex_lock(&api_todo_lock);
+    api_workers_quit = true;
+    pthread_cond_broadcast(&api_todo_cond);
+    mutex_unlock(&api_todo_lock);
+    while (workers > 0)
+        pthread_join(api_workers[--workers], NULL);
+
+    for (i = 0; i < API_CONN_MAX; i++) {
+        conn = api_conns[i];
+        if (!conn)
+            continue;
+        if (!conn->closed) {
+            api_conn_flush(conn);
+            if (!conn->closed)
+                api_conn_close(conn);
+        }
+        free(conn->out);
+        free(conn);
+        api_conns[i] = NULL;
+    }
+
+    if (api_evfd >= 0) {
+        close(api_evfd);
+        api_evfd = -1;
+    }
+    if (api_epfd >= 0) {
+        close(api_epfd);
+        api_epfd = -1;
+    }
+
+    if (bye)
+        return (true);
+
+    if (flags >= 0)
+        fcntl(apisock, F_SETFL, flags);
+    return (false);
+}
+#endif /* HAVE_SYS_EPOLL_H */
+
 void api(int api_thr_id)
 {
     struct io_data *io_data;
     struct thr_info bye_thr;
     char buf[TMPBUFSIZ];
-    char param_buf[TMPBUFSIZ];
     SOCKETTYPE c;
     int n, bound;
     char *connectaddr;
@@ -4279,17 +5104,8 @@ void api(int api_thr_id)
     struct sockaddr_in serv;
     struct sockaddr_in cli;
     socklen_t clisiz;
-    char cmdbuf[100];
-    char *cmd = NULL, *cmdptr, *cmdsbuf = NULL;
-    char *param;
     bool addrok;
     char group;
-    json_error_t json_err;
-    json_t *json_config = NULL;
-    json_t *json_val;
-    bool isjson;
-    bool did, isjoin = false, firstjoin;
-    int i;
 
     SOCKETTYPE *apisock;
 
@@ -4305,6 +5121,7 @@ void api(int api_thr_id)
     io_data = sock_io_new();
 
     mutex_init(&quit_restart_lock);
+    mutex_init(&api_write_lock);
 
     pthread_cleanup_push(tidyup, (void *)apisock);
     my_thr_id = api_thr_id;
@@ -4403,6 +5220,15 @@ void api(int api_thr_id)
     if (opt_api_mcast)
         mcast_init();
 
+#ifdef HAVE_SYS_EPOLL_H
+    if (opt_api_epoll) {
+        applog(LOG_WARNING, "API serving clients with epoll");
+        if (api_epoll(*apisock))
+            goto die;
+        applog(LOG_WARNING, "API serving one client at a time instead");
+    }
+#endif
+
     while (!bye) {
         clisiz = sizeof(cli);
         if (SOCKETFAIL(c = accept(*apisock, (struct sockaddr *)(&cli), &clisiz))) {
@@ -4427,149 +5253,8 @@ void api(int api_thr_id)
                 applog(LOG_DEBUG, "API: recv command: (%d) '%s'", n, buf);
 
             if (!SOCKETFAIL(n)) {
-                // the time of the request in now
-                when = time(NULL);
-                io_reinit(io_data);
-
-                did = false;
-
-                if (*buf != ISJSON) {
-                    isjson = false;
-
-                    param = strchr(buf, SEPARATOR);
-                    if (param != NULL)
-                        *(param++) = '\0';
-
-                    cmd = buf;
-                }
-                else {
-                    isjson = true;
-
-                    param = NULL;
-
-#if JANSSON_MAJOR_VERSION > 2 || (JANSSON_MAJOR_VERSION == 2 && JANSSON_MINOR_VERSION > 0)
-                    json_config = json_loadb(buf, n, 0, &json_err);
-#elif JANSSON_MAJOR_VERSION > 1
-                    json_config = json_loads(buf, 0, &json_err);
-#else
-                    json_config = json_loads(buf, &json_err);
-#endif
-
-                    if (!json_is_object(json_config)) {
-                        message(io_data, MSG_INVJSON, 0, NULL, isjson);
-                        send_result(io_data, c, isjson);
-                        did = true;
-                    }
-                    else {
-                        json_val = json_object_get(json_config, JSON_COMMAND);
-                        if (json_val == NULL) {
-                            message(io_data, MSG_MISCMD, 0, NULL, isjson);
-                            send_result(io_data, c, isjson);
-                            did = true;
-                        }
-                        else {
-                            if (!json_is_string(json_val)) {
-                                message(io_data, MSG_INVCMD, 0, NULL, isjson);
-                                send_result(io_data, c, isjson);
-                                did = true;
-                            }
-                            else {
-                                cmd = (char *)json_string_value(json_val);
-                                json_val = json_object_get(json_config, JSON_PARAMETER);
-                                if (json_is_string(json_val))
-                                    param = (char *)json_string_value(json_val);
-                                else if (json_is_integer(json_val)) {
-                                    sprintf(param_buf, "%d", (int)json_integer_value(json_val));
-                                    param = param_buf;
-                                }
-                                else if (json_is_real(json_val)) {
-                                    sprintf(param_buf, "%f", (double)json_real_value(json_val));
-                                    param = param_buf;
-                                }
-                            }
-                        }
-                    }
-                }
-
-                if (!did) {
-                    if (strchr(cmd, CMDJOIN)) {
-                        firstjoin = isjoin = true;
-                        // cmd + leading '|' + '\0'
-                        cmdsbuf = (char *)malloc(strlen(cmd) + 2);
-                        if (!cmdsbuf)
-                            quithere(1, "OOM cmdsbuf");
-                        strcpy(cmdsbuf, "|");
-                        param = NULL;
-                    }
-                    else
-                        firstjoin = isjoin = false;
-
-                    cmdptr = cmd;
-                    do {
-                        did = false;
-                        if (isjoin) {
-                            cmd = strchr(cmdptr, CMDJOIN);
-                            if (cmd)
-                                *(cmd++) = '\0';
-                            if (!*cmdptr)
-                                goto inochi;
-                        }
-
-                        for (i = 0; cmds[i].name != NULL; i++) {
-                            if (strcmp(cmdptr, cmds[i].name) == 0) {
-                                sprintf(cmdbuf, "|%s|", cmdptr);
-                                if (isjoin) {
-                                    if (strstr(cmdsbuf, cmdbuf)) {
-                                        did = true;
-                                        break;
-                                    }
-                                    strcat(cmdsbuf, cmdptr);
-                                    strcat(cmdsbuf, "|");
-                                    head_join(io_data, cmdptr, isjson, &firstjoin);
-                                    if (!cmds[i].joinable) {
-                                        message(io_data, MSG_ACCDENY, 0, cmds[i].name, isjson);
-                                        did = true;
-                                        tail_join(io_data, isjson);
-                                        break;
-                                    }
-                                }
-                                if (ISPRIVGROUP(group) || strstr(COMMANDS(group), cmdbuf))
-                                    (cmds[i].func)(io_data, c, param, isjson, group);
-                                else {
-                                    message(io_data, MSG_ACCDENY, 0, cmds[i].name, isjson);
-                                    applog(LOG_DEBUG, "API: access denied to '%s' for '%s' command", connectaddr, cmds[i].name);
-                                }
-
-                                did = true;
-                                if (!isjoin)
-                                    send_result(io_data, c, isjson);
-                                else
-                                    tail_join(io_data, isjson);
-                                break;
-                            }
-                        }
-
-                        if (!did) {
-                            if (isjoin)
-                                head_join(io_data, cmdptr, isjson, &firstjoin);
-                            message(io_data, MSG_INVCMD, 0, NULL, isjson);
-                            if (isjoin)
-                                tail_join(io_data, isjson);
-                            else
-                                send_result(io_data, c, isjson);
-                        }
-                    inochi:
-                        if (isjoin)
-                            cmdptr = cmd;
-                    }
-                    while (isjoin && cmdptr);
-                }
-
-                if (isjoin)
-                    send_result(io_data, c, isjson);
-
-                if (isjson && json_is_object(json_config))
-                    json_decref(json_config);
+                api_request(io_data, buf, n, group, connectaddr, time(NULL), NULL);
+                send_result(io_data, c);
             }
         }
         CLOSESOCKET(c);
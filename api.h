@@ -287,6 +287,7 @@ struct io_data {
   char *cur;
   bool sock;
   bool close;
+  time_t when; // when the request occurred
 };
 
 struct io_list {
@@ -367,6 +368,10 @@ extern struct api_data *print_data(struct api_data *root, char *buf, bool isjson
     uint64_t dids;
     uint64_t didnts; // should be tries - dids
     uint64_t unlocks;
+    double waited; // seconds between get and got, total and worst
+    double max_waited;
+    double held; // seconds between got/did and unlock, total and worst
+    double max_held;
     LOCKSTAT lastgot;
     LOCKLINE *lockgets;
     LOCKLINE *locktries;
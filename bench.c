@@ -0,0 +1,79 @@
+/*
+ * Micro-benchmarks of the host side hot paths, run with --bench <name|all>
+ * instead of mining. Each benchmark is a plain function registered in
+ * benches[] and reports its own rates through bench_report().
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the Free
+ * Software Foundation; either version 3 of the License, or (at your option)
+ * any later version.  See COPYING for more details.
+ */
+
+#include "config.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <sys/time.h>
+
+#include "miner.h"
+#include "util.h"
+#include "bench.h"
+
+char *opt_bench = NULL;
+
+static struct bench benches[] = {
+  { "workgen", "stratum work generation per algorithm", bench_work_generation },
+  { "cn", "cryptonight scratchpad backing and AES core", bench_cryptonight },
+  { "submit", "stratum submit message formatting", bench_stratum_submit },
+  { "hash", "nonce verification hash per algorithm", bench_hashes },
+  { "aes", "Groestl and ECHO with tables and with AES-NI", bench_aes_hashes_run },
+  { "sha256", "coinbase and merkle double SHA-256 per backend", bench_sha256 },
+  { NULL, NULL, NULL }
+};
+
+/* Calls fn(arg) in growing batches until BENCH_SECS have passed and returns
+ * the number of calls per second */
+double bench_rate(void (*fn)(void *), void *arg)
+{
+  struct timeval start, now;
+  uint64_t calls = 0, batch = 1, i;
+  double elapsed;
+
+  cgtime(&start);
+  do {
+    for (i = 0; i < batch; i++)
+      fn(arg);
+    calls += batch;
+    if (batch < 1024)
+      batch <<= 1;
+    cgtime(&now);
+    elapsed = tdiff(&now, &start);
+  } while (elapsed < BENCH_SECS);
+
+  return calls / elapsed;
+}
+
+void bench_report(const char *bench, const char *what, double rate, const char *unit)
+{
+  applog(LOG_WARNING, "%-10s %-24s %14.1f %s", bench, what, rate, unit);
+}
+
+void bench_run(const char *name)
+{
+  struct bench *b;
+  bool found = false;
+
+  for (b = benches; b->name; b++) {
+    if (strcasecmp(name, "all") && strcasecmp(name, b->name))
+      continue;
+    found = true;
+    applog(LOG_WARNING, "Running %s benchmark: %s", b->name, b->desc);
+    b->run();
+  }
+
+  if (!found) {
+    applog(LOG_ERR, "Unknown benchmark %s, choose one of:", name);
+    for (b = benches; b->name; b++)
+      applog(LOG_ERR, "  %-10s %s", b->name, b->desc);
+  }
+}
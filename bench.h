@@ -0,0 +1,29 @@
+#ifndef BENCH_H
+#define BENCH_H
+
+#include <stdint.h>
+
+/* How long each case of a micro-benchmark runs for */
+#define BENCH_SECS 2.0
+
+struct bench {
+  const char *name;
+  const char *desc;
+  void (*run)(void);
+};
+
+extern char *opt_bench;
+
+extern double bench_rate(void (*fn)(void *), void *arg);
+extern void bench_report(const char *bench, const char *what, double rate, const char *unit);
+extern void bench_run(const char *name);
+
+/* Benchmarks living next to the code they measure */
+extern void bench_work_generation(void);
+extern void bench_cryptonight(void);
+extern void bench_stratum_submit(void);
+extern void bench_hashes(void);
+extern void bench_aes_hashes_run(void);
+extern void bench_sha256(void);
+
+#endif /* BENCH_H */
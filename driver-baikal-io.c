@@ -0,0 +1,351 @@
+/*
+ * Framing and reply routing of the Baikal protocol, shared by the USB and
+ * serial drivers.
+ *
+ * Frames look like ':' miner_id cmd param dest [0 data]... '\r' '\n'.
+ * Requests are written by the caller and the replies are collected by the
+ * transport, a reader thread on the UART or an async read on USB, which
+ * feeds whatever bytes it gets into baikal_parser_feed(). Complete frames
+ * are routed to the slot of the (miner_id, cmd) that requested them so
+ * several boards can have commands in flight at the same time.
+ *
+ * Frames carry no sequence number. A board answers the requests of a slot
+ * in order, so the reply to a request that timed out is still owed and is
+ * dropped when it turns up, instead of answering the next request.
+ *
+ * Only logging and the time helpers of sgminer are used here, so the test
+ * under tests/ can link this file on its own.
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the Free
+ * Software Foundation; either version 3 of the License, or (at your option)
+ * any later version.  See COPYING for more details.
+ */
+
+#include "config.h"
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+
+#include "logging.h"
+#include "miner.h"
+#include "util.h"
+#include "driver-baikal.h"
+
+
+int baikal_encode(const baikal_msg *msg, uint8_t *buf)
+{
+    int i, pos = 0;
+
+    buf[pos++] = ':';
+    buf[pos++] = msg->miner_id;
+    buf[pos++] = msg->cmd;
+    buf[pos++] = msg->param;
+    buf[pos++] = msg->dest;
+
+    for (i = 0; i < msg->len; i++, pos += 2) {
+        buf[pos] = 0;
+        buf[pos + 1] = msg->data[i];
+    }
+
+    buf[pos++] = '\r';
+    buf[pos++] = '\n';
+
+    return (pos);
+}
+
+
+/* Size of the reply the device sends back for a command, -1 if unknown */
+int baikal_reply_size(uint8_t cmd)
+{
+    switch (cmd) {
+    case BAIKAL_GET_INFO:
+        return (21);
+    case BAIKAL_GET_RESULT:
+        return (23);
+    case BAIKAL_RESET:
+    case BAIKAL_SET_OPTION:
+    case BAIKAL_SEND_WORK:
+    case BAIKAL_SET_ID:
+    case BAIKAL_SET_IDLE:
+        return (7);
+    default:
+        return (-1);
+    }
+}
+
+
+static void baikal_decode(const uint8_t *buf, int size, baikal_msg *msg)
+{
+    int len, pos = 1;
+
+    msg->miner_id   = buf[pos++];
+    msg->cmd        = buf[pos++];
+    msg->param      = buf[pos++];
+    msg->dest       = buf[pos++];
+
+    for (len = 0; pos < size - 2; len++, pos += 2) {
+        msg->data[len] = buf[pos + 1];
+    }
+
+    msg->len = len;
+}
+
+
+static void baikal_io_deliver(struct baikal_io *io, baikal_msg *msg)
+{
+    struct baikal_slot *slot;
+    struct timeval now;
+
+    mutex_lock(&io->lock);
+    io->frames++;
+    slot = &io->slots[msg->miner_id][msg->cmd];
+    if (slot->late > 0) {
+        cgtime(&now);
+        if (timercmp(&now, &slot->late_until, <)) {
+            slot->late--;
+            io->late++;
+            mutex_unlock(&io->lock);
+            return;
+        }
+        /* too late to still be coming, it was lost */
+        slot->late = 0;
+    }
+
+    if (slot->pending && !slot->done) {
+        memcpy(&slot->reply, msg, sizeof(baikal_msg));
+        slot->done = true;
+        pthread_cond_broadcast(&io->cond);
+    }
+    else {
+        io->unsolicited++;
+    }
+    mutex_unlock(&io->lock);
+}
+
+
+static void baikal_parser_drop(struct baikal_parser *parser, int count)
+{
+    parser->len -= count;
+    memmove(parser->buf, parser->buf + count, parser->len);
+}
+
+
+/* Pull one complete frame out of the parser, resyncing on garbage */
+static bool baikal_parser_frame(struct baikal_io *io, baikal_msg *msg)
+{
+    struct baikal_parser *parser = &io->parser;
+    uint8_t *start;
+    int size;
+
+    while (parser->len > 0) {
+        start = memchr(parser->buf, ':', parser->len);
+        if (start == NULL) {
+            io->resyncs++;
+            parser->len = 0;
+            return (false);
+        }
+
+        if (start != parser->buf) {
+            io->resyncs++;
+            baikal_parser_drop(parser, start - parser->buf);
+        }
+
+        /* need the header to know how long the frame is */
+        if (parser->len < 5) {
+            return (false);
+        }
+
+        size = baikal_reply_size(parser->buf[2]);
+        if ((size < 0) || (parser->buf[1] >= BAIKAL_MAXMINERS)) {
+            io->resyncs++;
+            baikal_parser_drop(parser, 1);
+            continue;
+        }
+
+        if (parser->len < size) {
+            return (false);
+        }
+
+        if ((parser->buf[size - 2] != '\r') || (parser->buf[size - 1] != '\n')) {
+            io->resyncs++;
+            baikal_parser_drop(parser, 1);
+            continue;
+        }
+
+        baikal_decode(parser->buf, size, msg);
+        baikal_parser_drop(parser, size);
+        return (true);
+    }
+
+    return (false);
+}
+
+
+/* Called by the reader thread only */
+void baikal_parser_feed(struct baikal_io *io, const uint8_t *data, int len)
+{
+    struct baikal_parser *parser = &io->parser;
+    baikal_msg msg;
+    int count;
+
+    while (len > 0) {
+        count = MIN(len, (int)sizeof(parser->buf) - parser->len);
+        memcpy(parser->buf + parser->len, data, count);
+        parser->len += count;
+        data += count;
+        len -= count;
+
+        while (baikal_parser_frame(io, &msg)) {
+            baikal_io_deliver(io, &msg);
+        }
+
+        /* a full buffer without a frame in it can never complete */
+        if (parser->len == sizeof(parser->buf)) {
+            io->resyncs++;
+            parser->len = 0;
+        }
+    }
+}
+
+
+void baikal_io_init(struct baikal_io *io)
+{
+    memset(io, 0, sizeof(struct baikal_io));
+    mutex_init(&io->lock);
+    mutex_init(&io->wlock);
+    if (unlikely(pthread_cond_init(&io->cond, NULL))) {
+        quit(1, "Failed to pthread_cond_init baikal io");
+    }
+}
+
+
+bool baikal_io_start(struct baikal_io *io, void *(*reader)(void *), void *arg)
+{
+    io->running = true;
+    io->dead = false;
+    if (unlikely(pthread_create(&io->thr, NULL, reader, arg))) {
+        applog(LOG_ERR, "Failed to create baikal io thread");
+        io->running = false;
+        return (false);
+    }
+    io->started = true;
+
+    return (true);
+}
+
+
+void baikal_io_stop(struct baikal_io *io)
+{
+    if (io->started != true) {
+        return;
+    }
+
+    io->running = false;
+    pthread_join(io->thr, NULL);
+    io->started = false;
+}
+
+
+/* Transport is gone, release anybody waiting for a reply */
+void baikal_io_fail(struct baikal_io *io)
+{
+    mutex_lock(&io->lock);
+    io->dead = true;
+    pthread_cond_broadcast(&io->cond);
+    mutex_unlock(&io->lock);
+}
+
+
+/*
+ * Must be called before the request is written so a fast reply is not lost.
+ * Returns the generation baikal_io_wait() is given to collect the reply.
+ */
+uint32_t baikal_io_arm(struct baikal_io *io, uint8_t miner_id, uint8_t cmd)
+{
+    struct baikal_slot *slot = &io->slots[miner_id][cmd];
+    uint32_t gen;
+
+    mutex_lock(&io->lock);
+    gen = ++slot->gen;
+    slot->pending = true;
+    slot->done = false;
+    /* a wait on the previous generation is over */
+    pthread_cond_broadcast(&io->cond);
+    mutex_unlock(&io->lock);
+
+    return (gen);
+}
+
+
+/* The request was never written, no reply is owed for it */
+void baikal_io_disarm(struct baikal_io *io, uint8_t miner_id, uint8_t cmd, uint32_t gen)
+{
+    struct baikal_slot *slot = &io->slots[miner_id][cmd];
+
+    mutex_lock(&io->lock);
+    if (slot->gen == gen) {
+        slot->pending = false;
+        slot->done = false;
+    }
+    mutex_unlock(&io->lock);
+}
+
+
+/*
+ * Wait for the reply to request gen of msg->miner_id / msg->cmd. Fails at
+ * once if the slot has been armed again since. On a timeout the reply is
+ * still owed, it is dropped if it arrives within another timeout.
+ */
+bool baikal_io_wait(struct baikal_io *io, baikal_msg *msg, uint32_t gen, int timeout)
+{
+    struct baikal_slot *slot = &io->slots[msg->miner_id][msg->cmd];
+    struct timespec then, tdiff;
+    struct timeval now, twait;
+    bool ret;
+
+    cgtime(&now);
+    timeval_to_spec(&then, &now);
+    ms_to_timespec(&tdiff, timeout);
+    timeraddspec(&then, &tdiff);
+
+    mutex_lock(&io->lock);
+    if (slot->gen != gen) {
+        mutex_unlock(&io->lock);
+        return (false);
+    }
+
+    while ((slot->done != true) && (io->dead != true) && (slot->gen == gen)) {
+        if (pthread_cond_timedwait(&io->cond, &io->lock, &then) == ETIMEDOUT) {
+            break;
+        }
+    }
+
+    /* armed again behind our back, the slot is not ours any more */
+    if (slot->gen != gen) {
+        mutex_unlock(&io->lock);
+        return (false);
+    }
+
+    ret = slot->done;
+    if (ret == true) {
+        memcpy(msg, &slot->reply, sizeof(baikal_msg));
+    }
+    else {
+        io->timeouts++;
+        if (io->dead != true) {
+            cgtime(&now);
+            twait.tv_sec = timeout / 1000;
+            twait.tv_usec = (timeout % 1000) * 1000;
+            timeradd(&now, &twait, &slot->late_until);
+            slot->late++;
+        }
+    }
+    slot->pending = false;
+    slot->done = false;
+    mutex_unlock(&io->lock);
+
+    return (ret);
+}
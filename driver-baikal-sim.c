@@ -0,0 +1,507 @@
+
+/*
+ * Software Baikal controller.
+ *
+ * Speaks the Baikal serial protocol on the master side of a pty so that the
+ * unmodified baikals_drv code can be driven without boards attached, which
+ * makes the host side (work generation, nonce checking, submission) easy to
+ * load test. Nonces are real: every simulated board hashes the work it was
+ * sent with the CPU regenhash of the configured algorithm and reports the
+ * nonces the host will accept, limited to a configurable rate.
+ *
+ * Enabled with --baikal-sim boards[:rate], rate being nonces per second per
+ * board (0 = as fast as the CPU finds them).
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the Free
+ * Software Foundation; either version 3 of the License, or (at your option)
+ * any later version.  See COPYING for more details.
+ */
+
+#include "config.h"
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#include "logging.h"
+#include "miner.h"
+#include "util.h"
+#include "algorithm.h"
+#include "config_parser.h"
+#include "driver-baikal.h"
+
+#ifdef LINUX
+
+#include <fcntl.h>
+#include <poll.h>
+#include <termios.h>
+
+#define SIM_FW_VER          (0x10)
+#define SIM_HW_VER          (0x10)
+#define SIM_ASIC_COUNT      (8)
+#define SIM_TEMP            (45)
+#define SIM_FOUND_MAX       (32)
+#define SIM_SCAN_BATCH      (64)
+#define SIM_JOB_MS          (500)   /* min time on a job once a newer one is queued */
+
+struct sim_job {
+    bool        valid;
+    uint8_t     algo;
+    uint8_t     target[8];
+    uint8_t     data[BAIKAL_FRAME_MAX];
+    int         len;
+};
+
+struct sim_found {
+    uint32_t    nonce;
+    uint8_t     work_idx;
+    uint8_t     chip_id;
+};
+
+struct sim_board {
+    int         id;
+    bool        idle;
+    uint8_t     clock;
+    struct sim_job jobs[BAIKAL_WORK_FIFO];
+    int         head;           /* last job received */
+    int         cur;            /* job being hashed, -1 if none */
+    struct sim_found found[SIM_FOUND_MAX];
+    int         found_rd;
+    int         found_cnt;
+    pthread_t   thr;
+};
+
+struct baikal_sim {
+    pthread_mutex_t lock;
+    int         fd;             /* pty master */
+    char        path[64];       /* pty slave */
+    int         board_count;
+    int         rate;
+    bool        running;
+    pthread_t   thr;
+    struct sim_board boards[BAIKAL_MAXMINERS];
+};
+
+static struct baikal_sim sim;
+
+
+/* Undo the per algorithm packing done by baikal_pack_work() */
+static bool sim_load_work(struct work *work, const struct sim_job *job, algorithm_type_t type)
+{
+    const algorithm_layout_t *layout = algorithm_layout(type);
+    int len = job->len - 10;
+
+    if ((len <= 0) || (len > (int)sizeof(work->data))) {
+        return (false);
+    }
+
+    /* midstate jobs can not be turned back into a header */
+    if ((layout->baikal_midstate != BAIKAL_MIDSTATE_NONE) && (job->algo & 0x01)) {
+        return (false);
+    }
+
+    memset(work->data, 0, sizeof(work->data));
+    memcpy(work->data, &job->data[10], len);
+
+    if (layout->baikal_swab != 0) {
+        be32enc_vect((uint32_t *)work->data, (const uint32_t *)work->data, layout->baikal_swab);
+    }
+
+    if ((type == ALGO_CRYPTONIGHT) || (type == ALGO_CRYPTONIGHT_LITE)) {
+        work->XMRBlobLen = 76;
+    }
+
+    return (true);
+}
+
+
+/*
+ * A real board only reports nonces under the device target, which a CPU
+ * rarely reaches at the difficulties the driver asks for. Diff 1 nonces
+ * are what test_nonce() checks, so take those too to keep the host busy.
+ */
+static bool sim_hash_meets(const struct work *work, const uint8_t *target, uint32_t diff1targ)
+{
+    uint64_t hash64, target64;
+
+    memcpy(&hash64, &work->hash[24], 8);
+    memcpy(&target64, target, 8);
+
+    if ((diff1targ != 0) && (le32toh(((const uint32_t *)work->hash)[7]) <= diff1targ)) {
+        return (true);
+    }
+
+    return (le64toh(hash64) <= le64toh(target64));
+}
+
+
+static void *sim_board_thread(void *userdata)
+{
+    struct sim_board *board = (struct sim_board *)userdata;
+    algorithm_t *algorithm = &default_profile.algorithm;
+    int nonce_pos = algorithm_layout(algorithm->type)->nonce_off;
+    struct work *work = calloc(1, sizeof(struct work));
+    struct sim_job job;
+    struct timeval job_start, now, rate_start;
+    uint32_t nonce = 0, *work_nonce;
+    uint64_t emitted = 0;
+    int cur = -1, i;
+    bool loaded = false;
+
+    if (unlikely(!work)) {
+        quit(1, "Failed to calloc work in sim_board_thread");
+    }
+
+    RenameThread("BaikalSim");
+    work_nonce = (uint32_t *)(work->data + nonce_pos);
+    cgtime(&job_start);
+    cgtime(&rate_start);
+
+    while (sim.running) {
+        mutex_lock(&sim.lock);
+        cgtime(&now);
+        /* move on to the newest job once this one had its share of time */
+        if ((board->head >= 0) && (board->cur != board->head) && board->jobs[board->head].valid &&
+            ((board->cur < 0) || (ms_tdiff(&now, &job_start) >= SIM_JOB_MS))) {
+            board->cur = board->head;
+        }
+        if ((board->idle == true) || (board->cur < 0) || !board->jobs[board->cur].valid) {
+            board->cur = -1;
+            mutex_unlock(&sim.lock);
+            cgsleep_ms(10);
+            continue;
+        }
+        if (board->cur != cur) {
+            cur = board->cur;
+            memcpy(&job, &board->jobs[cur], sizeof(struct sim_job));
+            cgtime(&job_start);
+            loaded = false;
+        }
+        mutex_unlock(&sim.lock);
+
+        if (loaded != true) {
+            if (sim_load_work(work, &job, algorithm->type) != true) {
+                applog(LOG_DEBUG, "baikal sim %d : can not hash job %d for %s", board->id, cur, algorithm->name);
+                cgsleep_ms(SIM_JOB_MS);
+                continue;
+            }
+            nonce = le32toh(*work_nonce);
+            loaded = true;
+        }
+
+        /* hold back once the nonce budget for this second is spent */
+        if (sim.rate > 0) {
+            cgtime(&now);
+            if (emitted >= (uint64_t)(tdiff(&now, &rate_start) * sim.rate) + 1) {
+                cgsleep_ms(5);
+                continue;
+            }
+        }
+
+        for (i = 0; i < SIM_SCAN_BATCH; i++, nonce++) {
+            *work_nonce = htole32(nonce);
+            algorithm->regenhash(work);
+            if (sim_hash_meets(work, job.target, algorithm->diff1targ) != true) {
+                continue;
+            }
+
+            mutex_lock(&sim.lock);
+            if (board->found_cnt < SIM_FOUND_MAX) {
+                struct sim_found *found = &board->found[(board->found_rd + board->found_cnt) % SIM_FOUND_MAX];
+
+                found->nonce    = nonce;
+                found->work_idx = cur;
+                found->chip_id  = nonce % SIM_ASIC_COUNT;
+                board->found_cnt++;
+            }
+            mutex_unlock(&sim.lock);
+
+            emitted++;
+            nonce++;
+            break;
+        }
+    }
+
+    free(work);
+
+    return (NULL);
+}
+
+
+static void sim_reply(baikal_msg *msg)
+{
+    uint8_t buf[BAIKAL_FRAME_MAX * 2];
+    int len, pos = 0, amount;
+
+    len = baikal_encode(msg, buf);
+    while (pos < len) {
+        amount = write(sim.fd, buf + pos, len - pos);
+        if (amount < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return;
+        }
+        pos += amount;
+    }
+}
+
+
+static void sim_handle(baikal_msg *req)
+{
+    struct sim_board *board;
+    baikal_msg msg = {0, };
+
+    if (req->miner_id >= sim.board_count) {
+        return;
+    }
+
+    board = &sim.boards[req->miner_id];
+
+    msg.miner_id    = req->miner_id;
+    msg.cmd         = req->cmd;
+    msg.dest        = req->dest;
+
+    mutex_lock(&sim.lock);
+    switch (req->cmd) {
+    case BAIKAL_RESET:
+        msg.param = sim.board_count;
+        break;
+
+    case BAIKAL_GET_INFO:
+        msg.data[0] = SIM_FW_VER;
+        msg.data[1] = SIM_HW_VER;
+        msg.data[2] = 0;
+        msg.data[3] = board->clock;
+        msg.data[4] = SIM_ASIC_COUNT;
+        msg.data[5] = SIM_ASIC_COUNT;
+        msg.data[6] = 0;
+        msg.len     = 7;
+        break;
+
+    case BAIKAL_SET_OPTION:
+        board->idle = false;
+        break;
+
+    case BAIKAL_SEND_WORK:
+        if ((req->param < BAIKAL_WORK_FIFO) && (req->len >= 10)) {
+            struct sim_job *job = &board->jobs[req->param];
+
+            job->valid  = true;
+            job->algo   = req->data[0];
+            memcpy(job->target, &req->data[2], 8);
+            memcpy(job->data, req->data, req->len);
+            job->len    = req->len;
+            board->head = req->param;
+            board->idle = false;
+        }
+        msg.param = board->clock;
+        break;
+
+    case BAIKAL_GET_RESULT:
+        if (board->found_cnt > 0) {
+            struct sim_found *found = &board->found[board->found_rd];
+
+            memcpy(msg.data, &found->nonce, 4);
+            msg.data[4] = found->chip_id;
+            msg.data[5] = found->work_idx;
+            msg.param |= 0x01;
+            board->found_rd = (board->found_rd + 1) % SIM_FOUND_MAX;
+            board->found_cnt--;
+        }
+        /* ask for more once the board is on its newest job */
+        if ((board->idle != true) && (board->cur == board->head)) {
+            msg.param |= 0x02;
+        }
+        msg.data[6] = SIM_TEMP;
+        msg.data[7] = 0;
+        msg.len     = 8;
+        break;
+
+    case BAIKAL_SET_ID:
+        break;
+
+    case BAIKAL_SET_IDLE:
+        board->idle = true;
+        mutex_unlock(&sim.lock);
+        return;
+
+    default:
+        mutex_unlock(&sim.lock);
+        return;
+    }
+    mutex_unlock(&sim.lock);
+
+    sim_reply(&msg);
+}
+
+
+/*
+ * Requests carry their data as (0, value) pairs, so the trailer is the
+ * first pair after the header that starts with '\r' instead of 0.
+ */
+static int sim_parse(const uint8_t *buf, int len, baikal_msg *msg)
+{
+    int pos = 5;
+
+    while (pos + 1 < len) {
+        if ((buf[pos] == '\r') && (buf[pos + 1] == '\n')) {
+            msg->miner_id   = buf[1];
+            msg->cmd        = buf[2];
+            msg->param      = buf[3];
+            msg->dest       = buf[4];
+            for (msg->len = 0; 5 + msg->len * 2 < pos; msg->len++) {
+                msg->data[msg->len] = buf[5 + msg->len * 2 + 1];
+            }
+            return (pos + 2);
+        }
+        if (buf[pos] != 0) {
+            return (-1);
+        }
+        pos += 2;
+    }
+
+    return (0);
+}
+
+
+static void *sim_thread(void *userdata)
+{
+    uint8_t buf[BAIKAL_FRAME_MAX * 4];
+    struct pollfd pfd;
+    baikal_msg msg;
+    int len = 0, amount, used;
+    uint8_t *start;
+
+    RenameThread("BaikalSimIO");
+
+    pfd.fd = sim.fd;
+    pfd.events = POLLIN;
+
+    while (sim.running) {
+        if (poll(&pfd, 1, BAIKAL_IO_POLL) <= 0) {
+            continue;
+        }
+
+        amount = read(sim.fd, buf + len, sizeof(buf) - len);
+        if (amount <= 0) {
+            if ((amount < 0) && (errno != EINTR) && (errno != EAGAIN) && (errno != EIO)) {
+                break;
+            }
+            /* EIO until the driver opens the slave side */
+            cgsleep_ms(10);
+            continue;
+        }
+        len += amount;
+
+        while (len > 0) {
+            start = memchr(buf, ':', len);
+            if (start == NULL) {
+                len = 0;
+                break;
+            }
+            if (start != buf) {
+                len -= start - buf;
+                memmove(buf, start, len);
+            }
+
+            used = (len < 5) ? 0 : sim_parse(buf, len, &msg);
+            if (used == 0) {
+                break;
+            }
+            if (used < 0) {
+                used = 1;
+            }
+            else {
+                sim_handle(&msg);
+            }
+            len -= used;
+            memmove(buf, buf + used, len);
+        }
+
+        if (len == sizeof(buf)) {
+            len = 0;
+        }
+    }
+
+    return (NULL);
+}
+
+
+/*
+ * Start the simulator and return the pty slave the serial driver should
+ * open instead of BAIKAL_IO_PORT, NULL on failure.
+ */
+char *baikal_sim_start(const char *arg)
+{
+    struct termios options;
+    int boards = 1, rate = 0;
+    char *path;
+    int i;
+
+    /* a later detect reuses the running boards */
+    if (sim.running) {
+        return (strdup(sim.path));
+    }
+
+    sscanf(arg, "%d:%d", &boards, &rate);
+    if (boards < 1) {
+        boards = 1;
+    }
+    if (boards > BAIKAL_MAXMINERS) {
+        boards = BAIKAL_MAXMINERS;
+    }
+
+    memset(&sim, 0, sizeof(sim));
+    mutex_init(&sim.lock);
+    sim.board_count = boards;
+    sim.rate        = MAX(rate, 0);
+
+    sim.fd = posix_openpt(O_RDWR | O_NOCTTY);
+    if (sim.fd < 0) {
+        applog(LOG_ERR, "baikal sim : posix_openpt failed(%d)", errno);
+        return (NULL);
+    }
+
+    if ((grantpt(sim.fd) < 0) || (unlockpt(sim.fd) < 0) || ((path = ptsname(sim.fd)) == NULL)) {
+        applog(LOG_ERR, "baikal sim : pty setup failed(%d)", errno);
+        close(sim.fd);
+        return (NULL);
+    }
+    snprintf(sim.path, sizeof(sim.path), "%s", path);
+
+    if (tcgetattr(sim.fd, &options) == 0) {
+        cfmakeraw(&options);
+        tcsetattr(sim.fd, TCSANOW, &options);
+    }
+
+    for (i = 0; i < sim.board_count; i++) {
+        struct sim_board *board = &sim.boards[i];
+
+        board->id       = i;
+        board->cur      = -1;
+        board->head     = -1;
+        board->clock    = BAIKAL_CLK_DEF >> 1;
+    }
+
+    sim.running = true;
+    if (unlikely(pthread_create(&sim.thr, NULL, sim_thread, NULL))) {
+        quit(1, "Failed to create baikal sim thread");
+    }
+
+    for (i = 0; i < sim.board_count; i++) {
+        if (unlikely(pthread_create(&sim.boards[i].thr, NULL, sim_board_thread, &sim.boards[i]))) {
+            quit(1, "Failed to create baikal sim board thread");
+        }
+    }
+
+    applog(LOG_NOTICE, "baikal sim : %d board(s) at %s, %d nonces/s per board%s",
+           sim.board_count, path, sim.rate, (sim.rate == 0) ? " (unlimited)" : "");
+
+    return (strdup(path));
+}
+
+#endif /* LINUX */
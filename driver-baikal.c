@@ -0,0 +1,847 @@
+/*
+ * Transport independent part of the Baikal drivers, the framing itself is
+ * in driver-baikal-io.c.
+ *
+ * The commands, the nonce checks and the work FIFO handling are shared, a
+ * driver only supplies how a frame is written (baikal_info.sendmsg) and how
+ * long a reply may take.
+ *
+ * The per-board difficulty controller, the hashrate accounting and the chip
+ * health checks live here, both drivers run them from their scanwork loop.
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the Free
+ * Software Foundation; either version 3 of the License, or (at your option)
+ * any later version.  See COPYING for more details.
+ */
+
+#include "config.h"
+
+#include <errno.h>
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+
+#include "logging.h"
+#include "miner.h"
+#include "util.h"
+#include "driver-baikal.h"
+#include "algorithm.h"
+
+
+/*
+ * Lays the header of work out behind the 10 byte SEND_WORK preamble in data,
+ * which the caller has zeroed, and returns the payload length. data[0]
+ * already holds the board algorithm and is bumped when a midstate is sent.
+ */
+int baikal_pack_work(const struct work *work, uint8_t *data)
+{
+    const algorithm_layout_t *layout = algorithm_layout(work->pool->algorithm.type);
+
+    if ((layout->baikal_midstate != BAIKAL_MIDSTATE_NONE) && (work->pool->algorithm.calc_midstate != NULL)) {
+        data[0] += 1;
+        memcpy(&data[10], work->midstate, 32);
+
+        if (layout->baikal_midstate == BAIKAL_MIDSTATE_DECRED) {
+            memcpy(&data[42], &work->data[128], 52);
+            *((uint32_t *)&data[94]) = 0x01000080UL;
+            *((uint32_t *)&data[98]) = 0x00000000UL;
+            *((uint32_t *)&data[102]) = 0xa0050000UL;
+        }
+        else {
+            memcpy(&data[42], &work->data[64], 16);
+            be32enc_vect((uint32_t *)&data[42], (const uint32_t *)&data[42], 4);
+            *((uint32_t *)&data[58]) = 0x00000080;
+            *((uint32_t *)&data[94]) = 0x01000000;
+            *((uint32_t *)&data[102]) = 0x80020000;
+        }
+        return (106);
+    }
+
+    memcpy(&data[10], work->data, layout->baikal_len);
+    if (layout->baikal_swab != 0) {
+        be32enc_vect((uint32_t *)&data[10], (const uint32_t *)&data[10], layout->baikal_swab);
+    }
+
+    return (10 + layout->baikal_len);
+}
+
+
+/*
+ * The verifier callbacks use the device, wait for the ones still queued
+ * before it goes away. They only need nonce_lock to finish.
+ */
+void baikal_nonce_drain(struct baikal_info *info)
+{
+    int pending;
+
+    while (42) {
+        mutex_lock(&info->nonce_lock);
+        pending = info->nonces_pending;
+        mutex_unlock(&info->nonce_lock);
+
+        if (pending <= 0) {
+            break;
+        }
+        cgsleep_ms(10);
+    }
+}
+
+
+/* Queue a request, the reply is collected later with baikal_wait() */
+bool baikal_post(struct cgpu_info *baikal, baikal_msg *msg, uint32_t *gen)
+{
+    struct baikal_info *info = baikal->device_data;
+
+    *gen = baikal_io_arm(&info->io, msg->miner_id, msg->cmd);
+    if (info->sendmsg(baikal, msg) < 0) {
+        baikal_io_disarm(&info->io, msg->miner_id, msg->cmd, *gen);
+        return (false);
+    }
+
+    return (true);
+}
+
+
+bool baikal_wait(struct cgpu_info *baikal, baikal_msg *msg, uint32_t gen)
+{
+    struct baikal_info *info = baikal->device_data;
+
+    return (baikal_io_wait(&info->io, msg, gen, info->timeout));
+}
+
+
+bool baikal_command(struct cgpu_info *baikal, baikal_msg *msg)
+{
+    uint32_t gen;
+
+    if (baikal_post(baikal, msg, &gen) != true) {
+        return (false);
+    }
+
+    return (baikal_wait(baikal, msg, gen));
+}
+
+
+/* Runs on a verifier thread once the nonce has been re-hashed */
+static void baikal_nonce_verified(__maybe_unused struct thr_info *thr, bool valid, void *data)
+{
+    struct baikal_nonce *bn = (struct baikal_nonce *)data;
+    struct baikal_info *info = bn->baikal->device_data;
+    struct miner_info *miner = &info->miners[bn->miner_id];
+
+    mutex_lock(&info->nonce_lock);
+    cgtime(&miner->asics[bn->unit_id][bn->chip_id].last_seen);
+    if (valid == true) {
+        miner->asics[bn->unit_id][bn->chip_id].nonce++;
+        miner->nonce++;
+        miner->asics[bn->unit_id][bn->chip_id].rate.hashes += bn->hashes;
+        miner->measured.hashes += bn->hashes;
+        miner->hashes_done += bn->hashes;
+    }
+    else {
+        applog(LOG_ERR, "hw error : %d[u:%d, c:%2d] : [%3d, %08x]", bn->miner_id, bn->unit_id, bn->chip_id, bn->work_idx, bn->nonce);
+        miner->asics[bn->unit_id][bn->chip_id].error++;
+        miner->error++;
+    }
+    info->nonces_pending--;
+    mutex_unlock(&info->nonce_lock);
+
+    if (valid != true) {
+        inc_hw_errors_bkl();
+    }
+
+    free(bn);
+}
+
+
+static void baikal_checknonce(struct cgpu_info *baikal, baikal_msg *msg)
+{
+    struct baikal_info *info = baikal->device_data;
+    struct miner_info *miner = &info->miners[msg->miner_id];
+    struct baikal_nonce *bn;
+    uint8_t work_idx, chip_id, unit_id;
+    uint32_t nonce;
+
+    chip_id     = msg->data[4];
+    work_idx    = msg->data[5];
+    unit_id     = msg->data[7];
+    nonce       = *((uint32_t *)msg->data);
+
+    /* unit and chip index the asics table, a garbled reply must not */
+    if ((unit_id >= BAIKAL_MAXUNIT) || (chip_id >= BAIKAL_MAXASICS)) {
+        applog(LOG_ERR, "hw error : %d[u:%d, c:%2d] : bad unit or chip", msg->miner_id, unit_id, chip_id);
+        mutex_lock(&info->nonce_lock);
+        miner->error++;
+        mutex_unlock(&info->nonce_lock);
+        inc_hw_errors(mining_thr[miner->thr_id]);
+        inc_hw_errors_bkl();
+        return;
+    }
+
+    if (work_idx >= BAIKAL_WORK_FIFO) {
+        return;
+    }
+
+    if ((miner->works[work_idx] == NULL) || (baikal==NULL)) {
+        return;
+    }
+
+#if BAIKAL_CHECK_STALE
+    /* stale work */
+    if (miner->works[work_idx]->devflag == false) {
+        return;
+    }
+#endif
+
+    /* check algorithm */
+    if (miner->works[work_idx]->pool->algorithm.type != baikal->algorithm.type) {
+        return;
+    }
+
+    bn = cgmalloc(sizeof(struct baikal_nonce));
+    bn->baikal      = baikal;
+    bn->miner_id    = msg->miner_id;
+    bn->unit_id     = unit_id;
+    bn->chip_id     = chip_id;
+    bn->work_idx    = work_idx;
+    bn->nonce       = nonce;
+    bn->hashes      = baikal_work_hashes(miner->works[work_idx]);
+
+    mutex_lock(&info->nonce_lock);
+    info->nonces_pending++;
+    mutex_unlock(&info->nonce_lock);
+
+    submit_nonce_async(mining_thr[miner->thr_id], miner->works[work_idx], nonce, baikal_nonce_verified, bn);
+}
+
+
+/* Boards with shared work copy it from board 0 instead of getting their own */
+static bool baikal_shares_work(struct baikal_info *info, int miner_id)
+{
+    return ((info->share_work == true) && (miner_id != 0) && (info->miners[miner_id].asic_ver == 0x51));
+}
+
+
+/* Fill the next FIFO slot of a board and post it, baikal_send_work_wait() completes it */
+bool baikal_send_work_post(struct cgpu_info *baikal, int miner_id)
+{
+    struct baikal_info *info = baikal->device_data;
+    struct miner_info *miner = &info->miners[miner_id];
+    struct thr_info *thr = mining_thr[miner->thr_id];
+    struct work *work;
+    baikal_msg msg;
+
+    /* Do not send */
+    if (miner->overheated == true) {
+        return (true);
+    }
+
+    /* the FIFO of board 0 must be current before it is copied */
+    if (baikal_shares_work(info, miner_id) == true) {
+        if (baikal_send_work_wait(baikal, 0) != true) {
+            return (false);
+        }
+    }
+
+    mutex_lock(baikal->mutex);
+
+    if (miner->works[miner->work_idx] == NULL) {
+        if (baikal_shares_work(info, miner_id) == true) {
+            struct miner_info *miner_base = &info->miners[0];
+            int idx = (miner_base->work_idx - 1) % BAIKAL_WORK_FIFO;
+            work = copy_work(miner_base->works[idx]);
+            work->thr_id = miner->thr_id;
+        }
+        else {
+            work = get_work(thr, miner->thr_id);
+        }
+        miner->works[miner->work_idx] = work;
+        work->devflag = true;
+    }
+    else {
+        work = miner->works[miner->work_idx];
+    }
+
+    if (work->pool->algorithm.type != thr->cgpu->algorithm.type) {
+        thr->cgpu->algorithm.type = work->pool->algorithm.type;
+    }
+
+    work->device_diff = baikal_work_diff(miner, work);
+    set_target(work->device_target, work->device_diff, work->pool->algorithm.diff_multiplier2, work->thr_id);
+
+    memset(msg.data, 0x0, 512);
+    msg.data[0] = to_baikal_algorithm(work->pool->algorithm.type);
+    msg.data[1] = miner_id;
+    memcpy(&msg.data[2], &work->device_target[24], 8);
+    if (*((uint32_t *)&msg.data[6]) != 0x0) { // TripleS
+        memset(&msg.data[2], 0xFF, 4);
+    }
+
+    if ((info->nicehash_nonce == true) && algorithm_layout(work->pool->algorithm.type)->nicehash_nonce24 && work->pool->nicehash) {
+        msg.data[0] += 1;   // cn_nice
+    }
+    msg.len = baikal_pack_work(work, msg.data);
+
+    msg.miner_id    = miner_id;
+    msg.cmd         = BAIKAL_SEND_WORK;
+    msg.param       = miner->work_idx;
+    msg.dest        = 0;
+
+    if (baikal_post(baikal, &msg, &miner->work_gen) != true) {
+        applog(LOG_ERR, "baikal_send_work : sendmsg error[%d]", miner_id);
+        mutex_unlock(baikal->mutex);
+        return (false);
+    }
+
+    miner->work_pending = true;
+    mutex_unlock(baikal->mutex);
+
+    return (true);
+}
+
+
+bool baikal_send_work_wait(struct cgpu_info *baikal, int miner_id)
+{
+    struct baikal_info *info = baikal->device_data;
+    struct miner_info *miner = &info->miners[miner_id];
+    baikal_msg msg;
+
+    if (miner->work_pending != true) {
+        return (true);
+    }
+
+    miner->work_pending = false;
+
+    msg.miner_id    = miner_id;
+    msg.cmd         = BAIKAL_SEND_WORK;
+    if (baikal_wait(baikal, &msg, miner->work_gen) != true) {
+        applog(LOG_ERR, "baikal_send_work : readmsg error[%d]", miner_id);
+        return (false);
+    }
+
+    mutex_lock(baikal->mutex);
+
+    /* update clock */
+    miner->clock = msg.param << 1;
+
+    miner->work_idx++;
+    if (miner->work_idx >= BAIKAL_WORK_FIFO) {
+        miner->work_idx = 0;
+    }
+
+    if (miner->works[miner->work_idx] != NULL) {
+        free_work(miner->works[miner->work_idx]);
+        miner->works[miner->work_idx] = NULL;
+    }
+
+    mutex_unlock(baikal->mutex);
+
+    return (true);
+}
+
+
+/*
+ * Asks every board for its result at once, they answer while the others are
+ * handled. Once one fails the rest are still waited for, so no slot is left
+ * armed for a stray reply, but no new work is sent.
+ */
+bool baikal_process_result(struct cgpu_info *baikal)
+{
+    struct baikal_info *info = baikal->device_data;
+    struct miner_info *miner;
+    baikal_msg msg = {0, };
+    uint32_t gen[BAIKAL_MAXMINERS];
+    bool posted[BAIKAL_MAXMINERS] = {false, };
+    bool ret = true;
+    int i;
+
+    for (i = 0; i < info->miner_count; i++) {
+        miner = &info->miners[i];
+        if (miner->working == true) {
+            msg.miner_id    = i;
+            msg.cmd         = BAIKAL_GET_RESULT;
+            msg.dest        = 0;
+            msg.len         = 0;
+
+            if (baikal_post(baikal, &msg, &gen[i]) != true) {
+                applog(LOG_ERR, "baikal_process_result : sendmsg error");
+                ret = false;
+                break;
+            }
+            posted[i] = true;
+        }
+    }
+
+    for (i = 0; i < info->miner_count; i++) {
+        if (posted[i] != true) {
+            continue;
+        }
+
+        miner = &info->miners[i];
+        msg.miner_id    = i;
+        msg.cmd         = BAIKAL_GET_RESULT;
+
+        if (baikal_wait(baikal, &msg, gen[i]) != true) {
+            applog(LOG_ERR, "baikal_process_result : readmsg error miner_id = %d", i);
+            ret = false;
+            continue;
+        }
+
+        miner->temp = msg.data[6];
+
+        if (msg.param & 0x01) {
+            baikal_checknonce(baikal, &msg);
+        }
+
+        /* the SEND_WORK reply is collected below */
+        if ((msg.param & 0x02) && (ret == true)) {
+            baikal_send_work_post(baikal, i);
+        }
+
+        if (msg.param & 0x04) {
+            ret = false;
+            continue;
+        }
+
+        if (miner->temp > info->cutofftemp) {
+            miner->overheated = true;
+        }
+        else if (miner->temp < info->recovertemp) {
+            miner->overheated = false;
+        }
+    }
+
+    for (i = 0; i < info->miner_count; i++) {
+        if (baikal_send_work_wait(baikal, i) != true) {
+            ret = false;
+        }
+    }
+
+    return (ret);
+}
+
+
+/*
+ * A board reports every nonce under its device target, so its nonce rate is
+ * its hashrate over the device diff. Once per BAIKAL_DIFF_INTERVAL the diff
+ * that was in use is scaled by the square root of measured over wanted rate,
+ * which gets there in a few steps without chasing the noise of counting a
+ * few dozen nonces. An interval without nonces halves the diff.
+ */
+void baikal_diff_update(struct baikal_info *info, struct miner_info *miner)
+{
+    struct timeval now;
+    uint32_t nonces;
+    double secs, step;
+
+    if (opt_baikal_nonce_rate <= 0) {
+        return;
+    }
+
+    cgtime(&now);
+    mutex_lock(&info->nonce_lock);
+    nonces = miner->nonce + miner->error;
+    mutex_unlock(&info->nonce_lock);
+
+    if (miner->diff_start.tv_sec == 0) {
+        miner->diff_nonces = nonces;
+        miner->diff_start = now;
+        return;
+    }
+
+    secs = tdiff(&now, &miner->diff_start);
+    if (secs < BAIKAL_DIFF_INTERVAL) {
+        return;
+    }
+
+    miner->nonce_rate = (nonces - miner->diff_nonces) / secs;
+    miner->diff_nonces = nonces;
+    miner->diff_start = now;
+
+    /* no work went out yet, nothing to scale */
+    if (miner->device_diff <= 0) {
+        return;
+    }
+
+    if (miner->nonce_rate > 0) {
+        step = sqrt(miner->nonce_rate / opt_baikal_nonce_rate);
+        step = MAX(0.5, MIN(step, 2.0));
+    }
+    else {
+        step = 0.5;
+    }
+
+    /* scale what was sent, not working_diff, which may sit above the share diff */
+    miner->working_diff = MAX(miner->device_diff * step, BAIKAL_DIFF_MIN);
+
+    applog(LOG_DEBUG, "baikal %d : %.2f nonces/s at diff %.3f, next diff %.3f",
+           miner->thr_id, miner->nonce_rate, miner->device_diff, miner->working_diff);
+}
+
+
+/*
+ * Device diff for work. The controller's diff is capped at the share diff
+ * so no share is lost. Without it working_diff is only a floor.
+ */
+double baikal_work_diff(struct miner_info *miner, struct work *work)
+{
+    double diff;
+
+    if (opt_baikal_nonce_rate > 0) {
+        diff = MIN(MAX(miner->working_diff, BAIKAL_DIFF_MIN), work->work_difficulty);
+    }
+    else {
+        diff = MAX(miner->working_diff, work->work_difficulty);
+    }
+    miner->device_diff = diff;
+
+    return (diff);
+}
+
+
+/*
+ * Controller figures for the api stats. Verification saved is counted
+ * against a board that reports every diff 1 nonce: nonces/s the verifiers
+ * did not have to re-hash, and the share of one core that took on average.
+ */
+struct api_data *baikal_api_diff(struct api_data *root, struct miner_info *miner)
+{
+    struct verify_stats stats;
+    double saved, cpu = 0;
+
+    get_verify_stats(&stats);
+    saved = miner->nonce_rate * (MAX(miner->device_diff, 1.0) - 1.0);
+    if (stats.verified > 0) {
+        cpu = saved * stats.hash_total / stats.verified / 10.0;
+    }
+
+    root = api_add_diff(root, "Device Diff", &miner->device_diff, false);
+    root = api_add_double(root, "Nonce Rate", &miner->nonce_rate, false);
+    root = api_add_double(root, "Target Nonce Rate", &opt_baikal_nonce_rate, false);
+    root = api_add_double(root, "Verify Saved", &saved, true);
+    root = api_add_percent(root, "Verify CPU Saved", &cpu, true);
+
+    return (root);
+}
+
+
+/* Hashes a board does on average per nonce it finds under work's device target */
+double baikal_work_hashes(const struct work *work)
+{
+    return (work->device_diff * 4294967296.0 / work->pool->algorithm.diff_multiplier2);
+}
+
+
+static const double baikal_rate_window[BAIKAL_RATE_WINDOWS] = { 60.0, 300.0, 900.0 };
+
+static const char *baikal_chip_health_str[] = { "OK", "HW", "SLOW", "SILENT" };
+
+static void baikal_rate_decay(struct baikal_rate *rate, double secs)
+{
+    double sample = rate->hashes / secs;
+    int i;
+
+    for (i = 0; i < BAIKAL_RATE_WINDOWS; i++) {
+        rate->avg[i] += (sample - rate->avg[i]) * (1.0 - exp(-secs / baikal_rate_window[i]));
+    }
+    rate->hashes = 0;
+    rate->secs += secs;
+}
+
+
+/*
+ * Hashes/s over the window, corrected for the windows starting from 0 so
+ * a fresh board does not read low for its first 15 minutes.
+ */
+double baikal_rate_avg(const struct baikal_rate *rate, int window)
+{
+    double filled = 1.0 - exp(-rate->secs / baikal_rate_window[window]);
+
+    return ((filled > 0) ? rate->avg[window] / filled : 0);
+}
+
+
+/* Warns once the 5 minute measured rate strays from the nominal one, and once it is back */
+static void baikal_rate_check(struct miner_info *miner)
+{
+    double measured = baikal_rate_avg(&miner->measured, 1);
+    double nominal = baikal_rate_avg(&miner->nominal, 1);
+    double off;
+
+    if ((miner->nominal.secs < baikal_rate_window[1]) || (nominal <= 0)) {
+        return;
+    }
+
+    off = fabs(measured - nominal) * 100.0 / nominal;
+    if ((miner->rate_alert != true) && (off > BAIKAL_RATE_ALERT)) {
+        applog(LOG_WARNING, "baikal %d : measured %.2f MH/s is %.0f%% of the nominal %.2f MH/s",
+               miner->thr_id, measured / 1e6, measured * 100.0 / nominal, nominal / 1e6);
+        miner->rate_alert = true;
+    }
+    else if ((miner->rate_alert == true) && (off < BAIKAL_RATE_ALERT / 2)) {
+        applog(LOG_NOTICE, "baikal %d : measured %.2f MH/s is back near the nominal %.2f MH/s",
+               miner->thr_id, measured / 1e6, nominal / 1e6);
+        miner->rate_alert = false;
+    }
+}
+
+
+/*
+ * Called from scanwork with the clock derived hashes since the last call.
+ * Moves the windows along and returns the verified hashes since the last
+ * call, which is what the hashmeter gets.
+ */
+int64_t baikal_rate_update(struct baikal_info *info, struct miner_info *miner, int64_t nominal)
+{
+    struct timeval now;
+    double done, secs;
+    bool decayed = false;
+    int i, j;
+
+    cgtime(&now);
+    mutex_lock(&info->nonce_lock);
+    done = miner->hashes_done;
+    miner->hashes_done = 0;
+    miner->nominal.hashes += nominal;
+
+    if (miner->rate_start.tv_sec == 0) {
+        miner->rate_start = now;
+    }
+
+    secs = tdiff(&now, &miner->rate_start);
+    if (secs >= BAIKAL_RATE_INTERVAL) {
+        baikal_rate_decay(&miner->measured, secs);
+        baikal_rate_decay(&miner->nominal, secs);
+        for (i = 0; i < BAIKAL_MAXUNIT; i++) {
+            for (j = 0; j < BAIKAL_MAXASICS; j++) {
+                baikal_rate_decay(&miner->asics[i][j].rate, secs);
+            }
+        }
+        miner->rate_start = now;
+        decayed = true;
+    }
+    mutex_unlock(&info->nonce_lock);
+
+    if (decayed == true) {
+        baikal_rate_check(miner);
+    }
+
+    return ((int64_t)done);
+}
+
+
+/* Chips per unit; the boards report their chip count, not their layout */
+static int baikal_unit_chips(const struct miner_info *miner)
+{
+    return (MAX(1, MIN(miner->asic_count, BAIKAL_MAXASICS)));
+}
+
+
+/* A unit exists once one of its chips has returned a nonce */
+static bool baikal_unit_active(const struct miner_info *miner, int unit)
+{
+    int i;
+
+    for (i = 0; i < BAIKAL_MAXASICS; i++) {
+        if ((miner->asics[unit][i].nonce > 0) || (miner->asics[unit][i].error > 0)) {
+            return (true);
+        }
+    }
+
+    return (false);
+}
+
+
+/*
+ * Measured and nominal MH/s for the api stats, and the 5 minute measured
+ * MH/s of each chip of every unit that has returned nonces.
+ */
+struct api_data *baikal_api_rate(struct api_data *root, struct miner_info *miner)
+{
+    static const char *names[BAIKAL_RATE_WINDOWS] = { "1m", "5m", "15m" };
+    char name[32], buf[BAIKAL_MAXASICS * 20];
+    double mhs;
+    int chips = baikal_unit_chips(miner);
+    int i, j;
+
+    for (i = 0; i < BAIKAL_RATE_WINDOWS; i++) {
+        snprintf(name, sizeof(name), "MHS %s", names[i]);
+        mhs = baikal_rate_avg(&miner->measured, i) / 1e6;
+        root = api_add_mhs(root, name, &mhs, true);
+    }
+    for (i = 0; i < BAIKAL_RATE_WINDOWS; i++) {
+        snprintf(name, sizeof(name), "Nominal MHS %s", names[i]);
+        mhs = baikal_rate_avg(&miner->nominal, i) / 1e6;
+        root = api_add_mhs(root, name, &mhs, true);
+    }
+    root = api_add_bool(root, "Hashrate Alert", &miner->rate_alert, false);
+
+    for (i = 0; i < BAIKAL_MAXUNIT; i++) {
+        if (baikal_unit_active(miner, i) != true) {
+            continue;
+        }
+
+        buf[0] = '\0';
+        for (j = 0; j < chips; j++) {
+            tailsprintf(buf, sizeof(buf), "%s%.2f", j ? " " : "", baikal_rate_avg(&miner->asics[i][j].rate, 1) / 1e6);
+        }
+        snprintf(name, sizeof(name), "Unit%d Chip MHS 5m", i);
+        root = api_add_string(root, name, buf, true);
+    }
+
+    return (root);
+}
+
+
+static int baikal_cmp_double(const void *a, const void *b)
+{
+    double x = *(const double *)a, y = *(const double *)b;
+
+    return ((x > y) - (x < y));
+}
+
+
+/*
+ * Chip health, checked once per BAIKAL_HEALTH_INTERVAL. A chip is bad when
+ * it returned hw errors in the interval and they average over
+ * BAIKAL_HEALTH_ERRORS percent of what it returned, slow when its 5 minute rate is under BAIKAL_HEALTH_SLOW percent of the
+ * median chip of the board, and silent when it has not returned anything
+ * for BAIKAL_HEALTH_SILENT seconds. Only bad chips
+ * cost power for nothing, so only they make the board step its clock
+ * down, by BAIKAL_CLK_STEP per check and up to --baikal-derate MHz.
+ * Returns the clock to set, or 0 to leave it. The caller adds to
+ * miner->derate once the board has taken the new clock.
+ */
+int baikal_health_update(struct baikal_info *info, struct miner_info *miner)
+{
+    double rates[BAIKAL_MAXUNIT * BAIKAL_MAXASICS], median = 0, sample;
+    enum baikal_chip_health health;
+    struct asic_info *asic;
+    struct timeval now;
+    uint32_t nonces, errors;
+    int chips = baikal_unit_chips(miner);
+    int count = 0, bad = 0, prio, i, j;
+
+    cgtime(&now);
+    if (miner->health_start.tv_sec == 0) {
+        miner->health_start = now;
+        return (0);
+    }
+    if (tdiff(&now, &miner->health_start) < BAIKAL_HEALTH_INTERVAL) {
+        return (0);
+    }
+    miner->health_start = now;
+
+    mutex_lock(&info->nonce_lock);
+
+    /* no median until 5 minutes and 20 nonces a chip, the rates are noise before */
+    if ((miner->measured.secs >= 300) && (miner->nonce >= 20 * (uint32_t)chips)) {
+        for (i = 0; i < BAIKAL_MAXUNIT; i++) {
+            if (baikal_unit_active(miner, i) == true) {
+                for (j = 0; j < chips; j++) {
+                    rates[count++] = baikal_rate_avg(&miner->asics[i][j].rate, 1);
+                }
+            }
+        }
+        if (count > 0) {
+            qsort(rates, count, sizeof(double), baikal_cmp_double);
+            median = rates[count / 2];
+        }
+    }
+
+    for (i = 0; i < BAIKAL_MAXUNIT; i++) {
+        if (baikal_unit_active(miner, i) != true) {
+            continue;
+        }
+
+        for (j = 0; j < chips; j++) {
+            asic = &miner->asics[i][j];
+            nonces = asic->nonce - asic->health_nonce;
+            errors = asic->error - asic->health_error;
+            asic->health_nonce = asic->nonce;
+            asic->health_error = asic->error;
+
+            /* nothing back counts as a clean interval, a chip that went
+             * quiet after some errors is left to the silent check */
+            sample = (nonces + errors > 0) ? (double)errors / (nonces + errors) : 0;
+            asic->error_ratio = (asic->error_ratio + sample) / 2;
+
+            if ((errors > 0) && (asic->error >= 3) && (asic->error_ratio * 100 > BAIKAL_HEALTH_ERRORS)) {
+                health = BAIKAL_CHIP_ERRORS;
+                bad++;
+            }
+            else if ((asic->last_seen.tv_sec != 0) ? (tdiff(&now, &asic->last_seen) > BAIKAL_HEALTH_SILENT) :
+                     (miner->measured.secs > BAIKAL_HEALTH_SILENT)) {
+                health = BAIKAL_CHIP_SILENT;
+            }
+            else if ((median > 0) && (baikal_rate_avg(&asic->rate, 1) * 100 < median * BAIKAL_HEALTH_SLOW)) {
+                health = BAIKAL_CHIP_SLOW;
+            }
+            else {
+                health = BAIKAL_CHIP_OK;
+            }
+
+            if (health != asic->health) {
+                prio = (health == BAIKAL_CHIP_OK) ? LOG_NOTICE : LOG_WARNING;
+                applog(prio, "baikal %d : chip %d:%d %s, %.0f%% hw errors, %.2f MH/s",
+                       miner->thr_id, i, j, baikal_chip_health_str[health],
+                       asic->error_ratio * 100, baikal_rate_avg(&asic->rate, 1) / 1e6);
+                asic->health = health;
+            }
+        }
+    }
+    mutex_unlock(&info->nonce_lock);
+
+    if ((bad == 0) || (miner->derate + BAIKAL_CLK_STEP > opt_baikal_derate) ||
+        (info->clock - miner->derate - BAIKAL_CLK_STEP < BAIKAL_CLK_MIN)) {
+        return (0);
+    }
+
+    applog(LOG_WARNING, "baikal %d : %d chip(s) with hw errors, clock down to %d MHz",
+           miner->thr_id, bad, info->clock - miner->derate - BAIKAL_CLK_STEP);
+
+    return (info->clock - miner->derate - BAIKAL_CLK_STEP);
+}
+
+
+/* Per chip health, hw error percentage and seconds since its last nonce */
+struct api_data *baikal_api_health(struct api_data *root, struct miner_info *miner)
+{
+    char name[32], health[BAIKAL_MAXASICS * 8], errors[BAIKAL_MAXASICS * 8], seen[BAIKAL_MAXASICS * 12];
+    struct asic_info *asic;
+    struct timeval now;
+    int chips = baikal_unit_chips(miner);
+    int bad = 0, i, j;
+
+    cgtime(&now);
+    for (i = 0; i < BAIKAL_MAXUNIT; i++) {
+        if (baikal_unit_active(miner, i) != true) {
+            continue;
+        }
+
+        health[0] = errors[0] = seen[0] = '\0';
+        for (j = 0; j < chips; j++) {
+            asic = &miner->asics[i][j];
+            if (asic->health != BAIKAL_CHIP_OK) {
+                bad++;
+            }
+            tailsprintf(health, sizeof(health), "%s%s", j ? " " : "", baikal_chip_health_str[asic->health]);
+            tailsprintf(errors, sizeof(errors), "%s%.1f", j ? " " : "", asic->error_ratio * 100);
+            tailsprintf(seen, sizeof(seen), "%s%d", j ? " " : "",
+                        (asic->last_seen.tv_sec != 0) ? (int)tdiff(&now, &asic->last_seen) : -1);
+        }
+        snprintf(name, sizeof(name), "Unit%d Chip Health", i);
+        root = api_add_string(root, name, health, true);
+        snprintf(name, sizeof(name), "Unit%d Chip HW%%", i);
+        root = api_add_string(root, name, errors, true);
+        snprintf(name, sizeof(name), "Unit%d Chip Last Seen", i);
+        root = api_add_string(root, name, seen, true);
+    }
+
+    root = api_add_int(root, "Unhealthy Chips", &bad, true);
+    root = api_add_int(root, "Derate", &miner->derate, false);
+
+    return (root);
+}
@@ -37,6 +37,11 @@
 #define BAIKAL_GET_RESULT	    (0x05)
 #define BAIKAL_SET_ID		    (0x06)
 #define BAIKAL_SET_IDLE		    (0x07)
+#define BAIKAL_CMD_MAX          (0x08)
+
+#define BAIKAL_FRAME_MAX        (512)
+#define BAIKAL_IO_POLL          (100)   /* reader poll interval in ms */
+#define BAIKAL_IO_TIMEOUT       (999)   /* command reply timeout in ms */
 
 #define BAIKAL_MINER_TYPE_NONE  (0x00)
 #define BAIKAL_MINER_TYPE_MINI  (0x01)
@@ -48,9 +53,85 @@
 #define BAIKAL_EN_HWE           (1)
 #define BAIKAL_CLK_FIX          (0)
 
+#define BAIKAL_DIFF_DEF         (0.1)
+#define BAIKAL_DIFF_MIN         (1.0)   /* below diff 1 the host rejects what the board finds */
+#define BAIKAL_DIFF_INTERVAL    (10)    /* seconds of nonces per controller step */
+
+#define BAIKAL_RATE_WINDOWS     (3)     /* 1, 5 and 15 minutes */
+#define BAIKAL_RATE_INTERVAL    (5)     /* seconds between window updates */
+#define BAIKAL_RATE_ALERT       (25)    /* percent the measured rate may stray from nominal */
+
+#define BAIKAL_HEALTH_INTERVAL  (60)    /* seconds between chip health checks */
+#define BAIKAL_HEALTH_ERRORS    (10)    /* percent hw errors that mark a chip bad */
+#define BAIKAL_HEALTH_SLOW      (25)    /* percent of the median chip rate that marks a chip slow */
+#define BAIKAL_HEALTH_SILENT    (300)   /* seconds without a nonce that mark a chip silent */
+#define BAIKAL_CLK_STEP         (10)    /* MHz per derating step */
+
+enum baikal_chip_health {
+    BAIKAL_CHIP_OK = 0,
+    BAIKAL_CHIP_ERRORS,
+    BAIKAL_CHIP_SLOW,
+    BAIKAL_CHIP_SILENT,
+};
+
+typedef struct {
+    uint8_t     miner_id;
+    uint8_t     cmd;
+    uint8_t     param;
+    uint8_t     dest;
+    uint8_t     data[512];
+    uint32_t    len;
+} baikal_msg;
+
+/* Reassembly buffer for the byte stream coming back from the device */
+struct baikal_parser {
+    uint8_t     buf[BAIKAL_FRAME_MAX];
+    int         len;
+};
+
+/* One outstanding request per miner and command */
+struct baikal_slot {
+    bool        pending;
+    bool        done;
+    uint32_t    gen;            /* bumped by every baikal_io_arm() */
+    int         late;           /* replies owed to requests that timed out */
+    struct timeval late_until;  /* they count as lost after this */
+    baikal_msg  reply;
+};
+
+struct baikal_io {
+    pthread_mutex_t lock;       /* protects slots and dead */
+    pthread_cond_t  cond;
+    pthread_mutex_t wlock;      /* serialises writes to the device */
+    pthread_t       thr;
+    bool            started;
+    bool            running;
+    bool            dead;
+    struct baikal_parser parser;
+    struct baikal_slot slots[BAIKAL_MAXMINERS][BAIKAL_CMD_MAX];
+    uint32_t        frames;
+    uint32_t        resyncs;
+    uint32_t        unsolicited;
+    uint32_t        timeouts;
+    uint32_t        late;       /* replies dropped for arriving after their timeout */
+};
+
+/* Hashes/s decayed over 1, 5 and 15 minutes, the way the load average is */
+struct baikal_rate {
+    double hashes;                      /* added since the last update */
+    double avg[BAIKAL_RATE_WINDOWS];
+    double secs;                        /* time the windows cover so far */
+};
+
 struct asic_info {
     uint32_t nonce;
     uint32_t error;
+    struct baikal_rate rate;
+    struct timeval last_seen;
+    uint32_t health_nonce;      /* nonce and error at the last health check */
+    uint32_t health_error;
+    double error_ratio;         /* hw errors over all nonces, decayed per check */
+    enum baikal_chip_health health;
 };
 
 struct miner_info {
@@ -69,8 +150,21 @@ struct miner_info {
     uint32_t nonce;
     uint32_t error;    
     double working_diff;    
+    double device_diff;         /* diff of the last work sent */
+    double nonce_rate;          /* nonces/s over the last controller interval */
+    uint32_t diff_nonces;       /* nonce + error at the start of the interval */
+    struct timeval diff_start;
+    double hashes_done;         /* verified hashes not yet reported to scanwork */
+    struct baikal_rate measured;    /* from verified nonces at the device diff */
+    struct baikal_rate nominal;     /* from clock and chip count */
+    struct timeval rate_start;
+    bool rate_alert;
+    struct timeval health_start;
+    int derate;                 /* MHz taken off the configured clock */
     struct asic_info asics[BAIKAL_MAXUNIT][BAIKAL_MAXASICS]; 
     uint8_t work_idx;
+    bool    work_pending;   /* SEND_WORK posted, reply not yet consumed */
+    uint32_t work_gen;      /* its generation in the io slot */
     struct work *works[BAIKAL_WORK_FIFO];
     cgtimer_t start_time;
 };
@@ -86,16 +180,55 @@ struct baikal_info {
 	pthread_t *process_thr;
     struct miner_info miners[BAIKAL_MAXMINERS];    
     uint8_t miner_type;
+    struct baikal_io io;
+    pthread_mutex_t nonce_lock; /* nonce/error counters, bumped by the verifier threads */
+    int nonces_pending;         /* handed to the verifiers, under nonce_lock */
+    int (*sendmsg)(struct cgpu_info *baikal, baikal_msg *msg);  /* writes one frame */
+    int timeout;                /* ms a reply may take */
+    bool share_work;            /* 0x51 boards copy their work from board 0 */
+    bool nicehash_nonce;        /* the firmware has the cn_nice algorithms */
+    struct usb_transfer *read_ut;   /* async read of the USB driver */
 };
 
-typedef struct {
-    uint8_t     miner_id;
-    uint8_t     cmd;
-    uint8_t     param;
-    uint8_t     dest;
-    uint8_t     data[512];
-    uint32_t    len;
-} baikal_msg;
+/* A nonce handed to the verifier, identifies the chip that found it */
+struct baikal_nonce {
+    struct cgpu_info *baikal;
+    uint8_t miner_id;
+    uint8_t unit_id;
+    uint8_t chip_id;
+    uint8_t work_idx;
+    uint32_t nonce;
+    double hashes;      /* hashes the nonce stands for at its device diff */
+};
+
+extern int baikal_encode(const baikal_msg *msg, uint8_t *buf);
+extern int baikal_reply_size(uint8_t cmd);
+extern int baikal_pack_work(const struct work *work, uint8_t *data);
+extern void baikal_parser_feed(struct baikal_io *io, const uint8_t *data, int len);
+extern void baikal_io_init(struct baikal_io *io);
+extern bool baikal_io_start(struct baikal_io *io, void *(*reader)(void *), void *arg);
+extern void baikal_io_stop(struct baikal_io *io);
+extern void baikal_io_fail(struct baikal_io *io);
+extern uint32_t baikal_io_arm(struct baikal_io *io, uint8_t miner_id, uint8_t cmd);
+extern void baikal_io_disarm(struct baikal_io *io, uint8_t miner_id, uint8_t cmd, uint32_t gen);
+extern bool baikal_io_wait(struct baikal_io *io, baikal_msg *msg, uint32_t gen, int timeout);
+extern void baikal_nonce_drain(struct baikal_info *info);
+extern bool baikal_post(struct cgpu_info *baikal, baikal_msg *msg, uint32_t *gen);
+extern bool baikal_wait(struct cgpu_info *baikal, baikal_msg *msg, uint32_t gen);
+extern bool baikal_command(struct cgpu_info *baikal, baikal_msg *msg);
+extern bool baikal_send_work_post(struct cgpu_info *baikal, int miner_id);
+extern bool baikal_send_work_wait(struct cgpu_info *baikal, int miner_id);
+extern bool baikal_process_result(struct cgpu_info *baikal);
+extern char *baikal_sim_start(const char *arg);
+extern void baikal_diff_update(struct baikal_info *info, struct miner_info *miner);
+extern double baikal_work_diff(struct miner_info *miner, struct work *work);
+extern struct api_data *baikal_api_diff(struct api_data *root, struct miner_info *miner);
+extern double baikal_work_hashes(const struct work *work);
+extern double baikal_rate_avg(const struct baikal_rate *rate, int window);
+extern int64_t baikal_rate_update(struct baikal_info *info, struct miner_info *miner, int64_t nominal);
+extern struct api_data *baikal_api_rate(struct api_data *root, struct miner_info *miner);
+extern int baikal_health_update(struct baikal_info *info, struct miner_info *miner);
+extern struct api_data *baikal_api_health(struct api_data *root, struct miner_info *miner);
 
 
 #endif /* __DEVICE_BAIKAL_H__ */
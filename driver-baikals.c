@@ -42,9 +42,14 @@ static void baikal_detect(void)
 }
 #else
 
+#include <errno.h>
 #include <fcntl.h>
+#include <poll.h>
 #include <termios.h>
 
+/* Replies used to be read with VTIME=30 plus a 200ms settle delay */
+#define BAIKAL_COM_TIMEOUT  (3200)
+
 static bool detect_one = false;
 
 static void baikal_reset_boards(struct cgpu_info *baikal)
@@ -174,61 +179,85 @@ static int baikal_init_com(const char *devpath, int baud, uint8_t timeout)
 
 static int baikal_sendmsg(struct cgpu_info *baikal, baikal_msg *msg)
 {
-    int i, pos = 0;
-    int amount;
-    uint8_t buf[512] = {0, };
-
-    buf[pos++] = ':';
-    buf[pos++] = msg->miner_id;
-    buf[pos++] = msg->cmd;
-    buf[pos++] = msg->param;
-    buf[pos++] = msg->dest;
-
-    for (i = 0; i < msg->len; i++, pos += 2) {
-        buf[pos + 1] = msg->data[i];
+    struct baikal_info *info = baikal->device_data;
+    int len, pos = 0;
+    int amount = 0;
+    uint8_t buf[BAIKAL_FRAME_MAX * 2] = {0, };
+
+    len = baikal_encode(msg, buf);
+
+    mutex_lock(&info->io.wlock);
+    while (pos < len) {
+        amount = write(baikal->fd, buf + pos, len - pos);
+        if (amount < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            break;
+        }
+        pos += amount;
     }
+    mutex_unlock(&info->io.wlock);
 
-    buf[pos++] = '\r';
-    buf[pos++] = '\n';
-
-    amount = write(baikal->fd, buf, pos);
     if (amount < 0) {
+        applog(LOG_ERR, "baikal_sendmsg error(%d)", errno);
         return (amount);
     }
 
-    return (amount);
+    return (pos);
 }
 
 
-static int baikal_readmsg(struct cgpu_info *baikal, baikal_msg *msg, int size)
+/* Reader thread : waits on the UART and routes replies to their requester */
+static void *baikal_io_thread(void *userdata)
 {
-    int amount;
-    int len, pos = 1;
-    uint8_t buf[128] = {0, };
+    struct cgpu_info *baikal = (struct cgpu_info *)userdata;
+    struct baikal_info *info = baikal->device_data;
+    struct baikal_io *io = &info->io;
+    struct pollfd pfd;
+    uint8_t buf[BAIKAL_FRAME_MAX];
+    int ret, amount;
 
-    amount = read(baikal->fd, buf, size);
-    if (amount < size) {
-        return (-1);
-    }
+    RenameThread("BaikalIO");
 
-    if ((buf[0] != ':') || (buf[amount - 2] != '\r') || (buf[amount - 1] != '\n')) {
-        return (-1);
-    }
+    pfd.fd = baikal->fd;
+    pfd.events = POLLIN;
 
-    msg->miner_id   = buf[pos++];
-    msg->cmd        = buf[pos++];
-    msg->param      = buf[pos++];
-    msg->dest       = buf[pos++];
+    while (io->running == true) {
+        ret = poll(&pfd, 1, BAIKAL_IO_POLL);
+        if (ret < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            applog(LOG_ERR, "baikal_io_thread : poll error(%d)", errno);
+            break;
+        }
 
-    for (len = 0; pos < amount - 2; len++, pos += 2) {
-        msg->data[len] = buf[pos + 1];
+        if (ret == 0) {
+            continue;
+        }
+
+        if (pfd.revents & (POLLERR | POLLHUP | POLLNVAL)) {
+            applog(LOG_ERR, "baikal_io_thread : port closed");
+            break;
+        }
+
+        amount = read(baikal->fd, buf, sizeof(buf));
+        if (amount > 0) {
+            baikal_parser_feed(io, buf, amount);
+        }
+        else if ((amount < 0) && (errno != EINTR) && (errno != EAGAIN)) {
+            applog(LOG_ERR, "baikal_io_thread : read error(%d)", errno);
+            break;
+        }
     }
 
-    msg->len = len;
+    baikal_io_fail(io);
 
-    return (amount);
+    return (NULL);
 }
 
+
 static void baikal_cleanup(struct cgpu_info *baikal)
 {
     int i;
@@ -247,26 +276,25 @@ static void baikal_cleanup(struct cgpu_info *baikal)
         }
     }
 
+    /* stop eating bytes a later detect will need */
+    baikal_io_stop(&info->io);
+    baikal_nonce_drain(info);
+
     detect_one = false;
 }
 
-static void baikal_clearbuffer(struct cgpu_info *baikal)
+static bool baikal_finalize(struct cgpu_info *baikal)
 {
-    int err, retries = 0;
-    baikal_msg msg;
+    struct baikal_info *info = baikal->device_data;
 
-    do {
-        err = baikal_readmsg(baikal, &msg, 128);
-        if (err < 0)
-            break;
+    if (info) {
+        baikal_io_stop(&info->io);
+        baikal_nonce_drain(info);
     }
-    while (retries++ < 10);
-}
 
-
-static bool baikal_finalize(struct cgpu_info *baikal)
-{
-    close(baikal->fd);
+    if (baikal->fd >= 0) {
+        close(baikal->fd);
+    }
 
     if (baikal->device_data) {
         free(baikal->device_data);
@@ -289,7 +317,6 @@ static bool baikal_finalize(struct cgpu_info *baikal)
 
 static bool baikal_reset(struct cgpu_info *baikal)
 {
-    int amount;
     struct baikal_info *info    = baikal->device_data;
     baikal_msg msg = {0, };
 
@@ -298,33 +325,18 @@ static bool baikal_reset(struct cgpu_info *baikal)
     msg.len         = 0;
     msg.dest        = 0;
 
-    mutex_lock(baikal->mutex);
-
-    amount = baikal_sendmsg(baikal, &msg);
-    if (amount < 0) {
-        mutex_unlock(baikal->mutex);
-        return (false);
-    }
-
-    cgsleep_ms(200);
-
-    amount = baikal_readmsg(baikal, &msg, 7);
-    if (amount < 0) {
-        mutex_unlock(baikal->mutex);
+    if (baikal_command(baikal, &msg) != true) {
         return (false);
     }
 
     info->miner_count = msg.param;
 
-    mutex_unlock(baikal->mutex);
-
     return (true);
 }
 
 
 static bool baikal_getinfo(struct cgpu_info *baikal)
 {
-    int amount;
     uint16_t sign;
     baikal_msg msg = {0, };
     struct baikal_info *info    = baikal->device_data;
@@ -335,25 +347,10 @@ static bool baikal_getinfo(struct cgpu_info *baikal)
     msg.dest        = 0;
     msg.len         = 0;
 
-    mutex_lock(baikal->mutex);
-
-    amount = baikal_sendmsg(baikal, &msg);
-    if (amount < 0) {
-        mutex_unlock(baikal->mutex);
-        return (false);
-    }
-
-    // TODO :
-    cgsleep_ms(200);
-
-    amount = baikal_readmsg(baikal, &msg, 21);
-    if (amount < 0) {
-        mutex_unlock(baikal->mutex);
+    if (baikal_command(baikal, &msg) != true) {
         return (false);
     }
 
-    mutex_unlock(baikal->mutex);
-
     miner->fw_ver       = msg.data[0];
     miner->hw_ver       = msg.data[1];
     miner->bbg          = msg.data[2];
@@ -361,7 +358,7 @@ static bool baikal_getinfo(struct cgpu_info *baikal)
     miner->asic_count   = msg.data[4];
     miner->asic_count_r = msg.data[5];
     miner->asic_ver     = msg.data[6]; 
-    miner->working_diff = 0.1;
+    miner->working_diff = BAIKAL_DIFF_DEF;
     miner->work_idx     = 0;
     miner->working      = true;
     miner->overheated   = false;
@@ -372,7 +369,6 @@ static bool baikal_getinfo(struct cgpu_info *baikal)
 
 static bool baikal_setoption(struct cgpu_info *baikal, uint16_t clk, uint8_t mode, uint8_t temp, uint8_t fanspeed)
 {
-    int amount;
     baikal_msg msg = {0, };
 
     msg.miner_id    = baikal->miner_id;
@@ -384,30 +380,12 @@ static bool baikal_setoption(struct cgpu_info *baikal, uint16_t clk, uint8_t mod
     msg.dest        = 0;
     msg.len         = 4;
 
-    mutex_lock(baikal->mutex);
-
-    amount = baikal_sendmsg(baikal, &msg);
-    if (amount < 0) {
-        mutex_unlock(baikal->mutex);
-        return (false);
-    }
-
-    amount = baikal_readmsg(baikal, &msg, 7);
-    if (amount < 0) {
-        mutex_unlock(baikal->mutex);
-        return (false);
-    }
-
-    mutex_unlock(baikal->mutex);
-
-    return (true);
+    return (baikal_command(baikal, &msg));
 }
 
 
 static bool baikal_setidle(struct cgpu_info *baikal)
 {
-    int amount;
-    struct baikal_info *info    = baikal->device_data;
     baikal_msg msg = {0, };
 
     msg.miner_id    = baikal->miner_id; 
@@ -415,10 +393,8 @@ static bool baikal_setidle(struct cgpu_info *baikal)
     msg.len         = 0;
     msg.dest        = 0;
 
-    mutex_lock(baikal->mutex);
-
-    amount = baikal_sendmsg(baikal, &msg);
-    mutex_unlock(baikal->mutex);
+    /* no reply is read back for SET_IDLE */
+    baikal_sendmsg(baikal, &msg);
 
     return (true);
 }
@@ -475,12 +451,22 @@ static void baikal_detect(void)
     int fanspeed        = BAIKAL_FANSPEED_DEF;
     int recovertemp     = BAIKAL_RECOVER_TEMP;
     uint8_t miner_type  = BAIKAL_MINER_TYPE_NONE;
+    const char *devpath = BAIKAL_IO_PORT;
+    char *simpath       = NULL;
 
     if (detect_one == true) {
         return;
     }
 
-    if (baikal_exist(&miner_type) != true) {
+    /* simulated boards sit behind a pty, there is no GPIO to probe */
+    if (opt_baikal_sim != NULL) {
+        simpath = baikal_sim_start(opt_baikal_sim);
+        if (simpath == NULL) {
+            return;
+        }
+        devpath = simpath;
+    }
+    else if (baikal_exist(&miner_type) != true) {
         return;
     }
 
@@ -521,6 +507,10 @@ static void baikal_detect(void)
     info->fanspeed      = (uint8_t)fanspeed;
     info->recovertemp   = (uint8_t)recovertemp;
     info->miner_type    = miner_type;   
+    info->sendmsg       = baikal_sendmsg;
+    info->timeout       = BAIKAL_COM_TIMEOUT;
+    baikal_io_init(&info->io);
+    mutex_init(&info->nonce_lock);
 
     baikal->device_data = info;
     baikal->name        = strdup("BKLS");
@@ -530,12 +520,19 @@ static void baikal_detect(void)
     memset(miner, 0, sizeof(struct miner_info));
     cgtimer_time(&miner->start_time);
 
-    baikal->fd = baikal_init_com(BAIKAL_IO_PORT, BAIKAL_IO_SPEED, 30);
+    /* reads only happen once poll() reports data, so no VTIME */
+    baikal->fd = baikal_init_com(devpath, BAIKAL_IO_SPEED, 0);
+    free(simpath);
     if (baikal->fd < 0) {
         goto out;
     }
 
     baikal_reset_boards(baikal);
+    tcflush(baikal->fd, TCIFLUSH);
+
+    if (baikal_io_start(&info->io, baikal_io_thread, baikal) != true) {
+        goto out;
+    }
 
     if (baikal_reset(baikal) != true) {
         goto out;
@@ -594,6 +591,9 @@ static struct api_data* baikal_api_stats(struct cgpu_info *cgpu)
     root = api_add_int(root, "HWV", (int *)&miner->hw_ver, false);
     root = api_add_int(root, "FWV", (int *)&miner->fw_ver, false);
     root = api_add_string(root, "Algo", (char *)algorithm_type_str[thr->cgpu->algorithm.type], false);
+    root = baikal_api_diff(root, miner);
+    root = baikal_api_rate(root, miner);
+    root = baikal_api_health(root, miner);
 
     return (root);
 }
@@ -601,7 +601,6 @@ static struct api_data* baikal_api_stats(struct cgpu_info *cgpu)
 
 static void baikal_identify(struct cgpu_info *baikal)
 {
-    int amount;
     baikal_msg msg = {0, };
 
     msg.miner_id    = baikal->miner_id;
@@ -609,21 +608,7 @@ static void baikal_identify(struct cgpu_info *baikal)
     msg.dest        = 0;
     msg.len         = 0;
 
-    mutex_lock(baikal->mutex);
-
-    amount = baikal_sendmsg(baikal, &msg);
-    if (amount < 0) {
-        mutex_unlock(baikal->mutex);
-        return;
-    }
-
-    amount = baikal_readmsg(baikal, &msg, 7);
-    if (amount < 0) {
-        mutex_unlock(baikal->mutex);
-        return;
-    }
-
-    mutex_unlock(baikal->mutex);
+    baikal_command(baikal, &msg);
 }
 
 
@@ -638,270 +623,6 @@ static bool baikal_prepare(struct thr_info *thr)
 }
 
 
-static void baikal_checknonce(struct cgpu_info *baikal, baikal_msg *msg)
-{
-    struct baikal_info *info = baikal->device_data;
-    struct miner_info *miner = &info->miners[msg->miner_id];
-    uint8_t work_idx, chip_id, unit_id;
-    uint32_t nonce;
-
-    chip_id     = msg->data[4];
-    work_idx    = msg->data[5];
-    unit_id     = msg->data[7];
-    nonce       = *((uint32_t *)msg->data);
-
-    if (work_idx >= BAIKAL_WORK_FIFO) {
-        return;
-    }
-
-    if ((miner->works[work_idx] == NULL) || (baikal==NULL)) {
-        return;
-    }
-
-#if BAIKAL_CHECK_STALE
-    /* stale work */
-    if (miner->works[work_idx]->devflag == false) {
-        return;
-    }
-#endif 
-
-    /* check algorithm */
-    if (miner->works[work_idx]->pool->algorithm.type != baikal->algorithm.type) {
-        return;
-    }
-
-    if (submit_nonce(mining_thr[miner->thr_id], miner->works[work_idx], nonce) == true) {
-        miner->asics[unit_id][chip_id].nonce++;
-        miner->nonce++;
-    }
-    else {
-        applog(LOG_ERR, "hw error : %d[u:%d, c:%2d] : [%3d, %08x]", msg->miner_id, unit_id, chip_id, work_idx, nonce);
-        miner->asics[unit_id][chip_id].error++;
-		//miner->asics[unit_id][chip_id].nonce++;
-        miner->error++;
-        //hw_errors_bkl++;
-    }
-}
-
-
-static bool baikal_send_work(struct cgpu_info *baikal, int miner_id)
-{
-    struct baikal_info *info = baikal->device_data;
-    struct miner_info *miner = &info->miners[miner_id];
-    struct thr_info *thr = mining_thr[miner->thr_id];
-    struct work *work;
-    uint32_t target;
-    baikal_msg msg;
-    uint8_t algo;
-
-    /* Do not send */
-    if (miner->overheated == true) {
-        return (true);
-    }
-
-	mutex_lock(baikal->mutex);
-    if (miner->works[miner->work_idx] == NULL) {
-        work = get_work(thr, miner->thr_id);
-        work->devflag = true;
-        miner->works[miner->work_idx] = work;
-
-#if 0   /* TODO : Performance Check */
-        if (thr->work_restart) {                   
-            free_work(miner->works[miner->work_idx]);
-            miner->works[miner->work_idx] = NULL;    
-            applog(LOG_ERR, "work restart\n");     
-	        mutex_unlock(baikal->mutex);           
-            return true;                           
-        }                                          
-
-        uint32_t *work_nonce = (uint32_t *)(work->data + 39); 
-        applog(LOG_ERR, "start_nonce : %x\n", *work_nonce);
-#endif
-    }
-    
-    if (work->pool->algorithm.type != thr->cgpu->algorithm.type) {
-        thr->cgpu->algorithm.type = work->pool->algorithm.type;
-    }
-
-    work->device_diff = MAX(miner->working_diff, work->work_difficulty);    
-    //work->device_diff = MIN(miner->working_diff, work->work_difficulty);
-    set_target(work->device_target, work->device_diff, work->pool->algorithm.diff_multiplier2, work->thr_id);
-
-    memset(msg.data, 0x0, 512);
-    msg.data[0] = to_baikal_algorithm(work->pool->algorithm.type);
-    msg.data[1] = miner_id;
-    memcpy(&msg.data[2], &work->device_target[24], 8);    
-    if (*((uint32_t *)&msg.data[6]) != 0x0) { // TripleS
-        memset(&msg.data[2], 0xFF, 4);
-    }
-
-    switch (baikal->algorithm.type) {
-    case ALGO_BLAKECOIN:        // blake256r8
-    case ALGO_VANILLA:
-        if (work->pool->algorithm.calc_midstate) {   // use midstate
-            msg.data[0] += 1;
-
-            memcpy(&msg.data[10], work->midstate, 32);
-            memcpy(&msg.data[42], &work->data[64], 16);
-            be32enc_vect((uint32_t *)&msg.data[42], (const uint32_t *)&msg.data[42], 4);
-            *((uint32_t *)&msg.data[58]) = 0x00000080;
-            *((uint32_t *)&msg.data[94]) = 0x01000000;
-            *((uint32_t *)&msg.data[102]) = 0x80020000;
-            msg.len = 106;
-        }
-        else {
-            memcpy(&msg.data[10], work->data, 80);
-            be32enc_vect((uint32_t *)&msg.data[10], (const uint32_t *)&msg.data[10], 20);
-            msg.len = 90;
-        }
-        break;
-
-    case ALGO_DECRED:           // blake256r14
-        if (work->pool->algorithm.calc_midstate) {   // use midstate
-            msg.data[0] += 1;
-
-            memcpy(&msg.data[10], work->midstate, 32);
-            memcpy(&msg.data[42], &work->data[128], 52);
-            *((uint32_t *)&msg.data[94]) = 0x01000080UL;
-            *((uint32_t *)&msg.data[98]) = 0x00000000UL;
-            *((uint32_t *)&msg.data[102]) = 0xa0050000UL;
-            msg.len = 106;
-        }
-        else {
-            memcpy(&msg.data[10], work->data, 180);
-            msg.len = 190;
-        }
-        break;
-    case ALGO_SIA:              // blake2b
-        memcpy(&msg.data[10], work->data, 80);
-        be32enc_vect((uint32_t *)&msg.data[10], (const uint32_t *)&msg.data[10], 20);
-        msg.len = 90;
-        break;
-
-    case ALGO_LBRY:             // lbry-all
-        memcpy(&msg.data[10], work->data, 112);
-        be32enc_vect((uint32_t *)&msg.data[10], (const uint32_t *)&msg.data[10], 27);
-        msg.len = 122;
-        break;
-
-    case ALGO_PASCAL:           // lbry-sha
-        memcpy(&msg.data[10], work->data, 200);
-        msg.len = 210;
-        break;
-
-    case ALGO_X11:
-    case ALGO_X11GOST:
-    case ALGO_SKEINCOIN:
-    case ALGO_MYRIAD_GROESTL:
-    case ALGO_QUARK:
-    case ALGO_QUBIT:
-    case ALGO_GROESTL:
-    case ALGO_SKEIN2:
-    case ALGO_NIST:
-    case ALGO_CRYPTONIGHT:
-    case ALGO_CRYPTONIGHT_LITE:
-    case ALGO_BLAKE:
-    case ALGO_VELTOR:
-    default:
-        memcpy(&msg.data[10], work->data, 80);
-        msg.len = 90;
-        break;
-    }
-    msg.miner_id    = miner_id;
-    msg.cmd         = BAIKAL_SEND_WORK;
-    msg.param       = miner->work_idx;
-    msg.dest        = 0;
-
-    if (baikal_sendmsg(baikal, &msg) < 0) {
-        applog(LOG_ERR, "baikal_send_work : sendmsg error[%d]", miner_id);
-        mutex_unlock(baikal->mutex);
-        return (false);
-    }
-
-    if (baikal_readmsg(baikal, &msg, 7) < 0) {
-        applog(LOG_ERR, "baikal_send_work : readmsg error[%d]", miner_id);
-        mutex_unlock(baikal->mutex);
-        return (false);
-    }
-
-    /* update clock */
-    miner->clock = msg.param << 1;
-
-    miner->work_idx++;
-    if (miner->work_idx >= BAIKAL_WORK_FIFO) {
-        miner->work_idx = 0;
-    }
-
-    if (miner->works[miner->work_idx] != NULL) {
-        free_work(miner->works[miner->work_idx]);
-        miner->works[miner->work_idx] = NULL;
-    }
-        
-    /* TODO */		
-    //cgtimer_time(&miner->start_time);
-    mutex_unlock(baikal->mutex);
-
-    return (true);
-}
-
-
-static bool baikal_process_result(struct cgpu_info *baikal)
-{
-    struct baikal_info *info = baikal->device_data;
-    struct miner_info *miner;
-    baikal_msg msg = {0, };
-    int i;    
-
-    for (i = 0; i < info->miner_count; i++) {
-        miner = &info->miners[i];
-        if (miner->working == true) {            
-            msg.miner_id    = i;
-            msg.cmd         = BAIKAL_GET_RESULT;
-            msg.dest        = 0;
-            msg.len         = 0;
-
-            mutex_lock(baikal->mutex);
-            if (baikal_sendmsg(baikal, &msg) < 0) {
-                applog(LOG_ERR, "baikal_process_result : sendmsg error");
-                mutex_unlock(baikal->mutex);
-                return (false);
-            }
-
-            if (baikal_readmsg(baikal, &msg, 23) < 0) {
-                applog(LOG_ERR, "baikal_process_result : readmsg error miner_id = %d", i);
-                mutex_unlock(baikal->mutex);
-                return (false);
-            }
-            mutex_unlock(baikal->mutex);
-            
-            miner->temp = msg.data[6];
-
-            if (msg.param & 0x01) {
-                baikal_checknonce(baikal, &msg);
-            }
-
-            if (msg.param & 0x02) {
-                baikal_send_work(baikal, i);    
-            }
-
-            if (msg.param & 0x04) {
-                return false;
-            }              
-
-            if (miner->temp > info->cutofftemp) {
-                miner->overheated = true;
-            }
-            else if (miner->temp < info->recovertemp) {
-                miner->overheated = false;
-            }
-            			
-            cgsleep_ms(1);
-        }        
-    }
-
-    return (true);
-}
-
 static int64_t baikal_hash_done(struct cgpu_info *baikal, struct miner_info *miner, int elpased)
 {
     int64_t hash_done = 0;
@@ -959,7 +680,7 @@ static int64_t baikal_scanhash(struct thr_info *thr)
     struct baikal_info *info = baikal->device_data;
     struct miner_info *miner = &info->miners[baikal->miner_id];
     cgtimer_t now;
-    int elapsed, i;
+    int elapsed, clock, i;
    
     if (baikal->usbinfo.nodev) {
         return (-1);
@@ -981,17 +702,30 @@ static int64_t baikal_scanhash(struct thr_info *thr)
         return 0;
     }
 
+    baikal_diff_update(info, miner);
+
+    clock = baikal_health_update(info, miner);
+    if (clock > 0) {
+        if (baikal_setoption(baikal, clock, to_baikal_algorithm(baikal->algorithm.type), info->cutofftemp, info->fanspeed) == true) {
+            miner->derate = info->clock - clock;
+        }
+        else {
+            applog(LOG_ERR, "baikal %d : failed to set clock %d MHz", miner->thr_id, clock);
+        }
+    }
+
     cgtimer_time(&now);
     elapsed = cgtimer_to_ms(&now) - cgtimer_to_ms(&miner->start_time);
     miner->start_time = now; 
 
-    return (baikal_hash_done(baikal, miner, elapsed));    
+    return (baikal_rate_update(info, miner, baikal_hash_done(baikal, miner, elapsed)));
 }
 
 
 static void baikal_update_work(struct cgpu_info *baikal)
 {
     int i, j, count;
+    bool ok = true;
     struct timeval now;
     struct baikal_info *info = baikal->device_data;
     struct miner_info *miner;
@@ -1021,13 +755,24 @@ static void baikal_update_work(struct cgpu_info *baikal)
             }
             mutex_unlock(baikal->mutex);                           
 #endif 
+        }
 
-            for (j = 0; j < count; j++) {
-                if (baikal_send_work(baikal, i) != true) {
-                    baikal_cleanup(baikal);
-                    break;
+        /* one SEND_WORK per board in flight at a time */
+        for (j = 0; j < count; j++) {
+            for (i = 0; i < info->miner_count; i++) {
+                if (baikal_send_work_post(baikal, i) != true) {
+                    ok = false;
                 }
             }
+            for (i = 0; i < info->miner_count; i++) {
+                if (baikal_send_work_wait(baikal, i) != true) {
+                    ok = false;
+                }
+            }
+            if (ok != true) {
+                baikal_cleanup(baikal);
+                break;
+            }
         }
     }
 }
@@ -32,25 +32,17 @@ static int api_clock = BAIKAL_CLK_DEF;
 
 static int baikal_sendmsg(struct cgpu_info *baikal, baikal_msg *msg)
 {
+    struct baikal_info *info = baikal->device_data;
     int err;
-    int i, pos = 0;
+    int pos;
     int amount;
-    uint8_t buf[512] = {0, };
-
-    buf[pos++] = ':';
-    buf[pos++] = msg->miner_id;
-    buf[pos++] = msg->cmd;
-    buf[pos++] = msg->param;
-    buf[pos++] = msg->dest;
-
-    for (i = 0; i < msg->len; i++, pos += 2) {
-        buf[pos + 1] = msg->data[i];
-    }
+    uint8_t buf[BAIKAL_FRAME_MAX * 2] = {0, };
 
-    buf[pos++] = '\r';
-    buf[pos++] = '\n';
+    pos = baikal_encode(msg, buf);
 
+    mutex_lock(&info->io.wlock);
     err = usb_write(baikal, (char *)buf, pos, &amount, C_BAIKAL_SEND);
+    mutex_unlock(&info->io.wlock);
     if (err < 0) {
         applog(LOG_ERR, "baikal_sendmsg error(%d)\n", err);
         return (err);
@@ -60,36 +52,33 @@ static int baikal_sendmsg(struct cgpu_info *baikal, baikal_msg *msg)
 }
 
 
-static int baikal_readmsg(struct cgpu_info *baikal, baikal_msg *msg, int size)
+/* Called from the USB polling thread with every read that completes, the
+ * read is resubmitted right away so a reply never waits for a reader */
+static void baikal_io_read(__maybe_unused struct cgpu_info *baikal, unsigned char *buf, int amount, int err, void *arg)
 {
-    int err;
-    int amount;
-    int len, pos = 1;
-    uint8_t buf[128] = {0, };
+    struct baikal_io *io = (struct baikal_io *)arg;
 
-    err = usb_read_once(baikal, (char *)buf, size, &amount, C_BAIKAL_READ);
-    if (err < 0 || amount < 7) {
-        return (err);
+    if (amount > 0) {
+        baikal_parser_feed(io, buf, amount);
+        return;
     }
 
-    if ((buf[0] != ':') || (buf[amount - 2] != '\r') || (buf[amount - 1] != '\n')) {
-        return (-1);
+    if (err != LIBUSB_ERROR_TIMEOUT) {
+        applog(LOG_ERR, "baikal_io_read : read error(%d)", err);
     }
+    baikal_io_fail(io);
+}
 
-    msg->miner_id   = buf[pos++];
-    msg->cmd        = buf[pos++];
-    msg->param      = buf[pos++];
-    msg->dest       = buf[pos++];
 
-    for (len = 0; pos < amount - 2; len++, pos += 2) {
-        msg->data[len] = buf[pos + 1];
+static void baikal_io_read_stop(struct baikal_info *info)
+{
+    if (info->read_ut != NULL) {
+        usb_read_async_stop(info->read_ut);
+        info->read_ut = NULL;
     }
-
-    msg->len = len;
-
-    return (amount);
 }
 
+
 static void baikal_cleanup(struct cgpu_info *baikal)
 {
     int i;
@@ -98,6 +87,9 @@ static void baikal_cleanup(struct cgpu_info *baikal)
     struct cgpu_info *tmp;
     struct thr_info *thr;
 
+    /* the read must be gone before usb_nodev() closes the handle */
+    baikal_io_read_stop(info);
+
     for (i = 0; i < info->miner_count; i++) {
         miner  = &info->miners[i];
         thr = mining_thr[miner->thr_id];
@@ -109,18 +101,20 @@ static void baikal_cleanup(struct cgpu_info *baikal)
             usb_nodev(tmp);
         }
     }
+
+    baikal_nonce_drain(info);
 }
 
 
 static void baikal_clearbuffer(struct cgpu_info *baikal)
 {
-    int err, retries = 0;
-    baikal_msg msg;
+    int err, amount, retries = 0;
+    char buf[128];
 
     do {
-        err = baikal_readmsg(baikal, &msg, 128);
+        err = usb_read_once(baikal, buf, sizeof(buf), &amount, C_BAIKAL_READ);
         usb_buffer_clear(baikal);
-        if (err < 0)
+        if ((err < 0) || (amount <= 0))
             break;
     }
     while (retries++ < 10);
@@ -129,6 +123,13 @@ static void baikal_clearbuffer(struct cgpu_info *baikal)
 
 static bool baikal_finalize(struct cgpu_info *baikal)
 {
+    struct baikal_info *info = baikal->device_data;
+
+    if (info) {
+        baikal_io_read_stop(info);
+        baikal_nonce_drain(info);
+    }
+
     usb_uninit(baikal);
 
     if (baikal->device_data) {
@@ -152,7 +153,6 @@ static bool baikal_finalize(struct cgpu_info *baikal)
 
 static bool baikal_reset(struct cgpu_info *baikal)
 {
-    int amount;
     struct baikal_info *info    = baikal->device_data;
     baikal_msg msg = {0, };
 
@@ -161,31 +161,18 @@ static bool baikal_reset(struct cgpu_info *baikal)
     msg.len         = 0;
     msg.dest        = 0;
 
-    mutex_lock(baikal->mutex);
-
-    amount = baikal_sendmsg(baikal, &msg);
-    if (amount < 0) {
-        mutex_unlock(baikal->mutex);
-        return (false);
-    }
-
-    amount = baikal_readmsg(baikal, &msg, 7);
-    if (amount < 0) {
-        mutex_unlock(baikal->mutex);
+    if (baikal_command(baikal, &msg) != true) {
         return (false);
     }
 
     info->miner_count = msg.param;
 
-    mutex_unlock(baikal->mutex);
-
     return (true);
 }
 
 
 static bool baikal_getinfo(struct cgpu_info *baikal)
 {
-    int amount;
     uint16_t sign;
     baikal_msg msg = {0, };
     struct baikal_info *info    = baikal->device_data;
@@ -196,22 +183,10 @@ static bool baikal_getinfo(struct cgpu_info *baikal)
     msg.dest        = 0;
     msg.len         = 0;
 
-    mutex_lock(baikal->mutex);
-
-    amount = baikal_sendmsg(baikal, &msg);
-    if (amount < 0) {
-        mutex_unlock(baikal->mutex);
-        return (false);
-    }
-
-    amount = baikal_readmsg(baikal, &msg, 21);
-    if (amount < 0) {
-        mutex_unlock(baikal->mutex);
+    if (baikal_command(baikal, &msg) != true) {
         return (false);
     }
 
-    mutex_unlock(baikal->mutex);
-
     miner->fw_ver       = msg.data[0];
     miner->hw_ver       = msg.data[1];
     miner->bbg          = msg.data[2];
@@ -219,7 +194,7 @@ static bool baikal_getinfo(struct cgpu_info *baikal)
     miner->asic_count   = msg.data[4];
     miner->asic_count_r = msg.data[5];
     miner->asic_ver     = msg.data[6];
-    miner->working_diff = 0.1;
+    miner->working_diff = BAIKAL_DIFF_DEF;
     miner->work_idx     = 0;
     miner->working      = true;
     miner->overheated   = false;
@@ -231,7 +206,6 @@ static bool baikal_getinfo(struct cgpu_info *baikal)
 
 static bool baikal_setoption(struct cgpu_info *baikal, uint16_t clk, uint8_t mode, uint8_t temp, uint8_t fanspeed)
 {
-    int amount;
     baikal_msg msg = {0, };
 
     msg.miner_id    = baikal->miner_id;
@@ -243,30 +217,12 @@ static bool baikal_setoption(struct cgpu_info *baikal, uint16_t clk, uint8_t mod
     msg.dest        = 0;
     msg.len         = 4;
 
-    mutex_lock(baikal->mutex);
-
-    amount = baikal_sendmsg(baikal, &msg);
-    if (amount < 0) {
-        mutex_unlock(baikal->mutex);
-        return (false);
-    }
-
-    amount = baikal_readmsg(baikal, &msg, 7);
-    if (amount < 0) {
-        mutex_unlock(baikal->mutex);
-        return (false);
-    }
-
-    mutex_unlock(baikal->mutex);
-
-    return (true);
+    return (baikal_command(baikal, &msg));
 }
 
 
 static bool baikal_setidle(struct cgpu_info *baikal)
 {
-    int amount;
-    struct baikal_info *info    = baikal->device_data;
     baikal_msg msg = {0, };
 
     msg.miner_id    = baikal->miner_id;
@@ -274,10 +230,8 @@ static bool baikal_setidle(struct cgpu_info *baikal)
     msg.len         = 0;
     msg.dest        = 0;
 
-    mutex_lock(baikal->mutex);
-
-    amount = baikal_sendmsg(baikal, &msg);
-    mutex_unlock(baikal->mutex);
+    /* no reply is read back for SET_IDLE */
+    baikal_sendmsg(baikal, &msg);
 
     return (true);
 }
@@ -374,6 +328,12 @@ static struct cgpu_info* baikal_detect_one(struct libusb_device *dev, struct usb
     info->cutofftemp    = (uint8_t)cutofftemp;
     info->fanspeed      = (uint8_t)fanspeed;
     info->recovertemp   = (uint8_t)recovertemp;
+    info->sendmsg       = baikal_sendmsg;
+    info->timeout       = BAIKAL_IO_TIMEOUT;
+    info->share_work    = true;
+    info->nicehash_nonce = true;
+    baikal_io_init(&info->io);
+    mutex_init(&info->nonce_lock);
 
     baikal->device_data = info;
     baikal->name        = strdup("BKLU");
@@ -390,6 +350,11 @@ static struct cgpu_info* baikal_detect_one(struct libusb_device *dev, struct usb
 
     baikal_clearbuffer(baikal);
 
+    info->read_ut = usb_read_async(baikal, BAIKAL_FRAME_MAX, baikal_io_read, &info->io);
+    if (info->read_ut == NULL) {
+        goto out;
+    }
+
     if (baikal_reset(baikal) != true) {
         goto out;
     }
@@ -454,6 +419,9 @@ static struct api_data* baikal_api_stats(struct cgpu_info *cgpu)
     root = api_add_int(root, "HWV", (int *)&miner->hw_ver, false);
     root = api_add_int(root, "FWV", (int *)&miner->fw_ver, false);
     root = api_add_string(root, "Algo", (char *)algorithm_type_str[thr->cgpu->algorithm.type], false);
+    root = baikal_api_diff(root, miner);
+    root = baikal_api_rate(root, miner);
+    root = baikal_api_health(root, miner);
 
     return (root);
 }
@@ -461,7 +429,6 @@ static struct api_data* baikal_api_stats(struct cgpu_info *cgpu)
 
 static void baikal_identify(struct cgpu_info *baikal)
 {
-    int amount;
     baikal_msg msg = {0, };
 
     msg.miner_id    = baikal->miner_id;
@@ -469,21 +436,7 @@ static void baikal_identify(struct cgpu_info *baikal)
     msg.dest        = 0;
     msg.len         = 0;
 
-    mutex_lock(baikal->mutex);
-
-    amount = baikal_sendmsg(baikal, &msg);
-    if (amount < 0) {
-        mutex_unlock(baikal->mutex);
-        return;
-    }
-
-    amount = baikal_readmsg(baikal, &msg, 7);
-    if (amount < 0) {
-        mutex_unlock(baikal->mutex);
-        return;
-    }
-
-    mutex_unlock(baikal->mutex);
+    baikal_command(baikal, &msg);
 }
 
 
@@ -498,279 +451,6 @@ static bool baikal_prepare(struct thr_info *thr)
 }
 
 
-static void baikal_checknonce(struct cgpu_info *baikal, baikal_msg *msg)
-{
-    struct baikal_info *info = baikal->device_data;
-    struct miner_info *miner = &info->miners[msg->miner_id];
-    uint8_t work_idx, chip_id, unit_id;
-    uint32_t nonce;
-
-    chip_id     = msg->data[4];
-    work_idx    = msg->data[5];
-    unit_id     = msg->data[7];
-    nonce       = *((uint32_t *)msg->data);
-
-    if (work_idx >= BAIKAL_WORK_FIFO) {
-        return;
-    }
-
-    if ((miner->works[work_idx] == NULL) || (baikal==NULL)) {
-        return;
-    }
-
-#if BAIKAL_CHECK_STALE
-    /* stale work */
-    if (miner->works[work_idx]->devflag == false) {
-        return;
-    }
-#endif
-
-    /* check algorithm */
-    if (miner->works[work_idx]->pool->algorithm.type != baikal->algorithm.type) {
-		//applog(LOG_ERR, "? : %d[u:%d, c:%2d] : [%3d, %08x]", msg->miner_id, unit_id, chip_id, work_idx, nonce);
-        return;
-    }
-
-    if (submit_nonce(mining_thr[miner->thr_id], miner->works[work_idx], nonce) == true) {
-		//applog(LOG_ERR, "stale : %d[u:%d, c:%2d] : [%3d, %08x]", msg->miner_id, unit_id, chip_id, work_idx, nonce);
-        miner->asics[unit_id][chip_id].nonce++;
-        miner->nonce++;
-    }
-    else {
-        applog(LOG_ERR, "hw error : %d[u:%d, c:%2d] : [%3d, %08x]", msg->miner_id, unit_id, chip_id, work_idx, nonce);
-        miner->asics[unit_id][chip_id].error++;
-		//miner->asics[unit_id][chip_id].nonce++;
-        miner->error++;
-        hw_errors_bkl++;
-    }
-}
-
-
-static bool baikal_send_work(struct cgpu_info *baikal, int miner_id)
-{
-    struct baikal_info *info = baikal->device_data;
-    struct miner_info *miner = &info->miners[miner_id];
-
-    struct thr_info *thr = mining_thr[miner->thr_id];
-    struct work *work;
-    uint32_t target;
-    baikal_msg msg;
-    uint8_t algo;
-
-    /* Do not send */
-    if (miner->overheated == true) {
-        return (true);
-    }
-
-	mutex_lock(baikal->mutex);
-
-    if (miner->works[miner->work_idx] == NULL) {        
-        if ((miner_id != 0) && (miner->asic_ver == 0x51)) {
-            struct miner_info *miner_base = &info->miners[0];
-            int idx = (miner_base->work_idx - 1) % BAIKAL_WORK_FIFO;
-            work = copy_work(miner_base->works[idx]);            
-            work->thr_id = miner->thr_id;            
-        }
-        else {
-            work = get_work(thr, miner->thr_id);            
-        }
-        miner->works[miner->work_idx] = work;
-        work->devflag = true;
-    }
-
-    if (work->pool->algorithm.type != thr->cgpu->algorithm.type) {
-        thr->cgpu->algorithm.type = work->pool->algorithm.type;
-    }
-
-    work->device_diff = MAX(miner->working_diff, work->work_difficulty);
-    //work->device_diff = MIN(miner->working_diff, work->work_difficulty);
-    set_target(work->device_target, work->device_diff, work->pool->algorithm.diff_multiplier2, work->thr_id);
-
-    memset(msg.data, 0x0, 512);
-    msg.data[0] = to_baikal_algorithm(work->pool->algorithm.type);
-    msg.data[1] = miner_id;
-    memcpy(&msg.data[2], &work->device_target[24], 8);
-    if (*((uint32_t *)&msg.data[6]) != 0x0) { // TripleS
-        memset(&msg.data[2], 0xFF, 4);
-    }
-
-    switch (baikal->algorithm.type) {
-    case ALGO_BLAKECOIN:        // blake256r8
-    case ALGO_VANILLA:
-        if (work->pool->algorithm.calc_midstate) {   // use midstate
-            msg.data[0] += 1;
-
-            memcpy(&msg.data[10], work->midstate, 32);
-            memcpy(&msg.data[42], &work->data[64], 16);
-            be32enc_vect((uint32_t *)&msg.data[42], (const uint32_t *)&msg.data[42], 4);
-            *((uint32_t *)&msg.data[58]) = 0x00000080;
-            *((uint32_t *)&msg.data[94]) = 0x01000000;
-            *((uint32_t *)&msg.data[102]) = 0x80020000;
-            msg.len = 106;
-        }
-        else {
-            memcpy(&msg.data[10], work->data, 80);
-            be32enc_vect((uint32_t *)&msg.data[10], (const uint32_t *)&msg.data[10], 20);
-            msg.len = 90;
-        }
-        break;
-
-    case ALGO_DECRED:           // blake256r14
-        if (work->pool->algorithm.calc_midstate) {   // use midstate
-            msg.data[0] += 1;
-
-            memcpy(&msg.data[10], work->midstate, 32);
-            memcpy(&msg.data[42], &work->data[128], 52);
-            *((uint32_t *)&msg.data[94]) = 0x01000080UL;
-            *((uint32_t *)&msg.data[98]) = 0x00000000UL;
-            *((uint32_t *)&msg.data[102]) = 0xa0050000UL;
-            msg.len = 106;
-        }
-        else {
-            memcpy(&msg.data[10], work->data, 180);
-            msg.len = 190;
-        }
-        break;
-    case ALGO_SIA:              // blake2b
-        memcpy(&msg.data[10], work->data, 80);
-        be32enc_vect((uint32_t *)&msg.data[10], (const uint32_t *)&msg.data[10], 20);
-        msg.len = 90;
-        break;
-
-    case ALGO_LBRY:             // lbry-all
-        memcpy(&msg.data[10], work->data, 112);
-        be32enc_vect((uint32_t *)&msg.data[10], (const uint32_t *)&msg.data[10], 27);
-        msg.len = 122;
-        break;
-
-    case ALGO_PASCAL:           // lbry-sha
-        memcpy(&msg.data[10], work->data, 200);
-        msg.len = 210;
-        break;
-
-
-    case ALGO_CRYPTONIGHT:
-        if ((work->pool != NULL) && (strstr(work->pool->rpc_url, "nicehash") != NULL)) {
-            msg.data[0] += 1;   // cn_nice
-        }
-
-        memcpy(&msg.data[10], work->data, 80);
-        msg.len = 90;
-        break;
-
-    case ALGO_CRYPTONIGHT_LITE:
-    case ALGO_X11:
-    case ALGO_X11GOST:
-    case ALGO_SKEINCOIN:
-    case ALGO_MYRIAD_GROESTL:
-    case ALGO_QUARK:
-    case ALGO_QUBIT:
-    case ALGO_GROESTL:
-    case ALGO_SKEIN2:
-    case ALGO_NIST:
-    case ALGO_BLAKE:
-    case ALGO_VELTOR:
-    default:
-        memcpy(&msg.data[10], work->data, 80);
-        msg.len = 90;
-        break;
-    }
-
-    msg.miner_id    = miner_id;
-    msg.cmd         = BAIKAL_SEND_WORK;
-    msg.param       = miner->work_idx;
-    msg.dest        = 0;
-
-    if (baikal_sendmsg(baikal, &msg) < 0) {
-        applog(LOG_ERR, "baikal_send_work : sendmsg error[%d]", miner_id);
-        mutex_unlock(baikal->mutex);
-        return (false);
-    }
-
-    if (baikal_readmsg(baikal, &msg, 7) < 0) {
-        applog(LOG_ERR, "baikal_send_work : readmsg error[%d]", miner_id);
-        mutex_unlock(baikal->mutex);
-        return (false);
-    }
-
-    /* update clock */
-    miner->clock = msg.param << 1;
-
-    miner->work_idx++;
-    if (miner->work_idx >= BAIKAL_WORK_FIFO) {
-        miner->work_idx = 0;
-    }
-
-    if (miner->works[miner->work_idx] != NULL) {
-        free_work(miner->works[miner->work_idx]);
-        miner->works[miner->work_idx] = NULL;
-    }
-
-    /* TODO */
-    //cgtimer_time(&miner->start_time);
-    mutex_unlock(baikal->mutex);
-
-    return (true);
-}
-
-
-static bool baikal_process_result(struct cgpu_info *baikal)
-{
-    struct baikal_info *info = baikal->device_data;
-    struct miner_info *miner;
-    baikal_msg msg = {0, };
-    int i;
-
-    for (i = 0; i < info->miner_count; i++) {
-        miner = &info->miners[i];
-        if (miner->working == true) {
-            msg.miner_id    = i;
-            msg.cmd         = BAIKAL_GET_RESULT;
-            msg.dest        = 0;
-            msg.len         = 0;
-
-            mutex_lock(baikal->mutex);
-            if (baikal_sendmsg(baikal, &msg) < 0) {
-                applog(LOG_ERR, "baikal_process_result : sendmsg error");
-                mutex_unlock(baikal->mutex);
-                return (false);
-            }
-
-            if (baikal_readmsg(baikal, &msg, 23) < 0) {
-                applog(LOG_ERR, "baikal_process_result : readmsg error miner_id = %d", i);
-                mutex_unlock(baikal->mutex);
-                return (false);
-            }
-            mutex_unlock(baikal->mutex);
-
-            miner->temp = msg.data[6];
-
-            if (msg.param & 0x01) {
-                baikal_checknonce(baikal, &msg);
-            }
-
-            if (msg.param & 0x02) {
-                baikal_send_work(baikal, i);
-            }
-
-            if (msg.param & 0x04) {
-                return false;
-            }
-
-            if (miner->temp > info->cutofftemp) {
-                miner->overheated = true;
-            }
-            else if (miner->temp < info->recovertemp) {
-                miner->overheated = false;
-            }
-
-            cgsleep_ms(1);
-        }
-    }
-
-    return (true);
-}
-
 static int64_t baikal_hash_done(struct cgpu_info *baikal, struct miner_info *miner, int elpased)
 {
     int64_t hash_done = 0;
@@ -833,7 +513,7 @@ static int64_t baikal_scanhash(struct thr_info *thr)
     struct baikal_info *info = baikal->device_data;
     struct miner_info *miner = &info->miners[baikal->miner_id];
     cgtimer_t now;
-    int elapsed, i;
+    int elapsed, clock, i;
 
     if (baikal->usbinfo.nodev) {
         return (-1);
@@ -855,17 +535,30 @@ static int64_t baikal_scanhash(struct thr_info *thr)
         return 0;
     }
 
+    baikal_diff_update(info, miner);
+
+    clock = baikal_health_update(info, miner);
+    if (clock > 0) {
+        if (baikal_setoption(baikal, clock, to_baikal_algorithm(baikal->algorithm.type), info->cutofftemp, info->fanspeed) == true) {
+            miner->derate = info->clock - clock;
+        }
+        else {
+            applog(LOG_ERR, "baikal %d : failed to set clock %d MHz", miner->thr_id, clock);
+        }
+    }
+
     cgtimer_time(&now);
     elapsed = cgtimer_to_ms(&now) - cgtimer_to_ms(&miner->start_time);
     miner->start_time = now;
 
-    return (baikal_hash_done(baikal, miner, elapsed));
+    return (baikal_rate_update(info, miner, baikal_hash_done(baikal, miner, elapsed)));
 }
 
 
 static void baikal_update_work(struct cgpu_info *baikal)
 {
     int i, j, count;
+    bool ok = true;
     struct timeval now;
     struct baikal_info *info = baikal->device_data;
     struct miner_info *miner;
@@ -895,13 +588,24 @@ static void baikal_update_work(struct cgpu_info *baikal)
             }
             mutex_unlock(baikal->mutex);
 #endif
+        }
 
-            for (j = 0; j < count; j++) {
-                if (baikal_send_work(baikal, i) != true) {
-                    baikal_cleanup(baikal);
-                    break;
+        /* one SEND_WORK per board in flight at a time */
+        for (j = 0; j < count; j++) {
+            for (i = 0; i < info->miner_count; i++) {
+                if (baikal_send_work_post(baikal, i) != true) {
+                    ok = false;
                 }
             }
+            for (i = 0; i < info->miner_count; i++) {
+                if (baikal_send_work_wait(baikal, i) != true) {
+                    ok = false;
+                }
+            }
+            if (ok != true) {
+                baikal_cleanup(baikal);
+                break;
+            }
         }
     }
 }
@@ -0,0 +1,263 @@
+/*
+ * Shared executor for the short jobs that used to get a thread each:
+ * getwork share submission, OpenCL result checking and work restarts.
+ *
+ * A fixed set of workers takes tasks from one bounded queue per class.
+ * Submitters wait for room once EXEC_QUEUE_MAX tasks of their class are
+ * queued, except on a worker itself, which would otherwise deadlock the
+ * executor. Urgent tasks (restarts) go ahead of the queues and never wait.
+ * With two workers or more they also always find one free, other tasks
+ * only run on all workers but one. Of those, IO tasks get at most half, so
+ * from three workers up a pool that stops answering cannot hold up the CPU
+ * bound result checks. Otherwise the task queued first runs first.
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the Free
+ * Software Foundation; either version 3 of the License, or (at your option)
+ * any later version.  See COPYING for more details.
+ */
+
+#include "config.h"
+
+#include <string.h>
+#include <pthread.h>
+
+#include "logging.h"
+#include "miner.h"
+#include "util.h"
+#include "elist.h"
+#include "executor.h"
+
+struct exec_task {
+    exec_fn_t fn;
+    void *arg;
+    enum exec_class cls;
+    struct timeval tv_queued;
+    struct list_head list;
+};
+
+struct exec_queue {
+    struct list_head tasks;
+    int queued;
+    int busy;
+    int max;                    /* workers this class may run on */
+};
+
+static struct {
+    pthread_mutex_t lock;
+    pthread_cond_t work_cond;   /* a task was queued or a worker slot freed */
+    pthread_cond_t room_cond;   /* a task left a queue */
+    struct exec_queue queues[EXEC_CLASSES];
+    pthread_t *threads;
+    int normal_max;             /* workers that may run tasks that are not urgent */
+    int normal_busy;
+    bool started;
+    struct exec_stats stats;
+} exec;
+
+static bool exec_on_worker(void)
+{
+    pthread_t self = pthread_self();
+    int i;
+
+    for (i = 0; i < exec.stats.workers; i++) {
+        if (pthread_equal(exec.threads[i], self))
+            return (true);
+    }
+    return (false);
+}
+
+static void exec_run(struct exec_task *task)
+{
+    struct timeval tv_start, tv_end;
+    double wait, run;
+
+    cgtime(&tv_start);
+    wait = tdiff(&tv_start, &task->tv_queued) * 1000;
+    task->fn(task->arg);
+    cgtime(&tv_end);
+    run = tdiff(&tv_end, &tv_start) * 1000;
+
+    if (unlikely(!exec.started))
+        return;
+
+    mutex_lock(&exec.lock);
+    exec.stats.run++;
+    exec.stats.wait_total += wait;
+    if (wait > exec.stats.wait_max)
+        exec.stats.wait_max = wait;
+    exec.stats.run_total += run;
+    if (run > exec.stats.run_max)
+        exec.stats.run_max = run;
+    mutex_unlock(&exec.lock);
+}
+
+/* The oldest task a worker may start now, exec.lock held */
+static struct exec_task *exec_next(void)
+{
+    struct exec_task *task = NULL, *head;
+    struct exec_queue *q;
+    int cls;
+
+    q = &exec.queues[EXEC_URGENT];
+    if (!list_empty(&q->tasks))
+        return (list_entry(q->tasks.next, struct exec_task *, list));
+
+    if (exec.normal_busy >= exec.normal_max)
+        return (NULL);
+
+    for (cls = EXEC_URGENT + 1; cls < EXEC_CLASSES; cls++) {
+        q = &exec.queues[cls];
+        if (list_empty(&q->tasks) || q->busy >= q->max)
+            continue;
+        head = list_entry(q->tasks.next, struct exec_task *, list);
+        if (!task || tdiff(&task->tv_queued, &head->tv_queued) > 0)
+            task = head;
+    }
+
+    return (task);
+}
+
+static void *exec_thread(void __maybe_unused *userdata)
+{
+    struct exec_task *task;
+    struct exec_queue *q;
+
+    RenameThread("Exec");
+
+    mutex_lock(&exec.lock);
+    while (42) {
+        task = exec_next();
+        if (!task) {
+            pthread_cond_wait(&exec.work_cond, &exec.lock);
+            continue;
+        }
+
+        q = &exec.queues[task->cls];
+        list_del(&task->list);
+        q->queued--;
+        q->busy++;
+        if (task->cls != EXEC_URGENT)
+            exec.normal_busy++;
+        exec.stats.queued--;
+        exec.stats.busy++;
+        pthread_cond_broadcast(&exec.room_cond);
+        mutex_unlock(&exec.lock);
+
+        exec_run(task);
+
+        mutex_lock(&exec.lock);
+        exec.stats.busy--;
+        q->busy--;
+        if (task->cls != EXEC_URGENT) {
+            exec.normal_busy--;
+            pthread_cond_signal(&exec.work_cond);
+        }
+        free(task);
+    }
+
+    return (NULL);
+}
+
+/* Before exec_init() tasks still get a thread of their own */
+static void *exec_spawned(void *userdata)
+{
+    struct exec_task *task = (struct exec_task *)userdata;
+
+    pthread_detach(pthread_self());
+
+    exec_run(task);
+    free(task);
+    return (NULL);
+}
+
+void exec_init(int workers)
+{
+    int i;
+
+    mutex_init(&exec.lock);
+    if (unlikely(pthread_cond_init(&exec.work_cond, NULL)))
+        quit(1, "Failed to pthread_cond_init exec work_cond");
+    if (unlikely(pthread_cond_init(&exec.room_cond, NULL)))
+        quit(1, "Failed to pthread_cond_init exec room_cond");
+    for (i = 0; i < EXEC_CLASSES; i++)
+        INIT_LIST_HEAD(&exec.queues[i].tasks);
+
+    exec.threads = (pthread_t *)cgcalloc(workers, sizeof(pthread_t));
+    exec.normal_max = (workers > 1) ? workers - 1 : 1;
+    exec.queues[EXEC_URGENT].max = workers;
+    exec.queues[EXEC_CPU].max = exec.normal_max;
+    exec.queues[EXEC_IO].max = MAX(1, exec.normal_max / 2);
+
+    mutex_lock(&exec.lock);
+    for (i = 0; i < workers; i++) {
+        if (unlikely(pthread_create(&exec.threads[i], NULL, exec_thread, NULL)))
+            quit(1, "Failed to create exec thread");
+        pthread_detach(exec.threads[i]);
+    }
+    exec.stats.workers = workers;
+    exec.started = true;
+    mutex_unlock(&exec.lock);
+}
+
+void exec_submit(exec_fn_t fn, void *arg, enum exec_class cls)
+{
+    struct exec_task *task = (struct exec_task *)cgcalloc(1, sizeof(*task));
+    struct exec_queue *q = &exec.queues[cls];
+    pthread_t pth;
+
+    task->fn = fn;
+    task->arg = arg;
+    task->cls = cls;
+    cgtime(&task->tv_queued);
+
+    if (unlikely(!exec.started)) {
+        if (unlikely(pthread_create(&pth, NULL, exec_spawned, task)))
+            quit(1, "Failed to create exec task thread");
+        return;
+    }
+
+    mutex_lock(&exec.lock);
+    if (cls != EXEC_URGENT && q->queued >= EXEC_QUEUE_MAX && !exec_on_worker()) {
+        exec.stats.blocked++;
+        while (q->queued >= EXEC_QUEUE_MAX)
+            pthread_cond_wait(&exec.room_cond, &exec.lock);
+    }
+    list_add_tail(&task->list, &q->tasks);
+    q->queued++;
+    exec.stats.queued++;
+    if (exec.stats.queued > exec.stats.queued_max)
+        exec.stats.queued_max = exec.stats.queued;
+    pthread_cond_signal(&exec.work_cond);
+    mutex_unlock(&exec.lock);
+}
+
+void get_exec_stats(struct exec_stats *stats)
+{
+    if (unlikely(!exec.started)) {
+        memset(stats, 0, sizeof(*stats));
+        return;
+    }
+
+    mutex_lock(&exec.lock);
+    memcpy(stats, &exec.stats, sizeof(*stats));
+    mutex_unlock(&exec.lock);
+}
+
+/* Keeps the live counts, everything else restarts from zero */
+void zero_exec_stats(void)
+{
+    struct exec_stats keep;
+
+    if (unlikely(!exec.started))
+        return;
+
+    mutex_lock(&exec.lock);
+    keep = exec.stats;
+    memset(&exec.stats, 0, sizeof(exec.stats));
+    exec.stats.workers = keep.workers;
+    exec.stats.queued = keep.queued;
+    exec.stats.queued_max = keep.queued;
+    exec.stats.busy = keep.busy;
+    mutex_unlock(&exec.lock);
+}
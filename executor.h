@@ -0,0 +1,37 @@
+#ifndef EXECUTOR_H
+#define EXECUTOR_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#define EXEC_QUEUE_MAX  (256)   /* queued tasks of a class before submitters wait */
+
+typedef void (*exec_fn_t)(void *arg);
+
+/* Each class has its own queue and its own share of the workers */
+enum exec_class {
+    EXEC_URGENT,            /* work restarts, ahead of everything, never wait */
+    EXEC_CPU,               /* short CPU bound tasks, result checks */
+    EXEC_IO,                /* may block on the network for long, share submits */
+    EXEC_CLASSES
+};
+
+struct exec_stats {
+    int workers;
+    int queued;             /* tasks waiting for a worker */
+    int queued_max;
+    int busy;               /* workers running a task */
+    uint64_t run;
+    uint64_t blocked;       /* submits that waited for room in the queue */
+    double wait_total;      /* ms from submit to worker pickup */
+    double wait_max;
+    double run_total;       /* ms spent running tasks */
+    double run_max;
+};
+
+extern void exec_init(int workers);
+extern void exec_submit(exec_fn_t fn, void *arg, enum exec_class cls);
+extern void get_exec_stats(struct exec_stats *stats);
+extern void zero_exec_stats(void);
+
+#endif /* EXECUTOR_H */
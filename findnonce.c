@@ -13,6 +13,7 @@
 #include <string.h>
 
 #include "findnonce.h"
+#include "executor.h"
 #include "algorithm/scrypt.h"
 
 const uint32_t SHA256_K[64] = {
@@ -171,11 +172,10 @@ struct pc_data {
   struct thr_info *thr;
   struct work *work;
   uint32_t res[MAXBUFFERS];
-  pthread_t pth;
   int found;
 };
 
-static void *postcalc_hash(void *userdata)
+static void postcalc_hash(void *userdata)
 {
   struct pc_data *pcd = (struct pc_data *)userdata;
   struct thr_info *thr = pcd->thr;
@@ -183,8 +183,6 @@ static void *postcalc_hash(void *userdata)
 
   int found = thr->cgpu->algorithm.found_idx;
 
-  pthread_detach(pthread_self());
-
   /* To prevent corrupt values in FOUND from trying to read beyond the
    * end of the res[] array */
   if (unlikely(pcd->res[found] & ~found)) {
@@ -206,8 +204,6 @@ static void *postcalc_hash(void *userdata)
 
   discard_work(pcd->work);
   free(pcd);
-
-  return NULL;
 }
 
 void postcalc_hash_async(struct thr_info *thr, struct work *work, uint32_t *res)
@@ -226,9 +222,5 @@ void postcalc_hash_async(struct thr_info *thr, struct work *work, uint32_t *res)
   buffersize = BUFFERSIZE;
    memcpy(&pcd->res, res, buffersize);
 
-  if (pthread_create(&pcd->pth, NULL, postcalc_hash, (void *)pcd)) {
-    applog(LOG_ERR, "Failed to create postcalc_hash thread");
-    discard_work(pcd->work);
-    free(pcd);
-  }
+  exec_submit(postcalc_hash, (void *)pcd, EXEC_CPU);
 }
@@ -212,6 +212,7 @@ static inline int fsync (int fd)
 #define likely(expr) (expr)
 #endif
 #define __maybe_unused    __attribute__((unused))
+#define __cache_aligned   __attribute__((aligned(64)))
 
 #define uninitialised_var(x) x = x
 
@@ -545,6 +546,10 @@ struct sgminer_pool_stats {
   uint64_t times_received;
   uint64_t bytes_received;
   uint64_t net_bytes_received;
+  uint64_t send_calls;
+  uint64_t shares_sent;
+  uint64_t share_bytes_sent;
+  uint64_t share_send_calls;
 };
 
 struct cgpu_info {
@@ -1167,6 +1172,9 @@ extern char *opt_api_groups;
 extern char *opt_api_description;
 extern int opt_api_port;
 extern bool opt_api_listen;
+#ifdef HAVE_SYS_EPOLL_H
+extern bool opt_api_epoll;
+#endif
 extern bool opt_api_network;
 extern bool opt_delaynet;
 extern time_t last_getwork;
@@ -1183,10 +1191,20 @@ extern cgsem_t usb_resource_sem;
 #ifdef USE_BAIKAL
 extern char *opt_baikal_options;
 extern char *opt_baikal_fan;
+extern char *opt_baikal_sim;
+extern double opt_baikal_nonce_rate;
+extern int opt_baikal_derate;
 //enum cl_kernels opt_baikal_kernel;
 //enum cl_kernels select_kernel(char *arg);
 #endif 
 extern int swork_id;
+
+/* Ids of stratum requests, unique across all pools and threads */
+static inline int swork_next_id(void)
+{
+  return __sync_fetch_and_add(&swork_id, 1);
+}
+
 extern int opt_tcp_keepalive;
 extern bool opt_incognito;
 
@@ -1211,6 +1229,7 @@ extern json_t *json_rpc_call(CURL *curl, char *curl_err_str, const char *url, co
 #endif
 extern const char *proxytype(proxytypes_t proxytype);
 extern char *get_proxy(char *url, struct pool *pool);
+extern char *bin2hex_to(char *s, const unsigned char *p, size_t len);
 extern void __bin2hex(char *s, const unsigned char *p, size_t len);
 extern char *bin2hex(const unsigned char *p, size_t len);
 extern bool hex2bin(unsigned char *p, const char *hexstr, size_t len);
@@ -1226,6 +1245,9 @@ typedef bool (*sha256_func)(struct thr_info*, const unsigned char *pmidstate,
 extern bool fulltest(const unsigned char *hash, const unsigned char *target);
 
 extern int opt_queue;
+extern int opt_verify_threads;
+extern int opt_exec_threads;
+extern int opt_gen_threads;
 extern int opt_scantime;
 extern int opt_expiry;
 
@@ -1381,6 +1403,9 @@ enum pool_state {
   POOL_HIDDEN,
 };
 
+struct stratum_tmpl;
+struct stratum_share;
+
 struct stratum_work {
   char *job_id;
   char *prev_hash;
@@ -1510,8 +1535,13 @@ struct pool {
   char *stratum_port;
   struct addrinfo stratum_hints;
   SOCKETTYPE sock;
+  int sock_gen; /* bumped for every new socket */
+  bool nicehash; /* rpc_url is a nicehash one, set on connect */
   char *sockbuf;
   size_t sockbuf_size;
+  size_t sockbuf_rd; /* start of the next line */
+  size_t sockbuf_scan; /* bytes before this hold no \n */
+  size_t sockbuf_wr; /* end of received data */
   char *sockaddr_url; /* stripped url used for sockaddr */
   char *sockaddr_proxy_url;
   char *sockaddr_proxy_port;
@@ -1526,11 +1556,31 @@ struct pool {
   bool stratum_init;
   bool stratum_notify;
   struct stratum_work swork;
+  /* Refcounted copies of swork.job_id, nonce1 and swork.ntime shared by all
+   * the work generated from them, updated under data_lock write lock */
+  char *work_job_id;
+  char *work_nonce1;
+  char *work_ntime;
+  /* Bumped by every notify, stratum_tmpl is rebuilt when it goes stale */
+  unsigned int swork_gen;
+  struct stratum_tmpl *stratum_tmpl;
   pthread_t stratum_sthread;
   pthread_t stratum_rthread;
   pthread_mutex_t stratum_lock;
   struct thread_q *stratum_q;
-  int sshares; /* stratum shares submitted waiting on response */
+  /* Stratum shares submitted waiting on response, keyed by request id */
+  pthread_mutex_t sshare_lock;
+  struct stratum_share *stratum_shares;
+  int sshares;
+
+  /* Stratum event loop state, see stratum_io_thread */
+  int sio_state; /* non zero while the event loop owns the pool */
+  int sio_gen; /* sock_gen registered with epoll */
+  bool sio_failed;
+  bool sio_reconnect; /* client.reconnect left to the connect thread */
+  time_t sio_last; /* last data received */
+  time_t sio_connected;
+  time_t sio_retry;
 
   /* GBT variables */
   bool has_gbt;
@@ -1599,6 +1649,7 @@ struct work {
   bool    block;
 
   bool    stratum;
+  /* job_id, ntime and nonce1 are refcounted, see rcstr_new() */
   char    *job_id;
   uint64_t  nonce2;
   size_t    nonce2_len;
@@ -1629,6 +1680,8 @@ struct work {
   struct timeval  tv_work_start;
   struct timeval  tv_work_found;
   char    getwork_mode;
+
+  struct work *free_next; /* make_work() free list link */
 };
 
 #define TAILBUFSIZ 64
@@ -1645,9 +1698,29 @@ struct work {
 
 extern void get_datestamp(char *, size_t, struct timeval *);
 extern void inc_hw_errors(struct thr_info *thr);
+extern void inc_hw_errors_bkl(void);
 extern bool test_nonce(struct work *work, uint32_t nonce);
 extern bool submit_tested_work(struct thr_info *thr, struct work *work);
 extern bool submit_nonce(struct thr_info *thr, struct work *work, uint32_t nonce);
+
+typedef void (*verify_cb_t)(struct thr_info *thr, bool valid, void *data);
+
+struct verify_stats {
+    int queued;             /* nonces waiting for a verifier */
+    int queued_max;
+    uint64_t full;          /* nonces the caller verified, the queue being full */
+    uint64_t verified;
+    uint64_t valid;
+    uint64_t invalid;
+    uint64_t batched;       /* nonces re-hashed together with others */
+    double wait_total;      /* ms from enqueue to verifier pickup */
+    double wait_max;
+    double hash_total;      /* ms spent re-hashing and submitting */
+    double hash_max;
+};
+
+extern void submit_nonce_async(struct thr_info *thr, struct work *work, uint32_t nonce, verify_cb_t cb, void *data);
+extern void get_verify_stats(struct verify_stats *stats);
 extern struct work *get_work(struct thr_info *thr, const int thr_id);
 extern void __add_queued(struct cgpu_info *cgpu, struct work *work);
 extern struct work *get_queued(struct cgpu_info *cgpu);
@@ -52,6 +52,8 @@ char *curly = ":D";
 #include <libgen.h>
 #include "sph/sph_sha2.h"
 #include "sph/sph_blake.h"
+#include "sph/sph_aesni.h"
+#include "sph/sph_sha256_hw.h"
 
 #include "compat.h"
 #include "miner.h"
@@ -61,9 +63,12 @@ char *curly = ":D";
 //#include "bench_block.h"
 
 #include "algorithm.h"
+#include "algorithm/lanes.h"
 #include "pool.h"
 #include "config_parser.h"
 #include "events.h"
+#include "bench.h"
+#include "executor.h"
 
 #if defined(unix) || defined(__APPLE__)
 #include <errno.h>
@@ -71,6 +76,11 @@ char *curly = ":D";
 #include <sys/wait.h>
 #endif
 
+#ifdef HAVE_SYS_EPOLL_H
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#endif
+
 #ifdef USE_BAIKAL
 #include "driver-baikal.h"
 #endif
@@ -101,6 +111,9 @@ bool opt_remoteconf_usecache = false; // use last downloaded copy of the config
 int opt_cutofftemp = 95;
 int opt_log_interval = 5;
 int opt_queue = 1;
+int opt_verify_threads = 1;
+int opt_exec_threads = 4;
+int opt_gen_threads = 2;
 int opt_scantime = 7;
 int opt_expiry = 28;
 
@@ -146,6 +159,9 @@ bool opt_fail_only;
 int opt_fail_switch_delay = 60;
 int opt_watchpool_refresh = 30;
 static bool opt_fix_protocol;
+#ifdef HAVE_SYS_EPOLL_H
+static bool opt_stratum_epoll;
+#endif
 bool opt_lowmem;
 static bool opt_morenotices;
 bool opt_autofan;
@@ -156,6 +172,9 @@ char *opt_api_groups;
 char *opt_api_description = PACKAGE_STRING;
 int opt_api_port = 4028;
 bool opt_api_listen;
+#ifdef HAVE_SYS_EPOLL_H
+bool opt_api_epoll;
+#endif
 bool opt_api_mcast;
 char *opt_api_mcast_addr = API_MCAST_ADDR;
 char *opt_api_mcast_code = API_MCAST_CODE;
@@ -178,6 +197,9 @@ double opt_diff_mult = 0.0;
 
 char *opt_baikal_options = NULL;
 char *opt_baikal_fan = NULL;
+char *opt_baikal_sim = NULL;
+double opt_baikal_nonce_rate = 2.0;
+int opt_baikal_derate = 50;
 //enum cl_kernels opt_baikal_kernel = KL_X11;
 //char *opt_baikal_algo = X11_KERNNAME;
 static int total_algo;
@@ -229,7 +251,6 @@ static pthread_mutex_t *stgd_lock;
 pthread_mutex_t console_lock;
 cglock_t ch_lock;
 static pthread_rwlock_t blk_lock;
-static pthread_mutex_t sshare_lock;
 
 pthread_rwlock_t netacc_lock;
 pthread_rwlock_t mining_thr_lock;
@@ -338,8 +359,6 @@ struct stratum_share {
     time_t sshare_sent;
 };
 
-static struct stratum_share *stratum_shares = NULL;
-
 char *opt_socks_proxy = NULL;
 
 #if defined(unix) || defined(__APPLE__)
@@ -354,7 +373,24 @@ struct sigaction termhandler, inthandler;
 struct thread_q *getq;
 
 static int total_work;
-struct work *staged_work = NULL;
+
+/* Staged work lives in two FIFO rings protected by stgd_lock: work that can
+ * be rolled and everything else. hash_pop takes the oldest work of the
+ * preferred kind in O(1) instead of walking a hash, and the condition
+ * variables are only signalled when somebody is actually asleep on them. */
+struct work_ring {
+    struct work **works;
+    int size;       /* power of 2 */
+    int head;
+    int count;
+};
+
+#define STAGED_RING_MIN 64
+
+static struct work_ring staged_lane;    /* non-rollable work */
+static struct work_ring rollable_lane;
+static int staged_waiters;              /* threads asleep in hash_pop */
+static bool gws_waiting;                /* getwork scheduler asleep */
 
 struct schedtime schedstart;
 struct schedtime schedstop;
@@ -596,6 +632,7 @@ struct pool* add_pool(void)
         quit(1, "Failed to pthread_cond_init in add_pool");
     cglock_init(&pool->data_lock);
     mutex_init(&pool->stratum_lock);
+    mutex_init(&pool->sshare_lock);
     cglock_init(&pool->gbt_lock);
     mutex_init(&pool->XMRGlobalNonceLock);
     INIT_LIST_HEAD(&pool->curlring);
@@ -1026,6 +1063,8 @@ static void reject_pool(struct pool *pool)
 
 /* We can't remove the memory used for this struct pool because there may
  * still be work referencing it. We just remove it from the pools list */
+static void stratum_tmpl_release(struct pool *pool);
+
 void remove_pool(struct pool *pool)
 {
     int i, last_pool = total_pools - 1;
@@ -1047,6 +1086,8 @@ void remove_pool(struct pool *pool)
     pool->pool_no = total_pools;
     pool->removed = true;
     total_pools--;
+
+    stratum_tmpl_release(pool);
 }
 
 static char* set_pool_state(char *arg)
@@ -1328,6 +1369,22 @@ static char* set_baikal_fan(const char *arg)
 
     return (NULL);
 }
+static char* set_baikal_sim(const char *arg)
+{
+    opt_set_charp(arg, &opt_baikal_sim);
+
+    return (NULL);
+}
+static char* set_baikal_nonce_rate(const char *arg)
+{
+    char *end;
+
+    opt_baikal_nonce_rate = strtod(arg, &end);
+    if (end == arg || *end || opt_baikal_nonce_rate < 0)
+        return ("Invalid value passed to baikal-nonce-rate");
+
+    return (NULL);
+}
 #endif
 
 static char* set_api_allow(const char *arg)
@@ -1404,6 +1461,11 @@ struct opt_table opt_config_table[] = {
     OPT_WITH_ARG("--api-description",
                  set_api_description, NULL, NULL,
                  "Description placed in the API status header, default: sgminer version"),
+#ifdef HAVE_SYS_EPOLL_H
+    OPT_WITHOUT_ARG("--api-epoll",
+                    opt_set_bool, &opt_api_epoll,
+                    "Serve API clients from one epoll thread, running their commands on the executor"),
+#endif
     OPT_WITH_ARG("--api-groups",
                  set_api_groups, NULL, NULL,
                  "API one letter groups G:cmd:cmd[,P:cmd:*...] defining the cmds a groups can use"),
@@ -1477,6 +1539,9 @@ struct opt_table opt_config_table[] = {
     OPT_WITH_ARG("--expiry|-E",
                  set_int_0_to_9999, opt_show_intval, &opt_expiry,
                  "Upper bound on how many seconds after getting work we consider a share from it stale"),
+    OPT_WITH_ARG("--exec-threads",
+                 set_int_1_to_10, opt_show_intval, &opt_exec_threads,
+                 "Number of threads running getwork submits, OpenCL result checks and work restarts"),
 
     // event options
     OPT_WITH_ARG("--event-on",
@@ -1507,6 +1572,9 @@ struct opt_table opt_config_table[] = {
     OPT_WITHOUT_ARG("--fix-protocol",
                     opt_set_bool, &opt_fix_protocol,
                     "Do not redirect to a different getwork protocol (eg. stratum)"),
+    OPT_WITH_ARG("--gen-threads",
+                 set_int_0_to_10, opt_show_intval, &opt_gen_threads,
+                 "Number of threads generating stratum work, 0 generates it in the scheduler"),
 #ifdef USE_GPU
     OPT_WITH_ARG("--gpu-dyninterval",
                  set_int_1_to_65535, opt_show_intval, &opt_dynamic_interval,
@@ -1864,6 +1932,11 @@ struct opt_table opt_config_table[] = {
     OPT_WITH_ARG("--state|--pool-state",
                  set_pool_state, NULL, NULL,
                  "Specify pool state at startup (default: enabled)"),
+#ifdef HAVE_SYS_EPOLL_H
+    OPT_WITHOUT_ARG("--stratum-epoll",
+                    opt_set_bool, &opt_stratum_epoll,
+                    "Handle all stratum pools from a single epoll thread instead of two threads per pool"),
+#endif
     OPT_WITH_ARG("--switcher-mode",
                  set_switcher_mode, NULL, NULL,
                  "Algorithm/gpu settings switcher mode."),
@@ -1944,6 +2017,9 @@ struct opt_table opt_config_table[] = {
     OPT_WITHOUT_ARG("--verbose|-v",
                     opt_set_bool, &opt_verbose,
                     "Log verbose output to stderr as well as status output"),
+    OPT_WITH_ARG("--verify-threads",
+                 set_int_0_to_10, opt_show_intval, &opt_verify_threads,
+                 "Number of threads re-hashing device nonces, 0 verifies on the device thread"),
     OPT_WITH_ARG("--vote",
                  set_int_1_to_65535, opt_show_intval, &opt_vote,
                  "Optional vote value for decred blocks"),
@@ -1983,6 +2059,18 @@ struct opt_table opt_config_table[] = {
                  set_baikal_fan, NULL, NULL,
                  "Set baikal fan speed(percent)"),
 
+    OPT_WITH_ARG("--baikal-sim",
+                 set_baikal_sim, NULL, NULL,
+                 "Run the serial driver against simulated boards boards[:nonces per second]"),
+
+    OPT_WITH_ARG("--baikal-nonce-rate",
+                 set_baikal_nonce_rate, NULL, NULL,
+                 "Tune each board's difficulty for this many nonces per second, 0 to disable (default: 2)"),
+
+    OPT_WITH_ARG("--baikal-derate",
+                 set_int_0_to_9999, opt_show_intval, &opt_baikal_derate,
+                 "MHz a board's clock may be lowered for chips with too many hardware errors, 0 only flags them"),
+
     OPT_WITHOUT_ARG("--enable-nicehashsma",
                     opt_set_bool, &opt_enable_nicehash_sma,
                     "Use extra wide display without toggling"),
@@ -2038,6 +2126,9 @@ static struct opt_table opt_cmdline_table[] = {
     OPT_WITHOUT_ARG("--remote-config-usecache",
                     opt_set_bool, &opt_remoteconf_usecache,
                     "Use cached copy of the remote config file when download fails. Default: No"),
+    OPT_WITH_ARG("--bench",
+                 opt_set_charp, NULL, &opt_bench,
+                 "Run a host side micro-benchmark (workgen, all) and exit"),
     OPT_WITHOUT_ARG("--help|-h",
                     opt_verusage_and_exit, NULL,
                     "Print this message"),
@@ -2083,12 +2174,33 @@ static bool jobj_binary(const json_t *obj, const char *key,
 }
 #endif
 
+/* Work items are carved out of slabs and recycled through a free list rather
+ * than going back to the allocator each time one is retired */
+#define WORK_SLAB 64
+
+static pthread_mutex_t work_lock;
+static struct work *work_free;
+
 static struct work* make_work(void)
 {
-    struct work *w = (struct work *)calloc(1, sizeof(struct work));
+    struct work *w;
+    int i;
 
-    if (unlikely(!w))
-        quit(1, "Failed to calloc work in make_work");
+    mutex_lock(&work_lock);
+    if (unlikely(!work_free)) {
+        w = (struct work *)calloc(WORK_SLAB, sizeof(struct work));
+        if (unlikely(!w))
+            quit(1, "Failed to calloc work in make_work");
+        for (i = 0; i < WORK_SLAB; i++) {
+            w[i].free_next = work_free;
+            work_free = &w[i];
+        }
+    }
+    w = work_free;
+    work_free = w->free_next;
+    mutex_unlock(&work_lock);
+
+    w->free_next = NULL;
 
     cg_wlock(&control_lock);
     w->id = total_work++;
@@ -2101,10 +2213,10 @@ static struct work* make_work(void)
  * cleaned to remove any dynamically allocated arrays within the struct */
 void clean_work(struct work *w)
 {
-    free(w->job_id);
-    free(w->ntime);
+    rcstr_put(w->job_id);
+    rcstr_put(w->ntime);
     free(w->coinbase);
-    free(w->nonce1);
+    rcstr_put(w->nonce1);
     memset(w, 0, sizeof(struct work));
 }
 
@@ -2113,7 +2225,11 @@ void clean_work(struct work *w)
 void free_work(struct work *w)
 {
     clean_work(w);
-    free(w);
+
+    mutex_lock(&work_lock);
+    w->free_next = work_free;
+    work_free = w;
+    mutex_unlock(&work_lock);
 }
 
 static void calc_diff(struct work *work, double known);
@@ -2312,7 +2428,7 @@ static void gen_gbt_work(struct pool *pool, struct work *work)
     work->gbt_txns = pool->gbt_txns + 1;
 
     if (pool->gbt_workid)
-        work->job_id = strdup(pool->gbt_workid);
+        work->job_id = rcstr_new(pool->gbt_workid);
     cg_runlock(&pool->gbt_lock);
 
     flip32(work->data + 4 + 32, merkleroot);
@@ -2540,9 +2656,77 @@ void decay_time(double *f, double fadd, double fsecs)
     *f /= ftotal;
 }
 
+static void ring_init(struct work_ring *ring)
+{
+    ring->size = STAGED_RING_MIN;
+    ring->works = calloc(ring->size, sizeof(struct work *));
+    if (unlikely(!ring->works))
+        quit(1, "Failed to calloc work ring");
+    ring->head = 0;
+    ring->count = 0;
+}
+
+static inline struct work *ring_at(struct work_ring *ring, int i)
+{
+    return (ring->works[(ring->head + i) & (ring->size - 1)]);
+}
+
+/* Rings start at STAGED_RING_MIN, well above what the getwork scheduler
+ * normally keeps staged, and only grow if something stages more */
+static void ring_push(struct work_ring *ring, struct work *work)
+{
+    if (unlikely(ring->count == ring->size)) {
+        struct work **works = calloc(ring->size * 2, sizeof(struct work *));
+        int i;
+
+        if (unlikely(!works))
+            quit(1, "Failed to calloc work ring");
+        for (i = 0; i < ring->count; i++)
+            works[i] = ring_at(ring, i);
+        free(ring->works);
+        ring->works = works;
+        ring->size *= 2;
+        ring->head = 0;
+        applog(LOG_DEBUG, "Staged work ring grown to %d", ring->size);
+    }
+    ring->works[(ring->head + ring->count) & (ring->size - 1)] = work;
+    ring->count++;
+}
+
+static struct work *ring_pop(struct work_ring *ring)
+{
+    struct work *work;
+
+    if (!ring->count)
+        return (NULL);
+    work = ring->works[ring->head];
+    ring->head = (ring->head + 1) & (ring->size - 1);
+    ring->count--;
+    return (work);
+}
+
+/* Remove every work reap() takes ownership of, keeping the order of the
+ * rest. Returns the number removed. */
+static int ring_reap(struct work_ring *ring, bool (*reap)(struct work *, void *), void *arg)
+{
+    int i, kept = 0, count = ring->count;
+
+    for (i = 0; i < count; i++) {
+        struct work *work = ring_at(ring, i);
+
+        if (reap(work, arg))
+            continue;
+        ring->works[(ring->head + kept) & (ring->size - 1)] = work;
+        kept++;
+    }
+    ring->count = kept;
+
+    return (count - kept);
+}
+
 static int __total_staged(void)
 {
-    return (HASH_COUNT(staged_work));
+    return (staged_lane.count + rollable_lane.count);
 }
 
 static int total_staged(void)
@@ -4014,19 +4198,13 @@ static void roll_work(struct work *work)
     work->id = total_work++;
 }
 
-static void* submit_work_thread(void *userdata)
+static void submit_work_task(void *userdata)
 {
     struct work *work = (struct work *)userdata;
     struct pool *pool = work->pool;
     bool resubmit = false;
     struct curl_ent *ce;
 
-    pthread_detach(pthread_self());
-
-    RenameThread("SubmitWork");
-
-    applog(LOG_DEBUG, "Creating extra submit work thread");
-
     ce = pop_curl_entry(pool);
     /* submit solution to bitcoin via JSON-RPC */
     while (!submit_upstream_work(work, ce->curl, ce->curl_err_str, resubmit)) {
@@ -4053,8 +4231,6 @@ static void* submit_work_thread(void *userdata)
         applog(LOG_INFO, "json_rpc_call failed on submit_work, retrying");
     }
     push_curl_entry(ce, pool);
-
-    return (NULL);
 }
 
 static struct work* make_clone(struct work *work)
@@ -4082,14 +4258,16 @@ static void stage_work(struct work *work);
 
 static bool clone_available(void)
 {
-    struct work *work_clone = NULL, *work, *tmp;
+    struct work *work_clone = NULL, *work;
     bool cloned = false;
+    int i;
 
     mutex_lock(stgd_lock);
     if (!staged_rollable)
         goto out_unlock;
 
-    HASH_ITER(hh, staged_work, work, tmp) {
+    for (i = 0; i < rollable_lane.count; i++) {
+        work = ring_at(&rollable_lane, i);
         if (can_roll(work) && should_roll(work)) {
             roll_work(work);
             work_clone = make_clone(work);
@@ -4177,22 +4355,26 @@ static void _copy_work(struct work *work, const struct work *base_work, int noff
     /* Keep the unique new id assigned during make_work to prevent copied
      * work from having the same id. */
     work->id = id;
-    if (base_work->job_id)
-        work->job_id = strdup(base_work->job_id);
-    if (base_work->nonce1)
-        work->nonce1 = strdup(base_work->nonce1);
+    work->free_next = NULL;
+    /* The refcounted strings are shared, not duplicated */
+    work->job_id = rcstr_get(base_work->job_id);
+    work->nonce1 = rcstr_get(base_work->nonce1);
     if (base_work->ntime) {
         /* If we are passed an noffset the binary work->data ntime and
          * the work->ntime hex string need to be adjusted. */
         if (noffset) {
             uint32_t work_ntime = _get_work_time(work);
             uint32_t ntime = be32toh(work_ntime);
+            char *ntime_hex;
+
             ntime += noffset;
             _set_work_time(work, htobe32(ntime));
-            work->ntime = offset_ntime(base_work->ntime, noffset);
+            ntime_hex = offset_ntime(base_work->ntime, noffset);
+            work->ntime = rcstr_new(ntime_hex);
+            free(ntime_hex);
         }
         else
-            work->ntime = strdup(base_work->ntime);
+            work->ntime = rcstr_get(base_work->ntime);
     }
     else if (noffset) {
         uint32_t work_ntime = _get_work_time(work);
@@ -4250,8 +4432,7 @@ static bool stale_work(struct work *work, bool share)
 
     pool = work->pool;
 
-    if((pool->algorithm.type != ALGO_CRYPTONIGHT) &&
-      (pool->algorithm.type != ALGO_CRYPTONIGHT_LITE)) {
+    if (algorithm_layout(pool->algorithm.type)->block_check) {
         if (work->work_block != work_block) {
             applog(LOG_DEBUG, "Work stale due to block mismatch");
             return (true);
@@ -4506,19 +4687,23 @@ static void wake_gws(void)
     mutex_unlock(stgd_lock);
 }
 
+static bool reap_stale(struct work *work, void __maybe_unused *arg)
+{
+    if (!stale_work(work, false))
+        return (false);
+    discard_work(work);
+    return (true);
+}
+
 static void discard_stale(void)
 {
-    struct work *work, *tmp;
-    int stale = 0;
+    int stale, rolled;
 
     mutex_lock(stgd_lock);
-    HASH_ITER(hh, staged_work, work, tmp) {
-        if (stale_work(work, false)) {
-            HASH_DEL(staged_work, work);
-            discard_work(work);
-            stale++;
-        }
-    }
+    stale = ring_reap(&staged_lane, reap_stale, NULL);
+    rolled = ring_reap(&rollable_lane, reap_stale, NULL);
+    staged_rollable -= rolled;
+    stale += rolled;
     pthread_cond_signal(&gws_cond);
     mutex_unlock(stgd_lock);
 
@@ -4526,14 +4711,12 @@ static void discard_stale(void)
         applog(LOG_DEBUG, "Discarded %d stales that didn't match current hash", stale);
 }
 
-static void* restart_thread(void __maybe_unused *arg)
+static void restart_task(void __maybe_unused *arg)
 {
     struct pool *cp = current_pool();
     struct cgpu_info *cgpu;
     int i;
 
-    pthread_detach(pthread_self());
-
     /* Artificially set the lagging flag to avoid pool not providing work
      * fast enough  messages after every long poll */
     pool_tset(cp, &cp->lagging);
@@ -4565,17 +4748,13 @@ static void* restart_thread(void __maybe_unused *arg)
      * early. */
     cancel_usb_transfers();
 #endif
-    return (NULL);
 }
 
 /* In order to prevent a deadlock via the various drv->flush_work
- * implementations we send the restart messages via a separate thread. */
+ * implementations we send the restart messages from an executor worker. */
 static void restart_threads(void)
 {
-    pthread_t rthread;
-
-    if (unlikely(pthread_create(&rthread, NULL, restart_thread, NULL)))
-        quit(1, "Failed to create restart thread");
+    exec_submit(restart_task, NULL, EXEC_URGENT);
 }
 
 static void signal_work_update(void)
@@ -4643,7 +4822,7 @@ static void set_blockdiff(const struct work *work)
     }
 }
 
-static bool test_work_current(struct work *work)
+static bool __test_work_current(struct work *work)
 {
     struct pool *pool = work->pool;
     unsigned char bedata[32];
@@ -4762,11 +4941,6 @@ out:
     return (ret);
 }
 
-static int tv_sort(struct work *worka, struct work *workb)
-{
-    return (worka->tv_staged.tv_sec - workb->tv_staged.tv_sec);
-}
-
 static bool work_rollable(struct work *work)
 {
     return (!work->clone && work->rolltime);
@@ -4777,20 +4951,39 @@ static bool hash_push(struct work *work)
     bool rc = true;
 
     mutex_lock(stgd_lock);
-    if (work_rollable(work))
-        staged_rollable++;
     if (likely(!getq->frozen)) {
-        HASH_ADD_INT(staged_work, id, work);
-        HASH_SORT(staged_work, tv_sort);
+        if (work_rollable(work)) {
+            ring_push(&rollable_lane, work);
+            staged_rollable++;
+        }
+        else
+            ring_push(&staged_lane, work);
+        /* Each waiter passes the wakeup on if there is more work left */
+        if (staged_waiters)
+            pthread_cond_signal(&getq->cond);
     }
     else
         rc = false;
-    pthread_cond_broadcast(&getq->cond);
     mutex_unlock(stgd_lock);
 
     return (rc);
 }
 
+/* Stratum, longpoll and the work generators can all be looking at work from
+ * a new block at the same time, only one of them may add it */
+static pthread_mutex_t current_lock;
+
+static bool test_work_current(struct work *work)
+{
+    bool ret;
+
+    mutex_lock(&current_lock);
+    ret = __test_work_current(work);
+    mutex_unlock(&current_lock);
+
+    return (ret);
+}
+
 static void stage_work(struct work *work)
 {
     applog(LOG_DEBUG, "[THR%d] Pushing work from %s to hash queue", work->thr_id, get_pool_name(work->pool));
@@ -4864,6 +5057,8 @@ void zero_bestshare(void)
     }
 }
 
+static void zero_verify_stats(void);
+
 void zero_stats(void)
 {
     int i;
@@ -4876,6 +5071,8 @@ void zero_stats(void)
     total_rejected = 0;
     hw_errors = 0;    
     hw_errors_bkl = 0;
+    zero_verify_stats();
+    zero_exec_stats();
     total_stale = 0;
     total_discarded = 0;
     local_work = 0;
@@ -5904,13 +6101,13 @@ static bool parse_stratum_response(struct pool *pool, char *s)
 
     id = json_integer_value(id_val);
 
-    mutex_lock(&sshare_lock);
-    HASH_FIND_INT(stratum_shares, &id, sshare);
+    mutex_lock(&pool->sshare_lock);
+    HASH_FIND_INT(pool->stratum_shares, &id, sshare);
     if (sshare) {
-        HASH_DEL(stratum_shares, sshare);
+        HASH_DEL(pool->stratum_shares, sshare);
         pool->sshares--;
     }
-    mutex_unlock(&sshare_lock);
+    mutex_unlock(&pool->sshare_lock);
 
     if (!sshare) {
         double pool_diff;
@@ -6007,18 +6204,16 @@ void clear_stratum_shares(struct pool *pool)
     double diff_cleared = 0;
     int cleared = 0;
 
-    mutex_lock(&sshare_lock);
-    HASH_ITER(hh, stratum_shares, sshare, tmpshare) {
-        if (sshare->work->pool == pool) {
-            HASH_DEL(stratum_shares, sshare);
-            diff_cleared += sshare->work->work_difficulty;
-            free_work(sshare->work);
-            pool->sshares--;
-            free(sshare);
-            cleared++;
-        }
+    mutex_lock(&pool->sshare_lock);
+    HASH_ITER(hh, pool->stratum_shares, sshare, tmpshare) {
+        HASH_DEL(pool->stratum_shares, sshare);
+        diff_cleared += sshare->work->work_difficulty;
+        free_work(sshare->work);
+        pool->sshares--;
+        free(sshare);
+        cleared++;
     }
-    mutex_unlock(&sshare_lock);
+    mutex_unlock(&pool->sshare_lock);
 
     if (cleared) {
         applog(LOG_WARNING, "Lost %d shares due to stratum disconnect on %s", cleared, get_pool_name(pool));
@@ -6029,19 +6224,23 @@ void clear_stratum_shares(struct pool *pool)
     }
 }
 
+static bool reap_pool(struct work *work, void *arg)
+{
+    if (work->pool != (struct pool *)arg)
+        return (false);
+    free_work(work);
+    return (true);
+}
+
 void clear_pool_work(struct pool *pool)
 {
-    struct work *work, *tmp;
-    int cleared = 0;
+    int cleared, rolled;
 
     mutex_lock(stgd_lock);
-    HASH_ITER(hh, staged_work, work, tmp) {
-        if (work->pool == pool) {
-            HASH_DEL(staged_work, work);
-            free_work(work);
-            cleared++;
-        }
-    }
+    cleared = ring_reap(&staged_lane, reap_pool, pool);
+    rolled = ring_reap(&rollable_lane, reap_pool, pool);
+    staged_rollable -= rolled;
+    cleared += rolled;
     mutex_unlock(stgd_lock);
 
     if (cleared)
@@ -6103,6 +6302,7 @@ static bool cnx_needed(struct pool *pool)
 }
 
 static void wait_lpcurrent(struct pool *pool);
+static bool lp_waiting(struct pool *pool);
 static void pool_resus(struct pool *pool);
 static void gen_stratum_work(struct pool *pool, struct work *work);
 static void gen_stratum_work_cn(struct pool *pool, struct work *work);
@@ -6128,6 +6328,56 @@ static bool supports_resume(struct pool *pool)
     return (ret);
 }
 
+/* The stratum connection to the pool failed, account for it and drop what
+ * depended on it before reconnecting */
+static void stratum_interrupted(struct pool *pool)
+{
+    applog(LOG_NOTICE, "Stratum connection to %s interrupted", get_pool_name(pool));
+    pool->getfail_occasions++;
+    total_go++;
+
+    /* If the socket to our stratum pool disconnects, all
+     * tracked submitted shares are lost and we will leak
+     * the memory if we don't discard their records. */
+    if (!supports_resume(pool) || opt_lowmem)
+        clear_stratum_shares(pool);
+    clear_pool_work(pool);
+    if (pool == current_pool())
+        restart_threads();
+}
+
+/* Handles one message received from the pool */
+static void stratum_dispatch(struct pool *pool, char *s)
+{
+    /* Check this pool hasn't died while being a backup pool and
+     * has not had its idle flag cleared */
+    stratum_resumed(pool);
+
+    if (!parse_method(pool, s) && !parse_stratum_response(pool, s))
+        applog(LOG_INFO, "Unknown stratum msg: %s", s);
+    else if (pool->swork.clean) {
+        struct work *work = make_work();
+
+        /* Generate a single work item to update the current
+         * block database */
+        pool->swork.clean = false;
+        switch (pool->algorithm.type) {
+        case ALGO_CRYPTONIGHT:
+        case ALGO_CRYPTONIGHT_LITE:
+            gen_stratum_work_cn(pool, work);
+            break;
+
+        default:
+            gen_stratum_work(pool, work);
+        }
+        work->longpoll = true;
+        /* Return value doesn't matter. We're just informing
+         * that we may need to restart. */
+        test_work_current(work);
+        free_work(work);
+    }
+}
+
 /* One stratum receive thread per pool that has stratum waits on the socket
  * checking for new messages and for the integrity of the socket connection. We
  * reset the connection based on the integrity of the receive side only as the
@@ -6185,8 +6435,8 @@ static void* stratum_rthread(void *userdata)
           timeout_keep_alive.tv_usec = 0;
 
           if (!sock_full(pool) && (sel_ret = select(pool->sock + 1, &rd, NULL, NULL, &timeout_keep_alive)) < 1) {
-            if (sock_keepalived(pool, pool->XMRAuthID, swork_id++)) {
-              applog(LOG_NOTICE, "Stratum %s keepalived sent, id: %d", get_pool_name(pool), swork_id - 1);
+            if (sock_keepalived(pool, pool->XMRAuthID, swork_next_id())) {
+              applog(LOG_NOTICE, "Stratum %s keepalived sent", get_pool_name(pool));
             }
 
             FD_ZERO(&rd);
@@ -6205,18 +6455,7 @@ static void* stratum_rthread(void *userdata)
         else
             s = recv_line(pool);
         if (!s) {
-            applog(LOG_NOTICE, "Stratum connection to %s interrupted", get_pool_name(pool));
-            pool->getfail_occasions++;
-            total_go++;
-
-            /* If the socket to our stratum pool disconnects, all
-             * tracked submitted shares are lost and we will leak
-             * the memory if we don't discard their records. */
-            if (!supports_resume(pool) || opt_lowmem)
-                clear_stratum_shares(pool);
-            clear_pool_work(pool);
-            if (pool == current_pool())
-                restart_threads();
+            stratum_interrupted(pool);
 
             if (restart_stratum(pool))
                 continue;
@@ -6232,252 +6471,839 @@ static void* stratum_rthread(void *userdata)
             continue;
         }
 
-        /* Check this pool hasn't died while being a backup pool and
-         * has not had its idle flag cleared */
-        stratum_resumed(pool);
-
-        if (!parse_method(pool, s) && !parse_stratum_response(pool, s))
-            applog(LOG_INFO, "Unknown stratum msg: %s", s);
-        else if (pool->swork.clean) {
-            struct work *work = make_work();
-
-            /* Generate a single work item to update the current
-             * block database */
-            pool->swork.clean = false;
-            switch (pool->algorithm.type) {
-            case ALGO_CRYPTONIGHT:
-            case ALGO_CRYPTONIGHT_LITE:
-                gen_stratum_work_cn(pool, work);
-                break;
-
-            default:
-                gen_stratum_work(pool, work);
-            }
-            work->longpoll = true;
-            /* Return value doesn't matter. We're just informing
-             * that we may need to restart. */
-            test_work_current(work);
-            free_work(work);
-        }
-        free(s);
+        stratum_dispatch(pool, s);
     }
 
 out:
     return (NULL);
 }
 
-/* Each pool has one stratum send thread for sending shares to avoid many
- * threads being created for submission since all sends need to be serialised
- * anyway. */
-static void* stratum_sthread(void *userdata)
+/* The parts of the submit message that are the same for every share of a job
+ * and connection, so a share only needs its hex and id written in between:
+ * head nonce2 mid nonce tail id end, or for CryptoNight
+ * head nonce mid result tail id end */
+struct stratum_submit_tmpl {
+    /* What the template was built for, the strings are referenced so they
+     * can be compared by address */
+    char *job_id;
+    char *ntime;
+    int sock_gen;
+    size_t nonce2_len;
+    int vote;
+
+    bool cryptonight;
+    int nonce_off; /* of the nonce in work->data */
+    bool nonce_be;
+    bool nonce64; /* Sia pools take 64 bit nonces */
+    char *head, *mid, *tail;
+    size_t head_len, mid_len, tail_len;
+    const char *end;
+    size_t end_len;
+};
+
+static char *stratum_submit_part(size_t *len, const char *fmt, ...)
 {
-    struct pool *pool = (struct pool *)userdata;
-    char threadname[16];
+    va_list ap;
+    char *part;
 
-    pthread_detach(pthread_self());
+    va_start(ap, fmt);
+    *len = vsnprintf(NULL, 0, fmt, ap);
+    va_end(ap);
 
-    snprintf(threadname, sizeof(threadname), "%d/SStratum", pool->pool_no);
-    RenameThread(threadname);
+    part = (char *)cgmalloc(*len + 1);
+    va_start(ap, fmt);
+    vsnprintf(part, *len + 1, fmt, ap);
+    va_end(ap);
+    return (part);
+}
 
-    pool->stratum_q = tq_new();
-    if (!pool->stratum_q)
-        quit(1, "Failed to create stratum_q in stratum_sthread");
+static void stratum_submit_tmpl_clear(struct stratum_submit_tmpl *tmpl)
+{
+    rcstr_put(tmpl->job_id);
+    rcstr_put(tmpl->ntime);
+    free(tmpl->head);
+    free(tmpl->mid);
+    free(tmpl->tail);
+    memset(tmpl, 0, sizeof(struct stratum_submit_tmpl));
+}
 
+static void stratum_submit_tmpl_build(struct stratum_submit_tmpl *tmpl, struct pool *pool, struct work *work)
+{
+    static const char end[] = ", \"method\": \"mining.submit\"}";
+    const algorithm_layout_t *layout = algorithm_layout(pool->algorithm.type);
 
-    while (42) {
-        char noncehex[20] , nonce2hex[80] ,  s[4096] = {0};
-        struct stratum_share *sshare;
-        uint32_t *hash32, nonce;
-        unsigned char nonce2[32];
-        struct work *work;
-        bool submitted = false;
+    stratum_submit_tmpl_clear(tmpl);
+    tmpl->job_id = rcstr_get(work->job_id);
+    tmpl->ntime = rcstr_get(work->ntime);
+    tmpl->sock_gen = pool->sock_gen;
+    tmpl->nonce2_len = work->nonce2_len;
+    tmpl->vote = opt_vote;
 
-        if (unlikely(pool->removed)) {
-            break;
-        }
+    if ((pool->algorithm.type == ALGO_CRYPTONIGHT) || (pool->algorithm.type == ALGO_CRYPTONIGHT_LITE)) {
+        tmpl->cryptonight = true;
+        tmpl->nonce_off = layout->nonce_off;
+        tmpl->head = stratum_submit_part(&tmpl->head_len, "{\"method\": \"submit\", \"params\": {\"id\": \"%s\", \"job_id\": \"%s\", \"nonce\": \"",
+                                         pool->XMRAuthID, work->job_id);
+        tmpl->mid = stratum_submit_part(&tmpl->mid_len, "\", \"result\": \"");
+        tmpl->tail = stratum_submit_part(&tmpl->tail_len, "\"}, \"id\":");
+        tmpl->end = "}";
+        tmpl->end_len = 1;
+        return;
+    }
 
-        work = (struct work *)tq_pop(pool->stratum_q, NULL);
-        if (unlikely(!work))
-            quit(1, "Stratum q returned empty work");
-			
-		hash32 = (uint32_t*) work->hash;
-    	if (!(sshare = (struct stratum_share *)calloc(sizeof(struct stratum_share), 1))) {
-      		quit(1, "%s: calloc() failed on sshare.", __func__);
-    	}
+    tmpl->nonce_off = layout->nonce_off;
+    tmpl->nonce_be = layout->submit_be;
+    tmpl->nonce64 = layout->submit_nonce64;
 
-        if ((pool->algorithm.type == ALGO_CRYPTONIGHT) || (pool->algorithm.type == ALGO_CRYPTONIGHT_LITE)) {
-            char *ASCIIResult;
-            uint8_t HashResult[32];
+    tmpl->head = stratum_submit_part(&tmpl->head_len, "{\"params\": [\"%s\", \"%s\", \"", pool->rpc_user, work->job_id);
+    tmpl->mid = stratum_submit_part(&tmpl->mid_len, "\", \"%s\", \"", work->ntime);
+    if (pool->algorithm.type == ALGO_DECRED && opt_vote)
+        tmpl->tail = stratum_submit_part(&tmpl->tail_len, "\", \"%04x\"], \"id\": ", (opt_vote << 1) | 1);
+    else
+        tmpl->tail = stratum_submit_part(&tmpl->tail_len, "\"], \"id\": ");
+    tmpl->end = end;
+    tmpl->end_len = sizeof(end) - 1;
+}
 
-            sshare->sshare_time = time(NULL);
-            /* This work item is freed in parse_stratum_response */
-            sshare->work = work;
+static char *stratum_put(char *s, const char *part, size_t len)
+{
+    memcpy(s, part, len);
+    return (s + len);
+}
 
-            applog(LOG_DEBUG, "stratum_sthread() algorithm = %s", pool->algorithm.name);
+static char *stratum_put_id(char *s, int id)
+{
+    char digits[12];
+    unsigned int v = id;
+    int n = 0;
 
-			char *ASCIINonce = bin2hex(work->data + 39, 4);
+    if (id < 0) {
+        *s++ = '-';
+        v = -(unsigned int)id;
+    }
+    do {
+        digits[n++] = '0' + v % 10;
+        v /= 10;
+    } while (v);
+    while (n)
+        *s++ = digits[--n];
+    return (s);
+}
 
-            ASCIIResult = bin2hex(work->hash, 32);
+/* Builds the submit message for a share into s from the job's template,
+ * rebuilding that first if the share is from another job. Returns NULL when
+ * the share cannot be submitted, the work is discarded then */
+static struct stratum_share *stratum_share_new(struct pool *pool, struct stratum_submit_tmpl *tmpl, struct work *work, char *s, size_t size)
+{
+    struct stratum_share *sshare;
+    unsigned char nonce2[32];
+    uint32_t nonce;
+    char *p = s;
 
-            mutex_lock(&sshare_lock);
-            /* Give the stratum share a unique id */
-            sshare->id = swork_id++;
-            mutex_unlock(&sshare_lock);
+    if (unlikely(work->nonce2_len > 32)) {
+        applog(LOG_ERR, "%s asking for inappropriately long nonce2 length %d", get_pool_name(pool), (int)work->nonce2_len);
+        applog(LOG_ERR, "Not attempting to submit shares");
+        free_work(work);
+        return (NULL);
+    }
 
-            snprintf(s, sizeof(s), "{\"method\": \"submit\", \"params\": {\"id\": \"%s\", \"job_id\": \"%s\", \"nonce\": \"%s\", \"result\": \"%s\"}, \"id\":%d}", pool->XMRAuthID, work->job_id, ASCIINonce, ASCIIResult, sshare->id);
+    if (tmpl->job_id != work->job_id || tmpl->ntime != work->ntime || tmpl->sock_gen != pool->sock_gen ||
+        tmpl->nonce2_len != work->nonce2_len || tmpl->vote != opt_vote || !tmpl->head)
+        stratum_submit_tmpl_build(tmpl, pool, work);
 
-            free(ASCIINonce);
-            free(ASCIIResult);
-        }
+    /* The longest hex is 64 bytes of result, the id at most 11 digits */
+    if (unlikely(tmpl->head_len + tmpl->mid_len + tmpl->tail_len + tmpl->end_len + 2 * 32 + 16 + 11 >= size)) {
+        applog(LOG_ERR, "%s submit message for job %s too long", get_pool_name(pool), work->job_id);
+        free_work(work);
+        return (NULL);
+    }
 
-        else {
-            if (unlikely(work->nonce2_len > 32)) {
-                applog(LOG_ERR, "%s asking for inappropriately long nonce2 length %d", get_pool_name(pool), (int)work->nonce2_len);
-                applog(LOG_ERR, "Not attempting to submit shares");
-                free_work(work);
-                free(sshare);
-                continue;
-            }
+    if (!(sshare = (struct stratum_share *)calloc(sizeof(struct stratum_share), 1))) {
+        quit(1, "%s: calloc() failed on sshare.", __func__);
+    }
 
+    sshare->sshare_time = time(NULL);
+    /* This work item is freed in parse_stratum_response */
+    sshare->work = work;
+    /* Give the stratum share a unique id */
+    sshare->id = swork_next_id();
 
+    p = stratum_put(p, tmpl->head, tmpl->head_len);
+    if (tmpl->cryptonight) {
+        p = bin2hex_to(p, work->data + tmpl->nonce_off, 4);
+        p = stratum_put(p, tmpl->mid, tmpl->mid_len);
+        p = bin2hex_to(p, work->hash, 32);
+    }
+    else {
+        memset(nonce2, 0, sizeof(nonce2));
+        *((uint64_t *)nonce2) = htole64(work->nonce2);
+        p = bin2hex_to(p, nonce2, work->nonce2_len);
+        p = stratum_put(p, tmpl->mid, tmpl->mid_len);
 
+        memcpy(&nonce, work->data + tmpl->nonce_off, 4);
+        if (tmpl->nonce_be)
+            nonce = htobe32(nonce);
+        p = bin2hex_to(p, (const unsigned char *)&nonce, 4);
+        if (tmpl->nonce64)
+            p = stratum_put(p, "00000000", 8);
+    }
+    p = stratum_put(p, tmpl->tail, tmpl->tail_len);
+    p = stratum_put_id(p, sshare->id);
+    p = stratum_put(p, tmpl->end, tmpl->end_len);
+    *p = '\0';
 
-            sshare->sshare_time = time(NULL);
-            /* This work item is freed in parse_stratum_response */
-            sshare->work = work;
+    return (sshare);
+}
 
-            applog(LOG_DEBUG, "stratum_sthread() algorithm = %s", pool->algorithm.name);
+static void stratum_share_discard(struct pool *pool, struct work *work)
+{
+    applog(LOG_DEBUG, "Failed to submit stratum share, discarding");
+    free_work(work);
+    pool->stale_shares++;
+    total_stale++;
+}
+
+/* Shares built for a pool but not sent yet. Their submit lines are written
+ * back to back so a burst of shares goes out in a single write */
+#define SSHARE_BATCH 32
+#define SSHARE_LINE 4096
+
+struct stratum_batch {
+    struct stratum_share *sshare[SSHARE_BATCH];
+    int id[SSHARE_BATCH];   /* copies, sshare[i] is not ours once it is in the table */
+    size_t start[SSHARE_BATCH];
+    int count;
+    size_t len;
+    char buf[SSHARE_BATCH * 256 + SSHARE_LINE];
+    struct stratum_submit_tmpl tmpl;
+};
 
-            // Neoscrypt is little endian
-            if (pool->algorithm.type == ALGO_NEOSCRYPT) {
-                nonce = htobe32(*((uint32_t *)(work->data + 76)));
-                //*((uint32_t *)nonce2) = htole32(work->nonce2);
-            }
-            else if (pool->algorithm.type == ALGO_DECRED) {
-                nonce = *((uint32_t *)(work->data + 140));
-            }
-            else if (pool->algorithm.type == ALGO_LBRY) {
-                nonce = *((uint32_t *)(work->data + 108));
-            }
-            else if (pool->algorithm.type == ALGO_SIA) {
-#if SUPPORT_SIAPOOL
-                nonce = htobe32(*((uint32_t *)(work->data + 32)));
-#else
-                nonce = *((uint32_t *)(work->data + 32));
-#endif
-            }
-            else if (pool->algorithm.type == ALGO_PASCAL) {
-                nonce = htobe32(*((uint32_t *)(work->data + 196)));
-            }
-            else {
-                nonce = *((uint32_t *)(work->data + 76));
-            }
-            __bin2hex(noncehex, (const unsigned char *)&nonce, 4);
+static bool stratum_batch_full(struct stratum_batch *batch)
+{
+    return (batch->count == SSHARE_BATCH || sizeof(batch->buf) - batch->len < SSHARE_LINE);
+}
 
-#if SUPPORT_SIAPOOL
-            // Sia nonces are actually 64 bits long
-            if (pool->algorithm.type == ALGO_SIA)
-                strcat(noncehex, "00000000");
-#endif
+static void stratum_batch_add(struct pool *pool, struct stratum_batch *batch, struct work *work)
+{
+    uint32_t *hash32 = (uint32_t *)work->hash;
+    struct stratum_share *sshare;
+    char *s = batch->buf + batch->len;
 
-            *((uint64_t *)nonce2) = htole64(work->nonce2);
-            __bin2hex(nonce2hex, nonce2, work->nonce2_len);
-            memset(s, 0, 4096);
+    /* Leave room for the \n in place of the terminating nul */
+    sshare = stratum_share_new(pool, &batch->tmpl, work, s, SSHARE_LINE - 1);
+    if (!sshare)
+        return;
 
-            mutex_lock(&sshare_lock);
-            /* Give the stratum share a unique id */
-            sshare->id = swork_id++;
-            mutex_unlock(&sshare_lock);
+    applog(LOG_INFO, "Submitting share %08lx to %s", (long unsigned int)htole32(hash32[6]), get_pool_name(pool));
 
+    /* A failed send looks the shares up again by id, after a response or a
+     * disconnect may have freed them, so the id must not be read from the
+     * share then */
+    batch->sshare[batch->count] = sshare;
+    batch->id[batch->count] = sshare->id;
+    batch->start[batch->count] = batch->len;
+    batch->count++;
+    batch->len += strlen(s);
+    batch->buf[batch->len++] = '\n';
+}
 
-            if (pool->algorithm.type == ALGO_DECRED && opt_vote) {
-                snprintf(s, sizeof(s),
-                         "{\"params\": [\"%s\", \"%s\", \"%s\", \"%s\", \"%s\", \"%04x\"], \"id\": %d, \"method\": \"mining.submit\"}",
-                         pool->rpc_user, work->job_id, nonce2hex, work->ntime, noncehex, (opt_vote << 1) | 1, sshare->id);
-            }
-            else {
-                snprintf(s, sizeof(s),
-                         "{\"params\": [\"%s\", \"%s\", \"%s\", \"%s\", \"%s\"], \"id\": %d, \"method\": \"mining.submit\"}",
-                         pool->rpc_user, work->job_id, nonce2hex, work->ntime, noncehex, sshare->id);
-            }
-        }
+/* Removes share i from the batch, it is up to the caller to free it */
+static void stratum_batch_drop(struct stratum_batch *batch, int i)
+{
+    size_t start = batch->start[i];
+    size_t end = (i + 1 < batch->count) ? batch->start[i + 1] : batch->len;
+    int j;
 
-        applog(LOG_INFO, "Submitting share %08lx to %s", (long unsigned int)htole32(hash32[6]), get_pool_name(pool));
+    memmove(batch->buf + start, batch->buf + end, batch->len - end);
+    batch->len -= end - start;
+    for (j = i + 1; j < batch->count; j++) {
+        batch->sshare[j - 1] = batch->sshare[j];
+        batch->id[j - 1] = batch->id[j];
+        batch->start[j - 1] = batch->start[j] - (end - start);
+    }
+    batch->count--;
+}
 
-        /* Try resubmitting for up to 2 minutes if we fail to submit
-         * once and the stratum pool nonce1 still matches suggesting
-         * we may be able to resume. */
-        while (time(NULL) < sshare->sshare_time + 120) {
-            bool sessionid_match;
+/* Sends the batch and adds its shares to the pool's shares waiting for a
+ * response. The shares go into the table before they are sent so a response
+ * always finds its share, the send itself is done without the lock. Returns
+ * false when the send failed, the shares left in the batch then still belong
+ * to the caller */
+static bool stratum_batch_send(struct pool *pool, struct stratum_batch *batch)
+{
+    struct stratum_share *found;
+    time_t now = time(NULL);
+    int i, ssdiff;
 
-            mutex_lock(&sshare_lock);
-            if (likely(stratum_send(pool, s, strlen(s)))) {
-                int ssdiff;
+    if (!batch->count)
+        return (true);
 
-                if (pool_tclear(pool, &pool->submit_fail))
-                    applog(LOG_WARNING, "%s communication resumed, submitting work", get_pool_name(pool));
+    /* Once they are in the table the responses may free them at any time */
+    ssdiff = now - batch->sshare[0]->sshare_time;
 
-                sshare->sshare_sent = time(NULL);
-                ssdiff = sshare->sshare_sent - sshare->sshare_time;
-                if (opt_debug || ssdiff > 0) {
-                    applog(LOG_INFO, "Pool %d stratum share submission lag time %d seconds",
-                           pool->pool_no, ssdiff);
-                }
+    mutex_lock(&pool->sshare_lock);
+    for (i = 0; i < batch->count; i++) {
+        batch->sshare[i]->sshare_sent = now;
+        HASH_ADD_INT(pool->stratum_shares, id, batch->sshare[i]);
+        pool->sshares++;
+    }
+    mutex_unlock(&pool->sshare_lock);
 
-                HASH_ADD_INT(stratum_shares, id, sshare);
-                pool->sshares++;
-                mutex_unlock(&sshare_lock);
+    if (likely(stratum_send_shares(pool, batch->buf, batch->len, batch->count))) {
+        if (pool_tclear(pool, &pool->submit_fail))
+            applog(LOG_WARNING, "%s communication resumed, submitting work", get_pool_name(pool));
 
-                applog(LOG_DEBUG, "Successfully submitted, adding to stratum_shares db");
-                submitted = true;
-                break;
-            }
-            else {
-                mutex_unlock(&sshare_lock);
-            }
-            if (!pool_tset(pool, &pool->submit_fail) && cnx_needed(pool)) {
-                applog(LOG_WARNING, "%s stratum share submission failure", get_pool_name(pool));
-                total_ro++;
-                pool->remotefail_occasions++;
-            }
+        if (opt_debug || ssdiff > 0) {
+            applog(LOG_INFO, "Pool %d stratum share submission lag time %d seconds",
+                   pool->pool_no, ssdiff);
+        }
 
-            if (opt_lowmem) {
-                applog(LOG_DEBUG, "Lowmem option prevents resubmitting stratum share");
-                break;
-            }
+        applog(LOG_DEBUG, "Successfully submitted %d, adding to stratum_shares db", batch->count);
+        batch->count = 0;
+        batch->len = 0;
+        return (true);
+    }
 
-            cg_rlock(&pool->data_lock);
-            sessionid_match = (pool->nonce1 && !strcmp(work->nonce1, pool->nonce1));
-            cg_runlock(&pool->data_lock);
+    /* Take back what a disconnect did not clear while we were sending, the
+     * cleared ones have already been counted as stale and freed */
+    mutex_lock(&pool->sshare_lock);
+    for (i = 0; i < batch->count; ) {
+        /* by the copied id, batch->sshare[i] may be gone */
+        HASH_FIND_INT(pool->stratum_shares, &batch->id[i], found);
+        if (found) {
+            HASH_DEL(pool->stratum_shares, found);
+            pool->sshares--;
+            i++;
+        }
+        else
+            stratum_batch_drop(batch, i);
+    }
+    mutex_unlock(&pool->sshare_lock);
 
-            if (!sessionid_match) {
-                applog(LOG_DEBUG, "No matching session id for resubmitting stratum share");
+    if (unlikely(!batch->count))
+        return (true);
+
+    if (!pool_tset(pool, &pool->submit_fail) && cnx_needed(pool)) {
+        applog(LOG_WARNING, "%s stratum share submission failure", get_pool_name(pool));
+        total_ro++;
+        pool->remotefail_occasions++;
+    }
+    return (false);
+}
+
+/* Drops the shares that can no longer be resubmitted: found more than 2
+ * minutes ago or from a session the pool no longer has */
+static void stratum_batch_expire(struct pool *pool, struct stratum_batch *batch)
+{
+    time_t now = time(NULL);
+    int i;
+
+    for (i = 0; i < batch->count; ) {
+        struct stratum_share *sshare = batch->sshare[i];
+        bool sessionid_match;
+
+        cg_rlock(&pool->data_lock);
+        sessionid_match = (pool->nonce1 && !strcmp(sshare->work->nonce1, pool->nonce1));
+        cg_runlock(&pool->data_lock);
+
+        if (sessionid_match && now < sshare->sshare_time + 120) {
+            i++;
+            continue;
+        }
+
+        if (!sessionid_match)
+            applog(LOG_DEBUG, "No matching session id for resubmitting stratum share");
+        stratum_share_discard(pool, sshare->work);
+        free(sshare);
+        stratum_batch_drop(batch, i);
+    }
+}
+
+static void stratum_batch_discard(struct pool *pool, struct stratum_batch *batch)
+{
+    while (batch->count) {
+        stratum_share_discard(pool, batch->sshare[0]->work);
+        free(batch->sshare[0]);
+        stratum_batch_drop(batch, 0);
+    }
+}
+
+/* Each pool has one stratum send thread for sending shares to avoid many
+ * threads being created for submission since all sends need to be serialised
+ * anyway. */
+static void* stratum_sthread(void *userdata)
+{
+    struct pool *pool = (struct pool *)userdata;
+    struct stratum_batch *batch;
+    char threadname[16];
+
+    pthread_detach(pthread_self());
+
+    snprintf(threadname, sizeof(threadname), "%d/SStratum", pool->pool_no);
+    RenameThread(threadname);
+
+    pool->stratum_q = tq_new();
+    if (!pool->stratum_q)
+        quit(1, "Failed to create stratum_q in stratum_sthread");
+
+    batch = (struct stratum_batch *)calloc(1, sizeof(struct stratum_batch));
+    if (unlikely(!batch))
+        quit(1, "Failed to calloc stratum batch in stratum_sthread");
+
+    while (42) {
+        static const struct timespec no_wait;
+        struct work *work;
+
+        if (unlikely(pool->removed)) {
+            break;
+        }
+
+        work = (struct work *)tq_pop(pool->stratum_q, NULL);
+        if (unlikely(!work))
+            quit(1, "Stratum q returned empty work");
+
+        /* Send whatever else has been queued meanwhile along with it */
+        do {
+            stratum_batch_add(pool, batch, work);
+        } while (!stratum_batch_full(batch) &&
+                 (work = (struct work *)tq_pop(pool->stratum_q, &no_wait)));
+
+        /* Try resubmitting for up to 2 minutes if we fail to submit
+         * once and the stratum pool nonce1 still matches suggesting
+         * we may be able to resume. */
+        while (!stratum_batch_send(pool, batch)) {
+            if (opt_lowmem) {
+                applog(LOG_DEBUG, "Lowmem option prevents resubmitting stratum share");
                 break;
             }
+
+            stratum_batch_expire(pool, batch);
+            if (!batch->count)
+                break;
             /* Retry every 5 seconds */
             sleep(5);
         }
 
-        if (unlikely(!submitted)) {
-            applog(LOG_DEBUG, "Failed to submit stratum share, discarding");
-            free_work(work);
-            free(sshare);
-            pool->stale_shares++;
-            total_stale++;
-        }
+        stratum_batch_discard(pool, batch);
     }
 
     /* Freeze the work queue but don't free up its memory in case there is
      * work still trying to be submitted to the removed pool. */
     tq_freeze(pool->stratum_q);
+    stratum_submit_tmpl_clear(&batch->tmpl);
+    free(batch);
+
+    return (NULL);
+}
+
+#ifdef HAVE_SYS_EPOLL_H
+/* With --stratum-epoll a single thread owns the sockets of every stratum
+ * pool instead of a receive and a send thread per pool. It waits on all of
+ * them with epoll, parses what arrives, submits queued shares and runs the
+ * timers the per pool threads implement by sleeping. Connecting can block
+ * for up to DEFAULT_SOCKWAIT so it is handed to a single helper thread and
+ * the pool rejoins the loop once it is authorised again. */
+enum sio_state {
+    SIO_NONE = 0,   /* not handled by the event loop */
+    SIO_CONNECTED,  /* authorised, waiting to be added to the loop */
+    SIO_ACTIVE,     /* socket is in the epoll set */
+    SIO_PARKED,     /* suspended until the connection is needed again */
+    SIO_CONNECTING, /* owned by the connect thread */
+    SIO_RETRY,      /* connect failed, retry at sio_retry */
+    SIO_REMOVED
+};
+
+#define SIO_EVENTS 16
+#define SIO_TIMEOUT 90
+#define SIO_RETRY_SECS 30
+
+static pthread_mutex_t sio_lock;
+static int sio_epfd = -1, sio_evfd = -1;
+static struct thread_q *sio_cnx_q;
+/* Every pool the loop owns, removed pools drop out of pools[] but stay
+ * here until they have been shut down */
+static struct pool **sio_pools;
+static int sio_pool_count;
+
+static void stratum_io_wake(void)
+{
+    uint64_t one = 1;
+
+    if (sio_evfd >= 0 && write(sio_evfd, &one, sizeof(one)) < 0)
+        applog(LOG_DEBUG, "Failed to wake stratum io thread");
+}
+
+static int stratum_io_state(struct pool *pool)
+{
+    int state;
+
+    mutex_lock(&sio_lock);
+    state = pool->sio_state;
+    mutex_unlock(&sio_lock);
+
+    return (state);
+}
+
+static void stratum_io_set_state(struct pool *pool, int state)
+{
+    mutex_lock(&sio_lock);
+    pool->sio_state = state;
+    mutex_unlock(&sio_lock);
+}
+
+static void stratum_io_connect(struct pool *pool)
+{
+    stratum_io_set_state(pool, SIO_CONNECTING);
+    if (unlikely(!tq_push(sio_cnx_q, pool)))
+        quit(1, "Failed to queue stratum connect");
+}
+
+/* Shuts down a removed pool the first time the loop or the connect thread
+ * comes across it, stratum_io_tick then forgets it. The queue is only
+ * frozen since submit_work may still hold the pool */
+static void stratum_io_remove(struct pool *pool)
+{
+    static const struct timespec no_wait;
+    struct work *work;
+
+    suspend_stratum(pool);
+    tq_freeze(pool->stratum_q);
+    while ((work = (struct work *)tq_pop(pool->stratum_q, &no_wait)))
+        free_work(work);
+
+    mutex_lock(&pool->stratum_lock);
+    free(pool->sockbuf);
+    pool->sockbuf = NULL;
+    pool->sockbuf_size = 0;
+    mutex_unlock(&pool->stratum_lock);
+
+    stratum_io_set_state(pool, SIO_REMOVED);
+}
+
+/* Does the connection attempts of the event loop, one per request */
+static void *stratum_cnx_thread(void __maybe_unused *userdata)
+{
+    pthread_detach(pthread_self());
+    RenameThread("StratumCnx");
+
+    while (42) {
+        struct pool *pool = (struct pool *)tq_pop(sio_cnx_q, NULL);
+
+        if (unlikely(!pool))
+            continue;
+        if (unlikely(pool->removed)) {
+            stratum_io_remove(pool);
+            continue;
+        }
+
+        if (restart_stratum(pool)) {
+            if (pool->sio_failed)
+                stratum_resumed(pool);
+            pool->sio_failed = false;
+            stratum_io_set_state(pool, SIO_CONNECTED);
+        }
+        else {
+            /* First failure retries straight away like the per pool
+             * thread does, after that every 30 seconds */
+            if (!pool->sio_failed) {
+                pool_died(pool);
+                pool->sio_retry = time(NULL);
+                pool->sio_failed = true;
+            }
+            else {
+                pool_failed(pool);
+                pool->sio_retry = time(NULL) + SIO_RETRY_SECS;
+            }
+            stratum_io_set_state(pool, SIO_RETRY);
+        }
+        stratum_io_wake();
+    }
+
+    return (NULL);
+}
+
+/* Adds a freshly connected socket to the epoll set, epoll drops the old one
+ * by itself when it is closed */
+static void stratum_io_register(struct pool *pool)
+{
+    struct epoll_event ev;
+
+    memset(&ev, 0, sizeof(ev));
+    ev.events = EPOLLIN;
+    ev.data.ptr = pool;
+    if (epoll_ctl(sio_epfd, EPOLL_CTL_ADD, pool->sock, &ev) && errno != EEXIST)
+        applog(LOG_WARNING, "Failed to add %s socket to epoll: %s", get_pool_name(pool), strerror(errno));
+    pool->sio_gen = pool->sock_gen;
+}
+
+static void stratum_io_lost(struct pool *pool)
+{
+    stratum_interrupted(pool);
+    suspend_stratum(pool);
+    stratum_io_connect(pool);
+}
+
+static void stratum_io_lines(struct pool *pool)
+{
+    char *s;
+
+    while (pool->sock && (s = sockbuf_line(pool)))
+        stratum_dispatch(pool, s);
+
+    /* client.reconnect closed the socket, the connect thread opens the new one */
+    if (pool->sio_reconnect) {
+        pool->sio_reconnect = false;
+        stratum_io_connect(pool);
+        return;
+    }
+
+    if (pool->sock && pool->sock_gen != pool->sio_gen)
+        stratum_io_register(pool);
+}
+
+static void stratum_io_read(struct pool *pool, time_t now)
+{
+    ssize_t n;
+
+    if (stratum_io_state(pool) != SIO_ACTIVE || !pool->sock)
+        return;
+    if (unlikely(pool->removed)) {
+        stratum_io_remove(pool);
+        return;
+    }
+
+    n = recv_sockbuf(pool);
+    if (n == 0 || (n < 0 && !sock_blocks())) {
+        applog(LOG_DEBUG, "Stratum recv failed on %s", get_pool_name(pool));
+        stratum_io_lost(pool);
+        return;
+    }
+    if (n > 0)
+        pool->sio_last = now;
+    stratum_io_lines(pool);
+}
+
+/* Sends what stratum_io_submit has batched up. Shares that could not be sent
+ * go back on the queue */
+static bool stratum_io_flush(struct pool *pool, struct stratum_batch *batch)
+{
+    if (stratum_batch_send(pool, batch))
+        return (true);
+
+    while (batch->count) {
+        struct work *work = batch->sshare[0]->work;
+
+        free(batch->sshare[0]);
+        stratum_batch_drop(batch, 0);
+        if (opt_lowmem) {
+            applog(LOG_DEBUG, "Lowmem option prevents resubmitting stratum share");
+            stratum_share_discard(pool, work);
+        }
+        else if (unlikely(!tq_push(pool->stratum_q, work)))
+            stratum_share_discard(pool, work);
+    }
+    return (false);
+}
+
+/* Sends whatever the miners queued for the pool. A share that fails to go
+ * out is put back and retried on the next connection while its session is
+ * still valid, for up to 2 minutes after it was found like stratum_sthread */
+static bool stratum_io_submit(struct pool *pool, time_t now)
+{
+    static const struct timespec no_wait;
+    static struct stratum_batch batch;
+    struct work *work;
+
+    while ((work = (struct work *)tq_pop(pool->stratum_q, &no_wait))) {
+        if (now >= work->tv_work_found.tv_sec + 120) {
+            stratum_share_discard(pool, work);
+            continue;
+        }
+        if (work->tv_work_found.tv_sec < pool->sio_connected) {
+            bool sessionid_match;
+
+            cg_rlock(&pool->data_lock);
+            sessionid_match = (pool->nonce1 && !strcmp(work->nonce1, pool->nonce1));
+            cg_runlock(&pool->data_lock);
+
+            if (!sessionid_match) {
+                applog(LOG_DEBUG, "No matching session id for resubmitting stratum share");
+                stratum_share_discard(pool, work);
+                continue;
+            }
+        }
+
+        stratum_batch_add(pool, &batch, work);
+        if (stratum_batch_full(&batch) && !stratum_io_flush(pool, &batch))
+            return (false);
+    }
+    return (stratum_io_flush(pool, &batch));
+}
+
+
+/* Runs the timers of every pool in the loop, called after each wakeup */
+static void stratum_io_tick(time_t now)
+{
+    struct pool **list;
+    int i, count;
+
+    mutex_lock(&sio_lock);
+    for (i = count = 0; i < sio_pool_count; i++) {
+        if (sio_pools[i]->sio_state != SIO_REMOVED)
+            sio_pools[count++] = sio_pools[i];
+    }
+    sio_pool_count = count;
+    list = (struct pool **)cgmalloc(sizeof(struct pool *) * (count + 1));
+    memcpy(list, sio_pools, sizeof(struct pool *) * count);
+    mutex_unlock(&sio_lock);
+
+    for (i = 0; i < count; i++) {
+        struct pool *pool = list[i];
+
+        switch (stratum_io_state(pool)) {
+        case SIO_CONNECTED:
+            stratum_io_register(pool);
+            pool->sio_last = pool->sio_connected = now;
+            stratum_io_set_state(pool, SIO_ACTIVE);
+            /* Anything that arrived with the authorisation */
+            stratum_io_lines(pool);
+            /* Fall through */
+        case SIO_ACTIVE:
+            if (unlikely(pool->removed)) {
+                stratum_io_remove(pool);
+                break;
+            }
+            /* The protocol specifies that notify messages should be
+             * sent every minute so if we fail to receive any for 90
+             * seconds we assume the connection has been dropped */
+            if (now - pool->sio_last >= SIO_TIMEOUT) {
+                applog(LOG_DEBUG, "Stratum timed out on %s", get_pool_name(pool));
+                stratum_io_lost(pool);
+                break;
+            }
+            if (!cnx_needed(pool)) {
+                applog(LOG_INFO, "Suspending stratum on %s", get_pool_name(pool));
+                suspend_stratum(pool);
+                clear_stratum_shares(pool);
+                clear_pool_work(pool);
+                stratum_io_set_state(pool, SIO_PARKED);
+                break;
+            }
+            if (!stratum_io_submit(pool, now))
+                stratum_io_lost(pool);
+            break;
+        case SIO_PARKED:
+            if (unlikely(pool->removed))
+                stratum_io_remove(pool);
+            else if (!lp_waiting(pool))
+                stratum_io_connect(pool);
+            break;
+        case SIO_RETRY:
+            if (unlikely(pool->removed))
+                stratum_io_remove(pool);
+            else if (now >= pool->sio_retry)
+                stratum_io_connect(pool);
+            break;
+        default:
+            break;
+        }
+    }
+
+    free(list);
+}
+
+static void *stratum_io_thread(void __maybe_unused *userdata)
+{
+    struct epoll_event events[SIO_EVENTS];
+
+    pthread_detach(pthread_self());
+    RenameThread("StratumIO");
+
+    while (42) {
+        time_t now;
+        int i, n;
+
+        n = epoll_wait(sio_epfd, events, SIO_EVENTS, 1000);
+        if (unlikely(n < 0)) {
+            if (errno != EINTR)
+                applog(LOG_ERR, "Stratum epoll_wait failed: %s", strerror(errno));
+            n = 0;
+        }
+
+        now = time(NULL);
+        for (i = 0; i < n; i++) {
+            struct pool *pool = (struct pool *)events[i].data.ptr;
+
+            if (pool)
+                stratum_io_read(pool, now);
+            else {
+                uint64_t count;
+
+                if (read(sio_evfd, &count, sizeof(count)) < 0)
+                    applog(LOG_DEBUG, "Failed to read stratum io eventfd");
+            }
+        }
+        stratum_io_tick(now);
+    }
 
     return (NULL);
 }
 
+/* Hands a pool that has just been authorised to the event loop, starting the
+ * loop the first time */
+static void stratum_io_add(struct pool *pool)
+{
+    pthread_t thr;
+
+    mutex_lock(&sio_lock);
+    if (sio_epfd < 0) {
+        struct epoll_event ev;
+
+        sio_epfd = epoll_create1(EPOLL_CLOEXEC);
+        sio_evfd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+        if (unlikely(sio_epfd < 0 || sio_evfd < 0))
+            quit(1, "Failed to create stratum epoll: %s", strerror(errno));
+
+        memset(&ev, 0, sizeof(ev));
+        ev.events = EPOLLIN;
+        ev.data.ptr = NULL;
+        if (unlikely(epoll_ctl(sio_epfd, EPOLL_CTL_ADD, sio_evfd, &ev)))
+            quit(1, "Failed to add stratum eventfd to epoll");
+
+        sio_cnx_q = tq_new();
+        if (unlikely(!sio_cnx_q))
+            quit(1, "Failed to create sio_cnx_q");
+        if (unlikely(pthread_create(&thr, NULL, stratum_cnx_thread, NULL)))
+            quit(1, "Failed to create stratum connect thread");
+        if (unlikely(pthread_create(&thr, NULL, stratum_io_thread, NULL)))
+            quit(1, "Failed to create stratum io thread");
+    }
+
+    pool->stratum_q = tq_new();
+    if (!pool->stratum_q)
+        quit(1, "Failed to create stratum_q in stratum_io_add");
+    pool->sio_state = SIO_CONNECTED;
+
+    sio_pools = (struct pool **)realloc(sio_pools, sizeof(struct pool *) * (sio_pool_count + 1));
+    if (unlikely(!sio_pools))
+        quit(1, "Failed to realloc sio_pools");
+    sio_pools[sio_pool_count++] = pool;
+    mutex_unlock(&sio_lock);
+
+    stratum_io_wake();
+}
+#endif /* HAVE_SYS_EPOLL_H */
+
 static void init_stratum_threads(struct pool *pool)
 {
     have_longpoll = true;
 
+#ifdef HAVE_SYS_EPOLL_H
+    if (opt_stratum_epoll) {
+        stratum_io_add(pool);
+        return;
+    }
+#endif
     if (unlikely(pthread_create(&pool->stratum_sthread, NULL, stratum_sthread, (void *)pool)))
         quit(1, "Failed to create stratum sthread");
     if (unlikely(pthread_create(&pool->stratum_rthread, NULL, stratum_rthread, (void *)pool)))
@@ -6705,13 +7531,13 @@ static void pool_resus(struct pool *pool)
  * be handled. */
 static struct work* hash_pop(bool blocking)
 {
-    struct work *work = NULL, *tmp;
-    int hc;
+    struct work *work = NULL;
 
     mutex_lock(stgd_lock);
-    if (!HASH_COUNT(staged_work)) {
+    if (!__total_staged()) {
         if (!blocking)
             goto out_unlock;
+        staged_waiters++;
         do {
             struct timespec then;
             struct timeval now;
@@ -6731,7 +7557,8 @@ static struct work* hash_pop(bool blocking)
                 event_notify("idle");
             }
         }
-        while (!HASH_COUNT(staged_work));
+        while (!__total_staged());
+        staged_waiters--;
     }
 
     if (no_work) {
@@ -6739,25 +7566,20 @@ static struct work* hash_pop(bool blocking)
         no_work = false;
     }
 
-    hc = HASH_COUNT(staged_work);
-    /* Find clone work if possible, to allow masters to be reused */
-    if (hc > staged_rollable) {
-        HASH_ITER(hh, staged_work, work, tmp) {
-            if (!work_rollable(work))
-                break;
-        }
-    }
-    else
-        work = staged_work;
-    HASH_DEL(staged_work, work);
-    if (work_rollable(work))
+    /* Take clone work if possible, to allow masters to be reused */
+    work = ring_pop(&staged_lane);
+    if (!work) {
+        work = ring_pop(&rollable_lane);
         staged_rollable--;
+    }
 
     /* Signal the getwork scheduler to look for more work */
-    pthread_cond_signal(&gws_cond);
+    if (gws_waiting)
+        pthread_cond_signal(&gws_cond);
 
     /* Signal hash_pop again in case there are mutliple hash_pop waiters */
-    pthread_cond_signal(&getq->cond);
+    if (staged_waiters && __total_staged())
+        pthread_cond_signal(&getq->cond);
 
     /* Keep track of last getwork grabbed */
     last_getwork = time(NULL);
@@ -6874,8 +7696,8 @@ static void gen_stratum_work_cn(struct pool *pool, struct work *work)
 
   applog(LOG_DEBUG, "[THR%d] gen_stratum_work_cn() - algorithm = %s", work->thr_id, pool->algorithm.name);
   
-  cg_rlock(&pool->data_lock);
-  work->job_id = strdup(pool->swork.job_id);
+  cg_wlock(&pool->data_lock);
+  work->job_id = rcstr_intern(&pool->work_job_id, pool->swork.job_id);
   //strcpy(work->XMRID, pool->XMRID);
   memcpy(work->data, pool->XMRBlob, pool->XMRBlobLen);
   work->XMRBlobLen = pool->XMRBlobLen;
@@ -6884,7 +7706,7 @@ static void gen_stratum_work_cn(struct pool *pool, struct work *work)
   work->work_difficulty = work->sdiff;
   work->network_diff = pool->diff1;
   work->is_monero = pool->is_monero;
-  cg_runlock(&pool->data_lock);
+  cg_wunlock(&pool->data_lock);
   
   local_work++;
   work->pool = pool;
@@ -6903,49 +7725,148 @@ static void gen_stratum_work_cn(struct pool *pool, struct work *work)
   
   applog(LOG_DEBUG, "gen_stratum_work_cn() done.");
 }
-static void gen_stratum_work(struct pool *pool, struct work *work)
+/* Everything gen_stratum_work() needs from one stratum notify, copied once
+ * under data_lock so the work itself can be generated without the lock */
+struct stratum_tmpl {
+  int refs;
+  unsigned int gen;
+  char *nonce1;
+  unsigned char *coinbase;
+  size_t cb_len;
+  size_t nonce2_offset;
+  int n2size;
+  unsigned char *nonce1bin;
+  size_t n1_len;
+  unsigned char header_bin[128];
+  int merkle_offset;
+  int merkles;
+  unsigned char *merkle_bin;
+  uint32_t ntime;
+  uint32_t nbit;
+  /* SHA-256 state over the whole blocks of the coinbase in front of nonce2 */
+  bool has_prefix;
+  size_t prefix_len;
+  sph_sha256_context prefix;
+};
+
+static void stratum_tmpl_put(struct stratum_tmpl *tmpl)
 {
-  unsigned char merkle_root[32], merkle_sha[65];
-  uint32_t *data32, *swap32;
-  uint64_t nonce2le;
-  int i, j;
+  if (!tmpl || __sync_sub_and_fetch(&tmpl->refs, 1))
+    return;
+
+  rcstr_put(tmpl->nonce1);
+  free(tmpl->coinbase);
+  free(tmpl->nonce1bin);
+  free(tmpl->merkle_bin);
+  free(tmpl);
+}
 
+/* Drops the pool's job template and the cached job strings, works that
+ * were generated from them keep their own references */
+static void stratum_tmpl_release(struct pool *pool)
+{
   cg_wlock(&pool->data_lock);
+  stratum_tmpl_put(pool->stratum_tmpl);
+  pool->stratum_tmpl = NULL;
+  rcstr_put(pool->work_job_id);
+  pool->work_job_id = NULL;
+  rcstr_put(pool->work_nonce1);
+  pool->work_nonce1 = NULL;
+  rcstr_put(pool->work_ntime);
+  pool->work_ntime = NULL;
+  cg_wunlock(&pool->data_lock);
+}
+
+/* Must be called with the data_lock write lock held. Returns a reference to
+ * the template for the current job, rebuilding it when a notify or a new
+ * nonce1 made it stale. */
+static struct stratum_tmpl *stratum_tmpl_get(struct pool *pool, char *nonce1)
+{
+  struct stratum_tmpl *tmpl = pool->stratum_tmpl;
+  int i;
+
+  if (tmpl && tmpl->gen == pool->swork_gen && tmpl->nonce1 == nonce1) {
+    __sync_add_and_fetch(&tmpl->refs, 1);
+    return tmpl;
+  }
 
-    if (pool->algorithm.type == ALGO_PASCAL) {
-        for (i = 0; i < 56; i += 8) {
-            if (((pool->nonce2 >>  i) & 0xff) < 0x2d) pool->nonce2 = (pool->nonce2 & (0xffffffffffffff00 << i)) + (0x002d2d2d2d2d2d2d >> (48 - i));
-            if (((pool->nonce2 >>  i) & 0xff) > 0xfe) pool->nonce2 = (pool->nonce2 & (0xffffffffffffff00 << i)) + (0x012d2d2d2d2d2d2d >> (48 - i));
-        }
-        if (((pool->nonce2 >> 56) & 0xff) < 0x2d) pool->nonce2 = 0x2d2d2d2d2d2d2d2d;
-        if (((pool->nonce2 >> 56) & 0xff) > 0xfe) pool->nonce2 = 0x2d2d2d2d2d2d2d2d;
-    }
-    nonce2le = htole64(pool->nonce2);
-#if SUPPORT_SIAPOOL		
-    if (pool->algorithm.type != ALGO_DECRED) {
-#else
-    if (pool->algorithm.type != ALGO_DECRED && pool->algorithm.type != ALGO_SIA) {
-#endif	
+  stratum_tmpl_put(tmpl);
+
+  tmpl = (struct stratum_tmpl *)cgcalloc(1, sizeof(struct stratum_tmpl));
+  tmpl->refs = 2;
+  tmpl->gen = pool->swork_gen;
+  tmpl->nonce1 = rcstr_get(nonce1);
+  tmpl->cb_len = pool->swork.cb_len;
+  tmpl->coinbase = (unsigned char *)cgmalloc(tmpl->cb_len + 1);
+  if (pool->coinbase)
+    memcpy(tmpl->coinbase, pool->coinbase, tmpl->cb_len);
+  tmpl->nonce2_offset = pool->nonce2_offset;
+  tmpl->n2size = pool->n2size;
+  tmpl->n1_len = pool->n1_len;
+  tmpl->nonce1bin = (unsigned char *)cgmalloc(tmpl->n1_len + 1);
+  if (pool->nonce1bin)
+    memcpy(tmpl->nonce1bin, pool->nonce1bin, tmpl->n1_len);
+  memcpy(tmpl->header_bin, pool->header_bin, 128);
+  tmpl->merkle_offset = pool->merkle_offset;
+  tmpl->merkles = pool->swork.merkles;
+  tmpl->merkle_bin = (unsigned char *)cgmalloc(32 * tmpl->merkles + 1);
+  for (i = 0; i < tmpl->merkles; i++)
+    memcpy(tmpl->merkle_bin + (32 * i), pool->swork.merkle_bin[i], 32);
+  if (pool->swork.ntime)
+    hex2bin((unsigned char *)&tmpl->ntime, pool->swork.ntime, 4);
+  if (pool->swork.nbit)
+    hex2bin((unsigned char *)&tmpl->nbit, pool->swork.nbit, 4);
+
+  /* Only nonce2 changes between works, so the double SHA-256 of the
+   * coinbase can resume from the blocks that come before it */
+  if (pool->algorithm.gen_hash == gen_hash && tmpl->nonce2_offset <= tmpl->cb_len) {
+    tmpl->has_prefix = true;
+    tmpl->prefix_len = tmpl->nonce2_offset & ~(size_t)63;
+    sph_sha256_init(&tmpl->prefix);
+    sph_sha256(&tmpl->prefix, tmpl->coinbase, tmpl->prefix_len);
+  }
+
+  pool->stratum_tmpl = tmpl;
+  return tmpl;
+}
+
+/* Builds one work item from the template, nonce2 has already been reserved.
+ * root is the merkle root when gen_stratum_merkles() already worked it out. */
+static void gen_stratum_work_tmpl(struct pool *pool, struct stratum_tmpl *tmpl, struct work *work,
+                                  const unsigned char *root)
+{
+  unsigned char merkle_root[32], merkle_sha[65];
+  unsigned char *coinbase;
+  uint32_t *data32, *swap32;
+  uint64_t nonce2le = htole64(work->nonce2);
+  const algorithm_layout_t *layout = algorithm_layout(pool->algorithm.type);
+  int i, j;
+
+  /* Only touches the template and this work's own coinbase */
+  coinbase = (unsigned char *)alloca(tmpl->cb_len + 1);
+  memcpy(coinbase, tmpl->coinbase, tmpl->cb_len);
+  if (layout->coinbase_nonce2) {
     /* Update coinbase. Always use an LE encoded nonce2 to fill in values
     * from left to right and prevent overflow errors with small n2sizes */
-    memcpy(pool->coinbase + pool->nonce2_offset, &nonce2le, pool->n2size);
+    memcpy(coinbase + tmpl->nonce2_offset, &nonce2le, tmpl->n2size);
   }
-  
-  work->nonce2 = pool->nonce2++;
-  work->nonce2_len = pool->n2size;
-
-  /* Downgrade to a read lock to read off the pool variables */
-  cg_dwlock(&pool->data_lock);
-    if (pool->algorithm.type != ALGO_DECRED && pool->algorithm.type != ALGO_SIA && pool->algorithm.type != ALGO_PASCAL) {
 
-  /* Generate merkle root */
-    pool->algorithm.gen_hash(pool->coinbase, pool->swork.cb_len, merkle_root);
+  if (layout->merkle && root) {
+    memcpy(merkle_sha, root, 32);
+    memcpy(merkle_root, root, 32);
+  }
+  else if (layout->merkle) {
+    /* Generate merkle root */
+    if (tmpl->has_prefix)
+      gen_hash_prefixed(&tmpl->prefix, coinbase + tmpl->prefix_len, tmpl->cb_len - tmpl->prefix_len, merkle_root);
+    else
+      pool->algorithm.gen_hash(coinbase, tmpl->cb_len, merkle_root);
     memcpy(merkle_sha, merkle_root, 32);
-    for (i = 0; i < pool->swork.merkles; i++) {
-      memcpy(merkle_sha + 32, pool->swork.merkle_bin[i], 32);
-      gen_hash(merkle_sha, 64, merkle_root);
-      memcpy(merkle_sha, merkle_root, 32);
+    for (i = 0; i < tmpl->merkles; i++) {
+      memcpy(merkle_sha + 32, tmpl->merkle_bin + (32 * i), 32);
+      gen_hash64(merkle_sha, merkle_sha);
     }
+    memcpy(merkle_root, merkle_sha, 32);
   }
 
   applog(LOG_DEBUG, "[THR%d] gen_stratum_work() - algorithm = %s", work->thr_id, pool->algorithm.name);
@@ -6955,11 +7876,11 @@ static void gen_stratum_work(struct pool *pool, struct work *work)
     /* Incoming data is in little endian. */
     memcpy(merkle_root, merkle_sha, 32);
 
-    uint32_t temp = pool->merkle_offset / sizeof(uint32_t), i;
+    uint32_t temp = tmpl->merkle_offset / sizeof(uint32_t), i;
     /* Put version (4 byte) + prev_hash (4 byte* 8) but big endian encoded
     * into work. */
     for (i = 0; i < temp; ++i) {
-      ((uint32_t *)work->data)[i] = be32toh(((uint32_t *)pool->header_bin)[i]);
+      ((uint32_t *)work->data)[i] = be32toh(((uint32_t *)tmpl->header_bin)[i]);
     }
 
     /* Now add the merkle_root (4 byte* 8), but it is encoded in little endian. */
@@ -6970,42 +7891,42 @@ static void gen_stratum_work(struct pool *pool, struct work *work)
     }
 
     /* Add the time encoded in big endianess. */
-    hex2bin((unsigned char *)&temp, pool->swork.ntime, 4);
+    temp = tmpl->ntime;
 
     /* Add the nbits (big endianess). */
     ((uint32_t *)work->data)[17] = be32toh(temp);
-    hex2bin((unsigned char *)&temp, pool->swork.nbit, 4);
+    temp = tmpl->nbit;
     ((uint32_t *)work->data)[18] = be32toh(temp);
     ((uint32_t *)work->data)[20] = 0x80000000;
     ((uint32_t *)work->data)[31] = 0x00000280;
   }
   else if (pool->algorithm.type == ALGO_DECRED) {
     uint16_t vote = (uint16_t) (opt_vote << 1) | 1;
-    size_t nonce2_offset = MIN(pool->n1_len, 36);
-    memcpy(work->data, pool->header_bin, 4); // version
-    flip32(work->data + 4, pool->header_bin + 4); // prevhash
-    memcpy(work->data + 4 + 32, pool->coinbase, MIN((int)pool->swork.cb_len, 108));
+    size_t nonce2_offset = MIN(tmpl->n1_len, 36);
+    memcpy(work->data, tmpl->header_bin, 4); // version
+    flip32(work->data + 4, tmpl->header_bin + 4); // prevhash
+    memcpy(work->data + 4 + 32, coinbase, MIN((int)tmpl->cb_len, 108));
     memcpy(work->data + 100, &vote, 2);
     for (i = 36; i < 45; i++)
       ((uint32_t *)work->data)[i] = 0;
-    memcpy(work->data + 144, pool->nonce1bin, nonce2_offset);
-    memcpy(work->data + 144 + nonce2_offset, &nonce2le, pool->n2size);
-    size_t extranonce_len = MAX((int)pool->swork.cb_len - pool->nonce2_offset - pool->n2size, 0);
-    memcpy(work->data + 180 - extranonce_len, pool->coinbase + pool->nonce2_offset + pool->n2size, extranonce_len);
+    memcpy(work->data + 144, tmpl->nonce1bin, nonce2_offset);
+    memcpy(work->data + 144 + nonce2_offset, &nonce2le, tmpl->n2size);
+    size_t extranonce_len = MAX((int)tmpl->cb_len - (int)tmpl->nonce2_offset - tmpl->n2size, 0);
+    memcpy(work->data + 180 - extranonce_len, coinbase + tmpl->nonce2_offset + tmpl->n2size, extranonce_len);
   }
     else if (pool->algorithm.type == ALGO_SIA) {
 #if SUPPORT_SIAPOOL
-	 	unsigned char *cbbuf = alloca(1 + pool->swork.cb_len);
+	 	unsigned char *cbbuf = alloca(1 + tmpl->cb_len);
 	    cbbuf[0] = 0;
-    	memcpy(cbbuf + 1, pool->coinbase, pool->swork.cb_len);
+    	memcpy(cbbuf + 1, coinbase, tmpl->cb_len);
     	if (pool->algorithm.gen_hash == NULL) {        	
 	        applog(LOG_ERR, "gen_stratum_work : genHash is NULL");        
 	    }
-	    pool->algorithm.gen_hash(cbbuf, 1 + pool->swork.cb_len, merkle_root);
+	    pool->algorithm.gen_hash(cbbuf, 1 + tmpl->cb_len, merkle_root);
 	    merkle_sha[0] = 1;
 	    memcpy(merkle_sha + 33, merkle_root, 32);
-	    for (i = 0; i < pool->swork.merkles; i++) {
-		      memcpy(merkle_sha + 1, pool->swork.merkle_bin[i], 32);
+	    for (i = 0; i < tmpl->merkles; i++) {
+		      memcpy(merkle_sha + 1, tmpl->merkle_bin + (32 * i), 32);
 		      pool->algorithm.gen_hash(merkle_sha, 65, merkle_root);
 		      memcpy(merkle_sha + 33, merkle_root, 32);
 	    }
@@ -7015,21 +7936,21 @@ static void gen_stratum_work(struct pool *pool, struct work *work)
     	flip32(swap32, data32);
 
 	    /* Copy the data template from header_bin */
-    	memcpy(work->data, pool->header_bin, 128);
-	    memcpy(work->data + pool->merkle_offset, merkle_root, 32);
+    	memcpy(work->data, tmpl->header_bin, 128);
+	    memcpy(work->data + tmpl->merkle_offset, merkle_root, 32);
 #else
-        size_t nonce2_offset = MIN(pool->n1_len, 4);
-        swab256(work->data, pool->header_bin + 4); // prevhash
-        memcpy(work->data + 32 + 4, pool->nonce1bin, nonce2_offset);
-        memcpy(work->data + 32 + 4 + nonce2_offset, &nonce2le, pool->n2size);
-        memcpy(work->data + 32 + 8, pool->header_bin + 68, 4); // timestamp
-        flip32(work->data + 32 + 8 + 8, pool->coinbase); // merkleroot
+        size_t nonce2_offset = MIN(tmpl->n1_len, 4);
+        swab256(work->data, tmpl->header_bin + 4); // prevhash
+        memcpy(work->data + 32 + 4, tmpl->nonce1bin, nonce2_offset);
+        memcpy(work->data + 32 + 4 + nonce2_offset, &nonce2le, tmpl->n2size);
+        memcpy(work->data + 32 + 8, tmpl->header_bin + 68, 4); // timestamp
+        flip32(work->data + 32 + 8 + 8, coinbase); // merkleroot
 #endif			
     }
     else if (pool->algorithm.type == ALGO_PASCAL) {
       uint32_t temp;
-      memcpy(work->data, pool->coinbase, pool->swork.cb_len);
-      hex2bin((unsigned char *)&temp, pool->swork.ntime, 4);
+      memcpy(work->data, coinbase, tmpl->cb_len);
+      temp = tmpl->ntime;
       ((uint32_t *)work->data)[48] = be32toh(temp);
       ((uint32_t *)work->data)[49] = 0;
     }
@@ -7039,33 +7960,18 @@ static void gen_stratum_work(struct pool *pool, struct work *work)
     flip32(swap32, data32);
 
     /* Copy the data template from header_bin */
-    memcpy(work->data, pool->header_bin, 128);
-    memcpy(work->data + pool->merkle_offset, merkle_root, 32);
+    memcpy(work->data, tmpl->header_bin, 128);
+    memcpy(work->data + tmpl->merkle_offset, merkle_root, 32);
   }
 
-  /* Store the stratum work diff to check it still matches the pool's
-  * stratum diff when submitting shares */
-  work->sdiff = pool->swork.diff;
-
-  /* Copy parameters required for share submission */
-  work->job_id = strdup(pool->swork.job_id);
-  work->nonce1 = strdup(pool->nonce1);
-  work->ntime = strdup(pool->swork.ntime);
-  cg_runlock(&pool->data_lock);
-
   if (opt_debug) {
     char *header, *merkle_hash;
-    int datasize = 128;
-        if (pool->algorithm.type == ALGO_DECRED)
-            datasize = 180;
-	    else if (pool->algorithm.type == ALGO_PASCAL) 
-			datasize = 256;
 
-    header = bin2hex(work->data, datasize);
-        if (pool->algorithm.type != ALGO_DECRED && pool->algorithm.type != ALGO_PASCAL) {
-        merkle_hash = bin2hex((const unsigned char *)merkle_root, 32);
-        applog(LOG_DEBUG, "[THR%d] Generated stratum merkle %s", work->thr_id, merkle_hash);
-        free(merkle_hash);
+    header = bin2hex(work->data, layout->data_len);
+    if (layout->merkle) {
+      merkle_hash = bin2hex((const unsigned char *)merkle_root, 32);
+      applog(LOG_DEBUG, "[THR%d] Generated stratum merkle %s", work->thr_id, merkle_hash);
+      free(merkle_hash);
     }
     applog(LOG_DEBUG, "[THR%d] Generated stratum header %s", work->thr_id, header);
     applog(LOG_DEBUG, "[THR%d] Work job_id %s nonce2 %"PRIu64" ntime %s", work->thr_id, work->job_id,
@@ -7083,11 +7989,13 @@ static void gen_stratum_work(struct pool *pool, struct work *work)
     set_target(work->target, work->sdiff, pool->algorithm.diff_multiplier2, work->thr_id);
   }
 
+  cg_wlock(&control_lock);
   local_work++;
+  work->id = total_work++;
+  cg_wunlock(&control_lock);
   work->pool = pool;
   work->stratum = true;
   work->blk.nonce = 0;
-  work->id = total_work++;
   work->longpoll = false;
   work->getwork_mode = GETWORK_MODE_STRATUM;
   work->work_block = work_block;
@@ -7098,6 +8006,402 @@ static void gen_stratum_work(struct pool *pool, struct work *work)
   cgtime(&work->tv_staged);
 }
 
+/* Merkle roots of count works whose coinbases only differ in nonce2, LANES
+ * of them at a time, a short last group repeats its last work */
+static void gen_stratum_merkles(struct stratum_tmpl *tmpl, struct work **works, int count,
+                                unsigned char (*roots)[32])
+{
+  size_t len = tmpl->cb_len - tmpl->prefix_len;
+  unsigned char *cb, hash[LANES][32], branch[LANES][64];
+  uint64_t nonce2le;
+  int i, l, n;
+
+  cb = (unsigned char *)alloca(LANES * len + 1);
+  for (n = 0; n < count; n += LANES) {
+    for (l = 0; l < LANES; l++) {
+      nonce2le = htole64(works[MIN(n + l, count - 1)]->nonce2);
+      memcpy(cb + l * len, tmpl->coinbase + tmpl->prefix_len, len);
+      memcpy(cb + l * len + tmpl->nonce2_offset - tmpl->prefix_len, &nonce2le, tmpl->n2size);
+    }
+    sha256d_lanes(hash, &tmpl->prefix, cb, len);
+
+    for (i = 0; i < tmpl->merkles; i++) {
+      for (l = 0; l < LANES; l++) {
+        memcpy(branch[l], hash[l], 32);
+        memcpy(branch[l] + 32, tmpl->merkle_bin + (32 * i), 32);
+      }
+      sha256d64_lanes(hash, branch);
+    }
+
+    for (l = 0; l < LANES && n + l < count; l++)
+      memcpy(roots[n + l], hash[l], 32);
+  }
+}
+
+/* Generates count works from the current job of pool. Their nonce2 values
+ * are reserved as one contiguous range under a single data_lock write lock,
+ * the hashing then runs without any pool lock held. */
+static void gen_stratum_works(struct pool *pool, struct work **works, int count)
+{
+  struct stratum_tmpl *tmpl;
+  struct work *work;
+  int i, n;
+
+  cg_wlock(&pool->data_lock);
+  for (n = 0; n < count; n++) {
+    work = works[n];
+
+    if (pool->algorithm.type == ALGO_PASCAL) {
+        for (i = 0; i < 56; i += 8) {
+            if (((pool->nonce2 >>  i) & 0xff) < 0x2d) pool->nonce2 = (pool->nonce2 & (0xffffffffffffff00 << i)) + (0x002d2d2d2d2d2d2d >> (48 - i));
+            if (((pool->nonce2 >>  i) & 0xff) > 0xfe) pool->nonce2 = (pool->nonce2 & (0xffffffffffffff00 << i)) + (0x012d2d2d2d2d2d2d >> (48 - i));
+        }
+        if (((pool->nonce2 >> 56) & 0xff) < 0x2d) pool->nonce2 = 0x2d2d2d2d2d2d2d2d;
+        if (((pool->nonce2 >> 56) & 0xff) > 0xfe) pool->nonce2 = 0x2d2d2d2d2d2d2d2d;
+    }
+    work->nonce2 = pool->nonce2++;
+    work->nonce2_len = pool->n2size;
+
+    /* Store the stratum work diff to check it still matches the pool's
+    * stratum diff when submitting shares */
+    work->sdiff = pool->swork.diff;
+
+    /* Copy parameters required for share submission */
+    work->job_id = rcstr_intern(&pool->work_job_id, pool->swork.job_id);
+    work->nonce1 = rcstr_intern(&pool->work_nonce1, pool->nonce1);
+    work->ntime = rcstr_intern(&pool->work_ntime, pool->swork.ntime);
+  }
+  tmpl = stratum_tmpl_get(pool, works[0]->nonce1);
+  cg_wunlock(&pool->data_lock);
+
+  /* With SHA extensions one coinbase at a time is faster than the lanes */
+  if (count > 1 && !sph_sha256_hw_active && tmpl->has_prefix &&
+      algorithm_layout(pool->algorithm.type)->merkle &&
+      algorithm_layout(pool->algorithm.type)->coinbase_nonce2) {
+    unsigned char (*roots)[32] = (unsigned char (*)[32])alloca(count * 32);
+
+    gen_stratum_merkles(tmpl, works, count, roots);
+    for (n = 0; n < count; n++)
+      gen_stratum_work_tmpl(pool, tmpl, works[n], roots[n]);
+  }
+  else {
+    for (n = 0; n < count; n++)
+      gen_stratum_work_tmpl(pool, tmpl, works[n], NULL);
+  }
+
+  stratum_tmpl_put(tmpl);
+}
+
+static void gen_stratum_work(struct pool *pool, struct work *work)
+{
+  gen_stratum_works(pool, &work, 1);
+}
+
+/* Stratum work generators. The getwork scheduler in main() queues requests
+ * for a number of works from a pool and the generators turn each request
+ * into work with a single nonce2 reservation, so a burst of demand after a
+ * work restart is refilled by several threads at once. */
+#define GEN_BATCH 4
+
+struct gen_req {
+  struct pool *pool;
+  int count;
+};
+
+static struct thread_q *gen_q;
+static int gen_pending;     /* requested but not yet staged, under stgd_lock */
+
+static void *stratum_gen_thread(void __maybe_unused *userdata)
+{
+  struct work *works[GEN_BATCH];
+  struct gen_req *req;
+  int i;
+
+  pthread_detach(pthread_self());
+
+  RenameThread("StratumGen");
+
+  while (42) {
+    req = (struct gen_req *)tq_pop(gen_q, NULL);
+    if (!req)
+      continue;
+
+    for (i = 0; i < req->count; i++)
+      works[i] = make_work();
+    gen_stratum_works(req->pool, works, req->count);
+    for (i = 0; i < req->count; i++)
+      stage_work(works[i]);
+    applog(LOG_DEBUG, "Generated %d stratum works", req->count);
+
+    mutex_lock(stgd_lock);
+    gen_pending -= req->count;
+    mutex_unlock(stgd_lock);
+
+    free(req);
+  }
+
+  return (NULL);
+}
+
+static void gen_init(void)
+{
+  pthread_t pth;
+  int i;
+
+  if (!opt_gen_threads)
+    return;
+
+  gen_q = tq_new();
+  if (unlikely(!gen_q))
+    quit(1, "Failed to tq_new gen_q");
+
+  for (i = 0; i < opt_gen_threads; i++) {
+    if (unlikely(pthread_create(&pth, NULL, stratum_gen_thread, NULL)))
+      quit(1, "Failed to create stratum gen thread");
+  }
+}
+
+/* Ask the generators for need works from pool, or for one per thread already
+ * blocked waiting for work if that is more */
+static void gen_request(struct pool *pool, int need)
+{
+  struct gen_req *req;
+
+  mutex_lock(stgd_lock);
+  if (staged_waiters > need)
+    need = staged_waiters;
+  gen_pending += need;
+  mutex_unlock(stgd_lock);
+
+  while (need > 0) {
+    req = (struct gen_req *)cgmalloc(sizeof(struct gen_req));
+    req->pool = pool;
+    req->count = MIN(need, GEN_BATCH);
+    need -= req->count;
+    if (unlikely(!tq_push(gen_q, req)))
+      quit(1, "Failed to tq_push gen_q");
+  }
+}
+
+struct bench_workgen {
+  struct pool *pool;
+  struct work *work;
+  double rate;
+  pthread_t pth;
+};
+
+static void bench_workgen_one(void *arg)
+{
+  struct bench_workgen *bw = (struct bench_workgen *)arg;
+
+  clean_work(bw->work);
+  gen_stratum_work(bw->pool, bw->work);
+}
+
+static void *bench_workgen_thread(void *arg)
+{
+  struct bench_workgen *bw = (struct bench_workgen *)arg;
+
+  bw->rate = bench_rate(bench_workgen_one, bw);
+
+  return (NULL);
+}
+
+/* --bench workgen: a notify shaped like a typical pool job, a 160 byte
+ * coinbase and a 12 deep merkle branch, turned into work as fast as
+ * gen_stratum_work() allows for each of the stratum algorithms */
+void bench_work_generation(void)
+{
+  static const char *algos[] = {
+    "x11", "quark", "qubit", "x11-gost", "myriadcoin-groestl", "nist5",
+    "blake256r14", "blake256r8", "lbry", "sia", NULL
+  };
+  char cb1[2 * 60 + 1], cb2[2 * 92 + 1], merkles[12 * 69 + 1], *notify;
+  struct bench_workgen bw;
+  struct pool *pool;
+  int i, threads;
+  size_t len;
+
+  for (i = 0; i < (int)sizeof(cb1) - 1; i++)
+    cb1[i] = "0123456789abcdef"[(i * 7) & 0xf];
+  cb1[i] = '\0';
+  for (i = 0; i < (int)sizeof(cb2) - 1; i++)
+    cb2[i] = "0123456789abcdef"[(i * 5) & 0xf];
+  cb2[i] = '\0';
+  merkles[0] = '\0';
+  for (i = 0; i < 12; i++)
+    sprintf(merkles + strlen(merkles), "%s\"%064x\"", i ? "," : "", i + 1);
+
+  len = strlen(cb1) + strlen(cb2) + strlen(merkles) + 256;
+  notify = (char *)cgmalloc(len);
+  snprintf(notify, len, "{\"id\":null,\"method\":\"mining.notify\",\"params\":"
+           "[\"1a2b\",\"%064x\",\"%s\",\"%s\",[%s],\"20000000\",\"1b0404cb\",\"5a1d0b3c\",true]}",
+           0x1234, cb1, cb2, merkles);
+
+  pool = add_pool();
+  pool->nonce1 = strdup("08000002");
+  pool->n1_len = 4;
+  pool->nonce1bin = (unsigned char *)cgcalloc(pool->n1_len, 1);
+  hex2bin(pool->nonce1bin, pool->nonce1, pool->n1_len);
+  pool->n2size = 4;
+  pool->next_diff = 1;
+
+  bw.pool = pool;
+  bw.work = make_work();
+
+  for (i = 0; algos[i]; i++) {
+    set_algorithm(&pool->algorithm, algos[i]);
+    if (!parse_method(pool, notify)) {
+      applog(LOG_ERR, "workgen: %s rejected the benchmark notify", algos[i]);
+      continue;
+    }
+    bench_report("workgen", algos[i], bench_rate(bench_workgen_one, &bw), "works/s");
+  }
+
+  /* Generators sharing one pool only serialise on the nonce2 reservation */
+  set_algorithm(&pool->algorithm, "x11");
+  parse_method(pool, notify);
+  for (threads = 2; threads <= 8; threads <<= 1) {
+    struct bench_workgen *bws = (struct bench_workgen *)cgcalloc(threads, sizeof(struct bench_workgen));
+    double rate = 0;
+    char what[32];
+
+    for (i = 0; i < threads; i++) {
+      bws[i].pool = pool;
+      bws[i].work = make_work();
+      if (unlikely(pthread_create(&bws[i].pth, NULL, bench_workgen_thread, &bws[i])))
+        quit(1, "Failed to create workgen bench thread");
+    }
+    for (i = 0; i < threads; i++) {
+      pthread_join(bws[i].pth, NULL);
+      rate += bws[i].rate;
+      free_work(bws[i].work);
+    }
+    free(bws);
+
+    snprintf(what, sizeof(what), "x11 %d threads", threads);
+    bench_report("workgen", what, rate, "works/s");
+  }
+
+  free_work(bw.work);
+  free(notify);
+}
+
+struct bench_submit {
+  struct pool *pool;
+  struct work *work;
+  struct stratum_submit_tmpl tmpl;
+  char s[SSHARE_LINE];
+};
+
+/* Submit messages as they were built before the templates, the reference the
+ * template output is checked against */
+static void bench_submit_reference(struct bench_submit *bs, int id)
+{
+  struct pool *pool = bs->pool;
+  struct work *work = bs->work;
+
+  if (pool->algorithm.type == ALGO_CRYPTONIGHT) {
+    char *ASCIINonce = bin2hex(work->data + 39, 4);
+    char *ASCIIResult = bin2hex(work->hash, 32);
+
+    snprintf(bs->s, sizeof(bs->s), "{\"method\": \"submit\", \"params\": {\"id\": \"%s\", \"job_id\": \"%s\", \"nonce\": \"%s\", \"result\": \"%s\"}, \"id\":%d}",
+             pool->XMRAuthID, work->job_id, ASCIINonce, ASCIIResult, id);
+    free(ASCIINonce);
+    free(ASCIIResult);
+  }
+  else {
+    char noncehex[20], nonce2hex[80];
+    unsigned char nonce2[32];
+    uint32_t nonce = *((uint32_t *)(work->data + 76));
+
+    __bin2hex(noncehex, (const unsigned char *)&nonce, 4);
+    *((uint64_t *)nonce2) = htole64(work->nonce2);
+    __bin2hex(nonce2hex, nonce2, work->nonce2_len);
+    memset(bs->s, 0, sizeof(bs->s));
+    snprintf(bs->s, sizeof(bs->s),
+             "{\"params\": [\"%s\", \"%s\", \"%s\", \"%s\", \"%s\"], \"id\": %d, \"method\": \"mining.submit\"}",
+             pool->rpc_user, work->job_id, nonce2hex, work->ntime, noncehex, id);
+  }
+}
+
+static void bench_submit_snprintf(void *arg)
+{
+  struct bench_submit *bs = (struct bench_submit *)arg;
+  struct stratum_share *sshare = (struct stratum_share *)calloc(sizeof(struct stratum_share), 1);
+
+  sshare->id = swork_next_id();
+  bench_submit_reference(bs, sshare->id);
+  free(sshare);
+  bs->work->data[76]++;
+}
+
+static void bench_submit_tmpl(void *arg)
+{
+  struct bench_submit *bs = (struct bench_submit *)arg;
+
+  free(stratum_share_new(bs->pool, &bs->tmpl, bs->work, bs->s, sizeof(bs->s) - 1));
+  bs->work->data[76]++;
+}
+
+/* --bench submit: submit messages built per share with snprintf and bin2hex
+ * like they used to be, then from the job's template */
+void bench_stratum_submit(void)
+{
+  static const char *algos[] = { "x11", "cryptonight", NULL };
+  static const char notify[] = "{\"id\":null,\"method\":\"mining.notify\",\"params\":"
+    "[\"1a2b\",\"0000000000000000000000000000000000000000000000000000000000001234\","
+    "\"01000000010000000000000000000000000000000000000000000000000000000000000000ffffffff20020862062f503253482f04b8864e5008\","
+    "\"072f736c7573682f000000000100f2052a010000001976a914d23fcdf86f7e756a64a7a9688ef9903327048ed988ac00000000\","
+    "[],\"20000000\",\"1b0404cb\",\"5a1d0b3c\",true]}";
+  struct bench_submit bs;
+  char *ref;
+  int i, id;
+
+  memset(&bs, 0, sizeof(bs));
+  bs.pool = add_pool();
+  bs.pool->rpc_user = strdup("worker.1");
+  strcpy(bs.pool->XMRAuthID, "0b94a1c4-5bd1-4c63-8a8c-1a3ad1bb06d7");
+  bs.pool->nonce1 = strdup("08000002");
+  bs.pool->n1_len = 4;
+  bs.pool->nonce1bin = (unsigned char *)cgcalloc(bs.pool->n1_len, 1);
+  hex2bin(bs.pool->nonce1bin, bs.pool->nonce1, bs.pool->n1_len);
+  bs.pool->n2size = 4;
+  bs.pool->next_diff = 1;
+
+  set_algorithm(&bs.pool->algorithm, "x11");
+  if (!parse_method(bs.pool, (char *)notify))
+    quit(1, "submit: the benchmark notify was rejected");
+  bs.work = make_work();
+  gen_stratum_work(bs.pool, bs.work);
+  for (i = 0; i < 32; i++)
+    bs.work->hash[i] = i * 37;
+
+  for (i = 0; algos[i]; i++) {
+    char what[32];
+
+    set_algorithm(&bs.pool->algorithm, algos[i]);
+    stratum_submit_tmpl_clear(&bs.tmpl);
+
+    /* Both must give the same message before either is timed */
+    free(stratum_share_new(bs.pool, &bs.tmpl, bs.work, bs.s, sizeof(bs.s) - 1));
+    ref = strdup(bs.s);
+    id = atoi(strrchr(ref, ':') + 1);
+    bench_submit_reference(&bs, id);
+    if (strcmp(ref, bs.s))
+      quit(1, "submit: %s template does not match the snprintf message", algos[i]);
+    free(ref);
+
+    snprintf(what, sizeof(what), "%s snprintf", algos[i]);
+    bench_report("submit", what, bench_rate(bench_submit_snprintf, &bs), "shares/s");
+    snprintf(what, sizeof(what), "%s template", algos[i]);
+    bench_report("submit", what, bench_rate(bench_submit_tmpl, &bs), "shares/s");
+  }
+
+  stratum_submit_tmpl_clear(&bs.tmpl);
+  free_work(bs.work);
+}
+
 static void enable_devices(void)
 {
 #ifdef USE_GPU
@@ -7935,7 +9239,6 @@ struct work* get_work(struct thr_info *thr, const int thr_id)
 static void submit_work_async(struct work *work)
 {
     struct pool *pool = work->pool;
-    pthread_t submit_thread;
 
     cgtime(&work->tv_work_found);
 
@@ -7967,11 +9270,14 @@ static void submit_work_async(struct work *work)
             applog(LOG_DEBUG, "Discarding work from removed pool");
             free_work(work);
         }
+#ifdef HAVE_SYS_EPOLL_H
+        else if (opt_stratum_epoll)
+            stratum_io_wake();
+#endif
     }
     else {
-        applog(LOG_DEBUG, "Pushing submit work to work thread");
-        if (unlikely(pthread_create(&submit_thread, NULL, submit_work_thread, (void *)work)))
-            quit(1, "Failed to create submit_work_thread");
+        applog(LOG_DEBUG, "Pushing submit work to the executor");
+        exec_submit(submit_work_task, (void *)work, EXEC_IO);
     }
 }
 
@@ -8007,65 +9313,42 @@ void inc_hw_errors(struct thr_info *thr)
 #endif 
 }
 
+/* Baikal boards report their hw errors from several verifier threads */
+void inc_hw_errors_bkl(void)
+{
+    mutex_lock(&stats_lock);
+    hw_errors_bkl++;
+    mutex_unlock(&stats_lock);
+}
+
+/* Fills in the work nonce */
+static void set_nonce(struct work *work, uint32_t nonce)
+{
+    const algorithm_layout_t *layout = algorithm_layout(work->pool->algorithm.type);
+    uint32_t *work_nonce = (uint32_t *)(work->data + layout->nonce_off);
+
+    if (layout->nicehash_nonce24 && work->pool->nicehash) {
+        *work_nonce &= 0xFF000000;
+        *work_nonce |= (htole32(nonce) & 0xFFFFFF);
+    }
+    else {
+        *work_nonce = htole32(nonce);
+    }
+}
+
 /* Fills in the work nonce and builds the output data in work->hash */
 static void rebuild_nonce(struct work *work, uint32_t nonce)
 {
-    uint32_t nonce_pos = 76;
-	
-    if (work->pool->algorithm.type == ALGO_CRE) {
-        nonce_pos = 140;
-	    uint32_t *work_nonce = (uint32_t *)(work->data + nonce_pos);
-	    *work_nonce = htole32(nonce);
-	}
-    else if (work->pool->algorithm.type == ALGO_DECRED) {
-        nonce_pos = 140;
-	    uint32_t *work_nonce = (uint32_t *)(work->data + nonce_pos);
-	    *work_nonce = htole32(nonce);
-	}
-    else if (work->pool->algorithm.type == ALGO_LBRY) {
-        nonce_pos = 108;
-	    uint32_t *work_nonce = (uint32_t *)(work->data + nonce_pos);
-	    *work_nonce = htole32(nonce);
-	}
-    else if (work->pool->algorithm.type == ALGO_SIA) {
-	    nonce_pos = 32;
-		uint32_t *work_nonce = (uint32_t *)(work->data + nonce_pos);
-        *work_nonce = htole32(nonce);
-	}
-	else if (work->pool->algorithm.type == ALGO_CRYPTONIGHT) {
-	    uint32_t *work_nonce = (uint32_t *)(work->data + 39);        
-        if ((work->pool != NULL) && (strstr(work->pool->rpc_url, "nicehash") != NULL)) {
-            *work_nonce &= 0xFF000000;
-            *work_nonce |= (htole32(nonce) & 0xFFFFFF);
-        }
-        else {
-            *work_nonce = htole32(nonce);
-        }	    
-	}		
-    else if (work->pool->algorithm.type == ALGO_CRYPTONIGHT_LITE) {
-	    uint32_t *work_nonce = (uint32_t *)(work->data + 39);	    
-        *work_nonce = htole32(nonce);
-	}		
-    else if (work->pool->algorithm.type == ALGO_PASCAL) {
-        nonce_pos = 196;		
-	    uint32_t *work_nonce = (uint32_t *)(work->data + nonce_pos);
-	    *work_nonce = htole32(nonce);
-		}
-	else {
-	    uint32_t *work_nonce = (uint32_t *)(work->data + nonce_pos);
-	    *work_nonce = htole32(nonce);
-	}
-	work->pool->algorithm.regenhash(work);
+    set_nonce(work, nonce);
+    work->pool->algorithm.regenhash(work);
 }
 
-/* For testing a nonce against diff 1 */
-bool test_nonce(struct work *work, uint32_t nonce)
+/* Whether work->hash meets diff 1 */
+static bool hash_meets_diff1(struct work *work)
 {
     uint32_t *hash_32 = (uint32_t *)(work->hash + 28);
     uint32_t diff1targ;
 
-    rebuild_nonce(work, nonce);
-
     // for Neoscrypt, the diff1targ value is in work->target
     if (work->pool->algorithm.type == ALGO_NEOSCRYPT || work->pool->algorithm.type == ALGO_PLUCK
         || work->pool->algorithm.type == ALGO_YESCRYPT || work->pool->algorithm.type == ALGO_YESCRYPT_MULTI) {
@@ -8084,6 +9367,13 @@ bool test_nonce(struct work *work, uint32_t nonce)
     return (le32toh(*hash_32) <= diff1targ);
 }
 
+/* For testing a nonce against diff 1 */
+bool test_nonce(struct work *work, uint32_t nonce)
+{
+    rebuild_nonce(work, nonce);
+    return (hash_meets_diff1(work));
+}
+
 static void update_work_stats(struct thr_info *thr, struct work *work)
 {
   double test_diff = current_diff;
@@ -8158,10 +9448,10 @@ bool submit_tested_work(struct thr_info *thr, struct work *work)
     return (true); 
 }
 
-/* Returns true if nonce for work was a valid share */
-bool submit_nonce(struct thr_info *thr, struct work *work, uint32_t nonce)
+/* Submits work whose hash has been rebuilt, returns true if it was a valid share */
+static bool submit_hashed_work(struct thr_info *thr, struct work *work)
 {
-    if (test_nonce(work, nonce)) {
+    if (hash_meets_diff1(work)) {
         submit_tested_work(thr, work);
         return (true);
     }
@@ -8172,6 +9462,223 @@ bool submit_nonce(struct thr_info *thr, struct work *work, uint32_t nonce)
     return (false);
 }
 
+/* Returns true if nonce for work was a valid share */
+bool submit_nonce(struct thr_info *thr, struct work *work, uint32_t nonce)
+{
+    rebuild_nonce(work, nonce);
+    return (submit_hashed_work(thr, work));
+}
+
+/* Nonce verification stage. Drivers that can find nonces faster than the
+ * host re-hashes them hand them to submit_nonce_async() and go straight back
+ * to their device, the verifier threads run submit_nonce() on a copy of the
+ * work and report the outcome through the callback. When the algorithm has a
+ * regenhash_batch a verifier takes up to VERIFY_BATCH waiting nonces at once
+ * and re-hashes them together. Once VERIFY_QUEUE_MAX nonces are waiting the
+ * caller verifies its own, which slows the device down to what the host can
+ * keep up with. */
+#define VERIFY_BATCH 8
+#define VERIFY_QUEUE_MAX 1024
+
+struct verify_job {
+    struct thr_info *thr;
+    struct work *work;
+    uint32_t nonce;
+    verify_cb_t cb;
+    void *data;
+    struct timeval tv_queued;
+};
+
+static struct thread_q *verify_q;
+static pthread_mutex_t verify_lock;
+static struct verify_stats verify_stats;
+
+static void verify_done(struct verify_job *job, bool valid, bool queued, struct timeval *tv_start, double hash, bool batched)
+{
+    double wait;
+
+    wait = queued ? tdiff(tv_start, &job->tv_queued) * 1000 : 0;
+
+    mutex_lock(&verify_lock);
+    if (queued)
+        verify_stats.queued--;
+    verify_stats.verified++;
+    if (batched)
+        verify_stats.batched++;
+    if (valid)
+        verify_stats.valid++;
+    else
+        verify_stats.invalid++;
+    verify_stats.wait_total += wait;
+    if (wait > verify_stats.wait_max)
+        verify_stats.wait_max = wait;
+    verify_stats.hash_total += hash;
+    if (hash > verify_stats.hash_max)
+        verify_stats.hash_max = hash;
+    mutex_unlock(&verify_lock);
+
+    if (job->cb)
+        job->cb(job->thr, valid, job->data);
+
+    free_work(job->work);
+    free(job);
+}
+
+static void verify_job(struct verify_job *job, bool queued)
+{
+    struct timeval tv_start, tv_end;
+    bool valid;
+
+    cgtime(&tv_start);
+    valid = submit_nonce(job->thr, job->work, job->nonce);
+    cgtime(&tv_end);
+
+    verify_done(job, valid, queued, &tv_start, tdiff(&tv_end, &tv_start) * 1000, false);
+}
+
+/* Re-hashes queued jobs together if they share a regenhash_batch, one by one
+ * otherwise. Each job of a batch is charged an even share of its time. */
+static void verify_jobs(struct verify_job **jobs, int count)
+{
+    void (*batch)(struct work **, int) = jobs[0]->work->pool->algorithm.regenhash_batch;
+    struct work *works[VERIFY_BATCH];
+    bool valid[VERIFY_BATCH];
+    struct timeval tv_start, tv_end;
+    double hash;
+    int i;
+
+    for (i = 1; i < count; i++) {
+        if (jobs[i]->work->pool->algorithm.regenhash_batch != batch)
+            break;
+    }
+
+    if ((count == 1) || (batch == NULL) || (i < count)) {
+        for (i = 0; i < count; i++)
+            verify_job(jobs[i], true);
+        return;
+    }
+
+    cgtime(&tv_start);
+    for (i = 0; i < count; i++) {
+        set_nonce(jobs[i]->work, jobs[i]->nonce);
+        works[i] = jobs[i]->work;
+    }
+    batch(works, count);
+    for (i = 0; i < count; i++)
+        valid[i] = submit_hashed_work(jobs[i]->thr, jobs[i]->work);
+    cgtime(&tv_end);
+
+    hash = tdiff(&tv_end, &tv_start) * 1000 / count;
+    for (i = 0; i < count; i++)
+        verify_done(jobs[i], valid[i], true, &tv_start, hash, true);
+}
+
+static void *verify_thread(void __maybe_unused *userdata)
+{
+    static const struct timespec no_wait;
+    struct verify_job *jobs[VERIFY_BATCH];
+    int count;
+
+    pthread_detach(pthread_self());
+
+    RenameThread("Verify");
+
+    while (42) {
+        jobs[0] = (struct verify_job *)tq_pop(verify_q, NULL);
+        if (!jobs[0])
+            continue;
+
+        /* pick up whatever else is already waiting to fill the lanes */
+        count = 1;
+        if (jobs[0]->work->pool->algorithm.regenhash_batch) {
+            while ((count < VERIFY_BATCH) &&
+                   (jobs[count] = (struct verify_job *)tq_pop(verify_q, &no_wait)))
+                count++;
+        }
+
+        verify_jobs(jobs, count);
+    }
+
+    return (NULL);
+}
+
+static void verify_init(void)
+{
+    pthread_t pth;
+    int i;
+
+    mutex_init(&verify_lock);
+
+    if (!opt_verify_threads)
+        return;
+
+    verify_q = tq_new();
+    if (unlikely(!verify_q))
+        quit(1, "Failed to tq_new verify_q");
+
+    for (i = 0; i < opt_verify_threads; i++) {
+        if (unlikely(pthread_create(&pth, NULL, verify_thread, NULL)))
+            quit(1, "Failed to create verify thread");
+    }
+}
+
+/* Verify and submit a nonce without holding up the calling device thread.
+ * The work is copied so the driver may recycle its own item straight away. */
+void submit_nonce_async(struct thr_info *thr, struct work *work, uint32_t nonce, verify_cb_t cb, void *data)
+{
+    struct verify_job *job = (struct verify_job *)cgcalloc(1, sizeof(*job));
+    bool full;
+
+    job->thr = thr;
+    job->work = copy_work(work);
+    job->nonce = nonce;
+    job->cb = cb;
+    job->data = data;
+
+    if (!verify_q) {
+        verify_job(job, false);
+        return;
+    }
+
+    cgtime(&job->tv_queued);
+
+    mutex_lock(&verify_lock);
+    full = (verify_stats.queued >= VERIFY_QUEUE_MAX);
+    if (full)
+        verify_stats.full++;
+    else if (++verify_stats.queued > verify_stats.queued_max)
+        verify_stats.queued_max = verify_stats.queued;
+    mutex_unlock(&verify_lock);
+
+    if (full) {
+        verify_job(job, false);
+        return;
+    }
+
+    if (unlikely(!tq_push(verify_q, job)))
+        quit(1, "Failed to tq_push verify_q");
+}
+
+void get_verify_stats(struct verify_stats *stats)
+{
+    mutex_lock(&verify_lock);
+    memcpy(stats, &verify_stats, sizeof(*stats));
+    mutex_unlock(&verify_lock);
+}
+
+/* Keeps the live queue depth, everything else restarts from zero */
+static void zero_verify_stats(void)
+{
+    int queued;
+
+    mutex_lock(&verify_lock);
+    queued = verify_stats.queued;
+    memset(&verify_stats, 0, sizeof(verify_stats));
+    verify_stats.queued = queued;
+    verify_stats.queued_max = queued;
+    mutex_unlock(&verify_lock);
+}
+
 static inline bool abandon_work(struct work *work, struct timeval *wdiff, uint64_t hashes)
 {
     if (wdiff->tv_sec > opt_scantime ||
@@ -8540,11 +10047,16 @@ static struct pool* select_longpoll_pool(struct pool *cp)
 /* This will make the longpoll thread wait till it's the current pool, or it
  * has been flagged as rejecting, before attempting to open any connections.
  */
+static bool lp_waiting(struct pool *pool)
+{
+    return (!cnx_needed(pool) && (pool->state == POOL_DISABLED ||
+                                  (pool != current_pool() && pool_strategy != POOL_LOADBALANCE &&
+                                   pool_strategy != POOL_BALANCE)));
+}
+
 static void wait_lpcurrent(struct pool *pool)
 {
-    while (!cnx_needed(pool) && (pool->state == POOL_DISABLED ||
-                                 (pool != current_pool() && pool_strategy != POOL_LOADBALANCE &&
-                                  pool_strategy != POOL_BALANCE))) {
+    while (lp_waiting(pool)) {
         mutex_lock(&lp_lock);
         pthread_cond_wait(&lp_cond, &lp_lock);
         mutex_unlock(&lp_lock);
@@ -9779,6 +11291,7 @@ static void* libusb_poll_thread(void __maybe_unused *arg)
 
     /* Cancel any cancellable usb transfers */
     cancel_usb_transfers();
+    cancel_usb_async_reads(NULL);
 
     /* Keep event handling going until there are no async transfers in
      * flight. */
@@ -9996,9 +11509,13 @@ int main(int argc, char *argv[] )
     mutex_init(&console_lock);
     cglock_init(&control_lock);
     mutex_init(&stats_lock);
+    mutex_init(&work_lock);
+    mutex_init(&current_lock);
+#ifdef HAVE_SYS_EPOLL_H
+    mutex_init(&sio_lock);
+#endif
     mutex_init(&sharelog_lock);
     cglock_init(&ch_lock);
-    mutex_init(&sshare_lock);
     rwlock_init(&blk_lock);
     rwlock_init(&netacc_lock);
     rwlock_init(&mining_thr_lock);
@@ -10026,6 +11543,8 @@ int main(int argc, char *argv[] )
         quit(1, "Failed to create getq");
     /* We use the getq mutex as the staged lock */
     stgd_lock = &getq->mutex;
+    ring_init(&staged_lane);
+    ring_init(&rollable_lane);
 
 #ifdef USE_USBUTILS
     initialise_usb();
@@ -10135,6 +11654,23 @@ int main(int argc, char *argv[] )
     if (want_per_device_stats)
         opt_verbose = true;
 
+    /* before any thread hashes, the sph contexts follow the choice */
+    {
+        const char *failed;
+
+        if (sph_aesni_init())
+            applog(LOG_INFO, "Groestl and ECHO CPU hashing uses AES-NI");
+        if (sph_sha256_hw_init(&failed))
+            applog(LOG_INFO, "SHA-256 CPU hashing uses %s", sph_sha256_hw_name);
+        else if (failed)
+            applog(LOG_WARNING, "SHA extensions %s failed its known answer test, using portable code", failed);
+    }
+
+    if (opt_bench) {
+        bench_run(opt_bench);
+        quit(0, "Benchmark finished");
+    }
+
     total_control_threads = 9;
     control_thr = (struct thr_info *)calloc(total_control_threads, sizeof(*thr));
     if (!control_thr)
@@ -10293,6 +11829,10 @@ int main(int argc, char *argv[] )
         fork_monitor();
 #endif // defined(unix)
 
+    exec_init(opt_exec_threads);
+    verify_init();
+    gen_init();
+
 #ifdef USE_USBUTILS
     mining_thr = cgcalloc(mining_threads, sizeof(thr));
     for (i = 0; i < mining_threads; i++)
@@ -10515,15 +12055,17 @@ int main(int argc, char *argv[] )
         then.tv_nsec = now.tv_usec * 1000;
 
         mutex_lock(stgd_lock);
-        ts = __total_staged();
+        ts = __total_staged() + gen_pending;
 
         if (!pool_localgen(cp) && !ts && !opt_fail_only)
             lagging = true;
 
         /* Wait until hash_pop tells us we need to create more work */
         if (ts > max_staged) {
+            gws_waiting = true;
             pthread_cond_timedwait(&gws_cond, stgd_lock, &then);
-            ts = __total_staged();
+            gws_waiting = false;
+            ts = __total_staged() + gen_pending;
         }
         mutex_unlock(stgd_lock);
 
@@ -10570,6 +12112,11 @@ retry:
                 break;
 
             default:
+                if (gen_q) {
+                    free_work(work);
+                    gen_request(pool, max_staged + 1 - ts);
+                    continue;
+                }
                 gen_stratum_work(pool, work);
             }
 
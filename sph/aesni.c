@@ -0,0 +1,417 @@
+/*
+ * AES-NI Groestl and ECHO.
+ *
+ * Groestl keeps its state as eight rows of one xmm register each. The 512
+ * bit state of Groestl-224/256 fills half a register per row, so P and Q
+ * of its compression run side by side in the two halves. SubBytes is the AES
+ * S-box, so AESENCLAST with a zero key does it, and the row rotation of
+ * ShiftBytes is folded with the inverse of the AES ShiftRows into the one
+ * PSHUFB that precedes it. The chaining value and the message come in
+ * column by column and are transposed on the way in and out.
+ *
+ * ECHO is built from AES rounds on 128 bit words and maps onto AESENC
+ * directly.
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the Free
+ * Software Foundation; either version 3 of the License, or (at your option)
+ * any later version.  See COPYING for more details.
+ */
+
+#include <stddef.h>
+#include <string.h>
+
+#include "sph_groestl.h"
+#include "sph_echo.h"
+#include "sph_aesni.h"
+
+int sph_aesni_active = 0;
+
+#if SPH_AESNI
+
+#include <cpuid.h>
+#include <immintrin.h>
+
+#define AESNI_TARGET	__attribute__((target("aes,ssse3")))
+
+/*
+ * PSHUFB masks of the Groestl rounds, [variant][row]. Variant 0 runs P of
+ * the small state in the low half of each row and Q in the high half,
+ * variants 1 and 2 are P and Q of the big state. Filled by
+ * sph_aesni_init().
+ */
+static unsigned char groestl_masks[3][8][16];
+
+static const int groestl_shifts[4][8] = {
+	{ 0, 1, 2, 3, 4, 5, 6, 7 },
+	{ 1, 3, 5, 7, 0, 2, 4, 6 },
+	{ 0, 1, 2, 3, 4, 5, 6, 11 },
+	{ 1, 3, 5, 11, 0, 2, 4, 6 }
+};
+
+static void
+groestl_masks_init(void)
+{
+	int isr[16];
+	int i, k, j;
+
+	/* AESENCLAST moves byte r + 4 * ((c + r) % 4) to r + 4 * c */
+	for (k = 0; k < 16; k ++)
+		isr[(k & 3) + 4 * (((k >> 2) + (k & 3)) & 3)] = k;
+
+	for (i = 0; i < 8; i ++) {
+		for (k = 0; k < 16; k ++) {
+			j = isr[k];
+			groestl_masks[0][i][k] = j < 8
+				? (j + groestl_shifts[0][i]) & 7
+				: 8 + ((j + groestl_shifts[1][i]) & 7);
+			groestl_masks[1][i][k] = (j + groestl_shifts[2][i]) & 15;
+			groestl_masks[2][i][k] = (j + groestl_shifts[3][i]) & 15;
+		}
+	}
+}
+
+AESNI_TARGET static inline __m128i
+xtime(__m128i x)
+{
+	return _mm_xor_si128(_mm_add_epi8(x, x),
+		_mm_and_si128(_mm_cmpgt_epi8(_mm_setzero_si128(), x),
+		_mm_set1_epi8(0x1B)));
+}
+
+/*
+ * Eight columns (four registers) to four registers holding two rows each,
+ * row 2 * p in the low half of z[p] and row 2 * p + 1 in the high half.
+ */
+AESNI_TARGET static inline void
+groestl_cols_rows(__m128i z[4], const __m128i c[4])
+{
+	const __m128i il = _mm_set_epi8(15, 7, 14, 6, 13, 5, 12, 4,
+		11, 3, 10, 2, 9, 1, 8, 0);
+	__m128i x0, x1, x2, x3, y0, y1, y2, y3;
+
+	x0 = _mm_shuffle_epi8(c[0], il);
+	x1 = _mm_shuffle_epi8(c[1], il);
+	x2 = _mm_shuffle_epi8(c[2], il);
+	x3 = _mm_shuffle_epi8(c[3], il);
+	y0 = _mm_unpacklo_epi16(x0, x1);
+	y1 = _mm_unpackhi_epi16(x0, x1);
+	y2 = _mm_unpacklo_epi16(x2, x3);
+	y3 = _mm_unpackhi_epi16(x2, x3);
+	z[0] = _mm_unpacklo_epi32(y0, y2);
+	z[1] = _mm_unpackhi_epi32(y0, y2);
+	z[2] = _mm_unpacklo_epi32(y1, y3);
+	z[3] = _mm_unpackhi_epi32(y1, y3);
+}
+
+/* Inverse of groestl_cols_rows() */
+AESNI_TARGET static inline void
+groestl_rows_cols(__m128i c[4], const __m128i z[4])
+{
+	const __m128i ev = _mm_set_epi8(15, 14, 11, 10, 7, 6, 3, 2,
+		13, 12, 9, 8, 5, 4, 1, 0);
+	const __m128i dl = _mm_set_epi8(15, 13, 11, 9, 7, 5, 3, 1,
+		14, 12, 10, 8, 6, 4, 2, 0);
+	__m128i z0, z1, z2, z3, y0, y1, y2, y3, x0, x1, x2, x3;
+
+	z0 = _mm_shuffle_epi32(z[0], _MM_SHUFFLE(3, 1, 2, 0));
+	z1 = _mm_shuffle_epi32(z[1], _MM_SHUFFLE(3, 1, 2, 0));
+	z2 = _mm_shuffle_epi32(z[2], _MM_SHUFFLE(3, 1, 2, 0));
+	z3 = _mm_shuffle_epi32(z[3], _MM_SHUFFLE(3, 1, 2, 0));
+	y0 = _mm_shuffle_epi8(_mm_unpacklo_epi64(z0, z1), ev);
+	y2 = _mm_shuffle_epi8(_mm_unpackhi_epi64(z0, z1), ev);
+	y1 = _mm_shuffle_epi8(_mm_unpacklo_epi64(z2, z3), ev);
+	y3 = _mm_shuffle_epi8(_mm_unpackhi_epi64(z2, z3), ev);
+	x0 = _mm_unpacklo_epi64(y0, y1);
+	x1 = _mm_unpackhi_epi64(y0, y1);
+	x2 = _mm_unpacklo_epi64(y2, y3);
+	x3 = _mm_unpackhi_epi64(y2, y3);
+	c[0] = _mm_shuffle_epi8(x0, dl);
+	c[1] = _mm_shuffle_epi8(x1, dl);
+	c[2] = _mm_shuffle_epi8(x2, dl);
+	c[3] = _mm_shuffle_epi8(x3, dl);
+}
+
+AESNI_TARGET static void
+groestl_load(__m128i r[8], const void *src, int big)
+{
+	const unsigned char *s = src;
+	__m128i c[4], lo[4], hi[4];
+	int p;
+
+	for (p = 0; p < 4; p ++)
+		c[p] = _mm_loadu_si128((const __m128i *)(s + 16 * p));
+	groestl_cols_rows(lo, c);
+	if (!big) {
+		for (p = 0; p < 4; p ++) {
+			r[2 * p] = lo[p];
+			r[2 * p + 1] = _mm_unpackhi_epi64(lo[p], lo[p]);
+		}
+		return;
+	}
+	for (p = 0; p < 4; p ++)
+		c[p] = _mm_loadu_si128((const __m128i *)(s + 64 + 16 * p));
+	groestl_cols_rows(hi, c);
+	for (p = 0; p < 4; p ++) {
+		r[2 * p] = _mm_unpacklo_epi64(lo[p], hi[p]);
+		r[2 * p + 1] = _mm_unpackhi_epi64(lo[p], hi[p]);
+	}
+}
+
+AESNI_TARGET static void
+groestl_store(void *dst, const __m128i r[8], int big)
+{
+	unsigned char *d = dst;
+	__m128i c[4], lo[4], hi[4];
+	int p;
+
+	for (p = 0; p < 4; p ++)
+		lo[p] = _mm_unpacklo_epi64(r[2 * p], r[2 * p + 1]);
+	groestl_rows_cols(c, lo);
+	for (p = 0; p < 4; p ++)
+		_mm_storeu_si128((__m128i *)(d + 16 * p), c[p]);
+	if (!big)
+		return;
+	for (p = 0; p < 4; p ++)
+		hi[p] = _mm_unpackhi_epi64(r[2 * p], r[2 * p + 1]);
+	groestl_rows_cols(c, hi);
+	for (p = 0; p < 4; p ++)
+		_mm_storeu_si128((__m128i *)(d + 64 + 16 * p), c[p]);
+}
+
+/*
+ * Row i of MixBytes is 2 a[i] ^ 2 a[i + 1] ^ 3 a[i + 2] ^ 4 a[i + 3]
+ * ^ 5 a[i + 4] ^ 3 a[i + 5] ^ 5 a[i + 6] ^ 7 a[i + 7], indices mod 8.
+ */
+#define MIX_ROW(i)   do { \
+		__m128i s1, s2, s4; \
+		s1 = _mm_xor_si128(_mm_xor_si128(a[((i) + 2) & 7], \
+			a[((i) + 4) & 7]), _mm_xor_si128(a[((i) + 5) & 7], \
+			_mm_xor_si128(a[((i) + 6) & 7], a[((i) + 7) & 7]))); \
+		s2 = _mm_xor_si128(_mm_xor_si128(a[i], a[((i) + 1) & 7]), \
+			_mm_xor_si128(_mm_xor_si128(a[((i) + 2) & 7], \
+			a[((i) + 5) & 7]), a[((i) + 7) & 7])); \
+		s4 = _mm_xor_si128(_mm_xor_si128(a[((i) + 3) & 7], \
+			a[((i) + 4) & 7]), _mm_xor_si128(a[((i) + 6) & 7], \
+			a[((i) + 7) & 7])); \
+		x[i] = _mm_xor_si128(xtime(_mm_xor_si128(s2, xtime(s4))), s1); \
+	} while (0)
+
+/*
+ * Each round adds the round constant r ^ (column << 4) masked with m0 and
+ * m7 and the fixed k0, km and k7 to row 0, rows 1 to 6 and row 7.
+ */
+AESNI_TARGET static void
+groestl_perm(__m128i x[8], int variant, int rounds)
+{
+	const __m128i zero = _mm_setzero_si128();
+	const __m128i ones = _mm_set1_epi8(-1);
+	const __m128i high = _mm_set_epi64x(-1LL, 0);
+	__m128i cols, m0, m7, k0, km, k7;
+	__m128i m[8], a[8], rc;
+	int i, r;
+
+	switch (variant) {
+	case 0:
+		cols = _mm_set1_epi64x(0x7060504030201000LL);
+		m0 = _mm_set_epi64x(0, -1LL);
+		m7 = k0 = km = k7 = high;
+		break;
+	case 1:
+		cols = _mm_set_epi64x(0xF0E0D0C0B0A09080LL,
+			0x7060504030201000LL);
+		m0 = ones;
+		m7 = k0 = km = k7 = zero;
+		break;
+	default:
+		cols = _mm_set_epi64x(0xF0E0D0C0B0A09080LL,
+			0x7060504030201000LL);
+		m0 = zero;
+		m7 = k0 = km = k7 = ones;
+		break;
+	}
+	for (i = 0; i < 8; i ++)
+		m[i] = _mm_loadu_si128(
+			(const __m128i *)groestl_masks[variant][i]);
+
+	for (r = 0; r < rounds; r ++) {
+		rc = _mm_xor_si128(cols, _mm_set1_epi8((char)r));
+		x[0] = _mm_xor_si128(x[0],
+			_mm_xor_si128(_mm_and_si128(rc, m0), k0));
+		for (i = 1; i < 7; i ++)
+			x[i] = _mm_xor_si128(x[i], km);
+		x[7] = _mm_xor_si128(x[7],
+			_mm_xor_si128(_mm_and_si128(rc, m7), k7));
+		for (i = 0; i < 8; i ++)
+			a[i] = _mm_aesenclast_si128(
+				_mm_shuffle_epi8(x[i], m[i]), zero);
+		MIX_ROW(0);
+		MIX_ROW(1);
+		MIX_ROW(2);
+		MIX_ROW(3);
+		MIX_ROW(4);
+		MIX_ROW(5);
+		MIX_ROW(6);
+		MIX_ROW(7);
+	}
+}
+
+#undef MIX_ROW
+
+/* H ^= P(H ^ m) ^ Q(m), P and Q side by side for the small state */
+AESNI_TARGET static void
+groestl_compress(void *h, const void *buf, int big)
+{
+	__m128i g[8], p[8], q[8];
+	int i;
+
+	groestl_load(g, h, big);
+	groestl_load(q, buf, big);
+	if (!big) {
+		for (i = 0; i < 8; i ++)
+			p[i] = _mm_unpacklo_epi64(_mm_xor_si128(g[i], q[i]),
+				q[i]);
+		groestl_perm(p, 0, 10);
+		for (i = 0; i < 8; i ++)
+			g[i] = _mm_xor_si128(g[i], _mm_xor_si128(p[i],
+				_mm_unpackhi_epi64(p[i], p[i])));
+	} else {
+		for (i = 0; i < 8; i ++)
+			p[i] = _mm_xor_si128(g[i], q[i]);
+		groestl_perm(p, 1, 14);
+		groestl_perm(q, 2, 14);
+		for (i = 0; i < 8; i ++)
+			g[i] = _mm_xor_si128(g[i], _mm_xor_si128(p[i], q[i]));
+	}
+	groestl_store(h, g, big);
+}
+
+/* H ^= P(H) */
+AESNI_TARGET static void
+groestl_final(void *h, int big)
+{
+	__m128i g[8], p[8];
+	int i;
+
+	groestl_load(g, h, big);
+	for (i = 0; i < 8; i ++)
+		p[i] = g[i];
+	groestl_perm(p, big ? 1 : 0, big ? 14 : 10);
+	for (i = 0; i < 8; i ++)
+		g[i] = _mm_xor_si128(g[i], p[i]);
+	groestl_store(h, g, big);
+}
+
+/* see sph_aesni.h */
+void
+sph_groestl_small_compress_aesni(void *h, const void *buf)
+{
+	groestl_compress(h, buf, 0);
+}
+
+/* see sph_aesni.h */
+void
+sph_groestl_small_final_aesni(void *h)
+{
+	groestl_final(h, 0);
+}
+
+/* see sph_aesni.h */
+void
+sph_groestl_big_compress_aesni(void *h, const void *buf)
+{
+	groestl_compress(h, buf, 1);
+}
+
+/* see sph_aesni.h */
+void
+sph_groestl_big_final_aesni(void *h)
+{
+	groestl_final(h, 1);
+}
+
+#define MIX_COLUMN(n)   do { \
+		__m128i a = W[n], b = W[(n) + 1], c = W[(n) + 2], d = W[(n) + 3]; \
+		__m128i ab = _mm_xor_si128(a, b); \
+		__m128i bc = _mm_xor_si128(b, c); \
+		__m128i cd = _mm_xor_si128(c, d); \
+		__m128i abx = xtime(ab), bcx = xtime(bc), cdx = xtime(cd); \
+		W[n] = _mm_xor_si128(abx, _mm_xor_si128(bc, d)); \
+		W[(n) + 1] = _mm_xor_si128(bcx, _mm_xor_si128(a, cd)); \
+		W[(n) + 2] = _mm_xor_si128(cdx, _mm_xor_si128(ab, d)); \
+		W[(n) + 3] = _mm_xor_si128(_mm_xor_si128(abx, bcx), \
+			_mm_xor_si128(cdx, _mm_xor_si128(ab, c))); \
+	} while (0)
+
+/* see sph_aesni.h */
+AESNI_TARGET void
+sph_echo_big_compress_aesni(void *cc)
+{
+	sph_echo_big_context *sc = cc;
+	const __m128i zero = _mm_setzero_si128();
+	__m128i W[16], t;
+	unsigned long long lo, hi;
+	int u, n;
+
+	lo = (unsigned long long)sc->C1 << 32 | sc->C0;
+	hi = (unsigned long long)sc->C3 << 32 | sc->C2;
+	for (n = 0; n < 8; n ++) {
+		W[n] = _mm_loadu_si128((const __m128i *)&sc->u.Vs[n][0]);
+		W[n + 8] = _mm_loadu_si128((const __m128i *)(sc->buf + 16 * n));
+	}
+
+	for (u = 0; u < 10; u ++) {
+		for (n = 0; n < 16; n ++) {
+			W[n] = _mm_aesenc_si128(_mm_aesenc_si128(W[n],
+				_mm_set_epi64x((long long)hi, (long long)lo)), zero);
+			if (++ lo == 0)
+				hi ++;
+		}
+
+		t = W[1]; W[1] = W[5]; W[5] = W[9]; W[9] = W[13]; W[13] = t;
+		t = W[2]; W[2] = W[10]; W[10] = t;
+		t = W[6]; W[6] = W[14]; W[14] = t;
+		t = W[15]; W[15] = W[11]; W[11] = W[7]; W[7] = W[3]; W[3] = t;
+
+		MIX_COLUMN(0);
+		MIX_COLUMN(4);
+		MIX_COLUMN(8);
+		MIX_COLUMN(12);
+	}
+
+	for (n = 0; n < 8; n ++) {
+		t = _mm_loadu_si128((const __m128i *)&sc->u.Vs[n][0]);
+		t = _mm_xor_si128(t, _mm_loadu_si128(
+			(const __m128i *)(sc->buf + 16 * n)));
+		t = _mm_xor_si128(t, _mm_xor_si128(W[n], W[n + 8]));
+		_mm_storeu_si128((__m128i *)&sc->u.Vs[n][0], t);
+	}
+}
+
+#undef MIX_COLUMN
+
+static int
+aesni_cpu(void)
+{
+	unsigned int a, b, c, d;
+
+	if (!__get_cpuid(1, &a, &b, &c, &d))
+		return 0;
+	return (c & bit_AES) && (c & bit_SSSE3);
+}
+
+#endif
+
+/* see sph_aesni.h */
+int
+sph_aesni_init(void)
+{
+	sph_aesni_active = 0;
+#if SPH_AESNI
+	if (aesni_cpu()) {
+		groestl_masks_init();
+		sph_aesni_active = 1;
+	}
+#endif
+	return sph_aesni_active;
+}
@@ -35,6 +35,7 @@
 #include <limits.h>
 
 #include "sph_echo.h"
+#include "sph_aesni.h"
 
 #if SPH_SMALL_FOOTPRINT && !defined SPH_SMALL_FOOTPRINT_ECHO
 #define SPH_SMALL_FOOTPRINT_ECHO   1
@@ -720,6 +721,12 @@ echo_big_compress(sph_echo_big_context *sc)
 {
 	DECL_STATE_BIG
 
+#if SPH_AESNI
+	if (sph_aesni_active) {
+		sph_echo_big_compress_aesni(sc);
+		return;
+	}
+#endif
 	COMPRESS_BIG(sc);
 }
 
@@ -34,6 +34,7 @@
 #include <string.h>
 
 #include "sph_groestl.h"
+#include "sph_aesni.h"
 
 #if SPH_SMALL_FOOTPRINT && !defined SPH_SMALL_FOOTPRINT_GROESTL
 #define SPH_SMALL_FOOTPRINT_GROESTL   1
@@ -2791,7 +2792,12 @@ groestl_small_core(sph_groestl_small_context *sc, const void *data, size_t len)
 		data = (const unsigned char *)data + clen;
 		len -= clen;
 		if (ptr == sizeof sc->buf) {
-			COMPRESS_SMALL;
+#if SPH_AESNI
+			if (sph_aesni_active)
+				sph_groestl_small_compress_aesni(H, buf);
+			else
+#endif
+				COMPRESS_SMALL;
 #if SPH_64
 			sc->count ++;
 #else
@@ -2852,7 +2858,12 @@ groestl_small_close(sph_groestl_small_context *sc,
 #endif
 	groestl_small_core(sc, pad, pad_len);
 	READ_STATE_SMALL(sc);
-	FINAL_SMALL;
+#if SPH_AESNI
+	if (sph_aesni_active)
+		sph_groestl_small_final_aesni(H);
+	else
+#endif
+		FINAL_SMALL;
 #if SPH_GROESTL_64
 	for (u = 0; u < 4; u ++)
 		enc64e(pad + (u << 3), H[u + 4]);
@@ -2925,7 +2936,12 @@ groestl_big_core(sph_groestl_big_context *sc, const void *data, size_t len)
 		data = (const unsigned char *)data + clen;
 		len -= clen;
 		if (ptr == sizeof sc->buf) {
-			COMPRESS_BIG;
+#if SPH_AESNI
+			if (sph_aesni_active)
+				sph_groestl_big_compress_aesni(H, buf);
+			else
+#endif
+				COMPRESS_BIG;
 #if SPH_64
 			sc->count ++;
 #else
@@ -2986,7 +3002,12 @@ groestl_big_close(sph_groestl_big_context *sc,
 #endif
 	groestl_big_core(sc, pad, pad_len);
 	READ_STATE_BIG(sc);
-	FINAL_BIG;
+#if SPH_AESNI
+	if (sph_aesni_active)
+		sph_groestl_big_final_aesni(H);
+	else
+#endif
+		FINAL_BIG;
 #if SPH_GROESTL_64
 	for (u = 0; u < 8; u ++)
 		enc64e(pad + (u << 3), H[u + 8]);
@@ -34,6 +34,7 @@
 #include <string.h>
 
 #include "sph_sha2.h"
+#include "sph_sha256_hw.h"
 
 #if SPH_SMALL_FOOTPRINT && !defined SPH_SMALL_FOOTPRINT_SHA2
 #define SPH_SMALL_FOOTPRINT_SHA2   1
@@ -608,6 +609,12 @@ static const sph_u32 K[64] = {
 static void
 sha2_round(const unsigned char *data, sph_u32 r[8])
 {
+#if SPH_SHA256_SHANI
+	if (sph_sha256_hw_active) {
+		sph_sha256_hw_block(data, r);
+		return;
+	}
+#endif
 #define SHA2_IN(x)   sph_dec32be_aligned(data + (4 * (x)))
 	SHA2_ROUND_BODY(SHA2_IN, r);
 #undef SHA2_IN
@@ -684,6 +691,12 @@ sph_sha256_addbits_and_close(void *cc, unsigned ub, unsigned n, void *dst)
 void
 sph_sha224_comp(const sph_u32 msg[16], sph_u32 val[8])
 {
+#if SPH_SHA256_SHANI
+	if (sph_sha256_hw_active) {
+		sph_sha256_hw_comp(msg, val);
+		return;
+	}
+#endif
 #define SHA2_IN(x)   msg[x]
 	SHA2_ROUND_BODY(SHA2_IN, val);
 #undef SHA2_IN
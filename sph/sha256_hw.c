@@ -0,0 +1,249 @@
+/*
+ * SHA-256 compression with the x86 SHA extensions.
+ *
+ * The state is kept in two registers as ABEF/CDGH halves the way
+ * SHA256RNDS2 wants them, four rounds per message schedule step.
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the Free
+ * Software Foundation; either version 3 of the License, or (at your option)
+ * any later version.  See COPYING for more details.
+ */
+
+#include <stddef.h>
+#include <string.h>
+
+#include "sph_sha2.h"
+#include "sph_sha256_hw.h"
+
+int sph_sha256_hw_active = 0;
+const char *sph_sha256_hw_name = "portable";
+
+#if SPH_SHA256_SHANI
+
+#include <cpuid.h>
+#include <immintrin.h>
+
+static const sph_u32 K256[64] = {
+	SPH_C32(0x428A2F98), SPH_C32(0x71374491),
+	SPH_C32(0xB5C0FBCF), SPH_C32(0xE9B5DBA5),
+	SPH_C32(0x3956C25B), SPH_C32(0x59F111F1),
+	SPH_C32(0x923F82A4), SPH_C32(0xAB1C5ED5),
+	SPH_C32(0xD807AA98), SPH_C32(0x12835B01),
+	SPH_C32(0x243185BE), SPH_C32(0x550C7DC3),
+	SPH_C32(0x72BE5D74), SPH_C32(0x80DEB1FE),
+	SPH_C32(0x9BDC06A7), SPH_C32(0xC19BF174),
+	SPH_C32(0xE49B69C1), SPH_C32(0xEFBE4786),
+	SPH_C32(0x0FC19DC6), SPH_C32(0x240CA1CC),
+	SPH_C32(0x2DE92C6F), SPH_C32(0x4A7484AA),
+	SPH_C32(0x5CB0A9DC), SPH_C32(0x76F988DA),
+	SPH_C32(0x983E5152), SPH_C32(0xA831C66D),
+	SPH_C32(0xB00327C8), SPH_C32(0xBF597FC7),
+	SPH_C32(0xC6E00BF3), SPH_C32(0xD5A79147),
+	SPH_C32(0x06CA6351), SPH_C32(0x14292967),
+	SPH_C32(0x27B70A85), SPH_C32(0x2E1B2138),
+	SPH_C32(0x4D2C6DFC), SPH_C32(0x53380D13),
+	SPH_C32(0x650A7354), SPH_C32(0x766A0ABB),
+	SPH_C32(0x81C2C92E), SPH_C32(0x92722C85),
+	SPH_C32(0xA2BFE8A1), SPH_C32(0xA81A664B),
+	SPH_C32(0xC24B8B70), SPH_C32(0xC76C51A3),
+	SPH_C32(0xD192E819), SPH_C32(0xD6990624),
+	SPH_C32(0xF40E3585), SPH_C32(0x106AA070),
+	SPH_C32(0x19A4C116), SPH_C32(0x1E376C08),
+	SPH_C32(0x2748774C), SPH_C32(0x34B0BCB5),
+	SPH_C32(0x391C0CB3), SPH_C32(0x4ED8AA4A),
+	SPH_C32(0x5B9CCA4F), SPH_C32(0x682E6FF3),
+	SPH_C32(0x748F82EE), SPH_C32(0x78A5636F),
+	SPH_C32(0x84C87814), SPH_C32(0x8CC70208),
+	SPH_C32(0x90BEFFFA), SPH_C32(0xA4506CEB),
+	SPH_C32(0xBEF9A3F7), SPH_C32(0xC67178F2)
+};
+
+#define SHANI_TARGET	__attribute__((target("sha,sse4.1,ssse3")))
+
+SHANI_TARGET static inline void
+shani_comp(__m128i m0, __m128i m1, __m128i m2, __m128i m3, sph_u32 val[8])
+{
+	__m128i s0, s1, abef, cdgh, t;
+	int g;
+
+	/* ABCD EFGH to ABEF CDGH */
+	t = _mm_shuffle_epi32(_mm_loadu_si128((const __m128i *)val), 0xB1);
+	s1 = _mm_shuffle_epi32(_mm_loadu_si128((const __m128i *)(val + 4)), 0x1B);
+	s0 = _mm_alignr_epi8(t, s1, 8);
+	s1 = _mm_blend_epi16(s1, t, 0xF0);
+	abef = s0;
+	cdgh = s1;
+
+	for (g = 0; g < 16; g ++) {
+		if (g >= 4) {
+			m0 = _mm_sha256msg2_epu32(_mm_add_epi32(
+				_mm_sha256msg1_epu32(m0, m1),
+				_mm_alignr_epi8(m3, m2, 4)), m3);
+		}
+		t = _mm_add_epi32(m0,
+			_mm_loadu_si128((const __m128i *)(K256 + 4 * g)));
+		s1 = _mm_sha256rnds2_epu32(s1, s0, t);
+		s0 = _mm_sha256rnds2_epu32(s0, s1, _mm_shuffle_epi32(t, 0x0E));
+
+		/* the next step works on the following four words */
+		t = m0;
+		m0 = m1;
+		m1 = m2;
+		m2 = m3;
+		m3 = t;
+	}
+
+	s0 = _mm_add_epi32(s0, abef);
+	s1 = _mm_add_epi32(s1, cdgh);
+
+	/* and back */
+	t = _mm_shuffle_epi32(s0, 0x1B);
+	s1 = _mm_shuffle_epi32(s1, 0xB1);
+	_mm_storeu_si128((__m128i *)val, _mm_blend_epi16(t, s1, 0xF0));
+	_mm_storeu_si128((__m128i *)(val + 4), _mm_alignr_epi8(s1, t, 8));
+}
+
+/* see sph_sha256_hw.h */
+SHANI_TARGET void
+sph_sha256_hw_block(const void *data, sph_u32 val[8])
+{
+	const __m128i bswap = _mm_set_epi64x(0x0C0D0E0F08090A0BLL,
+		0x0405060700010203LL);
+	const __m128i *p = data;
+
+	shani_comp(_mm_shuffle_epi8(_mm_loadu_si128(p), bswap),
+		_mm_shuffle_epi8(_mm_loadu_si128(p + 1), bswap),
+		_mm_shuffle_epi8(_mm_loadu_si128(p + 2), bswap),
+		_mm_shuffle_epi8(_mm_loadu_si128(p + 3), bswap), val);
+}
+
+/* see sph_sha256_hw.h */
+SHANI_TARGET void
+sph_sha256_hw_comp(const sph_u32 msg[16], sph_u32 val[8])
+{
+	const __m128i *p = (const __m128i *)msg;
+
+	shani_comp(_mm_loadu_si128(p), _mm_loadu_si128(p + 1),
+		_mm_loadu_si128(p + 2), _mm_loadu_si128(p + 3), val);
+}
+
+static const char *
+sha256_hw_cpu(void)
+{
+	unsigned int a, b, c, d;
+
+	if (!__get_cpuid(1, &a, &b, &c, &d)
+		|| !(c & bit_SSSE3) || !(c & bit_SSE4_1))
+		return NULL;
+	if (__get_cpuid_max(0, NULL) < 7)
+		return NULL;
+	__cpuid_count(7, 0, a, b, c, d);
+	return (b & bit_SHA) ? "SHA-NI" : NULL;
+}
+
+/*
+ * Published digests of the empty message, "abc" and the 448 bit message of
+ * FIPS 180-2, then bytes 0, 1, 2... of 64 and 300 bytes.
+ */
+static const struct {
+	const char *msg;
+	size_t len;
+	const char *sha256;
+} sha256_hw_kat[] = {
+	{ "", 0,
+	  "e3b0c44298fc1c149afbf4c8996fb92427ae41e4649b934ca495991b7852b855" },
+	{ "abc", 3,
+	  "ba7816bf8f01cfea414140de5dae2223b00361a396177a9cb410ff61f20015ad" },
+	{ "abcdbcdecdefdefgefghfghighijhijkijkljklmklmnlmnomnopnopq", 56,
+	  "248d6a61d20638b8e5c026930c3e6039a33ce45964ff2167f6ecedd419db06c1" },
+	{ NULL, 64,
+	  "fdeab9acf3710362bd2658cdc9a29e8f9c757fcf9811603a8c447cd1d9151108" },
+	{ NULL, 300,
+	  "7728ae2f2c36e2aaafbe79ca14c87ae2f89e7c88c4390ecbbf82dce88706958d" }
+};
+
+static int
+sha256_hw_match(const unsigned char *digest, const char *hex)
+{
+	static const char xd[] = "0123456789abcdef";
+	size_t u;
+
+	for (u = 0; u < 32; u ++) {
+		if (hex[2 * u] != xd[digest[u] >> 4]
+			|| hex[2 * u + 1] != xd[digest[u] & 0x0F])
+			return 0;
+	}
+	return 1;
+}
+
+/*
+ * The digests go through sph_sha256(), the bare compression function is
+ * compared with the portable one on a few chained blocks.
+ */
+static const char *
+sha256_hw_kat_check(void)
+{
+	unsigned char msg[300], out[32];
+	sph_sha256_context cc;
+	sph_u32 words[16], hw[8], sw[8];
+	size_t u;
+	int n;
+
+	for (u = 0; u < sizeof msg; u ++)
+		msg[u] = (unsigned char)u;
+
+	for (u = 0; u < sizeof sha256_hw_kat / sizeof sha256_hw_kat[0]; u ++) {
+		sph_sha256_init(&cc);
+		sph_sha256(&cc, sha256_hw_kat[u].msg != NULL
+			? (const void *)sha256_hw_kat[u].msg : (const void *)msg,
+			sha256_hw_kat[u].len);
+		sph_sha256_close(&cc, out);
+		if (!sha256_hw_match(out, sha256_hw_kat[u].sha256))
+			return "sha256";
+	}
+
+	for (u = 0; u < 16; u ++)
+		words[u] = (sph_u32)(0x9E3779B9 * (u + 1));
+	for (u = 0; u < 8; u ++)
+		hw[u] = sw[u] = (sph_u32)(0x7F4A7C15 * (u + 3));
+	for (n = 0; n < 4; n ++) {
+		sph_sha256_hw_comp(words, hw);
+		sph_sha256_hw_active = 0;
+		sph_sha256_comp(words, sw);
+		sph_sha256_hw_active = 1;
+		words[n] ^= sw[n];
+	}
+	if (memcmp(hw, sw, sizeof hw) != 0)
+		return "sha256_comp";
+	return NULL;
+}
+
+#endif
+
+/* see sph_sha256_hw.h */
+int
+sph_sha256_hw_init(const char **failed)
+{
+	const char *bad = NULL;
+#if SPH_SHA256_SHANI
+	const char *name;
+#endif
+
+	sph_sha256_hw_active = 0;
+	sph_sha256_hw_name = "portable";
+#if SPH_SHA256_SHANI
+	name = sha256_hw_cpu();
+	if (name != NULL) {
+		sph_sha256_hw_active = 1;
+		bad = sha256_hw_kat_check();
+		if (bad != NULL)
+			sph_sha256_hw_active = 0;
+		else
+			sph_sha256_hw_name = name;
+	}
+#endif
+	if (failed != NULL)
+		*failed = bad;
+	return sph_sha256_hw_active;
+}
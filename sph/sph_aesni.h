@@ -0,0 +1,49 @@
+/*
+ * AES-NI implementations of the Groestl and ECHO compression functions.
+ *
+ * groestl.c and echo.c call these instead of their table code when
+ * sph_aesni_active is set. sph_aesni_init() sets it when the CPU has
+ * AES-NI and SSSE3, and must run before any hashing thread starts. The
+ * state layouts are those of the sph contexts, so contexts can be shared
+ * either way. tests/sph-aesni.c checks both against known answers.
+ */
+
+#ifndef SPH_AESNI_H__
+#define SPH_AESNI_H__
+
+#ifdef __cplusplus
+extern "C"{
+#endif
+
+#if (defined(__x86_64__) || defined(__i386__)) && defined(__GNUC__)
+#define SPH_AESNI   1
+#else
+#define SPH_AESNI   0
+#endif
+
+extern int sph_aesni_active;
+
+/* Picks the implementation, returns 1 when AES-NI is used */
+int sph_aesni_init(void);
+
+#if SPH_AESNI
+
+/*
+ * h is the 64 (small) or 128 (big) byte Groestl chaining value, one
+ * column after the other, and buf one message block of the same size.
+ */
+void sph_groestl_small_compress_aesni(void *h, const void *buf);
+void sph_groestl_small_final_aesni(void *h);
+void sph_groestl_big_compress_aesni(void *h, const void *buf);
+void sph_groestl_big_final_aesni(void *h);
+
+/* Compresses the buffered block of a sph_echo_big_context */
+void sph_echo_big_compress_aesni(void *cc);
+
+#endif
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
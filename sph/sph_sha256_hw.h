@@ -0,0 +1,53 @@
+/*
+ * SHA-256 compression with the x86 SHA extensions.
+ *
+ * sha2.c calls these instead of its portable code when
+ * sph_sha256_hw_active is set, so every sph_sha256() and sph_sha256_comp()
+ * user follows. sph_sha256_hw_init() sets it when the CPU has them and
+ * they pass the known answer tests, and must run before any hashing
+ * thread starts.
+ */
+
+#ifndef SPH_SHA256_HW_H__
+#define SPH_SHA256_HW_H__
+
+#include "sph_types.h"
+
+#ifdef __cplusplus
+extern "C"{
+#endif
+
+#if (defined(__x86_64__) || defined(__i386__)) && defined(__GNUC__)
+#define SPH_SHA256_SHANI   1
+#else
+#define SPH_SHA256_SHANI   0
+#endif
+
+extern int sph_sha256_hw_active;
+
+/* "SHA-NI" or "portable" after sph_sha256_hw_init() */
+extern const char *sph_sha256_hw_name;
+
+/*
+ * Picks the implementation, returns 1 when the instructions are used. When
+ * the CPU has them but a known answer test fails the portable code stays
+ * in use and *failed (if not NULL) names the test.
+ */
+int sph_sha256_hw_init(const char **failed);
+
+#if SPH_SHA256_SHANI
+
+/*
+ * One compression of val with a 64 byte block, given as big endian bytes
+ * or as the 16 words they decode to.
+ */
+void sph_sha256_hw_block(const void *data, sph_u32 val[8]);
+void sph_sha256_hw_comp(const sph_u32 msg[16], sph_u32 val[8]);
+
+#endif
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
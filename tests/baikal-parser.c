@@ -0,0 +1,354 @@
+/*
+ * Drives the Baikal frame parser from the far end of a pty pair, the way
+ * the serial reader sees a board: replies split into single bytes, several
+ * replies in one write, garbage or broken frames between good ones, and
+ * replies that arrive after their request timed out.
+ *
+ * Only driver-baikal-io.c is linked in, the few sgminer functions it uses
+ * are stubbed out below.
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the Free
+ * Software Foundation; either version 3 of the License, or (at your option)
+ * any later version.  See COPYING for more details.
+ */
+
+#include "config.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <termios.h>
+#include <unistd.h>
+#include <sys/time.h>
+
+#include "miner.h"
+#include "driver-baikal.h"
+
+#define TEST_TIMEOUT    (500)   /* ms to wait for a frame that must arrive */
+#define TEST_NO_FRAME   (100)   /* ms to wait for a frame that must not */
+
+static int failures;
+
+#define CHECK(cond) do { \
+        if (!(cond)) { \
+            fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, #cond); \
+            failures++; \
+        } \
+    } while (0)
+
+/* What driver-baikal-io.c needs from the rest of sgminer */
+bool opt_debug;
+bool opt_log_output;
+int opt_log_level = LOG_ERR;
+bool use_syslog;
+
+void _applog(int prio, const char *str, bool force)
+{
+    fprintf(stderr, "[%d] %s\n", prio, str);
+}
+
+void _quit(int status)
+{
+    exit(status);
+}
+
+void cgtime(struct timeval *tv)
+{
+    gettimeofday(tv, NULL);
+}
+
+void timeval_to_spec(struct timespec *spec, const struct timeval *val)
+{
+    spec->tv_sec = val->tv_sec;
+    spec->tv_nsec = val->tv_usec * 1000;
+}
+
+void ms_to_timespec(struct timespec *spec, int64_t ms)
+{
+    spec->tv_sec = ms / 1000;
+    spec->tv_nsec = (ms % 1000) * 1000000;
+}
+
+void timeraddspec(struct timespec *a, const struct timespec *b)
+{
+    a->tv_sec += b->tv_sec;
+    a->tv_nsec += b->tv_nsec;
+    if (a->tv_nsec >= 1000000000) {
+        a->tv_nsec -= 1000000000;
+        a->tv_sec++;
+    }
+}
+
+struct test_port {
+    struct baikal_io io;
+    int master;
+    int slave;
+};
+
+/* Same loop as the serial driver's reader, on the slave side of the pty */
+static void *test_reader(void *userdata)
+{
+    struct test_port *port = (struct test_port *)userdata;
+    uint8_t buf[BAIKAL_FRAME_MAX];
+    struct pollfd pfd;
+    ssize_t n;
+
+    pfd.fd = port->slave;
+    pfd.events = POLLIN;
+
+    while (port->io.running == true) {
+        if (poll(&pfd, 1, BAIKAL_IO_POLL) <= 0) {
+            continue;
+        }
+        n = read(port->slave, buf, sizeof(buf));
+        if (n > 0) {
+            baikal_parser_feed(&port->io, buf, n);
+        }
+    }
+
+    return (NULL);
+}
+
+static bool test_open(struct test_port *port)
+{
+    struct termios options;
+
+    port->master = posix_openpt(O_RDWR | O_NOCTTY);
+    if ((port->master < 0) || grantpt(port->master) || unlockpt(port->master)) {
+        perror("posix_openpt");
+        return (false);
+    }
+
+    port->slave = open(ptsname(port->master), O_RDWR | O_NOCTTY);
+    if (port->slave < 0) {
+        perror("open pty slave");
+        return (false);
+    }
+
+    /* the board talks binary, keep "\r\n" and every other byte as sent */
+    tcgetattr(port->slave, &options);
+    cfmakeraw(&options);
+    tcsetattr(port->slave, TCSANOW, &options);
+
+    baikal_io_init(&port->io);
+    return (baikal_io_start(&port->io, test_reader, port));
+}
+
+static void test_close(struct test_port *port)
+{
+    baikal_io_stop(&port->io);
+    close(port->slave);
+    close(port->master);
+}
+
+static int test_frame(uint8_t *buf, uint8_t miner_id, uint8_t cmd, uint8_t param, int len)
+{
+    baikal_msg msg;
+    int i;
+
+    memset(&msg, 0, sizeof(msg));
+    msg.miner_id = miner_id;
+    msg.cmd = cmd;
+    msg.param = param;
+    msg.dest = 0;
+    msg.len = len;
+    for (i = 0; i < len; i++) {
+        msg.data[i] = (uint8_t)(0xa0 + miner_id + i);
+    }
+
+    return (baikal_encode(&msg, buf));
+}
+
+static void test_write(struct test_port *port, const uint8_t *buf, int len)
+{
+    CHECK(write(port->master, buf, len) == len);
+}
+
+/* Wait for and check the reply test_frame() built for request gen of miner_id / cmd */
+static bool test_expect(struct test_port *port, uint8_t miner_id, uint8_t cmd, uint32_t gen, uint8_t param, int len)
+{
+    baikal_msg msg;
+    int i;
+
+    msg.miner_id = miner_id;
+    msg.cmd = cmd;
+    if (baikal_io_wait(&port->io, &msg, gen, TEST_TIMEOUT) != true) {
+        fprintf(stderr, "no reply for miner %d cmd %d\n", miner_id, cmd);
+        return (false);
+    }
+
+    CHECK(msg.miner_id == miner_id);
+    CHECK(msg.cmd == cmd);
+    CHECK(msg.param == param);
+    CHECK(msg.len == (uint32_t)len);
+    for (i = 0; i < len; i++) {
+        CHECK(msg.data[i] == (uint8_t)(0xa0 + miner_id + i));
+    }
+
+    return (true);
+}
+
+/* A GET_RESULT reply trickling in one byte at a time */
+static void test_split(struct test_port *port)
+{
+    uint8_t buf[BAIKAL_FRAME_MAX];
+    uint32_t gen;
+    int i, len;
+
+    len = test_frame(buf, 0, BAIKAL_GET_RESULT, 1, 8);
+    CHECK(len == baikal_reply_size(BAIKAL_GET_RESULT));
+
+    gen = baikal_io_arm(&port->io, 0, BAIKAL_GET_RESULT);
+    for (i = 0; i < len; i++) {
+        test_write(port, buf + i, 1);
+        usleep(1000);
+    }
+    CHECK(test_expect(port, 0, BAIKAL_GET_RESULT, gen, 1, 8));
+}
+
+/* Replies for three boards in a single write, delivered to each slot */
+static void test_concatenated(struct test_port *port)
+{
+    uint8_t buf[BAIKAL_FRAME_MAX];
+    uint32_t gen[3];
+    int len = 0;
+
+    gen[0] = baikal_io_arm(&port->io, 1, BAIKAL_SET_OPTION);
+    gen[1] = baikal_io_arm(&port->io, 2, BAIKAL_GET_INFO);
+    gen[2] = baikal_io_arm(&port->io, 3, BAIKAL_SEND_WORK);
+
+    len += test_frame(buf + len, 1, BAIKAL_SET_OPTION, 2, 0);
+    len += test_frame(buf + len, 2, BAIKAL_GET_INFO, 3, 7);
+    len += test_frame(buf + len, 3, BAIKAL_SEND_WORK, 4, 0);
+    test_write(port, buf, len);
+
+    CHECK(test_expect(port, 3, BAIKAL_SEND_WORK, gen[2], 4, 0));
+    CHECK(test_expect(port, 1, BAIKAL_SET_OPTION, gen[0], 2, 0));
+    CHECK(test_expect(port, 2, BAIKAL_GET_INFO, gen[1], 3, 7));
+}
+
+/* Noise, an unknown command, a bad trailer and a truncated frame all get
+ * skipped and the good frame behind them still gets through */
+static void test_corrupt(struct test_port *port)
+{
+    uint8_t buf[BAIKAL_FRAME_MAX];
+    baikal_msg msg;
+    uint32_t resyncs = port->io.resyncs;
+    uint32_t gen[2];
+    int len = 0, bad;
+
+    gen[0] = baikal_io_arm(&port->io, 0, BAIKAL_GET_RESULT);
+    gen[1] = baikal_io_arm(&port->io, 1, BAIKAL_GET_RESULT);
+
+    memcpy(buf + len, "\x00\xff noise", 8);
+    len += 8;
+
+    len += test_frame(buf + len, 0, 0x7f, 0, 0);
+
+    bad = test_frame(buf + len, 0, BAIKAL_GET_RESULT, 9, 8);
+    buf[len + bad - 1] = '\r';
+    len += bad;
+
+    bad = test_frame(buf + len, 1, BAIKAL_GET_RESULT, 9, 8);
+    len += bad - 6;
+
+    len += test_frame(buf + len, 0, BAIKAL_GET_RESULT, 5, 8);
+    test_write(port, buf, len);
+
+    CHECK(test_expect(port, 0, BAIKAL_GET_RESULT, gen[0], 5, 8));
+    CHECK(port->io.resyncs > resyncs);
+
+    /* the truncated frame never completes */
+    msg.miner_id = 1;
+    msg.cmd = BAIKAL_GET_RESULT;
+    CHECK(baikal_io_wait(&port->io, &msg, gen[1], TEST_NO_FRAME) == false);
+}
+
+/* A reply nobody asked for is counted and dropped */
+static void test_unsolicited(struct test_port *port)
+{
+    uint8_t buf[BAIKAL_FRAME_MAX];
+    uint32_t unsolicited = port->io.unsolicited;
+    int len;
+
+    len = test_frame(buf, 4, BAIKAL_SET_IDLE, 0, 0);
+    test_write(port, buf, len);
+    usleep(TEST_NO_FRAME * 1000);
+
+    CHECK(port->io.unsolicited == unsolicited + 1);
+}
+
+/* The reply to a request that timed out turns up after the next request
+ * was sent, it must not be taken for the answer to that one */
+static void test_late(struct test_port *port)
+{
+    uint8_t buf[BAIKAL_FRAME_MAX];
+    uint32_t late = port->io.late;
+    baikal_msg msg;
+    uint32_t gen;
+    int len;
+
+    gen = baikal_io_arm(&port->io, 2, BAIKAL_GET_RESULT);
+    msg.miner_id = 2;
+    msg.cmd = BAIKAL_GET_RESULT;
+    CHECK(baikal_io_wait(&port->io, &msg, gen, TEST_NO_FRAME) == false);
+
+    gen = baikal_io_arm(&port->io, 2, BAIKAL_GET_RESULT);
+    len = test_frame(buf, 2, BAIKAL_GET_RESULT, 6, 8);
+    len += test_frame(buf + len, 2, BAIKAL_GET_RESULT, 7, 8);
+    test_write(port, buf, len);
+
+    CHECK(test_expect(port, 2, BAIKAL_GET_RESULT, gen, 7, 8));
+    CHECK(port->io.late == late + 1);
+}
+
+/* A wait for an older generation of a slot that was armed again fails at
+ * once and leaves the reply to the current one */
+static void test_generation(struct test_port *port)
+{
+    uint8_t buf[BAIKAL_FRAME_MAX];
+    baikal_msg msg;
+    uint32_t old, gen;
+    int len;
+
+    old = baikal_io_arm(&port->io, 3, BAIKAL_GET_INFO);
+    gen = baikal_io_arm(&port->io, 3, BAIKAL_GET_INFO);
+    CHECK(old != gen);
+
+    msg.miner_id = 3;
+    msg.cmd = BAIKAL_GET_INFO;
+    CHECK(baikal_io_wait(&port->io, &msg, old, TEST_TIMEOUT) == false);
+
+    len = test_frame(buf, 3, BAIKAL_GET_INFO, 8, 7);
+    test_write(port, buf, len);
+    CHECK(test_expect(port, 3, BAIKAL_GET_INFO, gen, 8, 7));
+}
+
+int main(void)
+{
+    struct test_port port;
+
+    if (test_open(&port) != true) {
+        return (1);
+    }
+
+    test_split(&port);
+    test_concatenated(&port);
+    test_corrupt(&port);
+    test_unsolicited(&port);
+    test_late(&port);
+    test_generation(&port);
+
+    test_close(&port);
+
+    if (failures) {
+        fprintf(stderr, "%d check%s failed\n", failures, failures == 1 ? "" : "s");
+        return (1);
+    }
+
+    printf("baikal parser: all checks passed\n");
+    return (0);
+}
@@ -0,0 +1,133 @@
+/*
+ * Known answer tests of the sph Groestl and ECHO, run once with the table
+ * code and again with the AES-NI code of sph/aesni.c when the CPU has it.
+ *
+ * The digests are those of the table implementations; the empty message
+ * ones are the published test vectors. A NULL message is bytes 0, 1, 2...
+ * of len, long enough to run over several blocks.
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the Free
+ * Software Foundation; either version 3 of the License, or (at your option)
+ * any later version.  See COPYING for more details.
+ */
+
+#include <stdio.h>
+#include <string.h>
+
+#include "sph/sph_groestl.h"
+#include "sph/sph_echo.h"
+#include "sph/sph_aesni.h"
+
+static int failures;
+
+static const struct {
+    const char *msg;
+    size_t len;
+    const char *groestl512, *groestl256, *echo512;
+} test_kat[] = {
+    { "", 0,
+      "6d3ad29d279110eef3adbd66de2a0345a77baede1557f5d099fce0c03d6dc2ba"
+      "8e6d4a6633dfbd66053c20faa87d1a11f39a7fbe4a6c2f009801370308fc4ad8",
+      "1a52d11d550039be16107f9c58db9ebcc417f16f736adb2502567119f0083467",
+      "158f58cc79d300a9aa292515049275d051a28ab931726d0ec44bdd9faef4a702"
+      "c36db9e7922fff077402236465833c5cc76af4efc352b4b44c7fa15aa0ef234e" },
+    { "abc", 3,
+      "70e1c68c60df3b655339d67dc291cc3f1dde4ef343f11b23fdd44957693815a7"
+      "5a8339c682fc28322513fd1f283c18e53cff2b264e06bf83a2f0ac8c1f6fbff6",
+      "f3c1bb19c048801326a7efbcf16e3d7887446249829c379e1840d1a3a1e7d4d2",
+      "3bf04ec89d67e0dafd1b8ab26b176abaead6b3cdc706ff7198c3c6045e77d4ea"
+      "f64cd90af9c5a7674919b90ff8c9b4a7554d6cfeffb334406ec233fb0b0dd6bc" },
+    { NULL, 80,
+      "a41bd139d3da523aa700ce9dea78ca3c7c4b66e38e6769becbcd8fed37813fbc"
+      "5c2e6b1b9b9147e3e7e801e8e5231a1586f9ba99ecf6565ffb77ee5e792447bc",
+      "98d1d087df636ac82987e5cf4af29b051518bda24b6a51836ebb6f606efdb525",
+      "92b8e221943592e1ee59fd99a3449ac7ba19518c9d0f841f47810e50fc7f1580"
+      "62ba2bb44cdde7787699fd2db251fad863cffbab383296b84e9f08392bf8567a" },
+    { NULL, 120,
+      "5cfc13a05459f11cab784846d953da0b7c3eda4855db918da20993665b7e7260"
+      "cb3711782f402c04b49a03f70414246d56217e97e261cef8f0c225fd124cb971",
+      "fd4c080302f692160ff3f47c5ee35655867678ef626abe9fbb07e816c967508d",
+      "8482f2574bba5092b24b5d8797b7a240d9688a8dbe8d423254ce522b8683d276"
+      "53f5924eac5ed95b40e8fa30389dc15f7ba5b0fd65edb6dcf3e73cd41b4cb62f" },
+    { NULL, 300,
+      "159204e1be4611568dc593c231cbb19a16d9b61b7ad1b4d60eba5e38ee71e533"
+      "b8f8cfdd59ebd3208be0a7c885037d8ac4d58f440171bf92e2b370d2a91434f9",
+      "9f8bef389b2862c668fc4b7d54ca65beacea11a19f64ef657626cbb7f04ede94",
+      "cc977c5b1f563e55451464fdca6b125578084bb753e05e403562958327da11d4"
+      "b0c63ea32805dff8fe92222d6cd702cc4b3843e6e39b53dbc582166a44a2dfe4" }
+};
+
+static int test_match(const unsigned char *digest, size_t len, const char *hex)
+{
+    char out[129];
+    size_t i;
+
+    for (i = 0; i < len; i++) {
+        sprintf(out + 2 * i, "%02x", digest[i]);
+    }
+
+    return (memcmp(out, hex, 2 * len) == 0);
+}
+
+static void test_check(const char *impl, const char *name, size_t len, const unsigned char *digest, size_t size, const char *hex)
+{
+    if (test_match(digest, size, hex) != 1) {
+        fprintf(stderr, "%s %s of %u bytes does not match\n", impl, name, (unsigned)len);
+        failures++;
+    }
+}
+
+static void test_kats(const char *impl)
+{
+    unsigned char msg[300], out[64];
+    sph_groestl512_context g512;
+    sph_groestl256_context g256;
+    sph_echo512_context e512;
+    const void *data;
+    size_t i;
+
+    for (i = 0; i < sizeof(msg); i++) {
+        msg[i] = (unsigned char)i;
+    }
+
+    for (i = 0; i < sizeof(test_kat) / sizeof(test_kat[0]); i++) {
+        data = (test_kat[i].msg != NULL) ? (const void *)test_kat[i].msg : (const void *)msg;
+
+        sph_groestl512_init(&g512);
+        sph_groestl512(&g512, data, test_kat[i].len);
+        sph_groestl512_close(&g512, out);
+        test_check(impl, "groestl512", test_kat[i].len, out, 64, test_kat[i].groestl512);
+
+        sph_groestl256_init(&g256);
+        sph_groestl256(&g256, data, test_kat[i].len);
+        sph_groestl256_close(&g256, out);
+        test_check(impl, "groestl256", test_kat[i].len, out, 32, test_kat[i].groestl256);
+
+        sph_echo512_init(&e512);
+        sph_echo512(&e512, data, test_kat[i].len);
+        sph_echo512_close(&e512, out);
+        test_check(impl, "echo512", test_kat[i].len, out, 64, test_kat[i].echo512);
+    }
+}
+
+int main(void)
+{
+    sph_aesni_active = 0;
+    test_kats("tables");
+
+    if (sph_aesni_init()) {
+        test_kats("AES-NI");
+    }
+    else {
+        printf("sph aesni: no AES-NI, only the tables were checked\n");
+    }
+
+    if (failures) {
+        fprintf(stderr, "%d check%s failed\n", failures, failures == 1 ? "" : "s");
+        return (1);
+    }
+
+    printf("sph aesni: all checks passed\n");
+    return (0);
+}
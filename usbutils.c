@@ -1160,6 +1160,7 @@ static void _usb_uninit(struct cgpu_info *cgpu)
 #ifdef LINUX
 		libusb_attach_kernel_driver(cgpu->usbdev->handle, THISIF(cgpu->usbdev->found, ifinfo));
 #endif
+		cancel_usb_async_reads(cgpu->usbdev->handle);
 		cg_wlock(&cgusb_fd_lock);
 		libusb_close(cgpu->usbdev->handle);
 		cgpu->usbdev->handle = NULL;
@@ -2129,6 +2130,12 @@ struct usb_transfer {
 	struct libusb_transfer *transfer;
 	bool cancellable;
 	struct list_head list;
+	/* Only used by the persistent reads of usb_read_async() */
+	bool persistent;
+	struct cgpu_info *cgpu;
+	usb_read_cb read_cb;
+	void *read_arg;
+	unsigned char *buf;
 };
 
 bool async_usb_transfers(void)
@@ -2166,6 +2173,53 @@ void cancel_usb_transfers(void)
 		applog(LOG_DEBUG, "Cancelled %d USB transfers", cancellations);
 }
 
+/* Persistent reads never complete on their own, so they are stopped here
+ * rather than by cancel_usb_transfers(). With a handle only the reads on it
+ * are cancelled and waited for, so the handle can be closed. Without one all
+ * of them are cancelled and the caller keeps handling events until they are
+ * gone. */
+void cancel_usb_async_reads(struct libusb_device_handle *handle)
+{
+	struct usb_transfer *ut;
+	int cancellations = 0, tries = 0;
+	bool pending;
+
+	cg_wlock(&cgusb_fd_lock);
+	list_for_each_entry(ut, &ut_list, list) {
+		if (ut->persistent && (!handle || ut->transfer->dev_handle == handle)) {
+			ut->persistent = false;
+			libusb_cancel_transfer(ut->transfer);
+			cancellations++;
+		}
+	}
+	cg_wunlock(&cgusb_fd_lock);
+
+	if (!cancellations)
+		return;
+
+	applog(LOG_DEBUG, "Cancelled %d USB async reads", cancellations);
+
+	if (!handle)
+		return;
+
+	/* The polling thread runs their callbacks, which takes it no time
+	 * unless it has gone already */
+	do {
+		pending = false;
+		cg_rlock(&cgusb_fd_lock);
+		list_for_each_entry(ut, &ut_list, list) {
+			if (ut->read_cb && ut->transfer->dev_handle == handle)
+				pending = true;
+		}
+		cg_runlock(&cgusb_fd_lock);
+		if (pending)
+			cgsleep_ms(1);
+	} while (pending && ++tries < 1000);
+
+	if (pending)
+		applog(LOG_WARNING, "USB async reads still pending on close");
+}
+
 static void init_usb_transfer(struct usb_transfer *ut)
 {
 	cgsem_init(&ut->cgsem);
@@ -2174,6 +2228,8 @@ static void init_usb_transfer(struct usb_transfer *ut)
 		quit(1, "Failed to libusb_alloc_transfer");
 	ut->transfer->user_data = ut;
 	ut->cancellable = false;
+	ut->persistent = false;
+	ut->read_cb = NULL;
 }
 
 static void complete_usb_transfer(struct usb_transfer *ut)
@@ -2564,6 +2620,93 @@ out_noerrmsg:
 	return err;
 }
 
+static void LIBUSB_CALL read_async_callback(struct libusb_transfer *transfer)
+{
+	struct usb_transfer *ut = transfer->user_data;
+	int err = usb_transfer_toerr(transfer->status);
+
+	if (transfer->actual_length > 0)
+		ut->read_cb(ut->cgpu, transfer->buffer, transfer->actual_length, LIBUSB_SUCCESS, ut->read_arg);
+
+	cg_wlock(&cgusb_fd_lock);
+	if (ut->persistent && err == LIBUSB_SUCCESS) {
+		err = libusb_submit_transfer(transfer);
+		if (likely(!err)) {
+			cg_wunlock(&cgusb_fd_lock);
+			return;
+		}
+	}
+	ut->persistent = false;
+	list_del(&ut->list);
+	cg_wunlock(&cgusb_fd_lock);
+
+	ut->read_cb(ut->cgpu, NULL, 0, err, ut->read_arg);
+	cgsem_post(&ut->cgsem);
+}
+
+/* Keeps a bulk read posted on the endpoint for as long as the device is
+ * there. Every read that returns data is handed to read_cb from the polling
+ * thread and resubmitted at once, so no thread has to block in a read per
+ * reply. When the read ends, on an error or when it is stopped or the
+ * device closed, read_cb is called a last time with amount 0. The caller
+ * must release it with usb_read_async_stop(). */
+struct usb_transfer *_usb_read_async(struct cgpu_info *cgpu, int intinfo, int epinfo, size_t bufsiz,
+				     usb_read_cb read_cb, void *arg)
+{
+	struct cg_usb_device *usbdev;
+	struct usb_transfer *ut;
+	int err, pstate;
+
+	DEVRLOCK(cgpu, pstate);
+	if (cgpu->usbinfo.nodev) {
+		DEVRUNLOCK(cgpu, pstate);
+		return NULL;
+	}
+
+	usbdev = cgpu->usbdev;
+	ut = cgcalloc(1, sizeof(*ut));
+	init_usb_transfer(ut);
+	ut->buf = cgmalloc(bufsiz);
+	ut->cgpu = cgpu;
+	ut->read_cb = read_cb;
+	ut->read_arg = arg;
+	ut->persistent = true;
+
+	/* No timeout, it waits for as long as the device has nothing to say */
+	libusb_fill_bulk_transfer(ut->transfer, usbdev->handle, USBEP(usbdev, intinfo, epinfo),
+				  ut->buf, bufsiz, read_async_callback, ut, 0);
+	err = usb_submit_transfer(ut, ut->transfer, false, false);
+	DEVRUNLOCK(cgpu, pstate);
+
+	if (err) {
+		applog(LOG_ERR, "%s %i async read submit err:(%d) %s", cgpu->drv->name,
+		       cgpu->device_id, err, libusb_error_name(err));
+		complete_usb_transfer(ut);
+		free(ut->buf);
+		free(ut);
+		return NULL;
+	}
+
+	return ut;
+}
+
+/* Must not be called from read_cb, which runs on the polling thread */
+void usb_read_async_stop(struct usb_transfer *ut)
+{
+	cg_wlock(&cgusb_fd_lock);
+	if (ut->persistent) {
+		ut->persistent = false;
+		libusb_cancel_transfer(ut->transfer);
+	}
+	cg_wunlock(&cgusb_fd_lock);
+
+	cgsem_wait(&ut->cgsem);
+	cgsem_destroy(&ut->cgsem);
+	libusb_free_transfer(ut->transfer);
+	free(ut->buf);
+	free(ut);
+}
+
 int _usb_write(struct cgpu_info *cgpu, int intinfo, int epinfo, char *buf, size_t bufsiz, int *processed, int timeout, enum usb_cmds cmd)
 {
 	struct timeval write_start, tv_finish;
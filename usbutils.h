@@ -441,8 +441,12 @@ enum usb_cmds {
 struct device_drv;
 struct cgpu_info;
 
+struct usb_transfer;
+typedef void (*usb_read_cb)(struct cgpu_info *cgpu, unsigned char *buf, int amount, int err, void *arg);
+
 bool async_usb_transfers(void);
 void cancel_usb_transfers(void);
+void cancel_usb_async_reads(struct libusb_device_handle *handle);
 void usb_all(int level);
 void usb_list(void);
 const char *usb_cmdname(enum usb_cmds cmd);
@@ -463,6 +467,8 @@ struct api_data *api_usb_stats(int *count);
 void update_usb_stats(struct cgpu_info *cgpu);
 void usb_reset(struct cgpu_info *cgpu);
 int _usb_read(struct cgpu_info *cgpu, int intinfo, int epinfo, char *buf, size_t bufsiz, int *processed, int timeout, const char *end, enum usb_cmds cmd, bool readonce, bool cancellable);
+struct usb_transfer *_usb_read_async(struct cgpu_info *cgpu, int intinfo, int epinfo, size_t bufsiz, usb_read_cb read_cb, void *arg);
+void usb_read_async_stop(struct usb_transfer *ut);
 int _usb_write(struct cgpu_info *cgpu, int intinfo, int epinfo, char *buf, size_t bufsiz, int *processed, int timeout, enum usb_cmds);
 int _usb_transfer(struct cgpu_info *cgpu, uint8_t request_type, uint8_t bRequest, uint16_t wValue, uint16_t wIndex, uint32_t *data, int siz, unsigned int timeout, enum usb_cmds cmd);
 int _usb_transfer_read(struct cgpu_info *cgpu, uint8_t request_type, uint8_t bRequest, uint16_t wValue, uint16_t wIndex, char *buf, int bufsiz, int *amount, unsigned int timeout, enum usb_cmds cmd);
@@ -495,6 +501,9 @@ void initialise_usblocks(void);
 #define usb_read_ii_once(cgpu, intinfo, buf, bufsiz, read, cmd) \
 	_usb_read(cgpu, intinfo, DEFAULT_EP_IN, buf, bufsiz, read, DEVTIMEOUT, NULL, cmd, true, false)
 
+#define usb_read_async(cgpu, bufsiz, read_cb, arg) \
+	_usb_read_async(cgpu, DEFAULT_INTINFO, DEFAULT_EP_IN, bufsiz, read_cb, arg)
+
 #define usb_read_once_timeout(cgpu, buf, bufsiz, read, timeout, cmd) \
 	_usb_read(cgpu, DEFAULT_INTINFO, DEFAULT_EP_IN, buf, bufsiz, read, timeout, NULL, cmd, true, false)
 
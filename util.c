@@ -15,6 +15,7 @@
 #include <ctype.h>
 #include <stdarg.h>
 #include <string.h>
+#include <stddef.h>
 #include <jansson.h>
 #ifdef HAVE_LIBCURL
 #include <curl/curl.h>
@@ -711,17 +712,40 @@ char *get_proxy(char *url, struct pool *pool)
   return url;
 }
 
+/* The two hex digits of every byte value */
+static const char hexpairs[512] =
+  "000102030405060708090a0b0c0d0e0f"
+  "101112131415161718191a1b1c1d1e1f"
+  "202122232425262728292a2b2c2d2e2f"
+  "303132333435363738393a3b3c3d3e3f"
+  "404142434445464748494a4b4c4d4e4f"
+  "505152535455565758595a5b5c5d5e5f"
+  "606162636465666768696a6b6c6d6e6f"
+  "707172737475767778797a7b7c7d7e7f"
+  "808182838485868788898a8b8c8d8e8f"
+  "909192939495969798999a9b9c9d9e9f"
+  "a0a1a2a3a4a5a6a7a8a9aaabacadaeaf"
+  "b0b1b2b3b4b5b6b7b8b9babbbcbdbebf"
+  "c0c1c2c3c4c5c6c7c8c9cacbcccdcecf"
+  "d0d1d2d3d4d5d6d7d8d9dadbdcdddedf"
+  "e0e1e2e3e4e5e6e7e8e9eaebecedeeef"
+  "f0f1f2f3f4f5f6f7f8f9fafbfcfdfeff";
+
+/* Writes the len*2 hex digits of p to s without terminating them and returns
+ * the end of what was written */
+char *bin2hex_to(char *s, const unsigned char *p, size_t len)
+{
+  size_t i;
+
+  for (i = 0; i < len; i++, s += 2)
+    memcpy(s, hexpairs + (p[i] << 1), 2);
+  return s;
+}
+
 /* Adequate size s==len*2 + 1 must be alloced to use this variant */
 void __bin2hex(char *s, const unsigned char *p, size_t len)
 {
-  int i;
-  static const char hex[16] = {'0', '1', '2', '3', '4', '5', '6', '7', '8', '9', 'a', 'b', 'c', 'd', 'e', 'f'};
-
-  for (i = 0; i < (int)len; i++) {
-    *s++ = hex[p[i] >> 4];
-    *s++ = hex[p[i] & 0xF];
-  }
-  *s++ = '\0';
+  *bin2hex_to(s, p, len) = '\0';
 }
 
 /* Returns a malloced array string of a binary value of arbitrary length. The
@@ -1397,16 +1421,13 @@ enum send_ret {
   SEND_INACTIVE
 };
 
-/* Send a single command across a socket, appending \n to it. This should all
- * be done under stratum lock except when first establishing the socket */
-static enum send_ret __stratum_send(struct pool *pool, char *s, ssize_t len)
+/* Send complete lines across a socket. This should all be done under stratum
+ * lock except when first establishing the socket */
+static enum send_ret __stratum_sendbuf(struct pool *pool, const char *s, ssize_t len)
 {
   SOCKETTYPE sock = pool->sock;
   ssize_t ssent = 0;
 
-  strcat(s, "\n");
-  len++;
-
   while (len > 0 ) {
     struct timeval timeout = {1, 0};
     ssize_t sent;
@@ -1426,6 +1447,7 @@ retry:
 #else
     sent = send(pool->sock, s + ssent, len, MSG_NOSIGNAL);
 #endif
+    pool->sgminer_pool_stats.send_calls++;
     if (sent < 0) {
       if (!sock_blocks())
         return SEND_SENDFAIL;
@@ -1441,18 +1463,15 @@ retry:
   return SEND_OK;
 }
 
-bool stratum_send(struct pool *pool, char *s, ssize_t len)
+/* Send a single command across a socket, appending \n to it */
+static enum send_ret __stratum_send(struct pool *pool, char *s, ssize_t len)
 {
-  enum send_ret ret = SEND_INACTIVE;
-
-  if (opt_protocol)
-    applog(LOG_DEBUG, "SEND: %s", s);
-
-  mutex_lock(&pool->stratum_lock);
-  if (pool->stratum_active)
-    ret = __stratum_send(pool, s, len);
-  mutex_unlock(&pool->stratum_lock);
+  strcat(s, "\n");
+  return __stratum_sendbuf(pool, s, len + 1);
+}
 
+static bool stratum_send_result(struct pool *pool, enum send_ret ret)
+{
   /* This is to avoid doing applog under stratum_lock */
   switch (ret) {
     default:
@@ -1473,6 +1492,47 @@ bool stratum_send(struct pool *pool, char *s, ssize_t len)
   return (ret == SEND_OK);
 }
 
+bool stratum_send(struct pool *pool, char *s, ssize_t len)
+{
+  enum send_ret ret = SEND_INACTIVE;
+
+  if (opt_protocol)
+    applog(LOG_DEBUG, "SEND: %s", s);
+
+  mutex_lock(&pool->stratum_lock);
+  if (pool->stratum_active)
+    ret = __stratum_send(pool, s, len);
+  mutex_unlock(&pool->stratum_lock);
+
+  return stratum_send_result(pool, ret);
+}
+
+/* Send a batch of share submissions, each already terminated by \n, in as
+ * few writes as the socket allows */
+bool stratum_send_shares(struct pool *pool, const char *s, ssize_t len, int shares)
+{
+  struct sgminer_pool_stats *stats = &pool->sgminer_pool_stats;
+  enum send_ret ret = SEND_INACTIVE;
+  uint64_t calls;
+
+  if (opt_protocol)
+    applog(LOG_DEBUG, "SEND: %.*s", (int)len - 1, s);
+
+  mutex_lock(&pool->stratum_lock);
+  if (pool->stratum_active) {
+    calls = stats->send_calls;
+    ret = __stratum_sendbuf(pool, s, len);
+    if (ret == SEND_OK) {
+      stats->shares_sent += shares;
+      stats->share_bytes_sent += len;
+      stats->share_send_calls += stats->send_calls - calls;
+    }
+  }
+  mutex_unlock(&pool->stratum_lock);
+
+  return stratum_send_result(pool, ret);
+}
+
 static bool socket_full(struct pool *pool, int wait)
 {
   SOCKETTYPE sock = pool->sock;
@@ -1493,7 +1553,7 @@ static bool socket_full(struct pool *pool, int wait)
 /* Check to see if Santa's been good to you */
 bool sock_full(struct pool *pool)
 {
-  if (strlen(pool->sockbuf))
+  if (pool->sockbuf_rd < pool->sockbuf_wr)
     return true;
 
   return (socket_full(pool, 0));
@@ -1514,7 +1574,7 @@ bool sock_keepalived(struct pool *pool, const char *rpc2_id, int work_id)
 }
 static void clear_sockbuf(struct pool *pool)
 {
-  strcpy(pool->sockbuf, "");
+  pool->sockbuf_rd = pool->sockbuf_scan = pool->sockbuf_wr = 0;
 }
 
 static void clear_sock(struct pool *pool)
@@ -1533,36 +1593,117 @@ static void clear_sock(struct pool *pool)
   clear_sockbuf(pool);
 }
 
-/* Make sure the pool sockbuf is large enough to cope with any coinbase size
- * by reallocing it to a large enough size rounded up to a multiple of RBUFSIZE
- * and zeroing the new memory */
-static void recalloc_sock(struct pool *pool, size_t len)
+/* Make sure there is room for a full RECVSIZE read past the write offset.
+ * The unread tail is only moved to the front of the buffer when the end is
+ * reached, and the buffer grows in RBUFSIZE steps when a single line does
+ * not fit, so any coinbase size can be received */
+static void reserve_sockbuf(struct pool *pool)
 {
-  size_t old, newlen;
+  size_t used, newlen;
+
+  if (pool->sockbuf_size - pool->sockbuf_wr > RECVSIZE)
+    return;
+
+  if (pool->sockbuf_rd) {
+    used = pool->sockbuf_wr - pool->sockbuf_rd;
+    memmove(pool->sockbuf, pool->sockbuf + pool->sockbuf_rd, used);
+    pool->sockbuf_scan -= pool->sockbuf_rd;
+    pool->sockbuf_wr = used;
+    pool->sockbuf_rd = 0;
+  }
 
-  old = strlen(pool->sockbuf);
-  newlen = old + len + 1;
-  if (newlen < pool->sockbuf_size)
+  if (pool->sockbuf_size - pool->sockbuf_wr > RECVSIZE)
     return;
+
+  newlen = pool->sockbuf_wr + RECVSIZE + 1;
   newlen = newlen + (RBUFSIZE - (newlen % RBUFSIZE));
   // Avoid potentially recursive locking
   // applog(LOG_DEBUG, "Recallocing pool sockbuf to %d", new);
   pool->sockbuf = (char *)realloc(pool->sockbuf, newlen);
   if (!pool->sockbuf)
     quithere(1, "Failed to realloc pool sockbuf");
-  memset(pool->sockbuf + old, 0, newlen - old);
   pool->sockbuf_size = newlen;
 }
 
-/* Peeks at a socket to find the first end of line and then reads just that
- * from the socket and returns that as a malloced char */
+/* Finds the end of the next non empty line in the receive buffer, looking
+ * only at bytes that have not been scanned by an earlier call */
+static char *sockbuf_eol(struct pool *pool)
+{
+  char *eol;
+
+  while (pool->sockbuf_rd < pool->sockbuf_wr && pool->sockbuf[pool->sockbuf_rd] == '\n')
+    pool->sockbuf_rd++;
+  if (pool->sockbuf_scan < pool->sockbuf_rd)
+    pool->sockbuf_scan = pool->sockbuf_rd;
+
+  eol = (char *)memchr(pool->sockbuf + pool->sockbuf_scan, '\n',
+                       pool->sockbuf_wr - pool->sockbuf_scan);
+  if (!eol)
+    pool->sockbuf_scan = pool->sockbuf_wr;
+  return eol;
+}
+
+/* Hands out the line ending at eol, \0 terminated, and accounts for it */
+static char *sockbuf_take(struct pool *pool, char *eol)
+{
+  char *sret = pool->sockbuf + pool->sockbuf_rd;
+  ssize_t len = eol - sret;
+
+  *eol = '\0';
+
+  /* Rewind once everything received has been handed out so the common case
+   * of whole messages per recv never has to move anything */
+  pool->sockbuf_rd = pool->sockbuf_scan = eol + 1 - pool->sockbuf;
+  if (pool->sockbuf_rd == pool->sockbuf_wr)
+    clear_sockbuf(pool);
+
+  pool->sgminer_pool_stats.times_received++;
+  pool->sgminer_pool_stats.bytes_received += len;
+  pool->sgminer_pool_stats.net_bytes_received += len;
+  if (opt_protocol)
+    applog(LOG_DEBUG, "RECVD: %s", sret);
+  return sret;
+}
+
+#ifdef HAVE_SYS_EPOLL_H
+/* Single non blocking recv into the pool buffer for callers that wait on the
+ * socket themselves. Returns what recv returned */
+ssize_t recv_sockbuf(struct pool *pool)
+{
+  ssize_t n;
+
+  reserve_sockbuf(pool);
+  n = recv(pool->sock, pool->sockbuf + pool->sockbuf_wr,
+           pool->sockbuf_size - pool->sockbuf_wr - 1, MSG_DONTWAIT);
+  if (n > 0) {
+    pool->sockbuf_wr += n;
+    pool->sockbuf[pool->sockbuf_wr] = '\0';
+  }
+  return n;
+}
+#endif
+
+/* Returns the next complete line already received or NULL, never waits. The
+ * string has the same lifetime as the one from recv_line */
+char *sockbuf_line(struct pool *pool)
+{
+  char *eol = sockbuf_eol(pool);
+
+  if (!eol)
+    return NULL;
+  return sockbuf_take(pool, eol);
+}
+
+/* Receives into the pool buffer until it holds a complete line and returns
+ * that line in place, \0 terminated. The string belongs to the pool and is
+ * only valid until the next recv_line or suspend of the same pool */
 char *recv_line(struct pool *pool)
 {
-  char *tok, *sret = NULL;
-  ssize_t len, buflen;
+  char *eol;
   int waited = 0;
 
-  if (!strstr(pool->sockbuf, "\n")) {
+  eol = sockbuf_eol(pool);
+  if (!eol) {
     struct timeval rstart, now;
 
     cgtime(&rstart);
@@ -1572,12 +1713,11 @@ char *recv_line(struct pool *pool)
     }
 
     do {
-      char s[RBUFSIZE];
-      size_t slen;
       ssize_t n;
 
-      memset(s, 0, RBUFSIZE);
-      n = recv(pool->sock, s, RECVSIZE, 0);
+      reserve_sockbuf(pool);
+      n = recv(pool->sock, pool->sockbuf + pool->sockbuf_wr,
+               pool->sockbuf_size - pool->sockbuf_wr - 1, 0);
       if (!n) {
         applog(LOG_DEBUG, "Socket closed waiting in recv_line");
         suspend_stratum(pool);
@@ -1592,38 +1732,23 @@ char *recv_line(struct pool *pool)
           break;
         }
       } else {
-        slen = strlen(s);
-        recalloc_sock(pool, slen);
-        strcat(pool->sockbuf, s);
+        pool->sockbuf_wr += n;
+        pool->sockbuf[pool->sockbuf_wr] = '\0';
+        eol = sockbuf_eol(pool);
       }
-    } while (waited < DEFAULT_SOCKWAIT && !strstr(pool->sockbuf, "\n"));
+    } while (waited < DEFAULT_SOCKWAIT && !eol);
   }
 
-  buflen = strlen(pool->sockbuf);
-
-  if ((tok = strtok(pool->sockbuf, "\n")) == NULL) {
-    applog(LOG_DEBUG, "Failed to parse a \\n terminated string in recv_line: buffer = %s", pool->sockbuf);
+  if (!eol) {
+    applog(LOG_DEBUG, "Failed to parse a \\n terminated string in recv_line: buffer = %.*s",
+           (int)(pool->sockbuf_wr - pool->sockbuf_rd), pool->sockbuf + pool->sockbuf_rd);
     goto out;
   }
-  sret = strdup(tok);
-  len = strlen(sret);
-
-  /* Copy what's left in the buffer after the \n, including the
-   * terminating \0 */
-  if (buflen > len + 1)
-    memmove(pool->sockbuf, pool->sockbuf + len + 1, buflen - len + 1);
-  else
-    strcpy(pool->sockbuf, "");
 
-  pool->sgminer_pool_stats.times_received++;
-  pool->sgminer_pool_stats.bytes_received += len;
-  pool->sgminer_pool_stats.net_bytes_received += len;
+  return sockbuf_take(pool, eol);
 out:
-  if (!sret)
-    clear_sock(pool);
-  else if (opt_protocol)
-    applog(LOG_DEBUG, "RECVD: %s", sret);
-  return sret;
+  clear_sock(pool);
+  return NULL;
 }
 
 /* Extracts a string value from a json array with error checking. To be used
@@ -1808,6 +1933,7 @@ static bool parse_notify(struct pool *pool, json_t *val)
   memcpy(pool->coinbase + cb1_len, pool->nonce1bin, pool->n1_len);
   // NOTE: gap for nonce2, filled at work generation time
   memcpy(pool->coinbase + cb1_len + pool->n1_len + pool->n2size, cb2, cb2_len);
+  pool->swork_gen++;
   cg_wunlock(&pool->data_lock);
 
   if (opt_protocol) {
@@ -2109,6 +2235,13 @@ static bool parse_reconnect(struct pool *pool, json_t *val)
   free(tmp);
   mutex_unlock(&pool->stratum_lock);
 
+  /* Connecting can block, the stratum event loop does it on its connect
+   * thread instead so the other pools keep going */
+  if (pool->sio_state) {
+    pool->sio_reconnect = true;
+    return true;
+  }
+
   if (!restart_stratum(pool)) {
     pool_failed(pool);
     return false;
@@ -2256,7 +2389,7 @@ bool subscribe_extranonce(struct pool *pool)
   json_error_t err;
   bool ret = false;
 
-  sprintf(s, "{\"id\": %d, \"method\": \"mining.extranonce.subscribe\", \"params\": []}", swork_id++);
+  sprintf(s, "{\"id\": %d, \"method\": \"mining.extranonce.subscribe\", \"params\": []}", swork_next_id());
 
   if (!stratum_send(pool, s, strlen(s))) {
     return ret;
@@ -2275,16 +2408,12 @@ bool subscribe_extranonce(struct pool *pool)
     if (!sret) {
       return ret;
     }
-    else if (parse_method(pool, sret)) {
-      free(sret);
-    }
-    else {
+    else if (!parse_method(pool, sret)) {
       break;
     }
   }
 
   val = JSON_LOADS(sret, &err);
-  free(sret);
   res_val = json_object_get(val, "result");
   err_val = json_object_get(val, "error");
 
@@ -2334,11 +2463,11 @@ bool auth_stratum(struct pool *pool)
     sprintf(s, "{\"method\": \"login\", \"params\": {\"login\": \"%s\", \"pass\": \"%s\", \"agent\": \"%s/%s\"}, \"id\": 1}",
       pool->rpc_user, pool->rpc_pass, PACKAGE, VERSION);
   
-    swork_id++;
+    swork_next_id();
   }
   else {
     sprintf(s, "{\"id\": %d, \"method\": \"mining.authorize\", \"params\": [\"%s\", \"%s\"]}",
-      swork_id++, pool->rpc_user, pool->rpc_pass);
+      swork_next_id(), pool->rpc_user, pool->rpc_pass);
   }
 
   if (!stratum_send(pool, s, strlen(s))) {
@@ -2352,16 +2481,12 @@ bool auth_stratum(struct pool *pool)
     if (!sret) {
       return ret;
     }
-    else if (parse_method(pool, sret)) {
-      free(sret);
-    }
-    else {
+    else if (!parse_method(pool, sret)) {
       break;
     }
   }
 
   val = JSON_LOADS(sret, &err);
-  free(sret);
   res_val = json_object_get(val, "result");
   err_val = json_object_get(val, "error");
 
@@ -2796,6 +2921,8 @@ retry:
   }
 
   pool->sock = sockd;
+  pool->sock_gen++;
+  pool->nicehash = pool->rpc_url && strstr(pool->rpc_url, "nicehash");
   keep_sockalive(sockd);
   return true;
 }
@@ -2879,12 +3006,12 @@ resend:
   if (recvd) {
     /* Get rid of any crap lying around if we're resending */
     clear_sock(pool);
-    sprintf(s, "{\"id\": %d, \"method\": \"mining.subscribe\", \"params\": []}", swork_id++);
+    sprintf(s, "{\"id\": %d, \"method\": \"mining.subscribe\", \"params\": []}", swork_next_id());
   } else {
     if (pool->sessionid)
-      sprintf(s, "{\"id\": %d, \"method\": \"mining.subscribe\", \"params\": [\""PACKAGE"/"CGMINER_VERSION"\", \"%s\"]}", swork_id++, pool->sessionid);
+      sprintf(s, "{\"id\": %d, \"method\": \"mining.subscribe\", \"params\": [\""PACKAGE"/"CGMINER_VERSION"\", \"%s\"]}", swork_next_id(), pool->sessionid);
     else
-      sprintf(s, "{\"id\": %d, \"method\": \"mining.subscribe\", \"params\": [\""PACKAGE"/"CGMINER_VERSION"\"]}", swork_id++);
+      sprintf(s, "{\"id\": %d, \"method\": \"mining.subscribe\", \"params\": [\""PACKAGE"/"CGMINER_VERSION"\"]}", swork_next_id());
   }
 
   if (__stratum_send(pool, s, strlen(s)) != SEND_OK) {
@@ -2904,7 +3031,6 @@ resend:
   recvd = true;
 
   val = JSON_LOADS(sret, &err);
-  free(sret);
   if (!val) {
     applog(LOG_INFO, "JSON decode failed(%d): %s", err.line, err.text);
     goto out;
@@ -3356,6 +3482,52 @@ void *_cgrealloc(void *ptr, size_t size, const char *file, const char *func, con
 	return ret;
 }
 
+/* Reference counted strings. The count lives in front of the characters so
+ * the result can be used anywhere a plain string is read, but it must be
+ * released with rcstr_put() and never free()d or modified. */
+struct rcstr {
+	int refs;
+	char str[];
+};
+
+#define rcstr_of(s) ((struct rcstr *)((s) - offsetof(struct rcstr, str)))
+
+char *rcstr_new(const char *s)
+{
+	size_t len = strlen(s) + 1;
+	struct rcstr *rc = cgmalloc(sizeof(*rc) + len);
+
+	rc->refs = 1;
+	memcpy(rc->str, s, len);
+	return rc->str;
+}
+
+char *rcstr_get(char *s)
+{
+	if (s)
+		__sync_add_and_fetch(&rcstr_of(s)->refs, 1);
+	return s;
+}
+
+void rcstr_put(char *s)
+{
+	if (s && !__sync_sub_and_fetch(&rcstr_of(s)->refs, 1))
+		free(rcstr_of(s));
+}
+
+/* Returns a new reference to the copy of s kept in *cache, replacing the
+ * cached copy first if it no longer matches. Callers serialise on *cache. */
+char *rcstr_intern(char **cache, const char *s)
+{
+	if (!s)
+		return NULL;
+	if (!*cache || strcmp(*cache, s)) {
+		rcstr_put(*cache);
+		*cache = rcstr_new(s);
+	}
+	return rcstr_get(*cache);
+}
+
 
 void _cg_memcpy(void *dest, const void *src, unsigned int n, const char *file, const char *func, const int line)
 {
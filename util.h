@@ -108,6 +108,10 @@ void *_cgrealloc(void *ptr, size_t size, const char *file, const char *func, con
 #define cgmalloc(_size) _cgmalloc(_size, __FILE__, __func__, __LINE__)
 #define cgcalloc(_memb, _size) _cgcalloc(_memb, _size, __FILE__, __func__, __LINE__)
 #define cgrealloc(_ptr, _size) _cgrealloc(_ptr, _size, __FILE__, __func__, __LINE__)
+char *rcstr_new(const char *s);
+char *rcstr_get(char *s);
+void rcstr_put(char *s);
+char *rcstr_intern(char **cache, const char *s);
 struct thr_info;
 struct pool;
 enum dev_reason;
@@ -140,11 +144,16 @@ double us_tdiff(struct timeval *end, struct timeval *start);
 int ms_tdiff(struct timeval *end, struct timeval *start);
 double tdiff(struct timeval *end, struct timeval *start);
 bool stratum_send(struct pool *pool, char *s, ssize_t len);
+bool stratum_send_shares(struct pool *pool, const char *s, ssize_t len, int shares);
 bool sock_full(struct pool *pool);
 bool sock_keepalived(struct pool *pool, const char *rpc2_id, int work_id);
 void _cgrecalloc(void **ptr, size_t old, size_t new, const char *file, const char *func, const int line);
 #define recalloc(ptr, old, new) _cgrecalloc((void *)&(ptr), old, new, __FILE__, __func__, __LINE__)
 char *recv_line(struct pool *pool);
+#ifdef HAVE_SYS_EPOLL_H
+ssize_t recv_sockbuf(struct pool *pool);
+#endif
+char *sockbuf_line(struct pool *pool);
 bool parse_method(struct pool *pool, char *s);
 bool parse_notify_cn(struct pool *pool, json_t *val);
 bool extract_sockaddr(char *url, char **sockaddr_url, char **sockaddr_port);